@@ -0,0 +1,52 @@
+/* Mesh Message Authentication
+
+   Truncated HMAC-SHA256 tags with a per-sender replay window, keyed
+   from CONFIG_MESH_AUTH_KEY.
+*/
+
+#ifndef __MESH_AUTH_H__
+#define __MESH_AUTH_H__
+
+#include <stdint.h>
+#include "esp_err.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define MESH_AUTH_TAG_LEN       (8)
+#define MESH_AUTH_WINDOW        (64)    /* counters this far behind the newest one are still accepted once */
+
+/*******************************************************
+ *                Structures
+ *******************************************************/
+typedef struct {
+    uint16_t boot;          /* sender boot counter, kept in NVS */
+    uint32_t counter;       /* messages signed in this boot */
+} mesh_auth_nonce_t;
+
+typedef struct {
+    uint32_t signed_msgs;
+    uint32_t verified;
+    uint32_t bad_tags;
+    uint32_t replays;       /* duplicate or older than the window */
+    uint32_t evicted;       /* senders pushed out of the window table, down to a floor */
+    uint64_t verify_cycles_total;
+    uint32_t verify_cycles_max;
+} mesh_auth_stats_t;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+/* Call after nvs_flash_init() */
+esp_err_t mesh_auth_init(void);
+void mesh_auth_next_nonce(mesh_auth_nonce_t *nonce);
+/* Tag over the sender address and `len` bytes of `msg`; the nonce must be part of `msg` */
+void mesh_auth_sign(const uint8_t src[6], const uint8_t *msg, uint16_t len, uint8_t tag[MESH_AUTH_TAG_LEN]);
+/* ESP_ERR_INVALID_STATE for a replay, ESP_ERR_INVALID_MAC for a wrong tag */
+esp_err_t mesh_auth_verify(const uint8_t src[6], const uint8_t *msg, uint16_t len,
+                           const uint8_t tag[MESH_AUTH_TAG_LEN], const mesh_auth_nonce_t *nonce);
+/* Signs and verifies a sample frame `iterations` times and logs the cycles per verify */
+void mesh_auth_bench(int iterations);
+void mesh_auth_get_stats(mesh_auth_stats_t *stats);
+
+#endif /* __MESH_AUTH_H__ */
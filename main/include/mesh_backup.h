@@ -0,0 +1,55 @@
+/* Mesh Backup Parents
+
+   Ranked list of candidate parents from recent scans, so a node that
+   loses its parent can ask for the best backup straight away instead of
+   scanning all over again.
+*/
+
+#ifndef __MESH_BACKUP_H__
+#define __MESH_BACKUP_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_mesh.h"
+
+/*******************************************************
+ *                Structures
+ *******************************************************/
+typedef struct {
+    uint8_t bssid[6];       /* softAP of the candidate */
+    uint8_t channel;
+    uint8_t layer;          /* layer of the candidate, we would be layer + 1 */
+    int8_t rssi;
+    uint8_t free_slots;
+    int16_t score;
+    int64_t seen_us;        /* last scan that saw it */
+} mesh_backup_candidate_t;
+
+typedef struct {
+    uint32_t scans;         /* scans whose results were ranked */
+    uint32_t failovers;     /* parent losses handled with a backup */
+    uint32_t backup_hits;   /* ... that ended connected to a backup */
+    uint32_t backup_misses; /* backups that did not answer */
+    uint32_t fallbacks;     /* parent losses that ended in a full scan */
+    uint32_t reconnects;
+    uint32_t reconnect_us_last; /* PARENT_DISCONNECTED to PARENT_CONNECTED */
+    uint32_t reconnect_us_max;
+    uint64_t reconnect_us_total;
+} mesh_backup_stats_t;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+esp_err_t mesh_backup_init(void);
+/* Starts the periodic refresh scans, call on PARENT_CONNECTED */
+esp_err_t mesh_backup_start(void);
+void mesh_backup_on_scan_done(int number);
+void mesh_backup_on_parent_connected(const mesh_event_connected_t *connected);
+void mesh_backup_on_parent_disconnected(const mesh_event_disconnected_t *disconnected);
+void mesh_backup_on_no_parent(void);
+/* Copies up to `max` candidates, best first, and returns how many were copied */
+int mesh_backup_get_candidates(mesh_backup_candidate_t *candidates, int max);
+void mesh_backup_get_stats(mesh_backup_stats_t *stats);
+
+#endif /* __MESH_BACKUP_H__ */
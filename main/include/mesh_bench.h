@@ -0,0 +1,98 @@
+/* Mesh Benchmark
+
+   iperf-style throughput, loss and latency runs over the mesh, started
+   by the root and reported per layer. Built only with
+   CONFIG_MESH_BENCH_ENABLE.
+*/
+
+#ifndef __MESH_BENCH_H__
+#define __MESH_BENCH_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_mesh.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define MESH_BENCH_LAYERS       (8)     /* layers 1 to 7, the last slot is 8 and deeper */
+#define MESH_BENCH_HIST         (16)    /* bucket b: RTT of [2^b, 2^(b+1)) * 128 us */
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+typedef enum {
+    MESH_BENCH_UPSTREAM = 0,    /* every node to the root */
+    MESH_BENCH_BROADCAST,       /* the root to every node */
+    MESH_BENCH_PEER,            /* every node to one target node */
+} mesh_bench_mode_t;
+
+typedef enum {
+    MESH_BENCH_OP_START = 1,    /* mesh_bench_start_t, root to all */
+    MESH_BENCH_OP_DATA,         /* mesh_bench_data_t, sender to receiver */
+    MESH_BENCH_OP_ECHO,         /* mesh_bench_data_t without payload, receiver to sender */
+    MESH_BENCH_OP_REPORT,       /* mesh_bench_report_t, all to root */
+} mesh_bench_op_t;
+
+/*******************************************************
+ *                Structures
+ *******************************************************/
+typedef struct __attribute__((packed)) {
+    uint8_t type;           /* MESH_MSG_TYPE_BENCH */
+    uint8_t op;             /* mesh_bench_op_t */
+    uint16_t run;
+} mesh_bench_hdr_t;
+
+typedef struct __attribute__((packed)) {
+    mesh_bench_hdr_t hdr;
+    uint8_t mode;           /* mesh_bench_mode_t */
+    uint8_t target[6];      /* MESH_BENCH_PEER only */
+    uint16_t payload;       /* bytes per packet, headers included */
+    uint16_t rate_pps;      /* per sender */
+    uint16_t duration_s;
+} mesh_bench_start_t;
+
+typedef struct __attribute__((packed)) {
+    mesh_bench_hdr_t hdr;
+    uint8_t layer;          /* layer of the node that sent this packet */
+    uint32_t seq;
+    uint32_t sent_us;       /* sender clock, echoed back */
+    uint8_t data[];
+} mesh_bench_data_t;
+
+/* Per-layer figures are keyed by the node that is not the root: the
+ * sender for UPSTREAM and PEER, the receiver for BROADCAST. */
+typedef struct __attribute__((packed)) {
+    mesh_bench_hdr_t hdr;
+    uint8_t layer;
+    uint32_t sent;
+    uint32_t tx_blocked;    /* packets not sent for lack of buffers or credits */
+    uint32_t rx[MESH_BENCH_LAYERS];
+    uint32_t rx_bytes[MESH_BENCH_LAYERS];
+    uint16_t rtt[MESH_BENCH_LAYERS][MESH_BENCH_HIST];
+} mesh_bench_report_t;
+
+/* What the root's summary of a run adds up to, over all layers */
+typedef struct {
+    uint16_t run;           /* 0 until a summary is logged */
+    uint32_t reports;
+    uint32_t expected;
+    uint32_t rx;
+    uint32_t tx_blocked;
+} mesh_bench_totals_t;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+esp_err_t mesh_bench_init(void);
+/* Root only: announces a run to every node and takes part in it. The
+ * results are logged per layer once every node has reported. */
+esp_err_t mesh_bench_run(mesh_bench_mode_t mode, const uint8_t target[6], uint16_t payload,
+                         uint16_t rate_pps, uint16_t duration_s);
+/* Root: starts the run configured in menuconfig after CONFIG_MESH_BENCH_AUTO_START_S */
+esp_err_t mesh_bench_start(void);
+/* Root: totals of the last run whose summary was logged */
+void mesh_bench_get_totals(mesh_bench_totals_t *totals);
+
+#endif /* __MESH_BENCH_H__ */
@@ -0,0 +1,85 @@
+/* Mesh Data Plane
+
+   Preallocated packet buffer pool and the RX/TX tasks that move mesh
+   payloads between esp_mesh_recv()/esp_mesh_send() and the message
+   handlers, dispatched by the first byte of every payload.
+*/
+
+#ifndef __MESH_COMM_H__
+#define __MESH_COMM_H__
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_mesh.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define MESH_COMM_BUF_SIZE      (CONFIG_MESH_COMM_BUF_SIZE)
+
+/* Message types, carried in the first byte of every payload */
+#define MESH_MSG_TYPE_FRAME     (0x03)  /* mesh_frame_hdr_t command frame */
+#define MESH_MSG_TYPE_TELEMETRY (0x04)  /* mesh_telemetry_report_t, child to parent */
+#define MESH_MSG_TYPE_CREDIT    (0x05)  /* mesh_flow_grant_t, parent to child */
+#define MESH_MSG_TYPE_VOTE      (0x06)  /* mesh_vote_candidate_t, child to parent */
+#define MESH_MSG_TYPE_UPLINK    (0x07)  /* payload for the gateway server, node to root */
+#define MESH_MSG_TYPE_XFER      (0x08)  /* mesh_xfer_hdr_t bulk transfer, parent to child and back */
+#define MESH_MSG_TYPE_PING      (0x09)  /* mesh_ping_msg_t, any node to any node */
+#define MESH_MSG_TYPE_REL       (0x0A)  /* mesh_rel_hdr_t followed by another message, any node to any node */
+#define MESH_MSG_TYPE_BENCH     (0x0B)  /* mesh_bench_hdr_t benchmark traffic and control */
+#define MESH_MSG_TYPE_TIME      (0x0C)  /* mesh_time_msg_t clock sync, child to parent and back */
+#define MESH_MSG_TYPE_SHARD     (0x0D)  /* mesh_shard_hdr_t envelope from another shard, root to node */
+#define MESH_MSG_TYPE_HEALTH    (0x0E)  /* mesh_health_hdr_t resource history query and reply, any node to any node */
+#define MESH_MSG_TYPE_MAX       (0x20)
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+/* Called from the RX task, or from the app task for handlers registered
+ * with mesh_comm_register_app_handler(). The buffer belongs to the pool
+ * and is recycled as soon as the handler returns, so it must not be kept. */
+typedef esp_err_t (*mesh_comm_handler_t)(mesh_addr_t *from, uint8_t *buf, uint16_t len);
+
+/*******************************************************
+ *                Structures
+ *******************************************************/
+typedef struct {
+    uint32_t rx_packets;
+    uint32_t rx_errors;
+    uint32_t rx_unhandled;
+    uint32_t rx_dropped;        /* refused by flow control */
+    uint32_t tx_packets;
+    uint32_t tx_errors;
+    uint32_t pool_exhausted;    /* mesh_comm_alloc() calls that timed out */
+    uint32_t pool_min_free;     /* low-water mark of free pool buffers */
+    uint64_t tx_wait_us_total;  /* time spent queued before esp_mesh_send() */
+    uint32_t tx_wait_us_max;
+    uint32_t app_packets;       /* handled on the app task */
+    uint32_t app_dropped;       /* refused with the app ring full */
+    uint32_t app_ring_high_water;
+    uint64_t app_latency_us_total; /* time spent in the app ring */
+    uint32_t app_latency_us_max;
+    uint32_t dispatch_refused;  /* inner messages for an RX task handler, dispatched from another task */
+} mesh_comm_stats_t;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+esp_err_t mesh_comm_init(void);
+esp_err_t mesh_comm_start(void);
+esp_err_t mesh_comm_register_handler(uint8_t type, mesh_comm_handler_t handler);
+/* Same, but the handler runs on the app task, on the other core */
+esp_err_t mesh_comm_register_app_handler(uint8_t type, mesh_comm_handler_t handler);
+uint8_t *mesh_comm_alloc(uint32_t timeout_ms);
+void mesh_comm_free(uint8_t *buf);
+esp_err_t mesh_comm_send(const mesh_addr_t *to, uint8_t *buf, uint16_t len, int flag);
+void mesh_comm_get_stats(mesh_comm_stats_t *stats);
+/* Hands a message carried inside another one to its handler, on the task
+ * the handler was registered for: right away if that is the calling task,
+ * else a copy is queued for the app task. RX task handlers can only be
+ * dispatched from the RX task (ESP_ERR_NOT_SUPPORTED otherwise). */
+esp_err_t mesh_comm_dispatch(mesh_addr_t *from, uint8_t *buf, uint16_t len);
+/* Mesh (STA) address of the current parent, for P2P messages to it */
+esp_err_t mesh_comm_get_parent(mesh_addr_t *parent);
+
+#endif /* __MESH_COMM_H__ */
@@ -0,0 +1,40 @@
+/* Mesh Event Handlers
+
+   The handlers app_main() registers for the mesh and IP events. What they
+   track about the node lives in a mesh_events_state_t passed as the
+   handler `arg`, so tools/mesh_sim can run them for every simulated node.
+*/
+
+#ifndef __MESH_EVENTS_H__
+#define __MESH_EVENTS_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_event.h"
+#include "esp_netif.h"
+#include "esp_mesh.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define MESH_EVENTS_STATE_DEFAULT() { .netif_sta = NULL, .layer = -1, }
+
+/*******************************************************
+ *                Structures
+ *******************************************************/
+typedef struct {
+    esp_netif_t *netif_sta;     /* the root restarts its DHCP client on it */
+    int layer;
+    bool connected;
+    mesh_addr_t parent;
+    uint16_t last_layer;        /* for the layer:old-->new logs */
+} mesh_events_state_t;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+void ip_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data);
+/* `arg` is the mesh_events_state_t of the node */
+void mesh_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data);
+
+#endif /* __MESH_EVENTS_H__ */
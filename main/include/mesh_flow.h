@@ -0,0 +1,57 @@
+/* Mesh Flow Control
+
+   Credit-based flow control between a parent and its direct children,
+   plus RX queue sizing from the available heap.
+*/
+
+#ifndef __MESH_FLOW_H__
+#define __MESH_FLOW_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_mesh.h"
+
+/*******************************************************
+ *                Structures
+ *******************************************************/
+typedef struct __attribute__((packed)) {
+    uint8_t type;           /* MESH_MSG_TYPE_CREDIT */
+    uint16_t credits;       /* packets the child may send us in the next window */
+} mesh_flow_grant_t;
+
+typedef struct {
+    uint8_t mac[6];
+    uint16_t granted;       /* credits granted for the current window */
+    uint16_t depth;         /* packets received in the current window */
+    uint16_t max_depth;
+    uint32_t rx;            /* packets for us from the child's whole subtree */
+    uint32_t drops;         /* packets over the grant */
+    uint32_t stalls;        /* windows in which the child used up its grant */
+} mesh_flow_child_stats_t;
+
+typedef struct {
+    uint16_t budget;        /* credits shared among the children per window */
+    uint16_t tx_credits;    /* credits left for sends that leave through our parent */
+    uint32_t tx_stalls;     /* sends refused for lack of credits */
+    int xon_qsize;
+} mesh_flow_stats_t;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+esp_err_t mesh_flow_init(void);
+/* RX queue size for esp_mesh_set_xon_qsize(), picked from the free heap */
+int mesh_flow_xon_qsize(void);
+esp_err_t mesh_flow_start(void);
+void mesh_flow_child_add(const uint8_t mac[6]);
+void mesh_flow_child_remove(const uint8_t mac[6]);
+void mesh_flow_parent_connected(void);
+/* Data plane hooks: false means the packet must not be sent / processed.
+ * mesh_flow_rx_admit() is for the RX task only. */
+bool mesh_flow_tx_admit(const mesh_addr_t *to);
+bool mesh_flow_rx_admit(const mesh_addr_t *from);
+int mesh_flow_get_children(mesh_flow_child_stats_t *children, int max);
+void mesh_flow_get_stats(mesh_flow_stats_t *stats);
+
+#endif /* __MESH_FLOW_H__ */
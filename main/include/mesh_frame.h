@@ -0,0 +1,74 @@
+/* Mesh Command Frames
+
+   Versioned, packed frame that carries several typed commands in one mesh
+   packet. Commands are parsed in place: the iterator returns pointers into
+   the receive buffer, nothing is copied.
+
+   | mesh_frame_hdr_t | cmd | len | data[len] | cmd | len | data[len] | ... | tag |
+
+   The trailing tag (mesh_auth.h) covers the header and the commands, and
+   the nonce in the header makes every frame valid exactly once.
+*/
+
+#ifndef __MESH_FRAME_H__
+#define __MESH_FRAME_H__
+
+#include <stdint.h>
+#include "esp_err.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define MESH_FRAME_VERSION          (2)
+
+/* Command ids */
+#define MESH_FRAME_CMD_LIGHT_ON_OFF (0x01)  /* data: uint8_t on */
+#define MESH_FRAME_CMD_LIGHT_COLOR  (0x02)  /* data: uint8_t color */
+#define MESH_FRAME_CMD_LIGHT_SCENE  (0x03)  /* data: mesh_light_scene_t */
+
+/*******************************************************
+ *                Structures
+ *******************************************************/
+typedef struct __attribute__((packed)) {
+    uint8_t type;           /* MESH_MSG_TYPE_FRAME */
+    uint8_t version;        /* MESH_FRAME_VERSION */
+    uint8_t count;          /* number of commands */
+    uint8_t flags;
+    uint16_t length;        /* bytes of commands after the header, the tag not included */
+    uint16_t boot;          /* mesh_auth_nonce_t of the sender */
+    uint32_t counter;
+} mesh_frame_hdr_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t cmd;
+    uint8_t len;
+    uint8_t data[];
+} mesh_frame_cmd_t;
+
+typedef struct {
+    const uint8_t *pos;
+    const uint8_t *end;
+    uint8_t remaining;
+} mesh_frame_iter_t;
+
+typedef struct {
+    uint8_t *buf;
+    uint16_t cap;
+    uint16_t len;
+} mesh_frame_builder_t;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+/* Checks the tag against the sender address `from` and rejects replays */
+esp_err_t mesh_frame_iter_init(mesh_frame_iter_t *it, const uint8_t from[6], const uint8_t *buf, uint16_t len);
+/* Returns NULL after the last command, or if the frame is truncated */
+const mesh_frame_cmd_t *mesh_frame_iter_next(mesh_frame_iter_t *it);
+
+void mesh_frame_begin(mesh_frame_builder_t *b, uint8_t *buf, uint16_t cap);
+/* Reserves a command and returns where its `len` data bytes go, or NULL if it does not fit */
+uint8_t *mesh_frame_append(mesh_frame_builder_t *b, uint8_t cmd, uint8_t len);
+/* Fills in the header, signs the frame and returns the number of bytes to send */
+uint16_t mesh_frame_finish(mesh_frame_builder_t *b);
+
+#endif /* __MESH_FRAME_H__ */
@@ -0,0 +1,80 @@
+/* Mesh Gateway
+
+   Bridges upstream mesh messages to a server outside the mesh: the root
+   collects them into batches and sends the batches over one persistent
+   TCP connection. The server can send batches back on the same
+   connection, which is how shards reach each other.
+*/
+
+#ifndef __MESH_GATEWAY_H__
+#define __MESH_GATEWAY_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_mesh.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define MESH_GATEWAY_MAGIC          (0x4257474d)    /* "MGWB" */
+#define MESH_GATEWAY_VERSION        (2)
+#define MESH_GATEWAY_FLAG_PACKBITS  (0x01)
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+/* Called from the gateway task for every record of a batch from the server */
+typedef void (*mesh_gateway_downlink_t)(const uint8_t src[6], const uint8_t *data, uint16_t len);
+
+/*******************************************************
+ *                Structures
+ *******************************************************/
+/* On the wire a batch is this header followed by `len` bytes of records,
+ * PackBits encoded when MESH_GATEWAY_FLAG_PACKBITS is set. All fields are
+ * little endian. Batches from the server are never encoded, and their
+ * records carry mesh_shard_hdr_t envelopes. */
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t flags;
+    uint16_t count;         /* records in the batch */
+    uint16_t raw_len;       /* length of the records once decoded */
+    uint16_t len;           /* length of the records on the wire */
+    uint32_t seq;
+    uint8_t root[6];
+    uint16_t shard;         /* mesh_shard_get_id() of the root */
+} mesh_gateway_batch_hdr_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t src[6];         /* node that sent the message */
+    uint16_t len;
+    uint8_t data[];
+} mesh_gateway_record_t;
+
+typedef struct {
+    uint32_t records;
+    uint32_t batches;       /* batches sent */
+    uint32_t dropped;       /* batches dropped while the server was unreachable */
+    uint32_t oversize;      /* messages too large for a batch */
+    uint32_t connects;
+    uint32_t send_errors;
+    uint32_t down_batches;  /* batches received from the server */
+    uint32_t down_records;
+    uint64_t raw_bytes;     /* record bytes before compression */
+    uint64_t wire_bytes;    /* record bytes sent */
+} mesh_gateway_stats_t;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+esp_err_t mesh_gateway_init(void);
+/* Root only, once it has an IP */
+esp_err_t mesh_gateway_start(void);
+void mesh_gateway_set_reachable(bool reachable);
+/* From any node: forwarded to the root, then batched to the server */
+esp_err_t mesh_gateway_send(const uint8_t *data, uint16_t len);
+void mesh_gateway_set_downlink(mesh_gateway_downlink_t downlink);
+void mesh_gateway_get_stats(mesh_gateway_stats_t *stats);
+
+#endif /* __MESH_GATEWAY_H__ */
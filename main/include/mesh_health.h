@@ -0,0 +1,69 @@
+/* Mesh Health
+
+   Periodic samples of heap, task stack and mesh queue usage, kept in a
+   ring that any node can read from another one over the mesh.
+*/
+
+#ifndef __MESH_HEALTH_H__
+#define __MESH_HEALTH_H__
+
+#include <stdint.h>
+#include "esp_err.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+/* Tasks whose stack is watched, see s_health_tasks in mesh_health.c */
+#define MESH_HEALTH_TASKS       (9)
+#define MESH_HEALTH_NO_TASK     (0xffff)
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+typedef enum {
+    MESH_HEALTH_OP_QUERY = 1,   /* mesh_health_hdr_t, `count` newest samples wanted */
+    MESH_HEALTH_OP_REPLY,       /* mesh_health_reply_t */
+} mesh_health_op_t;
+
+/*******************************************************
+ *                Structures
+ *******************************************************/
+typedef struct __attribute__((packed)) {
+    uint32_t uptime_s;
+    uint32_t free_heap;
+    uint32_t min_free_heap;
+    uint32_t largest_block;     /* far below free_heap means a fragmented heap */
+    uint16_t tx_parent;         /* esp_mesh_get_tx_pending(), P2P included */
+    uint16_t tx_child;
+    uint16_t rx_self;           /* esp_mesh_get_rx_pending() */
+    uint16_t rx_ds;
+    uint16_t stack_free[MESH_HEALTH_TASKS];     /* high-water mark in bytes, MESH_HEALTH_NO_TASK if not running */
+} mesh_health_sample_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t type;               /* MESH_MSG_TYPE_HEALTH */
+    uint8_t op;                 /* mesh_health_op_t */
+    uint8_t count;
+    uint8_t layer;              /* of the sender */
+} mesh_health_hdr_t;
+
+typedef struct __attribute__((packed)) {
+    mesh_health_hdr_t hdr;
+    uint32_t worst_block;       /* smallest largest_block since boot */
+    uint32_t worst_block_s;     /* and when it was seen */
+    mesh_health_sample_t samples[];     /* newest first */
+} mesh_health_reply_t;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+/* Starts sampling every CONFIG_MESH_HEALTH_PERIOD_S */
+esp_err_t mesh_health_init(void);
+void mesh_health_sample(mesh_health_sample_t *sample);
+/* Copies up to `max` samples, newest first, and returns how many were copied */
+int mesh_health_get(mesh_health_sample_t *samples, int max);
+/* Asks `mac` for its `count` newest samples; the reply is logged */
+esp_err_t mesh_health_query(const uint8_t mac[6], int count);
+void mesh_health_dump(void);
+
+#endif /* __MESH_HEALTH_H__ */
@@ -18,10 +18,15 @@
 #define MESH_LIGHT_ON       (0x01)
 #define MESH_LIGHT_OFF     (0x00)
 
-
-#define  MESH_TOKEN_ID       (0x0)
-#define  MESH_TOKEN_VALUE    (0xbeef)
-#define  MESH_CONTROL_CMD    (0x2)
+#define MESH_LIGHT_RED       (0xff)
+#define MESH_LIGHT_GREEN     (0xfe)
+#define MESH_LIGHT_BLUE      (0xfd)
+#define MESH_LIGHT_YELLOW    (0xfc)
+#define MESH_LIGHT_PINK      (0xfb)
+#define MESH_LIGHT_INIT      (0xfa)
+#define MESH_LIGHT_WARNING   (0xf9)
+/* Scenes only: each node shows the color of its own layer */
+#define MESH_LIGHT_LAYER     (0xf0)
 
 /*******************************************************
  *                Type Definitions
@@ -31,11 +36,20 @@
  *                Structures
  *******************************************************/
 typedef struct {
-    uint8_t cmd;
-    bool on;
-    uint8_t token_id;
-    uint16_t token_value;
-} mesh_light_ctl_t;
+    uint32_t requested;     /* mesh_light_set() calls */
+    uint32_t skipped;       /* requests equal to the current color */
+    uint32_t coalesced;     /* requests replaced by a newer one before being applied */
+    uint32_t applied;       /* colors actually written to the LEDC */
+    uint32_t scenes;        /* scenes started on time */
+    uint32_t scenes_late;   /* scenes received too late, or without a synced clock, started at once */
+} mesh_light_stats_t;
+
+/* Data of MESH_FRAME_CMD_LIGHT_SCENE */
+typedef struct __attribute__((packed)) {
+    uint8_t color;
+    uint16_t fade_ms;
+    uint32_t at_ms;         /* mesh clock (mesh_time.h) in ms, low 32 bits */
+} mesh_light_scene_t;
 
 /*******************************************************
  *                Variables Declarations
@@ -46,7 +60,15 @@ typedef struct {
  *******************************************************/
 esp_err_t mesh_light_init(void);
 esp_err_t mesh_light_set(int color);
+void mesh_light_get_stats(mesh_light_stats_t *stats);
+/* Every node, this one included, fades to `color` at the same instant,
+ * CONFIG_MESH_LIGHT_SCENE_LEAD_MS from now */
+esp_err_t mesh_light_scene_send(int color, uint16_t fade_ms);
+/* Sets the color of node `to` over the reliable channel (mesh_rel.h) */
+esp_err_t mesh_light_color_send(const mesh_addr_t *to, int color);
 esp_err_t mesh_light_process(mesh_addr_t *from, uint8_t *buf, uint16_t len);
+/* Color of the LEDs at `layer`, off deeper than layer 6 (mesh_light_indicator.c) */
+int mesh_light_layer_color(int layer);
 void mesh_connected_indicator(int layer);
 void mesh_disconnected_indicator(void);
 
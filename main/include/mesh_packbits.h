@@ -0,0 +1,26 @@
+/* Mesh PackBits
+
+   Run-length encoding of the gateway batches (mesh_gateway.c), decoded
+   by the server (tools/gateway_server). No state and no tables, so it
+   costs nothing next to the mesh stack.
+*/
+
+#ifndef __MESH_PACKBITS_H__
+#define __MESH_PACKBITS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+/* Worst case output for `len` bytes: one header byte per 128 literals */
+#define MESH_PACKBITS_MAX_LEN(len)  ((len) + (len) / 128 + 1)
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+/* Encodes `len` bytes of `in` into `out`, which holds MESH_PACKBITS_MAX_LEN(len), and returns the bytes written */
+size_t mesh_packbits_encode(const uint8_t *in, size_t len, uint8_t *out);
+
+#endif /* __MESH_PACKBITS_H__ */
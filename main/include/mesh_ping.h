@@ -0,0 +1,76 @@
+/* Mesh Ping
+
+   Application level ping between any two nodes, with round trip time
+   histograms per destination and per layer of the responder.
+*/
+
+#ifndef __MESH_PING_H__
+#define __MESH_PING_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_mesh.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+/* bucket b counts round trips of [2^b, 2^(b+1)) us, the last one everything above ~0.5 s */
+#define MESH_PING_HIST_BUCKETS  (20)
+/* responder layers 1 to 7, the last slot collects layer 8 and deeper */
+#define MESH_PING_LAYERS        (8)
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+typedef enum {
+    MESH_PING_OP_REQUEST = 1,
+    MESH_PING_OP_REPLY,
+} mesh_ping_op_t;
+
+/*******************************************************
+ *                Structures
+ *******************************************************/
+typedef struct __attribute__((packed)) {
+    uint8_t type;           /* MESH_MSG_TYPE_PING */
+    uint8_t op;             /* mesh_ping_op_t */
+    uint16_t seq;
+    uint8_t layer;          /* layer of the sender of this message */
+    uint32_t sent_us;       /* origin clock, echoed back in the reply */
+} mesh_ping_msg_t;
+
+typedef struct {
+    uint32_t count;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint64_t sum_us;
+    uint32_t hist[MESH_PING_HIST_BUCKETS];
+} mesh_ping_hist_t;
+
+typedef struct {
+    uint8_t mac[6];
+    uint8_t layer;          /* responder layer in the last reply, 0 if none yet */
+    uint32_t sent;
+    uint32_t lost;          /* no reply within CONFIG_MESH_PING_TIMEOUT_MS */
+    mesh_ping_hist_t rtt;
+} mesh_ping_dest_t;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+esp_err_t mesh_ping_init(void);
+/* Starts the root's periodic ping-all, when CONFIG_MESH_PING_PERIOD_S is set */
+esp_err_t mesh_ping_start(void);
+esp_err_t mesh_ping_send(const uint8_t mac[6]);
+/* Pings every node in the routing table, one every few ms */
+esp_err_t mesh_ping_all(void);
+/* Copies up to `max` destinations and returns how many were copied */
+int mesh_ping_get_dests(mesh_ping_dest_t *dests, int max);
+/* `layer` is 1 based; layers deeper than MESH_PING_LAYERS share the last histogram */
+void mesh_ping_get_layer(int layer, mesh_ping_hist_t *hist);
+/* Upper bound in us of the `pct` percentile of `hist` */
+uint32_t mesh_ping_percentile(const mesh_ping_hist_t *hist, int pct);
+void mesh_ping_dump(void);
+void mesh_ping_reset(void);
+
+#endif /* __MESH_PING_H__ */
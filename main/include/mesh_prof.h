@@ -0,0 +1,67 @@
+/* Mesh Startup Profiler
+
+   Time and heap delta of each startup phase, from app_main() to the first
+   MESH_EVENT_PARENT_CONNECTED / IP_EVENT_STA_GOT_IP, emitted once as a
+   compact binary record (decoded on the host by tools/prof_decode/prof_decode.py).
+*/
+
+#ifndef __MESH_PROF_H__
+#define __MESH_PROF_H__
+
+#include <stdint.h>
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define MESH_PROF_MAGIC     (0x4652504d)    /* "MPRF" */
+#define MESH_PROF_VERSION   (1)
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+/* Keep in sync with PHASES in tools/prof_decode/prof_decode.py */
+typedef enum {
+    MESH_PROF_LIGHT_INIT,
+    MESH_PROF_NVS_INIT,
+    MESH_PROF_NETIF_INIT,
+    MESH_PROF_EVENT_LOOP,
+    MESH_PROF_MESH_NETIFS,
+    MESH_PROF_WIFI_INIT,
+    MESH_PROF_WIFI_START,
+    MESH_PROF_MESH_INIT,
+    MESH_PROF_MESH_CONFIG,
+    MESH_PROF_MESH_START,
+    MESH_PROF_APP_MAIN_DONE,
+    MESH_PROF_PARENT_CONNECTED,
+    MESH_PROF_GOT_IP,
+    MESH_PROF_PHASE_MAX,
+} mesh_prof_phase_t;
+
+/*******************************************************
+ *                Structures
+ *******************************************************/
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t count;
+    uint16_t reserved;
+    uint32_t start_us;      /* esp_timer time when app_main() started */
+    uint32_t start_heap;
+} mesh_prof_hdr_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t phase;
+    uint32_t end_us;        /* since start_us */
+    int32_t heap_delta;     /* free heap change during the phase */
+} mesh_prof_entry_t;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+void mesh_prof_begin(void);
+/* Marks the end of `phase`; only the first mark of each phase counts */
+void mesh_prof_mark(mesh_prof_phase_t phase);
+/* Logs the record once, as hex, tagged "mesh_prof" */
+void mesh_prof_emit(void);
+
+#endif /* __MESH_PROF_H__ */
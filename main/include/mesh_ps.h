@@ -0,0 +1,39 @@
+/* Mesh Power Save Tuner
+
+   Adapts the device duty cycle to the traffic of the node: more awake
+   time while it is busy, less while it is idle.
+*/
+
+#ifndef __MESH_PS_H__
+#define __MESH_PS_H__
+
+#include <stdint.h>
+#include "esp_err.h"
+
+/*******************************************************
+ *                Structures
+ *******************************************************/
+typedef struct {
+    uint8_t duty;           /* current device duty cycle (%) */
+    uint8_t parent_duty;    /* last duty cycle announced by our parent */
+    uint8_t child_duty;     /* highest duty cycle announced by a child */
+    uint32_t load_pps;      /* packets/s in the last period */
+    uint32_t raises;
+    uint32_t lowers;
+    uint64_t active_ms;     /* sum of duty x time: the time spent awake, i.e. the energy used */
+    uint64_t total_ms;
+    uint32_t tx_wait_us_avg;    /* mean TX queue wait in the last period */
+    uint32_t tx_wait_us_max;    /* worst mean TX queue wait of any period */
+} mesh_ps_stats_t;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+esp_err_t mesh_ps_init(void);
+esp_err_t mesh_ps_start(void);
+/* MESH_EVENT_PS_PARENT_DUTY / MESH_EVENT_PS_CHILD_DUTY, duty 0 when a child leaves */
+void mesh_ps_on_parent_duty(uint8_t duty);
+void mesh_ps_on_child_duty(uint16_t aid, uint8_t duty);
+void mesh_ps_get_stats(mesh_ps_stats_t *stats);
+
+#endif /* __MESH_PS_H__ */
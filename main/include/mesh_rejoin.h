@@ -0,0 +1,39 @@
+/* Mesh Fast Rejoin
+
+   Remembers the last good parent, channel and layer in NVS and, after a
+   reboot, tries that parent first instead of a full scan and vote.
+*/
+
+#ifndef __MESH_REJOIN_H__
+#define __MESH_REJOIN_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_mesh.h"
+
+/*******************************************************
+ *                Structures
+ *******************************************************/
+typedef struct {
+    bool fast_path;         /* the stored parent was tried */
+    bool fast_hit;          /* ... and we connected to it */
+    uint32_t fallbacks;     /* times we gave up on the stored parent */
+    int64_t join_us;        /* esp_mesh_start() to first MESH_EVENT_PARENT_CONNECTED */
+} mesh_rejoin_stats_t;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+/* Call after nvs_flash_init() */
+esp_err_t mesh_rejoin_init(void);
+/* Call before esp_mesh_set_config(): pins the stored channel */
+void mesh_rejoin_apply(mesh_cfg_t *cfg);
+/* Call right after esp_mesh_start(): tries the stored parent */
+esp_err_t mesh_rejoin_start(void);
+esp_err_t mesh_rejoin_try_parent(const uint8_t bssid[6], uint8_t channel, int layer);
+void mesh_rejoin_on_connected(const mesh_event_connected_t *connected);
+void mesh_rejoin_on_no_parent(void);
+void mesh_rejoin_get_stats(mesh_rejoin_stats_t *stats);
+
+#endif /* __MESH_REJOIN_H__ */
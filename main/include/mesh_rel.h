@@ -0,0 +1,61 @@
+/* Mesh Reliable Delivery
+
+   Optional at-least-once channel between two nodes: any mesh message can
+   be wrapped in a mesh_rel_hdr_t, which the sender retransmits until the
+   peer acknowledges it and the receiver delivers at most once.
+*/
+
+#ifndef __MESH_REL_H__
+#define __MESH_REL_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_mesh.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define MESH_REL_FLAG_DATA      (0x01)  /* a payload with `seq` follows the header */
+#define MESH_REL_FLAG_ACK       (0x02)  /* `ack` and `sack` are valid */
+
+/*******************************************************
+ *                Structures
+ *******************************************************/
+typedef struct __attribute__((packed)) {
+    uint8_t type;           /* MESH_MSG_TYPE_REL */
+    uint8_t flags;
+    uint16_t epoch;         /* sender's boot id: a new one resets the peer's receive window */
+    uint16_t seq;
+    uint16_t base;          /* lowest seq the sender still retransmits: the receiver is done with those below */
+    uint16_t ack_epoch;     /* epoch of the data being acknowledged */
+    uint16_t ack;           /* every seq below was received */
+    uint32_t sack;          /* bit i set: ack + 1 + i was received too */
+} mesh_rel_hdr_t;
+
+typedef struct {
+    uint32_t tx_data;
+    uint32_t tx_retransmits;
+    uint32_t tx_failed;     /* given up after CONFIG_MESH_REL_MAX_TRIES */
+    uint32_t tx_no_slot;    /* sends refused with every retransmit slot busy, or the peer's window full */
+    uint32_t tx_acks;       /* ACK-only packets */
+    uint32_t acks_piggybacked;
+    uint32_t rx_data;
+    uint32_t rx_dups;
+    uint32_t rx_out_of_window;
+} mesh_rel_stats_t;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+esp_err_t mesh_rel_init(void);
+/* `data` is a whole mesh message, starting with its type byte, up to
+ * CONFIG_MESH_REL_MAX_LEN bytes. It is copied: the caller keeps it. Only
+ * types registered with mesh_comm_register_app_handler() are delivered.
+ * ESP_ERR_NO_MEM while every slot is busy or the peer is a window behind. */
+esp_err_t mesh_rel_send(const mesh_addr_t *to, const uint8_t *data, uint16_t len);
+/* Messages still waiting for their ACK */
+int mesh_rel_pending(void);
+void mesh_rel_get_stats(mesh_rel_stats_t *stats);
+
+#endif /* __MESH_REL_H__ */
@@ -0,0 +1,87 @@
+/* Mesh SPSC Ring
+
+   Lock-free ring of fixed size elements between exactly one producer
+   task and one consumer task, possibly on different cores. The producer
+   only writes head, the consumer only writes tail, and each publishes
+   its index with a release store that the other side reads with an
+   acquire load, so no lock or critical section is needed.
+
+   Header only and free of ESP-IDF dependencies, so the same code can be
+   built and exercised on the host.
+*/
+
+#ifndef __MESH_RING_H__
+#define __MESH_RING_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+/*******************************************************
+ *                Structures
+ *******************************************************/
+typedef struct {
+    uint8_t *slots;
+    uint32_t elem_size;
+    uint32_t mask;          /* capacity - 1, capacity is a power of two */
+    uint32_t head;          /* next slot to write, producer only */
+    uint32_t tail;          /* next slot to read, consumer only */
+    /* producer side statistics */
+    uint32_t pushed;
+    uint32_t full;          /* pushes refused with the ring full */
+    uint32_t high_water;    /* highest occupancy seen by the producer */
+} mesh_ring_t;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+/* `storage` holds capacity * elem_size bytes; capacity must be a power of two */
+static inline bool mesh_ring_init(mesh_ring_t *ring, void *storage, uint32_t elem_size, uint32_t capacity)
+{
+    if (!storage || !elem_size || !capacity || (capacity & (capacity - 1))) {
+        return false;
+    }
+    memset(ring, 0, sizeof(mesh_ring_t));
+    ring->slots = (uint8_t *) storage;
+    ring->elem_size = elem_size;
+    ring->mask = capacity - 1;
+    return true;
+}
+
+/* Producer only */
+static inline bool mesh_ring_push(mesh_ring_t *ring, const void *elem)
+{
+    uint32_t head = ring->head;
+    uint32_t used = head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if (used > ring->mask) {
+        ring->full++;
+        return false;
+    }
+    memcpy(ring->slots + (head & ring->mask) * ring->elem_size, elem, ring->elem_size);
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    ring->pushed++;
+    if (used + 1 > ring->high_water) {
+        ring->high_water = used + 1;
+    }
+    return true;
+}
+
+/* Consumer only */
+static inline bool mesh_ring_pop(mesh_ring_t *ring, void *elem)
+{
+    uint32_t tail = ring->tail;
+    if (tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    memcpy(elem, ring->slots + (tail & ring->mask) * ring->elem_size, ring->elem_size);
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/* Either side; only a snapshot, the other side may move right after */
+static inline uint32_t mesh_ring_count(const mesh_ring_t *ring)
+{
+    return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+}
+
+#endif /* __MESH_RING_H__ */
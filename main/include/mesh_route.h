@@ -0,0 +1,36 @@
+/* Mesh Routing Table Index
+
+   Sorted, hashed copy of this node's routing table, kept up to date from
+   MESH_EVENT_ROUTING_TABLE_ADD/REMOVE so that membership checks and
+   descendant lists do not need esp_mesh_get_routing_table() each time.
+*/
+
+#ifndef __MESH_ROUTE_H__
+#define __MESH_ROUTE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_mesh.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define MESH_ROUTE_MAX      (CONFIG_MESH_ROUTE_TABLE_SIZE)
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+esp_err_t mesh_route_init(void);
+/* Re-reads the routing table and merges the differences into the index */
+esp_err_t mesh_route_update(void);
+void mesh_route_clear(void);
+bool mesh_route_contains(const uint8_t mac[6]);
+int mesh_route_size(void);
+uint32_t mesh_route_generation(void);
+/* Copies the sorted table into `table` and returns true, unless `*generation`
+ * is still current, in which case the caller's previous copy is valid and
+ * nothing is copied. */
+bool mesh_route_snapshot(mesh_addr_t *table, int max, int *count, uint32_t *generation);
+
+#endif /* __MESH_ROUTE_H__ */
@@ -0,0 +1,55 @@
+/* Mesh Shards
+
+   Splits the fleet into independent meshes, each with its own root and
+   uplink, chosen by a shard id provisioned in NVS. Shards exchange
+   messages through the gateway server.
+*/
+
+#ifndef __MESH_SHARD_H__
+#define __MESH_SHARD_H__
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_mesh.h"
+
+/*******************************************************
+ *                Structures
+ *******************************************************/
+/* Inter-shard envelope: node to its root as an uplink record, server to the
+ * root of the destination shard, then root to the destination node */
+typedef struct __attribute__((packed)) {
+    uint8_t type;           /* MESH_MSG_TYPE_SHARD */
+    uint16_t src_shard;
+    uint16_t dst_shard;
+    uint8_t src[6];
+    uint8_t dst[6];         /* all zeros for the root of dst_shard */
+    uint8_t data[];         /* a signed mesh_frame_hdr_t frame, the only type delivered */
+} mesh_shard_hdr_t;
+
+typedef struct {
+    uint32_t sent;          /* envelopes handed to the gateway */
+    uint32_t relayed;       /* root: envelopes from the server passed on to a node */
+    uint32_t delivered;
+    uint32_t dropped;       /* for another shard, or no buffer to relay them */
+    uint32_t rejected;      /* not from our root, or not carrying a command frame */
+} mesh_shard_stats_t;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+/* Call after nvs_flash_init() */
+esp_err_t mesh_shard_init(void);
+/* 0 is the unsharded mesh: MESH_ID and CONFIG_MESH_CHANNEL as they are */
+uint16_t mesh_shard_get_id(void);
+/* Turns the base mesh ID in `cfg` into the one of our shard, and picks its channel */
+void mesh_shard_apply(mesh_cfg_t *cfg);
+/* Stores the shard to join from the next boot on */
+esp_err_t mesh_shard_provision(uint16_t shard);
+/* `msg` is a command frame (mesh_frame.h): its tag proves the sender
+ * across shards. `dst` NULL for the root of `shard` */
+esp_err_t mesh_shard_send(uint16_t shard, const uint8_t dst[6], const uint8_t *msg, uint16_t len);
+void mesh_shard_get_stats(mesh_shard_stats_t *stats);
+/* Call on MESH_EVENT_ROOT_ADDRESS: envelopes are only taken from the root */
+void mesh_shard_on_root_address(const uint8_t root[6]);
+
+#endif /* __MESH_SHARD_H__ */
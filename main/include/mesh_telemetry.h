@@ -0,0 +1,63 @@
+/* Mesh Telemetry
+
+   In-network aggregation: every node merges its children's reports with
+   its own sample and sends a single report to its parent, so the root
+   receives one report per child instead of one per node.
+*/
+
+#ifndef __MESH_TELEMETRY_H__
+#define __MESH_TELEMETRY_H__
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_mesh.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define MESH_TELEMETRY_VERSION      (1)
+#define MESH_TELEMETRY_LAYER_HIST   (8)     /* layers 1..7, then 8 and deeper */
+#define MESH_TELEMETRY_RSSI_HIST    (8)     /* 10 dB buckets from -100 dBm */
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+typedef enum {
+    MESH_TELEMETRY_FREE_HEAP,
+    MESH_TELEMETRY_MIN_FREE_HEAP,
+    MESH_TELEMETRY_PARENT_RSSI,
+    MESH_TELEMETRY_UPTIME_S,
+    MESH_TELEMETRY_METRIC_MAX,
+} mesh_telemetry_metric_t;
+
+/*******************************************************
+ *                Structures
+ *******************************************************/
+typedef struct __attribute__((packed)) {
+    uint32_t count;
+    int32_t min;
+    int32_t max;
+    int64_t sum;
+} mesh_telemetry_stat_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t type;           /* MESH_MSG_TYPE_TELEMETRY */
+    uint8_t version;
+    uint16_t nodes;         /* nodes merged into this report */
+    uint16_t layer_hist[MESH_TELEMETRY_LAYER_HIST];
+    uint16_t rssi_hist[MESH_TELEMETRY_RSSI_HIST];
+    mesh_telemetry_stat_t stats[MESH_TELEMETRY_METRIC_MAX];
+} mesh_telemetry_report_t;
+
+/* Called on the root with the aggregate of the whole mesh */
+typedef void (*mesh_telemetry_sink_t)(const mesh_telemetry_report_t *report);
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+esp_err_t mesh_telemetry_init(void);
+esp_err_t mesh_telemetry_start(void);
+void mesh_telemetry_set_sink(mesh_telemetry_sink_t sink);
+esp_err_t mesh_telemetry_process(mesh_addr_t *from, uint8_t *buf, uint16_t len);
+
+#endif /* __MESH_TELEMETRY_H__ */
@@ -0,0 +1,57 @@
+/* Mesh Time
+
+   Mesh-wide clock: the root's esp_timer plus the offset it had synced
+   before it became root, handed down the tree one parent link at a time
+   so that every node can act at the same instant.
+*/
+
+#ifndef __MESH_TIME_H__
+#define __MESH_TIME_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+typedef enum {
+    MESH_TIME_OP_REQUEST = 1,
+    MESH_TIME_OP_REPLY,
+} mesh_time_op_t;
+
+/*******************************************************
+ *                Structures
+ *******************************************************/
+typedef struct __attribute__((packed)) {
+    uint8_t type;           /* MESH_MSG_TYPE_TIME */
+    uint8_t op;             /* mesh_time_op_t */
+    uint8_t synced;         /* reply: the parent has a mesh clock to give */
+    int64_t t1;             /* child local clock when the request left */
+    int64_t t2;             /* parent mesh clock when the request arrived */
+    int64_t t3;             /* parent mesh clock when the reply left */
+} mesh_time_msg_t;
+
+typedef struct {
+    bool synced;
+    int64_t offset_us;      /* mesh clock minus local clock, kept when becoming root */
+    uint32_t delay_us;      /* round trip of the sample in use */
+    int32_t last_step_us;   /* correction applied by the last sync */
+    uint32_t syncs;
+    uint32_t samples;
+    uint32_t rejected;      /* replies from an unsynced parent, or too slow to trust */
+} mesh_time_stats_t;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+esp_err_t mesh_time_init(void);
+/* Call on every parent connection: syncs right away, then every CONFIG_MESH_TIME_SYNC_PERIOD_S */
+esp_err_t mesh_time_start(void);
+bool mesh_time_is_synced(void);
+int64_t mesh_time_now(void);
+/* The esp_timer_get_time() value at which the mesh clock reads `mesh_us` */
+int64_t mesh_time_to_local(int64_t mesh_us);
+void mesh_time_get_stats(mesh_time_stats_t *stats);
+
+#endif /* __MESH_TIME_H__ */
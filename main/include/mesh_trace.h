@@ -0,0 +1,47 @@
+/* Mesh Event Trace
+
+   Binary ring of raw mesh/IP events kept in RTC memory, so the history
+   survives a soft reset. Formatting happens on the host, see
+   tools/trace_decode/trace_decode.py.
+*/
+
+#ifndef __MESH_TRACE_H__
+#define __MESH_TRACE_H__
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_event.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define MESH_TRACE_MAGIC        (0x5452434d)    /* "MCRT" */
+#define MESH_TRACE_DATA_LEN     (20)
+
+/* mesh_trace_entry_t.base */
+#define MESH_TRACE_BASE_MESH    (0)
+#define MESH_TRACE_BASE_IP      (1)
+
+/*******************************************************
+ *                Structures
+ *******************************************************/
+typedef struct __attribute__((packed)) {
+    uint32_t seq;           /* index + 1 once the entry is complete, 0 while being written */
+    uint32_t time_us;       /* low 32 bits of esp_timer_get_time() */
+    uint16_t id;            /* event id */
+    uint8_t base;           /* MESH_TRACE_BASE_* */
+    uint8_t boot;           /* boot counter, tells previous boots apart */
+    uint8_t data[MESH_TRACE_DATA_LEN];  /* raw event fields, little endian */
+} mesh_trace_entry_t;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+esp_err_t mesh_trace_init(void);
+void mesh_trace_event(esp_event_base_t event_base, int32_t event_id, const void *event_data);
+/* Copies up to `max` entries, oldest first; returns how many */
+int mesh_trace_read(mesh_trace_entry_t *entries, int max);
+/* Logs every entry as one hex line, tagged "mesh_trace" */
+void mesh_trace_dump(void);
+
+#endif /* __MESH_TRACE_H__ */
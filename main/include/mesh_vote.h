@@ -0,0 +1,50 @@
+/* Mesh Root Vote
+
+   Root candidate scoring with a hand-over hysteresis, and timing of the
+   root elections.
+*/
+
+#ifndef __MESH_VOTE_H__
+#define __MESH_VOTE_H__
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_mesh.h"
+
+/*******************************************************
+ *                Structures
+ *******************************************************/
+typedef struct __attribute__((packed)) {
+    uint8_t type;           /* MESH_MSG_TYPE_VOTE */
+    uint8_t addr[6];        /* best candidate of the sender's subtree */
+    uint16_t score;
+} mesh_vote_candidate_t;
+
+typedef struct {
+    uint16_t score;             /* our own score */
+    uint16_t best_score;        /* best candidate seen by the root in the last period */
+    uint8_t best_addr[6];
+    uint32_t elections;         /* elections that ended with a stable parent */
+    uint32_t election_us_last;  /* VOTE_STARTED to stable PARENT_CONNECTED */
+    uint32_t election_us_max;
+    uint32_t root_changes;      /* root address changes seen */
+    uint32_t yields_asked;      /* ROOT_ASKED_YIELD received as root */
+    uint32_t waives;            /* hand-overs to a better candidate */
+} mesh_vote_stats_t;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+esp_err_t mesh_vote_init(void);
+esp_err_t mesh_vote_start(void);
+/* Mesh event hooks */
+void mesh_vote_on_vote_started(void);
+void mesh_vote_on_parent_connected(void);
+void mesh_vote_on_parent_disconnected(void);
+void mesh_vote_on_root_address(const uint8_t addr[6]);
+/* Router RSSI seen by a scan, what a node that is not root is scored from */
+void mesh_vote_on_router_rssi(int8_t rssi);
+void mesh_vote_on_asked_yield(const mesh_event_root_conflict_t *conflict);
+void mesh_vote_get_stats(mesh_vote_stats_t *stats);
+
+#endif /* __MESH_VOTE_H__ */
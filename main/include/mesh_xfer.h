@@ -0,0 +1,82 @@
+/* Mesh Bulk Transfer
+
+   Pipelined transfer of large blobs (firmware images) down the mesh
+   tree: every node stores the chunks it receives from its parent in its
+   next OTA partition and relays them to its own children at the same
+   time.
+*/
+
+#ifndef __MESH_XFER_H__
+#define __MESH_XFER_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_partition.h"
+
+/*******************************************************
+ *                Type Definitions
+ *******************************************************/
+typedef enum {
+    MESH_XFER_OP_BEGIN = 1,     /* mesh_xfer_begin_t, parent to child */
+    MESH_XFER_OP_CHUNK,         /* mesh_xfer_chunk_t, parent to child */
+    MESH_XFER_OP_STATUS,        /* mesh_xfer_ack_t, child to parent */
+} mesh_xfer_op_t;
+
+/*******************************************************
+ *                Structures
+ *******************************************************/
+typedef struct __attribute__((packed)) {
+    uint8_t type;           /* MESH_MSG_TYPE_XFER */
+    uint8_t op;             /* mesh_xfer_op_t */
+    uint32_t id;            /* transfer id, never 0 */
+} mesh_xfer_hdr_t;
+
+typedef struct __attribute__((packed)) {
+    mesh_xfer_hdr_t hdr;
+    uint32_t size;
+    uint32_t crc;           /* CRC32 of the whole blob */
+    uint16_t chunk_size;
+} mesh_xfer_begin_t;
+
+typedef struct __attribute__((packed)) {
+    mesh_xfer_hdr_t hdr;
+    uint32_t index;
+    uint8_t data[];
+} mesh_xfer_chunk_t;
+
+typedef struct __attribute__((packed)) {
+    mesh_xfer_hdr_t hdr;
+    uint32_t base;          /* every chunk below base is stored */
+    uint64_t bitmap;        /* bit i set: chunk base + i is stored too */
+} mesh_xfer_ack_t;
+
+typedef struct {
+    uint32_t id;            /* current transfer, 0 if none */
+    uint32_t size;
+    uint32_t chunks;
+    uint32_t stored;        /* chunks stored so far */
+    bool complete;          /* all chunks stored and the CRC matched */
+    uint32_t elapsed_ms;    /* BEGIN to complete */
+    uint32_t rx_chunks;
+    uint32_t rx_dups;
+    uint32_t rx_overruns;   /* chunks dropped with the receive queue full */
+    uint32_t tx_chunks;
+    uint32_t retransmits;
+    uint32_t resumes;       /* transfers picked up again after a reboot */
+} mesh_xfer_stats_t;
+
+/* Called once all chunks are stored; result is ESP_ERR_INVALID_CRC if the blob is corrupt */
+typedef void (*mesh_xfer_done_cb_t)(uint32_t id, const esp_partition_t *part, esp_err_t result);
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+esp_err_t mesh_xfer_init(void);
+esp_err_t mesh_xfer_start(void);
+/* Root: send the first `size` bytes of `src` (e.g. the running app partition) to the whole mesh */
+esp_err_t mesh_xfer_push(const esp_partition_t *src, uint32_t size);
+void mesh_xfer_set_done_cb(mesh_xfer_done_cb_t cb);
+void mesh_xfer_get_stats(mesh_xfer_stats_t *stats);
+
+#endif /* __MESH_XFER_H__ */
@@ -18,39 +18,59 @@
 #include "esp_log.h"
 #include "esp_mesh.h"
 #include "esp_mesh_internal.h"
+#include "mesh_events.h"
 #include "mesh_light.h"
+#include "mesh_comm.h"
+#include "mesh_route.h"
+#include "mesh_rejoin.h"
+#include "mesh_prof.h"
+#include "mesh_telemetry.h"
+#include "mesh_flow.h"
+#include "mesh_trace.h"
+#include "mesh_ps.h"
+#include "mesh_vote.h"
+#include "mesh_gateway.h"
+#include "mesh_xfer.h"
+#include "mesh_ping.h"
+#include "mesh_backup.h"
+#include "mesh_rel.h"
+#include "mesh_bench.h"
+#include "mesh_auth.h"
+#include "mesh_time.h"
+#include "mesh_shard.h"
+#include "mesh_health.h"
 #include "nvs_flash.h"
 
 /*******************************************************
  *                Variable Definitions
  *******************************************************/
 
-// Pointer where the STA interface will be saved. you have to initialize it to NULL
-static esp_netif_t *netif_sta = NULL;
-
-static int mesh_layer = -1;
-static bool is_mesh_connected = false;
-static mesh_addr_t mesh_parent_addr;
+// What the mesh event handler knows about us (layer, parent, connected), see mesh_events.c. It also keeps the
+// pointer where the STA interface will be saved: you have to initialize it to NULL
+static mesh_events_state_t mesh_state = MESH_EVENTS_STATE_DEFAULT();
 static const uint8_t MESH_ID[6] = { 0x77, 0x77, 0x77, 0x77, 0x77, 0x77};
 
 
 // Used in debug print
 static const char *MESH_TAG = "mesh_main";
-static const char *IP_TAG = "wifi_ip";
-
 
-/*******************************************************
- *                Signatures
- *******************************************************/
-void ip_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data);
-void mesh_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data);
 
 void app_main(void) {
     // The ESP_ERROR_CHECK() works similarly to an assert: it checks the esp_err_t returned and
     // if it is not equal to ESP_OK it aborts the execution (and an error message is printed)
 
+    // Start the startup profiler: from here on every mesh_prof_mark() records how long the phase took and how
+    // much heap it used. The record is printed once we are connected (see the event handlers)
+    mesh_prof_begin();
+
     //This line will initialize the led handler
     ESP_ERROR_CHECK(mesh_light_init());
+    mesh_prof_mark(MESH_PROF_LIGHT_INIT);
+
+    // Event trace: every mesh/IP event is recorded in binary form in a ring in RTC memory (it survives a soft
+    // reset). The event handlers below only log at debug level: use mesh_trace_dump() and
+    // tools/trace_decode to read the history
+    ESP_ERROR_CHECK(mesh_trace_init());
 
 
     
@@ -63,17 +83,31 @@ void app_main(void) {
     // There is the concept of namespaces and much more. I'm pretty sure that the `menuconfig` settings are stored here, so you have to initialize the memory
     ESP_ERROR_CHECK(nvs_flash_init());
 
+    // Load the parent/channel/layer we were connected to before the reboot (if any). They are stored in NVS too
+    ESP_ERROR_CHECK(mesh_rejoin_init());
+
+    // Command frames are signed: load the shared key and bump the boot counter that keeps our nonces unique
+    ESP_ERROR_CHECK(mesh_auth_init());
+
+    // Shard: which of the independent meshes of the fleet we belong to. It is provisioned in NVS and decides
+    // the mesh ID (and with MESH_SHARD_CHANNEL_PLAN the channel) we use below
+    ESP_ERROR_CHECK(mesh_shard_init());
+    mesh_prof_mark(MESH_PROF_NVS_INIT);
+
     // this line will startup the TCP/IP stack. It must be called once in the setup of the program
     ESP_ERROR_CHECK(esp_netif_init());
+    mesh_prof_mark(MESH_PROF_NETIF_INIT);
 
     // this function is provided by esp_event.h and it startup a default event handler. Further in the code, using esp_event_handler_register it will
     // handle different events
     ESP_ERROR_CHECK(esp_event_loop_create_default());
+    mesh_prof_mark(MESH_PROF_EVENT_LOOP);
 
 
-    // Creates default STA and AP network interfaces for esp-mesh. It will return the STA interface in the netif_sta pointer.
+    // Creates default STA and AP network interfaces for esp-mesh. It will return the STA interface in the mesh_state.netif_sta pointer.
     // TODO: capire meglio
-    ESP_ERROR_CHECK(esp_netif_create_default_wifi_mesh_netifs(&netif_sta, NULL));
+    ESP_ERROR_CHECK(esp_netif_create_default_wifi_mesh_netifs(&mesh_state.netif_sta, NULL));
+    mesh_prof_mark(MESH_PROF_MESH_NETIFS);
 
     // WIFI initialization. The macro WIFI_INIT_CONFIG_DEFAULT will return default configuration values
     wifi_init_config_t config = WIFI_INIT_CONFIG_DEFAULT();
@@ -87,12 +121,14 @@ void app_main(void) {
 
     // Set the WiFi API configuration storage type to WIFI_STORAGE_FLASH. We are telling the ESP to store all configuration in both memory and flash
     ESP_ERROR_CHECK(esp_wifi_set_storage(WIFI_STORAGE_FLASH));
+    mesh_prof_mark(MESH_PROF_WIFI_INIT);
 
     // Start the wifi according to the configurations. In this case, WIFI_INIT_CONFIG_DEFAULT.
     // I (707) wifi:mode : sta (f4:65:0b:57:21:d8) + softAP (f4:65:0b:57:21:d9)
     // [MY ASSUMPTION] Remember that we have set the esp to create network interfaces for esp-mesh. Only the root node will connect to the router
     // So i'm still not connecting to WIFI, and this makes sense
     ESP_ERROR_CHECK(esp_wifi_start());
+    mesh_prof_mark(MESH_PROF_WIFI_START);
 
     /************************************
      *          MESH CONFIGURATION      *
@@ -101,8 +137,64 @@ void app_main(void) {
     // Call after wifi initialization, it will initialize the mesh with default values
     ESP_ERROR_CHECK(esp_mesh_init());
 
-    // Register a callback function for all mesh related events 
-    ESP_ERROR_CHECK(esp_event_handler_register(MESH_EVENT, ESP_EVENT_ANY_ID, &mesh_event_handler, NULL));
+    // Register a callback function for all mesh related events. The handler keeps what it learns in mesh_state
+    ESP_ERROR_CHECK(esp_event_handler_register(MESH_EVENT, ESP_EVENT_ANY_ID, &mesh_event_handler, &mesh_state));
+
+    // Prepare the data plane: the packet buffer pool is static, so after this point receiving and sending
+    // never allocate. The RX/TX tasks are started once we have a parent (see MESH_EVENT_PARENT_CONNECTED).
+    // Every payload starts with a message type byte, and each type has its own handler. The LED frames are
+    // application work, so they run on the app task on the other core, fed by a lock-free ring from mesh_rx
+    ESP_ERROR_CHECK(mesh_comm_init());
+    ESP_ERROR_CHECK(mesh_comm_register_app_handler(MESH_MSG_TYPE_FRAME, mesh_light_process));
+
+    // Local index of the routing table (sorted + hashed), refreshed on every routing table event, so other
+    // modules can check "is this node below me?" or get the descendant list without copying the whole table
+    ESP_ERROR_CHECK(mesh_route_init());
+
+    // Telemetry: every node merges the reports of its children with its own numbers and sends a single
+    // report to its parent, deepest layer first, so the root only hears from its direct children
+    ESP_ERROR_CHECK(mesh_telemetry_init());
+
+    // Flow control: as a parent, hand out credits to every child so that a noisy child cannot use up the
+    // buffers of its siblings; as a child, spend the credits we get from our parent
+    ESP_ERROR_CHECK(mesh_flow_init());
+
+    // Root vote: every node scores itself as a root candidate (router RSSI, uptime) and the
+    // root hands over only to a clearly better candidate, and only after a while. Elections are timed too
+    ESP_ERROR_CHECK(mesh_vote_init());
+
+    // Gateway: the root collects the messages nodes send upstream (and the mesh telemetry) into batches and
+    // forwards them to a server over a single TCP connection (menuconfig: MESH_GATEWAY_HOST/PORT)
+    ESP_ERROR_CHECK(mesh_gateway_init());
+
+    // Bulk transfer: large blobs (e.g. a firmware image pushed by the root with mesh_xfer_push()) flow down the
+    // tree chunk by chunk; every node stores them in its next OTA partition and relays them to its children
+    ESP_ERROR_CHECK(mesh_xfer_init());
+
+    // Ping: any node can ping any other with mesh_ping_send(); the root can also ping the whole routing table
+    // every MESH_PING_PERIOD_S and logs the round trip histograms per node and per layer
+    ESP_ERROR_CHECK(mesh_ping_init());
+
+    // Backup parents: every node ranks the parents it saw in recent scans (RSSI, free slots, layer), so when
+    // its parent goes away it can ask for the best backup right away instead of a full scan
+    ESP_ERROR_CHECK(mesh_backup_init());
+
+    // Reliable channel: mesh_rel_send() wraps any message handled on the app task (e.g. a light command frame) with
+    // a sequence number and resends it until the peer ACKs it; the peer drops duplicates, so the command runs once
+    ESP_ERROR_CHECK(mesh_rel_init());
+
+    // Benchmark (only with MESH_BENCH_ENABLE): the root can start iperf-like runs over the mesh with
+    // mesh_bench_run(), or one is started for us after MESH_BENCH_AUTO_START_S; results are logged per layer
+    ESP_ERROR_CHECK(mesh_bench_init());
+
+    // Mesh clock: every node syncs to its parent, and so to the root, so that mesh_light_scene_send() can make
+    // the whole tree change color at the same instant instead of layer after layer
+    ESP_ERROR_CHECK(mesh_time_init());
+
+    // Health: heap, largest free block, task stacks and mesh queues sampled every MESH_HEALTH_PERIOD_S into a
+    // ring that any node can read with mesh_health_query(), to catch slow leaks and fragmentation
+    ESP_ERROR_CHECK(mesh_health_init());
+    mesh_prof_mark(MESH_PROF_MESH_INIT);
 
     // Set mesh topology (I suppose that CONFIG_MESH_TOPOLOGY is taken from menuconfig, in my case chain)
     // This API must be called before starting the mesh
@@ -111,12 +203,17 @@ void app_main(void) {
     // Setting max layer (menuconfig, set to 6)
     ESP_ERROR_CHECK(esp_mesh_set_max_layer(CONFIG_MESH_MAX_LAYER));
 
-    // Set the treshold to be reached to be a root node (100% of votes)
-    ESP_ERROR_CHECK(esp_mesh_set_vote_percentage(1));
+    // Set the treshold to be reached to be a root node (menuconfig, 100% of votes by default)
+    ESP_ERROR_CHECK(esp_mesh_set_vote_percentage(CONFIG_MESH_VOTE_PERCENTAGE / 100.0f));
+
+    // When the root goes away, wait this long before electing a new one: a root that comes back quickly
+    // (reboot, short radio loss) keeps its role instead of causing two elections
+    ESP_ERROR_CHECK(esp_mesh_set_root_healing_delay(CONFIG_MESH_ROOT_HEALING_DELAY_MS));
 
     // Set the value for the RX queue size. It is the size of the receiver buffer
-    // This node can hold up to 128 packets before dropping them
-    ESP_ERROR_CHECK(esp_mesh_set_xon_qsize(128));
+    // This node can hold up to this many packets before dropping them. Instead of a fixed 128, the size
+    // is picked from the free heap (16..128); it cannot change once the mesh is started
+    ESP_ERROR_CHECK(esp_mesh_set_xon_qsize(mesh_flow_xon_qsize()));
 
     // PS stands for powersafe. This option is set in menuconfig
     // I disabled powersafe
@@ -148,238 +245,33 @@ void app_main(void) {
     cfg.mesh_ap.nonmesh_max_connection = CONFIG_MESH_NON_MESH_AP_CONNECTIONS;
     memcpy((uint8_t *) &cfg.mesh_ap.password, CONFIG_MESH_AP_PASSWD,
         strlen(CONFIG_MESH_AP_PASSWD));
+    /* shards: our own mesh ID and channel, derived from MESH_ID and the shard id */
+    mesh_shard_apply(&cfg);
+    /* fast rejoin: listen only on the channel we were on before the reboot */
+    mesh_rejoin_apply(&cfg);
     ESP_ERROR_CHECK(esp_mesh_set_config(&cfg));
+    mesh_prof_mark(MESH_PROF_MESH_CONFIG);
     /* mesh start */
     ESP_ERROR_CHECK(esp_mesh_start());
+    /* fast rejoin: ask for the old parent first, fall back to a normal scan if it is gone */
+    mesh_rejoin_start();
+    mesh_prof_mark(MESH_PROF_MESH_START);
     #ifdef CONFIG_MESH_ENABLE_PS
     /* set the device active duty cycle. (default:10, MESH_PS_DEVICE_DUTY_REQUEST) */
     ESP_ERROR_CHECK(esp_mesh_set_active_duty_cycle(CONFIG_MESH_PS_DEV_DUTY, CONFIG_MESH_PS_DEV_DUTY_TYPE));
     /* set the network active duty cycle. (default:10, -1, MESH_PS_NETWORK_DUTY_APPLIED_ENTIRE) */
     ESP_ERROR_CHECK(esp_mesh_set_network_duty_cycle(CONFIG_MESH_PS_NWK_DUTY, CONFIG_MESH_PS_NWK_DUTY_DURATION, CONFIG_MESH_PS_NWK_DUTY_RULE));
     #endif
+    // The device duty cycle above is only the starting point: once we have a parent, mesh_ps raises it while
+    // there is traffic and lowers it again when the node goes idle (menuconfig: MESH_PS_AUTO)
+    ESP_ERROR_CHECK(mesh_ps_init());
 
     ESP_LOGI(MESH_TAG, "mesh starts successfully, heap:%" PRId32 ", %s<%d>%s, ps:%d",  esp_get_minimum_free_heap_size(),
             esp_mesh_is_root_fixed() ? "root fixed" : "root not fixed",
             esp_mesh_get_topology(), esp_mesh_get_topology() ? "(chain)":"(tree)", esp_mesh_is_ps_enabled());
+    mesh_prof_mark(MESH_PROF_APP_MAIN_DONE);
 
 
 
 
 }
-
-// I assume this is the sign needed to handle the IP event callback. The code is self explainatory
-void ip_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data) {
-    ip_event_got_ip_t *event = (ip_event_got_ip_t *) event_data;
-    ESP_LOGI(IP_TAG, "<IP_EVENT_STA_GOT_IP>IP:" IPSTR, IP2STR(&event->ip_info.ip));
-
-}
-
-
-void mesh_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data) {
-    mesh_addr_t id = {0,};
-    static uint16_t last_layer = 0;
-    //Turning on the LED if i'm root
-    if (esp_mesh_is_root())
-        mesh_light_set(MESH_LIGHT_ON);
-    else
-        mesh_light_set(MESH_LIGHT_OFF);
-
-
-    switch (event_id) {
-        case MESH_EVENT_STARTED: {
-            esp_mesh_get_id(&id);
-            ESP_LOGI(MESH_TAG, "<MESH_EVENT_MESH_STARTED>ID:"MACSTR"", MAC2STR(id.addr));
-            is_mesh_connected = false;
-            mesh_layer = esp_mesh_get_layer();
-        }
-        break;
-        case MESH_EVENT_STOPPED: {
-            ESP_LOGI(MESH_TAG, "<MESH_EVENT_STOPPED>");
-            is_mesh_connected = false;
-            mesh_layer = esp_mesh_get_layer();
-        }
-        break;
-        case MESH_EVENT_CHILD_CONNECTED: {
-            printf("CHILD CONNECTED\n");
-            mesh_event_child_connected_t *child_connected = (mesh_event_child_connected_t *)event_data;
-            ESP_LOGI(MESH_TAG, "<MESH_EVENT_CHILD_CONNECTED>aid:%d, "MACSTR"",
-            child_connected->aid,
-            MAC2STR(child_connected->mac));
-        }
-        break;
-        case MESH_EVENT_CHILD_DISCONNECTED: {
-            mesh_event_child_disconnected_t *child_disconnected = (mesh_event_child_disconnected_t *)event_data;
-            ESP_LOGI(MESH_TAG, "<MESH_EVENT_CHILD_DISCONNECTED>aid:%d, "MACSTR"",
-            child_disconnected->aid,
-            MAC2STR(child_disconnected->mac));
-        }
-        break;
-        case MESH_EVENT_ROUTING_TABLE_ADD: {
-            mesh_event_routing_table_change_t *routing_table = (mesh_event_routing_table_change_t *)event_data;
-            ESP_LOGW(MESH_TAG, "<MESH_EVENT_ROUTING_TABLE_ADD>add %d, new:%d, layer:%d",
-            routing_table->rt_size_change,
-            routing_table->rt_size_new, mesh_layer);
-        }
-        break;
-        case MESH_EVENT_ROUTING_TABLE_REMOVE: {
-            mesh_event_routing_table_change_t *routing_table = (mesh_event_routing_table_change_t *)event_data;
-            ESP_LOGW(MESH_TAG, "<MESH_EVENT_ROUTING_TABLE_REMOVE>remove %d, new:%d, layer:%d",
-            routing_table->rt_size_change,
-            routing_table->rt_size_new, mesh_layer);
-        }
-        break;
-        case MESH_EVENT_NO_PARENT_FOUND: {
-            mesh_event_no_parent_found_t *no_parent = (mesh_event_no_parent_found_t *)event_data;
-            ESP_LOGI(MESH_TAG, "<MESH_EVENT_NO_PARENT_FOUND>scan times:%d",
-            no_parent->scan_times);
-        }
-        /* TODO handler for the failure */
-        break;
-        // TODO: uncomment last line?
-        case MESH_EVENT_PARENT_CONNECTED: {
-            mesh_event_connected_t *connected = (mesh_event_connected_t *)event_data;
-            esp_mesh_get_id(&id);
-            mesh_layer = connected->self_layer;
-            memcpy(&mesh_parent_addr.addr, connected->connected.bssid, 6);
-            ESP_LOGI(MESH_TAG,
-            "<MESH_EVENT_PARENT_CONNECTED>layer:%d-->%d, parent:"MACSTR"%s, ID:"MACSTR", duty:%d",
-            last_layer, mesh_layer, MAC2STR(mesh_parent_addr.addr),
-            esp_mesh_is_root() ? "<ROOT>" :
-            (mesh_layer == 2) ? "<layer2>" : "", MAC2STR(id.addr), connected->duty);
-            last_layer = mesh_layer;
-            mesh_connected_indicator(mesh_layer);
-            is_mesh_connected = true;
-            if (esp_mesh_is_root()) {
-                esp_netif_dhcpc_stop(netif_sta);
-                esp_netif_dhcpc_start(netif_sta);
-            }
-            //esp_mesh_comm_p2p_start();
-        }
-        break;
-        case MESH_EVENT_PARENT_DISCONNECTED: {
-            mesh_event_disconnected_t *disconnected = (mesh_event_disconnected_t *)event_data;
-            ESP_LOGI(MESH_TAG,
-            "<MESH_EVENT_PARENT_DISCONNECTED>reason:%d",
-            disconnected->reason);
-            is_mesh_connected = false;
-            mesh_disconnected_indicator();
-            mesh_layer = esp_mesh_get_layer();
-            }
-        break;
-        case MESH_EVENT_LAYER_CHANGE: {
-            mesh_event_layer_change_t *layer_change = (mesh_event_layer_change_t *)event_data;
-            mesh_layer = layer_change->new_layer;
-            ESP_LOGI(MESH_TAG, "<MESH_EVENT_LAYER_CHANGE>layer:%d-->%d%s",
-            last_layer, mesh_layer,
-            esp_mesh_is_root() ? "<ROOT>" :
-            (mesh_layer == 2) ? "<layer2>" : "");
-            last_layer = mesh_layer;
-            mesh_connected_indicator(mesh_layer);
-        }
-        break;
-        case MESH_EVENT_ROOT_ADDRESS: {
-            mesh_event_root_address_t *root_addr = (mesh_event_root_address_t *)event_data;
-            ESP_LOGI(MESH_TAG, "<MESH_EVENT_ROOT_ADDRESS>root address:"MACSTR"",
-            MAC2STR(root_addr->addr));
-        }
-        break;
-        case MESH_EVENT_VOTE_STARTED: {
-            printf("Started vote\n");
-            mesh_event_vote_started_t *vote_started = (mesh_event_vote_started_t *)event_data;
-            ESP_LOGI(MESH_TAG,
-            "<MESH_EVENT_VOTE_STARTED>attempts:%d, reason:%d, rc_addr:"MACSTR"",
-            vote_started->attempts,
-            vote_started->reason,
-            MAC2STR(vote_started->rc_addr.addr));
-        }
-        break;
-        case MESH_EVENT_VOTE_STOPPED: {
-            ESP_LOGI(MESH_TAG, "<MESH_EVENT_VOTE_STOPPED>");
-            break;
-        }
-        case MESH_EVENT_ROOT_SWITCH_REQ: {
-            mesh_event_root_switch_req_t *switch_req = (mesh_event_root_switch_req_t *)event_data;
-            ESP_LOGI(MESH_TAG,
-            "<MESH_EVENT_ROOT_SWITCH_REQ>reason:%d, rc_addr:"MACSTR"",
-            switch_req->reason,
-            MAC2STR( switch_req->rc_addr.addr));
-        }
-        break;
-        case MESH_EVENT_ROOT_SWITCH_ACK: {
-            /* new root */
-            printf("New root\n");
-            mesh_layer = esp_mesh_get_layer();
-            esp_mesh_get_parent_bssid(&mesh_parent_addr);
-            ESP_LOGI(MESH_TAG, "<MESH_EVENT_ROOT_SWITCH_ACK>layer:%d, parent:"MACSTR"", mesh_layer, MAC2STR(mesh_parent_addr.addr));
-        }
-        break;
-        case MESH_EVENT_TODS_STATE: {
-            mesh_event_toDS_state_t *toDs_state = (mesh_event_toDS_state_t *)event_data;
-            ESP_LOGI(MESH_TAG, "<MESH_EVENT_TODS_REACHABLE>state:%d", *toDs_state);
-        }
-        break;
-        case MESH_EVENT_ROOT_FIXED: {
-            printf("Root fixed\n");
-            mesh_event_root_fixed_t *root_fixed = (mesh_event_root_fixed_t *)event_data;
-            ESP_LOGI(MESH_TAG, "<MESH_EVENT_ROOT_FIXED>%s",
-            root_fixed->is_fixed ? "fixed" : "not fixed");
-        }
-        break;
-        case MESH_EVENT_ROOT_ASKED_YIELD: {
-            mesh_event_root_conflict_t *root_conflict = (mesh_event_root_conflict_t *)event_data;
-            ESP_LOGI(MESH_TAG,
-            "<MESH_EVENT_ROOT_ASKED_YIELD>"MACSTR", rssi:%d, capacity:%d",
-            MAC2STR(root_conflict->addr),
-            root_conflict->rssi,
-            root_conflict->capacity);
-        }
-        break;
-        case MESH_EVENT_CHANNEL_SWITCH: {
-            mesh_event_channel_switch_t *channel_switch = (mesh_event_channel_switch_t *)event_data;
-            ESP_LOGI(MESH_TAG, "<MESH_EVENT_CHANNEL_SWITCH>new channel:%d", channel_switch->channel);
-        }
-        break;
-            case MESH_EVENT_SCAN_DONE: {
-            mesh_event_scan_done_t *scan_done = (mesh_event_scan_done_t *)event_data;
-            ESP_LOGI(MESH_TAG, "<MESH_EVENT_SCAN_DONE>number:%d",
-            scan_done->number);
-        }
-        break;
-        case MESH_EVENT_NETWORK_STATE: {
-            mesh_event_network_state_t *network_state = (mesh_event_network_state_t *)event_data;
-            ESP_LOGI(MESH_TAG, "<MESH_EVENT_NETWORK_STATE>is_rootless:%d",
-            network_state->is_rootless);
-        }
-        break;
-            case MESH_EVENT_STOP_RECONNECTION: {
-            ESP_LOGI(MESH_TAG, "<MESH_EVENT_STOP_RECONNECTION>");
-        }
-        break;
-        case MESH_EVENT_FIND_NETWORK: {
-            mesh_event_find_network_t *find_network = (mesh_event_find_network_t *)event_data;
-            ESP_LOGI(MESH_TAG, "<MESH_EVENT_FIND_NETWORK>new channel:%d, router BSSID:"MACSTR"",
-            find_network->channel, MAC2STR(find_network->router_bssid));
-        }
-        break;
-        case MESH_EVENT_ROUTER_SWITCH: {
-            mesh_event_router_switch_t *router_switch = (mesh_event_router_switch_t *)event_data;
-            ESP_LOGI(MESH_TAG, "<MESH_EVENT_ROUTER_SWITCH>new router:%s, channel:%d, "MACSTR"",
-            router_switch->ssid, router_switch->channel, MAC2STR(router_switch->bssid));
-        }
-        break;
-        case MESH_EVENT_PS_PARENT_DUTY: {
-            mesh_event_ps_duty_t *ps_duty = (mesh_event_ps_duty_t *)event_data;
-            ESP_LOGI(MESH_TAG, "<MESH_EVENT_PS_PARENT_DUTY>duty:%d", ps_duty->duty);
-        }
-        break;
-        case MESH_EVENT_PS_CHILD_DUTY: {
-            mesh_event_ps_duty_t *ps_duty = (mesh_event_ps_duty_t *)event_data;
-            ESP_LOGI(MESH_TAG, "<MESH_EVENT_PS_CHILD_DUTY>cidx:%d, "MACSTR", duty:%d", ps_duty->child_connected.aid-1,
-            MAC2STR(ps_duty->child_connected.mac), ps_duty->duty);
-        }
-        break;
-        default:
-            ESP_LOGI(MESH_TAG, "unknown id:%" PRId32 "", event_id);
-        break;
-        }
-}
\ No newline at end of file
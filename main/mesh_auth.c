@@ -0,0 +1,323 @@
+/* Mesh Message Authentication
+
+   Tags are HMAC-SHA256 over the sender address and the message,
+   truncated to MESH_AUTH_TAG_LEN bytes. The key is SHA-256 of
+   CONFIG_MESH_AUTH_KEY; at boot the two HMAC pads are hashed once and
+   the resulting SHA-256 states kept, so a tag costs two short hash runs
+   from a cloned state instead of four blocks of key schedule. mbedtls
+   uses the SHA accelerator whenever the hardware lets it.
+
+   Every signed message carries a nonce: the sender's boot counter, bumped
+   in NVS at every boot, and a counter of messages signed since then.
+   Receivers keep, per sender, the newest nonce seen and a bitmap of the
+   MESH_AUTH_WINDOW nonces below it, so a message is accepted once even
+   if the mesh reorders it, and never again.
+
+   The window table holds CONFIG_MESH_AUTH_MAX_SENDERS senders. A sender
+   pushed out of it leaves its newest nonce behind as a floor, in a table
+   of MAC and nonce sized to the routing table, and nonces at or below
+   the floor stay refused. Otherwise frames recorded from 16 other senders
+   would be enough to push a node out and replay its old frames. A sender
+   that comes back takes its window up from the floor, so only the frames
+   still in flight when it was pushed out are lost. Once there are more
+   senders than both tables hold, the oldest floor is dropped: that is
+   more senders than one mesh can have.
+*/
+
+#include <string.h>
+#include <inttypes.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_cpu.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "nvs.h"
+#include "mbedtls/sha256.h"
+#include "mesh_auth.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define MESH_AUTH_NVS_NAMESPACE     "mesh_auth"
+#define MESH_AUTH_NVS_KEY           "boot"
+#define MESH_AUTH_BLOCK             (64)    /* SHA-256 block size */
+#define MESH_AUTH_HASH              (32)
+#define MESH_AUTH_FLOORS            (CONFIG_MESH_ROUTE_TABLE_SIZE)
+
+/*******************************************************
+ *                Structures
+ *******************************************************/
+typedef struct {
+    bool used;
+    uint8_t mac[6];
+    int64_t last_us;        /* for LRU replacement */
+    uint64_t top;           /* newest nonce, boot << 32 | counter */
+    uint64_t bitmap;        /* bit i set: top - i was seen */
+} mesh_auth_sender_t;
+
+/* What is left of a sender pushed out of s_senders */
+typedef struct {
+    bool used;
+    uint8_t mac[6];
+    uint64_t top;           /* this nonce and every one below it are refused */
+} mesh_auth_floor_t;
+
+/*******************************************************
+ *                Variable Definitions
+ *******************************************************/
+static const char *AUTH_TAG = "mesh_auth";
+
+static mbedtls_sha256_context s_inner;      /* after key ^ ipad, read only once initialized */
+static mbedtls_sha256_context s_outer;      /* after key ^ opad */
+static uint16_t s_boot = 0;
+static uint32_t s_counter = 0;
+static mesh_auth_sender_t s_senders[CONFIG_MESH_AUTH_MAX_SENDERS];
+static mesh_auth_floor_t s_floors[MESH_AUTH_FLOORS];
+static int s_floor_next = 0;                /* oldest floor, overwritten first */
+static mesh_auth_stats_t s_stats;
+static portMUX_TYPE s_auth_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+static void mesh_auth_hmac(const uint8_t src[6], const uint8_t *msg, uint16_t len, uint8_t out[MESH_AUTH_HASH])
+{
+    mbedtls_sha256_context ctx;
+    uint8_t inner[MESH_AUTH_HASH];
+
+    mbedtls_sha256_init(&ctx);
+    mbedtls_sha256_clone(&ctx, &s_inner);
+    mbedtls_sha256_update(&ctx, src, 6);
+    mbedtls_sha256_update(&ctx, msg, len);
+    mbedtls_sha256_finish(&ctx, inner);
+    mbedtls_sha256_clone(&ctx, &s_outer);
+    mbedtls_sha256_update(&ctx, inner, sizeof(inner));
+    mbedtls_sha256_finish(&ctx, out);
+    mbedtls_sha256_free(&ctx);
+}
+
+/* Must hold s_auth_lock */
+static mesh_auth_floor_t *mesh_auth_floor_find(const uint8_t mac[6])
+{
+    for (int i = 0; i < MESH_AUTH_FLOORS; i++) {
+        if (s_floors[i].used && memcmp(s_floors[i].mac, mac, 6) == 0) {
+            return &s_floors[i];
+        }
+    }
+    return NULL;
+}
+
+/* Must hold s_auth_lock */
+static mesh_auth_sender_t *mesh_auth_find(const uint8_t mac[6], bool create)
+{
+    mesh_auth_sender_t *victim = &s_senders[0];
+    for (int i = 0; i < CONFIG_MESH_AUTH_MAX_SENDERS; i++) {
+        mesh_auth_sender_t *s = &s_senders[i];
+        if (s->used && memcmp(s->mac, mac, 6) == 0) {
+            return s;
+        }
+        if (victim->used && (!s->used || s->last_us < victim->last_us)) {
+            victim = s;
+        }
+    }
+    if (!create) {
+        return NULL;
+    }
+    if (victim->used) {
+        mesh_auth_floor_t *f = &s_floors[s_floor_next];
+        s_floor_next = (s_floor_next + 1) % MESH_AUTH_FLOORS;
+        f->used = true;
+        memcpy(f->mac, victim->mac, 6);
+        f->top = victim->top;
+        s_stats.evicted++;
+    }
+    memset(victim, 0, sizeof(mesh_auth_sender_t));
+    memcpy(victim->mac, mac, 6);
+    mesh_auth_floor_t *f = mesh_auth_floor_find(mac);
+    if (f) {
+        /* back from the floor: everything up to it counts as seen */
+        victim->used = true;
+        victim->top = f->top;
+        victim->bitmap = UINT64_MAX;
+        f->used = false;
+    }
+    return victim;
+}
+
+/* Must hold s_auth_lock */
+static bool mesh_auth_fresh(const uint8_t mac[6], const mesh_auth_sender_t *s, uint64_t nonce)
+{
+    if (!s || !s->used) {
+        const mesh_auth_floor_t *f = mesh_auth_floor_find(mac);
+        return !f || nonce > f->top;
+    }
+    if (nonce > s->top) {
+        return true;
+    }
+    uint64_t d = s->top - nonce;
+    return d < MESH_AUTH_WINDOW && !(s->bitmap & (1ULL << d));
+}
+
+/* Must hold s_auth_lock */
+static void mesh_auth_accept(mesh_auth_sender_t *s, uint64_t nonce)
+{
+    if (!s->used) {
+        s->used = true;
+        s->top = nonce;
+        s->bitmap = 1;
+    } else if (nonce > s->top) {
+        uint64_t shift = nonce - s->top;
+        s->bitmap = shift >= MESH_AUTH_WINDOW ? 0 : s->bitmap << shift;
+        s->bitmap |= 1;
+        s->top = nonce;
+    } else {
+        s->bitmap |= 1ULL << (s->top - nonce);
+    }
+}
+
+void mesh_auth_next_nonce(mesh_auth_nonce_t *nonce)
+{
+    portENTER_CRITICAL(&s_auth_lock);
+    nonce->boot = s_boot;
+    nonce->counter = s_counter++;
+    portEXIT_CRITICAL(&s_auth_lock);
+}
+
+void mesh_auth_sign(const uint8_t src[6], const uint8_t *msg, uint16_t len, uint8_t tag[MESH_AUTH_TAG_LEN])
+{
+    uint8_t mac[MESH_AUTH_HASH];
+    mesh_auth_hmac(src, msg, len, mac);
+    memcpy(tag, mac, MESH_AUTH_TAG_LEN);
+    portENTER_CRITICAL(&s_auth_lock);
+    s_stats.signed_msgs++;
+    portEXIT_CRITICAL(&s_auth_lock);
+}
+
+esp_err_t mesh_auth_verify(const uint8_t src[6], const uint8_t *msg, uint16_t len,
+                           const uint8_t tag[MESH_AUTH_TAG_LEN], const mesh_auth_nonce_t *nonce)
+{
+    uint64_t n = ((uint64_t) nonce->boot << 32) | nonce->counter;
+    uint8_t mac[MESH_AUTH_HASH];
+    uint8_t diff = 0;
+    bool fresh;
+    esp_cpu_cycle_count_t start = esp_cpu_get_cycle_count();
+
+    /* the cheap check first: replays never cost a hash */
+    portENTER_CRITICAL(&s_auth_lock);
+    fresh = mesh_auth_fresh(src, mesh_auth_find(src, false), n);
+    if (!fresh) {
+        s_stats.replays++;
+    }
+    portEXIT_CRITICAL(&s_auth_lock);
+    if (!fresh) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    mesh_auth_hmac(src, msg, len, mac);
+    /* constant time, so a forger learns nothing from how long the check takes */
+    for (int i = 0; i < MESH_AUTH_TAG_LEN; i++) {
+        diff |= mac[i] ^ tag[i];
+    }
+    uint32_t cycles = esp_cpu_get_cycle_count() - start;
+
+    esp_err_t err = ESP_OK;
+    portENTER_CRITICAL(&s_auth_lock);
+    s_stats.verify_cycles_total += cycles;
+    if (cycles > s_stats.verify_cycles_max) {
+        s_stats.verify_cycles_max = cycles;
+    }
+    if (diff) {
+        s_stats.bad_tags++;
+        err = ESP_ERR_INVALID_MAC;
+    } else {
+        /* checked again: the same message may have been verified meanwhile on the other core */
+        mesh_auth_sender_t *s = mesh_auth_find(src, true);
+        if (mesh_auth_fresh(src, s, n)) {
+            mesh_auth_accept(s, n);
+            s->last_us = esp_timer_get_time();
+            s_stats.verified++;
+        } else {
+            s_stats.replays++;
+            err = ESP_ERR_INVALID_STATE;
+        }
+    }
+    portEXIT_CRITICAL(&s_auth_lock);
+    return err;
+}
+
+void mesh_auth_bench(int iterations)
+{
+    static const uint8_t src[6] = { 0x24, 0x0a, 0xc4, 0x00, 0x00, 0x01 };
+    uint8_t frame[32] = { 0 };
+    uint8_t tag[MESH_AUTH_TAG_LEN];
+    uint8_t mac[MESH_AUTH_HASH];
+    uint8_t diff = 0;
+
+    if (iterations <= 0) {
+        return;
+    }
+    mesh_auth_sign(src, frame, sizeof(frame), tag);
+    int64_t start_us = esp_timer_get_time();
+    esp_cpu_cycle_count_t start = esp_cpu_get_cycle_count();
+    for (int i = 0; i < iterations; i++) {
+        /* what mesh_auth_verify() spends on a fresh message, without touching the replay windows */
+        mesh_auth_hmac(src, frame, sizeof(frame), mac);
+        for (int j = 0; j < MESH_AUTH_TAG_LEN; j++) {
+            diff |= mac[j] ^ tag[j];
+        }
+    }
+    uint32_t cycles = esp_cpu_get_cycle_count() - start;
+    int64_t took_us = esp_timer_get_time() - start_us;
+    ESP_LOGI(AUTH_TAG, "%d verifies of a %d byte frame: %" PRIu32 " cycles, %" PRId64 " ns each%s",
+             iterations, (int) sizeof(frame), cycles / iterations, took_us * 1000 / iterations,
+             diff ? " (tag mismatch!)" : "");
+}
+
+void mesh_auth_get_stats(mesh_auth_stats_t *stats)
+{
+    portENTER_CRITICAL(&s_auth_lock);
+    memcpy(stats, &s_stats, sizeof(mesh_auth_stats_t));
+    portEXIT_CRITICAL(&s_auth_lock);
+}
+
+esp_err_t mesh_auth_init(void)
+{
+    uint8_t key[MESH_AUTH_HASH];
+    uint8_t pad[MESH_AUTH_BLOCK];
+    nvs_handle_t nvs;
+
+    /* any passphrase length: the HMAC key is its hash */
+    mbedtls_sha256((const unsigned char *) CONFIG_MESH_AUTH_KEY, strlen(CONFIG_MESH_AUTH_KEY), key, 0);
+    mbedtls_sha256_init(&s_inner);
+    mbedtls_sha256_init(&s_outer);
+    memset(pad, 0x36, sizeof(pad));
+    for (int i = 0; i < MESH_AUTH_HASH; i++) {
+        pad[i] ^= key[i];
+    }
+    mbedtls_sha256_starts(&s_inner, 0);
+    mbedtls_sha256_update(&s_inner, pad, sizeof(pad));
+    memset(pad, 0x5c, sizeof(pad));
+    for (int i = 0; i < MESH_AUTH_HASH; i++) {
+        pad[i] ^= key[i];
+    }
+    mbedtls_sha256_starts(&s_outer, 0);
+    mbedtls_sha256_update(&s_outer, pad, sizeof(pad));
+    memset(key, 0, sizeof(key));
+    memset(pad, 0, sizeof(pad));
+
+    /* a new boot counter, so that our nonces never repeat across reboots */
+    esp_err_t err = nvs_open(MESH_AUTH_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err != ESP_OK) {
+        return err;
+    }
+    nvs_get_u16(nvs, MESH_AUTH_NVS_KEY, &s_boot);
+    s_boot++;
+    err = nvs_set_u16(nvs, MESH_AUTH_NVS_KEY, s_boot);
+    if (err == ESP_OK) {
+        err = nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+    ESP_LOGI(AUTH_TAG, "boot %u", s_boot);
+    return err;
+}
@@ -0,0 +1,388 @@
+/* Mesh Backup Parents
+
+   When a parent goes away ESP-MESH scans every channel again before it
+   picks a new one, and the whole subtree below waits for it. Here every
+   node keeps the best CONFIG_MESH_BACKUP_MAX parents it has seen in
+   recent scans, ranked by RSSI, free child slots and layer; on
+   PARENT_DISCONNECTED it asks for the best one with esp_mesh_set_parent()
+   and moves down the list on every miss (NO_PARENT_FOUND or
+   CONFIG_MESH_BACKUP_TIMEOUT_MS). Only when the list is used up does it
+   go back to the normal self-organized scan.
+
+   The list is refreshed every CONFIG_MESH_BACKUP_SCAN_PERIOD_S with a
+   passive scan of the current channel. ESP-MESH only lets the
+   application scan with self-organized networking off, so it is turned
+   off for the scan and back on (keeping the parent) at SCAN_DONE.
+   Nodes of our own subtree are never candidates: picking one would
+   close a loop. The same scan sees the router's beacons, whose RSSI
+   goes to mesh_vote.
+*/
+
+#include <string.h>
+#include <inttypes.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_mesh.h"
+#include "esp_mesh_internal.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "freertos/FreeRTOS.h"
+#include "mesh_rejoin.h"
+#include "mesh_route.h"
+#include "mesh_vote.h"
+#include "mesh_backup.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define MESH_BACKUP_MAX             (CONFIG_MESH_BACKUP_MAX)
+#define MESH_BACKUP_MAX_AGE_US      (CONFIG_MESH_BACKUP_MAX_AGE_S * 1000000LL)
+#define MESH_BACKUP_TIMEOUT_US      (CONFIG_MESH_BACKUP_TIMEOUT_MS * 1000ULL)
+/* score weights: 2 per dB over -100 dBm, 8 per free child slot, minus 16 per layer of the candidate */
+#define MESH_BACKUP_W_RSSI          (2)
+#define MESH_BACKUP_W_SLOT          (8)
+#define MESH_BACKUP_W_LAYER         (16)
+
+/*******************************************************
+ *                Variable Definitions
+ *******************************************************/
+static const char *BACKUP_TAG = "mesh_backup";
+
+static mesh_backup_candidate_t s_cands[MESH_BACKUP_MAX];   /* best first */
+static int s_count = 0;
+static mesh_backup_stats_t s_stats;
+static uint8_t s_self_ap[6];
+static bool s_scanning = false;             /* our refresh scan, self-organized is off */
+static bool s_failover = false;             /* walking the list after a parent loss */
+static int s_next = 0;                      /* next candidate to try */
+static uint8_t s_trying[6];
+static int64_t s_disconnected_us = 0;       /* 0 while connected */
+static portMUX_TYPE s_backup_lock = portMUX_INITIALIZER_UNLOCKED;
+static esp_timer_handle_t s_scan_timer = NULL;
+static esp_timer_handle_t s_timeout_timer = NULL;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+/* Must hold s_backup_lock */
+static void mesh_backup_remove(int i)
+{
+    memmove(&s_cands[i], &s_cands[i + 1], (s_count - i - 1) * sizeof(mesh_backup_candidate_t));
+    s_count--;
+}
+
+/* Must hold s_backup_lock */
+static void mesh_backup_expire(int64_t now)
+{
+    for (int i = s_count - 1; i >= 0; i--) {
+        if (now - s_cands[i].seen_us > MESH_BACKUP_MAX_AGE_US) {
+            mesh_backup_remove(i);
+        }
+    }
+}
+
+/* Must hold s_backup_lock */
+static void mesh_backup_insert(const mesh_backup_candidate_t *cand)
+{
+    for (int i = 0; i < s_count; i++) {
+        if (memcmp(s_cands[i].bssid, cand->bssid, 6) == 0) {
+            mesh_backup_remove(i);
+            break;
+        }
+    }
+    int pos = s_count;
+    while (pos > 0 && s_cands[pos - 1].score < cand->score) {
+        pos--;
+    }
+    if (pos >= MESH_BACKUP_MAX) {
+        return;
+    }
+    int moved = (s_count < MESH_BACKUP_MAX ? s_count : MESH_BACKUP_MAX - 1) - pos;
+    memmove(&s_cands[pos + 1], &s_cands[pos], moved * sizeof(mesh_backup_candidate_t));
+    s_cands[pos] = *cand;
+    if (s_count < MESH_BACKUP_MAX) {
+        s_count++;
+    }
+}
+
+static bool mesh_backup_eligible(const wifi_ap_record_t *record, const mesh_assoc_t *assoc, const mesh_addr_t *id)
+{
+    uint8_t sta[6];
+
+    if (memcmp(assoc->mesh_id, id->addr, 6) != 0 || assoc->mesh_type == MESH_IDLE
+            || !assoc->layer_cap || assoc->assoc >= assoc->assoc_cap
+            || record->rssi < CONFIG_MESH_BACKUP_MIN_RSSI || memcmp(record->bssid, s_self_ap, 6) == 0) {
+        return false;
+    }
+    /* the routing table holds STA addresses, the softAP is STA + 1 */
+    memcpy(sta, record->bssid, 6);
+    for (int i = 5; i >= 0; i--) {
+        if (sta[i]-- != 0) {
+            break;
+        }
+    }
+    return !mesh_route_contains(sta);
+}
+
+void mesh_backup_on_scan_done(int number)
+{
+    wifi_ap_record_t record;
+    mesh_assoc_t assoc;
+    mesh_addr_t id;
+    int ie_len = 0;
+    int64_t now = esp_timer_get_time();
+    bool resume;
+
+    esp_mesh_get_id(&id);
+    for (int i = 0; i < number; i++) {
+        esp_mesh_scan_get_ap_ie_len(&ie_len);
+        if (esp_mesh_scan_get_ap_record(&record, &assoc) != ESP_OK) {
+            break;
+        }
+        if (ie_len != sizeof(assoc)) {
+            /* not a mesh node: if it is our router, root candidates are scored from it */
+            if (strcmp((const char *) record.ssid, CONFIG_MESH_ROUTER_SSID) == 0) {
+                mesh_vote_on_router_rssi(record.rssi);
+            }
+            continue;
+        }
+        if (!mesh_backup_eligible(&record, &assoc, &id)) {
+            continue;
+        }
+        mesh_backup_candidate_t cand = {
+            .channel = record.primary,
+            .layer = assoc.layer,
+            .rssi = record.rssi,
+            .free_slots = assoc.assoc_cap - assoc.assoc,
+            .seen_us = now,
+        };
+        memcpy(cand.bssid, record.bssid, 6);
+        cand.score = MESH_BACKUP_W_RSSI * (record.rssi + 100) + MESH_BACKUP_W_SLOT * cand.free_slots
+                     - MESH_BACKUP_W_LAYER * assoc.layer;
+        portENTER_CRITICAL(&s_backup_lock);
+        mesh_backup_insert(&cand);
+        portEXIT_CRITICAL(&s_backup_lock);
+    }
+    esp_mesh_flush_scan_result();
+
+    portENTER_CRITICAL(&s_backup_lock);
+    mesh_backup_expire(now);
+    s_stats.scans++;
+    resume = s_scanning && !s_failover;
+    s_scanning = false;
+    portEXIT_CRITICAL(&s_backup_lock);
+    if (resume) {
+        /* self-organized again, but keep the parent we have */
+        esp_mesh_set_self_organized(true, false);
+    }
+    ESP_LOGD(BACKUP_TAG, "%d APs scanned, %d backups", number, s_count);
+}
+
+static void mesh_backup_scan(void *arg)
+{
+    uint8_t channel = 0;
+    wifi_second_chan_t second;
+
+    if (esp_mesh_is_root()) {
+        return;
+    }
+    portENTER_CRITICAL(&s_backup_lock);
+    bool busy = s_scanning || s_failover || s_disconnected_us;
+    if (!busy) {
+        s_scanning = true;
+    }
+    portEXIT_CRITICAL(&s_backup_lock);
+    if (busy) {
+        return;
+    }
+    esp_wifi_get_channel(&channel, &second);
+    wifi_scan_config_t scan = {
+        .channel = channel,
+        .show_hidden = true,
+        .scan_type = WIFI_SCAN_TYPE_PASSIVE,
+    };
+    esp_mesh_set_self_organized(false, false);
+    esp_err_t err = esp_wifi_scan_start(&scan, false);
+    if (err != ESP_OK) {
+        ESP_LOGW(BACKUP_TAG, "scan failed:0x%x", err);
+        portENTER_CRITICAL(&s_backup_lock);
+        s_scanning = false;
+        portEXIT_CRITICAL(&s_backup_lock);
+        esp_mesh_set_self_organized(true, false);
+    }
+}
+
+static void mesh_backup_try_next(void)
+{
+    mesh_backup_candidate_t cand;
+    bool found = false;
+
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&s_backup_lock);
+    /* skip stale entries rather than expire them, s_next indexes the list */
+    while (s_next < s_count && now - s_cands[s_next].seen_us > MESH_BACKUP_MAX_AGE_US) {
+        s_next++;
+    }
+    if (s_failover && s_next < s_count) {
+        cand = s_cands[s_next++];
+        memcpy(s_trying, cand.bssid, 6);
+        found = true;
+    } else if (s_failover) {
+        s_failover = false;
+        s_stats.fallbacks++;
+    }
+    portEXIT_CRITICAL(&s_backup_lock);
+
+    if (found && mesh_rejoin_try_parent(cand.bssid, cand.channel, cand.layer + 1) == ESP_OK) {
+        ESP_LOGI(BACKUP_TAG, "trying backup "MACSTR", layer:%d, rssi:%d", MAC2STR(cand.bssid), cand.layer, cand.rssi);
+        esp_timer_stop(s_timeout_timer);
+        esp_timer_start_once(s_timeout_timer, MESH_BACKUP_TIMEOUT_US);
+        return;
+    }
+    if (found) {
+        /* not even accepted by the driver, go on with the next one */
+        mesh_backup_try_next();
+        return;
+    }
+    ESP_LOGW(BACKUP_TAG, "no backup left, scanning");
+    esp_mesh_set_self_organized(true, true);
+}
+
+static void mesh_backup_timeout(void *arg)
+{
+    portENTER_CRITICAL(&s_backup_lock);
+    bool miss = s_failover;
+    if (miss) {
+        s_stats.backup_misses++;
+    }
+    portEXIT_CRITICAL(&s_backup_lock);
+    if (miss) {
+        mesh_backup_try_next();
+    }
+}
+
+void mesh_backup_on_no_parent(void)
+{
+    esp_timer_stop(s_timeout_timer);
+    mesh_backup_timeout(NULL);
+}
+
+void mesh_backup_on_parent_disconnected(const mesh_event_disconnected_t *disconnected)
+{
+    bool scanning;
+    bool failover = false;
+
+    portENTER_CRITICAL(&s_backup_lock);
+    if (!s_disconnected_us) {
+        s_disconnected_us = esp_timer_get_time();
+    }
+    scanning = s_scanning;
+    s_scanning = false;
+    /* the parent we just lost is no backup */
+    for (int i = 0; i < s_count; i++) {
+        if (memcmp(s_cands[i].bssid, disconnected->bssid, 6) == 0) {
+            mesh_backup_remove(i);
+            break;
+        }
+    }
+#ifdef CONFIG_MESH_BACKUP
+    /* the root's parent is the router: nothing to fail over to */
+    if (!s_failover && s_count && esp_mesh_get_layer() != MESH_ROOT_LAYER) {
+        s_failover = true;
+        s_next = 0;
+        s_stats.failovers++;
+        failover = true;
+    }
+#endif
+    portEXIT_CRITICAL(&s_backup_lock);
+
+    if (scanning) {
+        esp_wifi_scan_stop();
+        if (!failover) {
+            esp_mesh_set_self_organized(true, true);
+        }
+    }
+    if (failover) {
+        mesh_backup_try_next();
+    }
+}
+
+void mesh_backup_on_parent_connected(const mesh_event_connected_t *connected)
+{
+    bool failover;
+    uint32_t took = 0;
+
+    esp_timer_stop(s_timeout_timer);
+    portENTER_CRITICAL(&s_backup_lock);
+    failover = s_failover;
+    if (failover && memcmp(connected->connected.bssid, s_trying, 6) == 0) {
+        s_stats.backup_hits++;
+    }
+    s_failover = false;
+    if (s_disconnected_us) {
+        took = (uint32_t)(esp_timer_get_time() - s_disconnected_us);
+        s_stats.reconnects++;
+        s_stats.reconnect_us_last = took;
+        s_stats.reconnect_us_total += took;
+        if (took > s_stats.reconnect_us_max) {
+            s_stats.reconnect_us_max = took;
+        }
+        s_disconnected_us = 0;
+    }
+    portEXIT_CRITICAL(&s_backup_lock);
+
+    if (failover) {
+        /* esp_mesh_set_parent() turned self-organized off: back on, keeping this parent */
+        esp_mesh_set_self_organized(true, false);
+    }
+    if (took) {
+        ESP_LOGI(BACKUP_TAG, "reconnected to "MACSTR" in %" PRIu32 " ms (%s)", MAC2STR(connected->connected.bssid),
+                 took / 1000, failover ? "backup" : "scan");
+    }
+}
+
+int mesh_backup_get_candidates(mesh_backup_candidate_t *candidates, int max)
+{
+    portENTER_CRITICAL(&s_backup_lock);
+    int n = s_count < max ? s_count : max;
+    memcpy(candidates, s_cands, n * sizeof(mesh_backup_candidate_t));
+    portEXIT_CRITICAL(&s_backup_lock);
+    return n;
+}
+
+void mesh_backup_get_stats(mesh_backup_stats_t *stats)
+{
+    portENTER_CRITICAL(&s_backup_lock);
+    memcpy(stats, &s_stats, sizeof(mesh_backup_stats_t));
+    portEXIT_CRITICAL(&s_backup_lock);
+}
+
+esp_err_t mesh_backup_init(void)
+{
+    esp_timer_create_args_t scan_args = {
+        .callback = mesh_backup_scan,
+        .name = "mesh_backup",
+    };
+    esp_timer_create_args_t timeout_args = {
+        .callback = mesh_backup_timeout,
+        .name = "mesh_backup_to",
+    };
+    ESP_ERROR_CHECK(esp_read_mac(s_self_ap, ESP_MAC_WIFI_SOFTAP));
+    ESP_ERROR_CHECK(esp_timer_create(&scan_args, &s_scan_timer));
+    ESP_ERROR_CHECK(esp_timer_create(&timeout_args, &s_timeout_timer));
+    return ESP_OK;
+}
+
+esp_err_t mesh_backup_start(void)
+{
+#if defined(CONFIG_MESH_BACKUP) && CONFIG_MESH_BACKUP_SCAN_PERIOD_S > 0
+    if (esp_timer_is_active(s_scan_timer)) {
+        return ESP_OK;
+    }
+    return esp_timer_start_periodic(s_scan_timer, CONFIG_MESH_BACKUP_SCAN_PERIOD_S * 1000000ULL);
+#else
+    return ESP_OK;
+#endif
+}
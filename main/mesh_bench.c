@@ -0,0 +1,478 @@
+/* Mesh Benchmark
+
+   The root announces a run with a START broadcast; from then on every
+   sender sends `rate_pps` packets of `payload` bytes per second for
+   `duration_s` seconds:
+
+   - UPSTREAM: every node but the root, to the root
+   - BROADCAST: the root, to the broadcast address
+   - PEER: every node but the target, to the target
+
+   Receivers count packets and bytes, and echo every
+   CONFIG_MESH_BENCH_ECHO_EVERY-th packet back so the sender can time the
+   round trip on its own clock. After the run plus a drain time every
+   node sends its counters to the root, which logs throughput, loss and
+   RTT percentiles per layer. Loss is what the senders sent minus what
+   the receivers got, so packets the sender could not even queue (no
+   buffer, no credit) are counted apart, as tx_blocked.
+
+   Packets go through mesh_comm like any other traffic, so the numbers
+   include the pool, flow control and the RX/TX tasks.
+*/
+
+#include <string.h>
+#include <inttypes.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_mesh.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "mesh_comm.h"
+#include "mesh_route.h"
+#include "mesh_bench.h"
+
+#ifdef CONFIG_MESH_BENCH_ENABLE
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define MESH_BENCH_DRAIN_US     (2 * 1000000LL)     /* run end to report */
+#define MESH_BENCH_COLLECT_US   (3 * 1000000LL)     /* report to summary, root only */
+#define MESH_BENCH_MIN_TICK_US  (1000)
+#define MESH_BENCH_RTT_SHIFT    (7)                 /* histogram unit: 128 us */
+#define MESH_BENCH_ALLOC_MS     (100)               /* control packets wait this long for a buffer */
+
+/*******************************************************
+ *                Structures
+ *******************************************************/
+typedef struct {
+    uint32_t reports;
+    uint32_t sent[MESH_BENCH_LAYERS];
+    uint32_t nodes[MESH_BENCH_LAYERS];      /* reports per layer, for BROADCAST */
+    uint32_t tx_blocked;
+    uint32_t rx[MESH_BENCH_LAYERS];
+    uint64_t rx_bytes[MESH_BENCH_LAYERS];
+    uint32_t rtt[MESH_BENCH_LAYERS][MESH_BENCH_HIST];
+} mesh_bench_result_t;
+
+/*******************************************************
+ *                Variable Definitions
+ *******************************************************/
+static const char *BENCH_TAG = "mesh_bench";
+static const mesh_addr_t s_broadcast = { .addr = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff } };
+
+static mesh_bench_start_t s_run;            /* current run, run 0 is none */
+static bool s_sending = false;
+static bool s_to_root = false;
+static mesh_addr_t s_dest;
+static int s_burst = 1;                     /* packets per send tick */
+static int64_t s_end_us = 0;                /* sending stops here, the drain time begins */
+static uint32_t s_seq = 0;
+static uint16_t s_next_run = 1;
+static uint8_t s_self[6];
+static mesh_bench_report_t s_report;        /* this node's counters for the current run */
+static mesh_bench_result_t s_result;        /* root: merged reports */
+static mesh_bench_totals_t s_totals;        /* root: the last summary */
+static portMUX_TYPE s_bench_lock = portMUX_INITIALIZER_UNLOCKED;
+static esp_timer_handle_t s_send_timer = NULL;
+static esp_timer_handle_t s_report_timer = NULL;
+static esp_timer_handle_t s_summary_timer = NULL;
+static esp_timer_handle_t s_auto_timer = NULL;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+static int mesh_bench_layer(int layer)
+{
+    return layer < 1 ? 0 : (layer > MESH_BENCH_LAYERS ? MESH_BENCH_LAYERS - 1 : layer - 1);
+}
+
+static uint32_t mesh_bench_percentile(const uint32_t *hist, int pct)
+{
+    uint64_t total = 0;
+    uint64_t seen = 0;
+    for (int b = 0; b < MESH_BENCH_HIST; b++) {
+        total += hist[b];
+    }
+    uint64_t want = (total * pct + 99) / 100;
+    for (int b = 0; b < MESH_BENCH_HIST && total; b++) {
+        seen += hist[b];
+        if (seen >= want) {
+            return (2u << b) << MESH_BENCH_RTT_SHIFT;
+        }
+    }
+    return 0;
+}
+
+static void mesh_bench_send(void *arg)
+{
+    int64_t now = esp_timer_get_time();
+    uint32_t sent = 0;
+    uint32_t blocked = 0;
+
+    if (now >= s_end_us) {
+        esp_timer_stop(s_send_timer);
+        s_sending = false;
+        return;
+    }
+    for (int i = 0; i < s_burst; i++) {
+        uint8_t *buf = mesh_comm_alloc(0);
+        if (!buf) {
+            blocked++;
+            continue;
+        }
+        mesh_bench_data_t *pkt = (mesh_bench_data_t *) buf;
+        pkt->hdr.type = MESH_MSG_TYPE_BENCH;
+        pkt->hdr.op = MESH_BENCH_OP_DATA;
+        pkt->hdr.run = s_run.hdr.run;
+        pkt->layer = esp_mesh_get_layer();
+        pkt->seq = s_seq++;
+        pkt->sent_us = (uint32_t) now;
+        if (mesh_comm_send(s_to_root ? NULL : &s_dest, buf, s_run.payload, MESH_DATA_P2P) == ESP_OK) {
+            sent++;
+        } else {
+            blocked++;
+        }
+    }
+    portENTER_CRITICAL(&s_bench_lock);
+    s_report.sent += sent;
+    s_report.tx_blocked += blocked;
+    portEXIT_CRITICAL(&s_bench_lock);
+}
+
+/* Root only */
+static void mesh_bench_merge(const mesh_bench_report_t *in)
+{
+    int layer = mesh_bench_layer(in->layer);
+
+    portENTER_CRITICAL(&s_bench_lock);
+    s_result.reports++;
+    s_result.sent[layer] += in->sent;
+    s_result.nodes[layer]++;
+    s_result.tx_blocked += in->tx_blocked;
+    for (int l = 0; l < MESH_BENCH_LAYERS; l++) {
+        s_result.rx[l] += in->rx[l];
+        s_result.rx_bytes[l] += in->rx_bytes[l];
+        for (int b = 0; b < MESH_BENCH_HIST; b++) {
+            s_result.rtt[l][b] += in->rtt[l][b];
+        }
+    }
+    portEXIT_CRITICAL(&s_bench_lock);
+}
+
+static void mesh_bench_report(void *arg)
+{
+    esp_timer_stop(s_send_timer);
+    s_sending = false;
+    if (esp_mesh_is_root()) {
+        static mesh_bench_report_t own;
+        portENTER_CRITICAL(&s_bench_lock);
+        memcpy(&own, &s_report, sizeof(mesh_bench_report_t));
+        portEXIT_CRITICAL(&s_bench_lock);
+        mesh_bench_merge(&own);
+        return;
+    }
+    uint8_t *buf = mesh_comm_alloc(MESH_BENCH_ALLOC_MS);
+    if (!buf) {
+        ESP_LOGW(BENCH_TAG, "no buffer for the report of run %u", s_run.hdr.run);
+        return;
+    }
+    portENTER_CRITICAL(&s_bench_lock);
+    memcpy(buf, &s_report, sizeof(mesh_bench_report_t));
+    portEXIT_CRITICAL(&s_bench_lock);
+    mesh_comm_send(NULL, buf, sizeof(mesh_bench_report_t), MESH_DATA_P2P);
+}
+
+static void mesh_bench_summary(void *arg)
+{
+    static mesh_bench_result_t r;
+    static const char *modes[] = { "upstream", "broadcast", "peer" };
+    mesh_bench_totals_t totals = { 0 };
+    uint32_t root_sent = 0;
+
+    portENTER_CRITICAL(&s_bench_lock);
+    memcpy(&r, &s_result, sizeof(mesh_bench_result_t));
+    portEXIT_CRITICAL(&s_bench_lock);
+
+    if (s_run.mode == MESH_BENCH_BROADCAST) {
+        /* only the root sent: every node at a layer should have got all of it */
+        root_sent = r.sent[0];
+    }
+    ESP_LOGI(BENCH_TAG, "run %u %s, %u B at %u pps for %u s: %" PRIu32 " reports, %" PRIu32 " blocked at the senders",
+             s_run.hdr.run, modes[s_run.mode], s_run.payload, s_run.rate_pps, s_run.duration_s,
+             r.reports, r.tx_blocked);
+    for (int l = 0; l < MESH_BENCH_LAYERS; l++) {
+        uint32_t expected = s_run.mode == MESH_BENCH_BROADCAST ? (l ? root_sent * r.nodes[l] : 0) : r.sent[l];
+        if (!expected && !r.rx[l]) {
+            continue;
+        }
+        uint32_t lost = expected > r.rx[l] ? expected - r.rx[l] : 0;
+        totals.expected += expected;
+        totals.rx += r.rx[l];
+        ESP_LOGI(BENCH_TAG, "layer %d%s: sent:%" PRIu32 " rx:%" PRIu32 " loss:%" PRIu32 ".%" PRIu32 "%% %" PRIu32 " kbit/s"
+                 " rtt p50:%" PRIu32 " p90:%" PRIu32 " p99:%" PRIu32 " us",
+                 l + 1, l == MESH_BENCH_LAYERS - 1 ? "+" : "", expected, r.rx[l],
+                 expected ? lost * 100 / expected : 0, expected ? lost * 1000 / expected % 10 : 0,
+                 (uint32_t)(r.rx_bytes[l] * 8 / 1000 / s_run.duration_s),
+                 mesh_bench_percentile(r.rtt[l], 50), mesh_bench_percentile(r.rtt[l], 90),
+                 mesh_bench_percentile(r.rtt[l], 99));
+    }
+
+    totals.run = s_run.hdr.run;
+    totals.reports = r.reports;
+    totals.tx_blocked = r.tx_blocked;
+    portENTER_CRITICAL(&s_bench_lock);
+    s_totals = totals;
+    portEXIT_CRITICAL(&s_bench_lock);
+}
+
+static void mesh_bench_begin(const mesh_bench_start_t *start)
+{
+    esp_timer_stop(s_send_timer);
+    esp_timer_stop(s_report_timer);
+    esp_timer_stop(s_summary_timer);
+
+    bool is_root = esp_mesh_is_root();
+    bool is_target = memcmp(start->target, s_self, 6) == 0;
+    uint64_t tick_us = 1000000ULL / start->rate_pps;
+    if (tick_us < MESH_BENCH_MIN_TICK_US) {
+        tick_us = MESH_BENCH_MIN_TICK_US;
+    }
+
+    portENTER_CRITICAL(&s_bench_lock);
+    s_run = *start;
+    memset(&s_report, 0, sizeof(s_report));
+    memset(&s_result, 0, sizeof(s_result));
+    s_report.hdr.type = MESH_MSG_TYPE_BENCH;
+    s_report.hdr.op = MESH_BENCH_OP_REPORT;
+    s_report.hdr.run = start->hdr.run;
+    s_report.layer = esp_mesh_get_layer();
+    s_seq = 0;
+    s_burst = (start->rate_pps * tick_us + 999999) / 1000000;
+    s_to_root = start->mode == MESH_BENCH_UPSTREAM;
+    s_dest = start->mode == MESH_BENCH_BROADCAST ? s_broadcast : (mesh_addr_t) { 0 };
+    if (start->mode == MESH_BENCH_PEER) {
+        memcpy(s_dest.addr, start->target, 6);
+    }
+    s_sending = (start->mode == MESH_BENCH_UPSTREAM && !is_root)
+                || (start->mode == MESH_BENCH_BROADCAST && is_root)
+                || (start->mode == MESH_BENCH_PEER && !is_target);
+    portEXIT_CRITICAL(&s_bench_lock);
+
+    int64_t run_us = start->duration_s * 1000000LL;
+    s_end_us = esp_timer_get_time() + run_us;
+    if (s_sending) {
+        esp_timer_start_periodic(s_send_timer, tick_us);
+    }
+    /* the report timer also stops the sender, should a send tick be late */
+    esp_timer_start_once(s_report_timer, run_us + MESH_BENCH_DRAIN_US);
+    if (is_root) {
+        esp_timer_start_once(s_summary_timer, run_us + MESH_BENCH_DRAIN_US + MESH_BENCH_COLLECT_US);
+    }
+}
+
+static void mesh_bench_on_data(mesh_addr_t *from, const mesh_bench_data_t *pkt, uint16_t len)
+{
+    int own = esp_mesh_get_layer();
+    int key = mesh_bench_layer(s_run.mode == MESH_BENCH_BROADCAST ? own : pkt->layer);
+
+    portENTER_CRITICAL(&s_bench_lock);
+    s_report.rx[key]++;
+    s_report.rx_bytes[key] += len;
+    portEXIT_CRITICAL(&s_bench_lock);
+
+    if (pkt->seq % CONFIG_MESH_BENCH_ECHO_EVERY) {
+        return;
+    }
+    uint8_t *buf = mesh_comm_alloc(0);
+    if (!buf) {
+        return;
+    }
+    mesh_bench_data_t *echo = (mesh_bench_data_t *) buf;
+    memcpy(echo, pkt, sizeof(mesh_bench_data_t));
+    echo->hdr.op = MESH_BENCH_OP_ECHO;
+    echo->layer = own;
+    mesh_comm_send(from, buf, sizeof(mesh_bench_data_t), MESH_DATA_P2P);
+}
+
+static void mesh_bench_on_echo(const mesh_bench_data_t *echo)
+{
+    uint32_t rtt = ((uint32_t) esp_timer_get_time() - echo->sent_us) >> MESH_BENCH_RTT_SHIFT;
+    int key = mesh_bench_layer(s_run.mode == MESH_BENCH_BROADCAST ? echo->layer : esp_mesh_get_layer());
+    int b = 0;
+    while (b < MESH_BENCH_HIST - 1 && (rtt >> (b + 1))) {
+        b++;
+    }
+    portENTER_CRITICAL(&s_bench_lock);
+    if (s_report.rtt[key][b] < UINT16_MAX) {
+        s_report.rtt[key][b]++;
+    }
+    portEXIT_CRITICAL(&s_bench_lock);
+}
+
+static esp_err_t mesh_bench_process(mesh_addr_t *from, uint8_t *buf, uint16_t len)
+{
+    const mesh_bench_hdr_t *hdr = (const mesh_bench_hdr_t *) buf;
+    if (len < sizeof(mesh_bench_hdr_t)) {
+        return ESP_FAIL;
+    }
+    switch (hdr->op) {
+    case MESH_BENCH_OP_START:
+        if (len < sizeof(mesh_bench_start_t) || hdr->run == s_run.hdr.run || esp_mesh_is_root()) {
+            return ESP_OK;
+        }
+        mesh_bench_begin((const mesh_bench_start_t *) buf);
+        return ESP_OK;
+    case MESH_BENCH_OP_DATA:
+        if (len >= sizeof(mesh_bench_data_t) && hdr->run == s_run.hdr.run) {
+            mesh_bench_on_data(from, (const mesh_bench_data_t *) buf, len);
+        }
+        return ESP_OK;
+    case MESH_BENCH_OP_ECHO:
+        if (len >= sizeof(mesh_bench_data_t) && hdr->run == s_run.hdr.run) {
+            mesh_bench_on_echo((const mesh_bench_data_t *) buf);
+        }
+        return ESP_OK;
+    case MESH_BENCH_OP_REPORT:
+        if (len >= sizeof(mesh_bench_report_t) && hdr->run == s_run.hdr.run && esp_mesh_is_root()) {
+            mesh_bench_merge((const mesh_bench_report_t *) buf);
+        }
+        return ESP_OK;
+    default:
+        return ESP_FAIL;
+    }
+}
+
+esp_err_t mesh_bench_run(mesh_bench_mode_t mode, const uint8_t target[6], uint16_t payload,
+                         uint16_t rate_pps, uint16_t duration_s)
+{
+    if (!esp_mesh_is_root()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (mode > MESH_BENCH_PEER || (mode == MESH_BENCH_PEER && !target) || !rate_pps || !duration_s
+            || payload < sizeof(mesh_bench_data_t) || payload > MESH_COMM_BUF_SIZE) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    mesh_bench_start_t start = {
+        .hdr = {
+            .type = MESH_MSG_TYPE_BENCH,
+            .op = MESH_BENCH_OP_START,
+            .run = s_next_run++,
+        },
+        .mode = mode,
+        .payload = payload,
+        .rate_pps = rate_pps,
+        .duration_s = duration_s,
+    };
+    if (target) {
+        memcpy(start.target, target, 6);
+    }
+    uint8_t *buf = mesh_comm_alloc(MESH_BENCH_ALLOC_MS);
+    if (!buf) {
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(buf, &start, sizeof(start));
+    esp_err_t err = mesh_comm_send(&s_broadcast, buf, sizeof(start), MESH_DATA_P2P);
+    if (err != ESP_OK) {
+        return err;
+    }
+    ESP_LOGI(BENCH_TAG, "run %u started", start.hdr.run);
+    mesh_bench_begin(&start);
+    return ESP_OK;
+}
+
+static void mesh_bench_auto(void *arg)
+{
+    static mesh_addr_t table[MESH_ROUTE_MAX];
+    uint8_t target[6] = { 0 };
+    uint32_t generation = 0;
+    int count = 0;
+
+    if (!esp_mesh_is_root()) {
+        return;
+    }
+    if (CONFIG_MESH_BENCH_MODE == MESH_BENCH_PEER) {
+        /* the last node of the table other than ourselves */
+        mesh_route_snapshot(table, MESH_ROUTE_MAX, &count, &generation);
+        for (int i = count - 1; i >= 0; i--) {
+            if (memcmp(table[i].addr, s_self, 6) != 0) {
+                memcpy(target, table[i].addr, 6);
+                break;
+            }
+        }
+    }
+    mesh_bench_run(CONFIG_MESH_BENCH_MODE, target, CONFIG_MESH_BENCH_PAYLOAD,
+                   CONFIG_MESH_BENCH_RATE_PPS, CONFIG_MESH_BENCH_DURATION_S);
+}
+
+esp_err_t mesh_bench_init(void)
+{
+    esp_timer_create_args_t send_args = {
+        .callback = mesh_bench_send,
+        .name = "bench_send",
+    };
+    esp_timer_create_args_t report_args = {
+        .callback = mesh_bench_report,
+        .name = "bench_report",
+    };
+    esp_timer_create_args_t summary_args = {
+        .callback = mesh_bench_summary,
+        .name = "bench_summary",
+    };
+    esp_timer_create_args_t auto_args = {
+        .callback = mesh_bench_auto,
+        .name = "bench_auto",
+    };
+    ESP_ERROR_CHECK(esp_read_mac(s_self, ESP_MAC_WIFI_STA));
+    ESP_ERROR_CHECK(esp_timer_create(&send_args, &s_send_timer));
+    ESP_ERROR_CHECK(esp_timer_create(&report_args, &s_report_timer));
+    ESP_ERROR_CHECK(esp_timer_create(&summary_args, &s_summary_timer));
+    ESP_ERROR_CHECK(esp_timer_create(&auto_args, &s_auto_timer));
+    return mesh_comm_register_handler(MESH_MSG_TYPE_BENCH, mesh_bench_process);
+}
+
+esp_err_t mesh_bench_start(void)
+{
+#if CONFIG_MESH_BENCH_AUTO_START_S > 0
+    if (!esp_mesh_is_root() || esp_timer_is_active(s_auto_timer)) {
+        return ESP_OK;
+    }
+    return esp_timer_start_once(s_auto_timer, CONFIG_MESH_BENCH_AUTO_START_S * 1000000ULL);
+#else
+    return ESP_OK;
+#endif
+}
+
+void mesh_bench_get_totals(mesh_bench_totals_t *totals)
+{
+    portENTER_CRITICAL(&s_bench_lock);
+    memcpy(totals, &s_totals, sizeof(mesh_bench_totals_t));
+    portEXIT_CRITICAL(&s_bench_lock);
+}
+
+#else /* CONFIG_MESH_BENCH_ENABLE */
+
+/* Benchmark not built in */
+esp_err_t mesh_bench_init(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t mesh_bench_run(mesh_bench_mode_t mode, const uint8_t target[6], uint16_t payload,
+                         uint16_t rate_pps, uint16_t duration_s)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t mesh_bench_start(void)
+{
+    return ESP_OK;
+}
+
+void mesh_bench_get_totals(mesh_bench_totals_t *totals)
+{
+    memset(totals, 0, sizeof(mesh_bench_totals_t));
+}
+
+#endif /* CONFIG_MESH_BENCH_ENABLE */
@@ -0,0 +1,400 @@
+/* Mesh Data Plane
+
+   Every packet lives in one of CONFIG_MESH_COMM_POOL_SIZE static buffers.
+   The RX task receives straight into a pool buffer and hands that same
+   buffer to the handler registered for its message type; the TX task
+   sends pool buffers queued by mesh_comm_send() and puts them back in
+   the pool. Nothing on the data path touches the heap.
+
+   The RX and TX tasks are pinned to CONFIG_MESH_COMM_TASK_CORE. Handlers
+   registered with mesh_comm_register_app_handler() do not run on the RX
+   task: the RX task pushes the buffer into a lock-free SPSC ring and the
+   app task, pinned to CONFIG_MESH_APP_TASK_CORE, runs the handler and
+   recycles the buffer, so slow application work never holds up the
+   radio.
+
+   Messages carried inside another one (mesh_comm_dispatch()) follow the
+   same rule: their handler runs on the task it was registered for. A
+   copy reaches the app task through the ring when the RX task dispatches
+   it, and through a small queue when any other task does, since the ring
+   has room for one producer only.
+*/
+
+#include <string.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_mesh.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "mesh_comm.h"
+#include "mesh_flow.h"
+#include "mesh_ring.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define MESH_COMM_POOL_SIZE     (CONFIG_MESH_COMM_POOL_SIZE)
+#define MESH_COMM_TX_QUEUE_LEN  (CONFIG_MESH_COMM_TX_QUEUE_LEN)
+#define MESH_COMM_TASK_CORE     (CONFIG_MESH_COMM_TASK_CORE)
+#define MESH_COMM_TASK_STACK    (3072)
+#define MESH_COMM_TASK_PRIO     (5)
+#define MESH_APP_RING_LEN       (CONFIG_MESH_APP_RING_LEN)
+#define MESH_APP_TASK_CORE      (CONFIG_MESH_APP_TASK_CORE)
+#define MESH_APP_TASK_STACK     (4096)
+#define MESH_APP_TASK_PRIO      (4)
+#define MESH_DISPATCH_QUEUE_LEN (4)
+
+_Static_assert((MESH_APP_RING_LEN & (MESH_APP_RING_LEN - 1)) == 0, "MESH_APP_RING_LEN must be a power of two");
+
+/*******************************************************
+ *                Structures
+ *******************************************************/
+typedef struct {
+    mesh_addr_t to;
+    bool to_root;
+    uint8_t *buf;
+    uint16_t len;
+    int flag;
+    int64_t queued_us;
+} mesh_comm_tx_t;
+
+typedef struct {
+    mesh_addr_t from;
+    uint8_t *buf;
+    uint16_t len;
+    mesh_comm_handler_t handler;
+    int64_t queued_us;
+} mesh_comm_app_t;
+
+/*******************************************************
+ *                Variable Definitions
+ *******************************************************/
+static const char *COMM_TAG = "mesh_comm";
+
+static uint8_t s_pool[MESH_COMM_POOL_SIZE][MESH_COMM_BUF_SIZE] __attribute__((aligned(4)));
+static QueueHandle_t s_free_queue = NULL;
+static QueueHandle_t s_tx_queue = NULL;
+static mesh_comm_handler_t s_handlers[MESH_MSG_TYPE_MAX];
+static uint32_t s_app_types = 0;    /* bit n set: type n runs on the app task */
+static mesh_comm_app_t s_app_slots[MESH_APP_RING_LEN];
+static mesh_ring_t s_app_ring;      /* RX task to app task */
+static TaskHandle_t s_app_task = NULL;
+static TaskHandle_t s_rx_task = NULL;
+static QueueHandle_t s_dispatch_queue = NULL;  /* other tasks to app task */
+static mesh_comm_stats_t s_stats;  /* written from every task that sends or receives */
+static portMUX_TYPE s_comm_lock = portMUX_INITIALIZER_UNLOCKED;
+static bool s_comm_started = false;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+uint8_t *mesh_comm_alloc(uint32_t timeout_ms)
+{
+    uint8_t *buf = NULL;
+    TickType_t wait = (timeout_ms == portMAX_DELAY) ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms);
+    if (xQueueReceive(s_free_queue, &buf, wait) != pdTRUE) {
+        portENTER_CRITICAL(&s_comm_lock);
+        s_stats.pool_exhausted++;
+        portEXIT_CRITICAL(&s_comm_lock);
+        return NULL;
+    }
+    UBaseType_t free_bufs = uxQueueMessagesWaiting(s_free_queue);
+    portENTER_CRITICAL(&s_comm_lock);
+    if (free_bufs < s_stats.pool_min_free) {
+        s_stats.pool_min_free = free_bufs;
+    }
+    portEXIT_CRITICAL(&s_comm_lock);
+    return buf;
+}
+
+void mesh_comm_free(uint8_t *buf)
+{
+    if (buf) {
+        xQueueSend(s_free_queue, &buf, 0);
+    }
+}
+
+esp_err_t mesh_comm_send(const mesh_addr_t *to, uint8_t *buf, uint16_t len, int flag)
+{
+    if (!buf || len == 0 || len > MESH_COMM_BUF_SIZE) {
+        mesh_comm_free(buf);
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!mesh_flow_tx_admit(to)) {
+        /* out of credits towards the parent */
+        mesh_comm_free(buf);
+        return ESP_ERR_NO_MEM;
+    }
+    mesh_comm_tx_t tx = {
+        .to_root = (to == NULL),
+        .buf = buf,
+        .len = len,
+        .flag = flag,
+        .queued_us = esp_timer_get_time(),
+    };
+    if (to) {
+        memcpy(&tx.to, to, sizeof(mesh_addr_t));
+    }
+    if (xQueueSend(s_tx_queue, &tx, 0) != pdTRUE) {
+        portENTER_CRITICAL(&s_comm_lock);
+        s_stats.tx_errors++;
+        portEXIT_CRITICAL(&s_comm_lock);
+        mesh_comm_free(buf);
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t mesh_comm_register_handler(uint8_t type, mesh_comm_handler_t handler)
+{
+    if (type >= MESH_MSG_TYPE_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    s_handlers[type] = handler;
+    s_app_types &= ~(1UL << type);
+    return ESP_OK;
+}
+
+esp_err_t mesh_comm_register_app_handler(uint8_t type, mesh_comm_handler_t handler)
+{
+    if (type >= MESH_MSG_TYPE_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    s_handlers[type] = handler;
+    s_app_types |= 1UL << type;
+    return ESP_OK;
+}
+
+void mesh_comm_get_stats(mesh_comm_stats_t *stats)
+{
+    portENTER_CRITICAL(&s_comm_lock);
+    memcpy(stats, &s_stats, sizeof(mesh_comm_stats_t));
+    portEXIT_CRITICAL(&s_comm_lock);
+    stats->app_dropped = s_app_ring.full;
+    stats->app_ring_high_water = s_app_ring.high_water;
+}
+
+esp_err_t mesh_comm_dispatch(mesh_addr_t *from, uint8_t *buf, uint16_t len)
+{
+    mesh_comm_handler_t handler = (len && buf[0] < MESH_MSG_TYPE_MAX) ? s_handlers[buf[0]] : NULL;
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    bool queued;
+
+    if (!handler) {
+        portENTER_CRITICAL(&s_comm_lock);
+        s_stats.rx_unhandled++;
+        portEXIT_CRITICAL(&s_comm_lock);
+        return ESP_ERR_NOT_FOUND;
+    }
+    bool app = s_app_types & (1UL << buf[0]);
+    if (app ? self == s_app_task : self == s_rx_task) {
+        return handler(from, buf, len);
+    }
+    if (!app) {
+        /* RX task handlers keep their state unlocked: they never run anywhere else */
+        portENTER_CRITICAL(&s_comm_lock);
+        s_stats.dispatch_refused++;
+        portEXIT_CRITICAL(&s_comm_lock);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    /* `buf` is part of the outer message, which is recycled once its handler returns */
+    uint8_t *copy = mesh_comm_alloc(0);
+    if (!copy) {
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(copy, buf, len);
+    mesh_comm_app_t item = {
+        .from = *from,
+        .buf = copy,
+        .len = len,
+        .handler = handler,
+        .queued_us = esp_timer_get_time(),
+    };
+    if (self == s_rx_task) {
+        queued = mesh_ring_push(&s_app_ring, &item);
+    } else {
+        queued = xQueueSend(s_dispatch_queue, &item, 0) == pdTRUE;
+    }
+    if (!queued) {
+        mesh_comm_free(copy);
+        return ESP_ERR_NO_MEM;
+    }
+    xTaskNotifyGive(s_app_task);
+    return ESP_OK;
+}
+
+esp_err_t mesh_comm_get_parent(mesh_addr_t *parent)
+{
+    if (esp_mesh_is_root() || esp_mesh_get_parent_bssid(parent) != ESP_OK) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    /* The parent BSSID is its softAP MAC, which on ESP32 is the STA MAC + 1,
+     * while mesh addresses are STA MACs. */
+    for (int i = 5; i >= 0; i--) {
+        if (parent->addr[i]-- != 0) {
+            break;
+        }
+    }
+    return ESP_OK;
+}
+
+static void mesh_comm_rx_task(void *arg)
+{
+    mesh_addr_t from;
+    mesh_data_t data;
+    int flag = 0;
+
+    while (true) {
+        uint8_t *buf = mesh_comm_alloc(portMAX_DELAY);
+        if (!buf) {
+            continue;
+        }
+        data.data = buf;
+        data.size = MESH_COMM_BUF_SIZE;
+        esp_err_t err = esp_mesh_recv(&from, &data, portMAX_DELAY, &flag, NULL, 0);
+        if (err != ESP_OK || data.size == 0) {
+            portENTER_CRITICAL(&s_comm_lock);
+            s_stats.rx_errors++;
+            portEXIT_CRITICAL(&s_comm_lock);
+            ESP_LOGW(COMM_TAG, "recv err:0x%x, size:%d", err, data.size);
+            mesh_comm_free(buf);
+            continue;
+        }
+        portENTER_CRITICAL(&s_comm_lock);
+        s_stats.rx_packets++;
+        portEXIT_CRITICAL(&s_comm_lock);
+        if (!mesh_flow_rx_admit(&from)) {
+            portENTER_CRITICAL(&s_comm_lock);
+            s_stats.rx_dropped++;
+            portEXIT_CRITICAL(&s_comm_lock);
+            mesh_comm_free(buf);
+            continue;
+        }
+        mesh_comm_handler_t handler = buf[0] < MESH_MSG_TYPE_MAX ? s_handlers[buf[0]] : NULL;
+        if (handler && (s_app_types & (1UL << buf[0]))) {
+            mesh_comm_app_t item = {
+                .from = from,
+                .buf = buf,
+                .len = data.size,
+                .handler = handler,
+                .queued_us = esp_timer_get_time(),
+            };
+            if (mesh_ring_push(&s_app_ring, &item)) {
+                /* the app task frees it */
+                xTaskNotifyGive(s_app_task);
+                continue;
+            }
+        } else if (handler) {
+            handler(&from, buf, data.size);
+        } else {
+            portENTER_CRITICAL(&s_comm_lock);
+            s_stats.rx_unhandled++;
+            portEXIT_CRITICAL(&s_comm_lock);
+        }
+        mesh_comm_free(buf);
+    }
+}
+
+static void mesh_comm_tx_task(void *arg)
+{
+    mesh_comm_tx_t tx;
+    mesh_data_t data = {
+        .proto = MESH_PROTO_BIN,
+        .tos = MESH_TOS_P2P,
+    };
+
+    while (true) {
+        if (xQueueReceive(s_tx_queue, &tx, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+        uint32_t wait_us = (uint32_t)(esp_timer_get_time() - tx.queued_us);
+        data.data = tx.buf;
+        data.size = tx.len;
+        esp_err_t err = esp_mesh_send(tx.to_root ? NULL : &tx.to, &data, tx.flag, NULL, 0);
+        portENTER_CRITICAL(&s_comm_lock);
+        s_stats.tx_wait_us_total += wait_us;
+        if (wait_us > s_stats.tx_wait_us_max) {
+            s_stats.tx_wait_us_max = wait_us;
+        }
+        if (err == ESP_OK) {
+            s_stats.tx_packets++;
+        } else {
+            s_stats.tx_errors++;
+        }
+        portEXIT_CRITICAL(&s_comm_lock);
+        if (err != ESP_OK) {
+            ESP_LOGW(COMM_TAG, "send err:0x%x, type:0x%02x", err, tx.buf[0]);
+        }
+        mesh_comm_free(tx.buf);
+    }
+}
+
+static void mesh_comm_app_run(mesh_comm_app_t *item)
+{
+    uint32_t latency_us = (uint32_t)(esp_timer_get_time() - item->queued_us);
+    portENTER_CRITICAL(&s_comm_lock);
+    s_stats.app_packets++;
+    s_stats.app_latency_us_total += latency_us;
+    if (latency_us > s_stats.app_latency_us_max) {
+        s_stats.app_latency_us_max = latency_us;
+    }
+    portEXIT_CRITICAL(&s_comm_lock);
+    item->handler(&item->from, item->buf, item->len);
+    mesh_comm_free(item->buf);
+}
+
+static void mesh_comm_app_task(void *arg)
+{
+    mesh_comm_app_t item;
+
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        while (mesh_ring_pop(&s_app_ring, &item)) {
+            mesh_comm_app_run(&item);
+        }
+        while (xQueueReceive(s_dispatch_queue, &item, 0) == pdTRUE) {
+            mesh_comm_app_run(&item);
+        }
+    }
+}
+
+esp_err_t mesh_comm_init(void)
+{
+    if (s_free_queue) {
+        return ESP_OK;
+    }
+    s_free_queue = xQueueCreate(MESH_COMM_POOL_SIZE, sizeof(uint8_t *));
+    s_tx_queue = xQueueCreate(MESH_COMM_TX_QUEUE_LEN, sizeof(mesh_comm_tx_t));
+    s_dispatch_queue = xQueueCreate(MESH_DISPATCH_QUEUE_LEN, sizeof(mesh_comm_app_t));
+    if (!s_free_queue || !s_tx_queue || !s_dispatch_queue) {
+        return ESP_ERR_NO_MEM;
+    }
+    for (int i = 0; i < MESH_COMM_POOL_SIZE; i++) {
+        uint8_t *buf = s_pool[i];
+        xQueueSend(s_free_queue, &buf, 0);
+    }
+    s_stats.pool_min_free = MESH_COMM_POOL_SIZE;
+    mesh_ring_init(&s_app_ring, s_app_slots, sizeof(mesh_comm_app_t), MESH_APP_RING_LEN);
+    return ESP_OK;
+}
+
+esp_err_t mesh_comm_start(void)
+{
+    if (s_comm_started) {
+        return ESP_OK;
+    }
+    if (!s_free_queue) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    s_comm_started = true;
+    /* the consumer first, the RX task notifies it */
+    xTaskCreatePinnedToCore(mesh_comm_app_task, "mesh_app", MESH_APP_TASK_STACK, NULL,
+                            MESH_APP_TASK_PRIO, &s_app_task, MESH_APP_TASK_CORE);
+    xTaskCreatePinnedToCore(mesh_comm_rx_task, "mesh_rx", MESH_COMM_TASK_STACK, NULL,
+                            MESH_COMM_TASK_PRIO, &s_rx_task, MESH_COMM_TASK_CORE);
+    xTaskCreatePinnedToCore(mesh_comm_tx_task, "mesh_tx", MESH_COMM_TASK_STACK, NULL,
+                            MESH_COMM_TASK_PRIO, NULL, MESH_COMM_TASK_CORE);
+    return ESP_OK;
+}
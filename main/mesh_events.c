@@ -0,0 +1,305 @@
+/* Mesh Event Handlers
+
+   The handlers app_main() registers. Every mesh event is recorded by
+   mesh_trace first, then drives the LEDs and the modules that follow the
+   mesh state: routing table, flow control, rejoin, backup parents, vote,
+   gateway and the data plane, which starts once we have a parent.
+
+   What the handler tracks (layer, parent, connected) is in the
+   mesh_events_state_t it gets as `arg`, and the node itself is only
+   asked through esp_mesh_is_root() and esp_mesh_get_layer(), so the same
+   code runs in tools/mesh_sim once per simulated node.
+*/
+
+#include <string.h>
+#include <inttypes.h>
+#include "esp_err.h"
+#include "esp_event.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_mesh.h"
+#include "esp_netif.h"
+#include "mesh_events.h"
+#include "mesh_light.h"
+#include "mesh_comm.h"
+#include "mesh_route.h"
+#include "mesh_rejoin.h"
+#include "mesh_prof.h"
+#include "mesh_telemetry.h"
+#include "mesh_flow.h"
+#include "mesh_trace.h"
+#include "mesh_ps.h"
+#include "mesh_vote.h"
+#include "mesh_gateway.h"
+#include "mesh_xfer.h"
+#include "mesh_ping.h"
+#include "mesh_backup.h"
+#include "mesh_bench.h"
+#include "mesh_time.h"
+#include "mesh_shard.h"
+
+/*******************************************************
+ *                Variable Definitions
+ *******************************************************/
+// Used in debug print
+static const char *MESH_TAG = "mesh_main";
+static const char *IP_TAG = "wifi_ip";
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+// I assume this is the sign needed to handle the IP event callback. The code is self explainatory
+void ip_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data) {
+    ip_event_got_ip_t *event = (ip_event_got_ip_t *) event_data;
+    mesh_trace_event(event_base, event_id, event_data);
+    ESP_LOGD(IP_TAG, "<IP_EVENT_STA_GOT_IP>IP:" IPSTR, IP2STR(&event->ip_info.ip));
+    // Only the root gets an IP, so for the root this is the last startup phase
+    mesh_prof_mark(MESH_PROF_GOT_IP);
+    mesh_prof_emit();
+    // We are the root and we have an IP: open the connection to the gateway server
+    mesh_gateway_start();
+
+}
+
+
+void mesh_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data) {
+    mesh_addr_t id = {0,};
+    mesh_events_state_t *state = (mesh_events_state_t *) arg;
+
+    // Record the raw event first: this is cheap (no formatting), the logs below are debug only
+    mesh_trace_event(event_base, event_id, event_data);
+
+    //The LEDs show the color of our layer (the root is the layer 1 color), so they only change when the
+    //layer does: on PARENT_CONNECTED, LAYER_CHANGE and ROOT_SWITCH_ACK, and they go off on PARENT_DISCONNECTED.
+    //Setting them on every event would paint over the layer color with the next event
+
+    switch (event_id) {
+        case MESH_EVENT_STARTED: {
+            esp_mesh_get_id(&id);
+            ESP_LOGD(MESH_TAG, "<MESH_EVENT_MESH_STARTED>ID:"MACSTR"", MAC2STR(id.addr));
+            state->connected = false;
+            state->layer = esp_mesh_get_layer();
+        }
+        break;
+        case MESH_EVENT_STOPPED: {
+            ESP_LOGD(MESH_TAG, "<MESH_EVENT_STOPPED>");
+            state->connected = false;
+            state->layer = esp_mesh_get_layer();
+            mesh_route_clear();
+        }
+        break;
+        case MESH_EVENT_CHILD_CONNECTED: {
+            mesh_event_child_connected_t *child_connected = (mesh_event_child_connected_t *)event_data;
+            ESP_LOGD(MESH_TAG, "<MESH_EVENT_CHILD_CONNECTED>aid:%d, "MACSTR"",
+            child_connected->aid,
+            MAC2STR(child_connected->mac));
+            mesh_flow_child_add(child_connected->mac);
+        }
+        break;
+        case MESH_EVENT_CHILD_DISCONNECTED: {
+            mesh_event_child_disconnected_t *child_disconnected = (mesh_event_child_disconnected_t *)event_data;
+            ESP_LOGD(MESH_TAG, "<MESH_EVENT_CHILD_DISCONNECTED>aid:%d, "MACSTR"",
+            child_disconnected->aid,
+            MAC2STR(child_disconnected->mac));
+            mesh_flow_child_remove(child_disconnected->mac);
+            mesh_ps_on_child_duty(child_disconnected->aid, 0);
+        }
+        break;
+        case MESH_EVENT_ROUTING_TABLE_ADD: {
+            mesh_event_routing_table_change_t *routing_table = (mesh_event_routing_table_change_t *)event_data;
+            ESP_LOGD(MESH_TAG, "<MESH_EVENT_ROUTING_TABLE_ADD>add %d, new:%d, layer:%d",
+            routing_table->rt_size_change,
+            routing_table->rt_size_new, state->layer);
+            mesh_route_update();
+        }
+        break;
+        case MESH_EVENT_ROUTING_TABLE_REMOVE: {
+            mesh_event_routing_table_change_t *routing_table = (mesh_event_routing_table_change_t *)event_data;
+            ESP_LOGD(MESH_TAG, "<MESH_EVENT_ROUTING_TABLE_REMOVE>remove %d, new:%d, layer:%d",
+            routing_table->rt_size_change,
+            routing_table->rt_size_new, state->layer);
+            mesh_route_update();
+        }
+        break;
+        case MESH_EVENT_NO_PARENT_FOUND: {
+            mesh_event_no_parent_found_t *no_parent = (mesh_event_no_parent_found_t *)event_data;
+            ESP_LOGD(MESH_TAG, "<MESH_EVENT_NO_PARENT_FOUND>scan times:%d",
+            no_parent->scan_times);
+            mesh_rejoin_on_no_parent();
+            // a backup parent did not answer either: try the next one, or scan when none is left
+            mesh_backup_on_no_parent();
+        }
+        break;
+        case MESH_EVENT_PARENT_CONNECTED: {
+            mesh_event_connected_t *connected = (mesh_event_connected_t *)event_data;
+            esp_mesh_get_id(&id);
+            state->layer = connected->self_layer;
+            memcpy(&state->parent.addr, connected->connected.bssid, 6);
+            ESP_LOGD(MESH_TAG,
+            "<MESH_EVENT_PARENT_CONNECTED>layer:%d-->%d, parent:"MACSTR"%s, ID:"MACSTR", duty:%d",
+            state->last_layer, state->layer, MAC2STR(state->parent.addr),
+            esp_mesh_is_root() ? "<ROOT>" :
+            (state->layer == 2) ? "<layer2>" : "", MAC2STR(id.addr), connected->duty);
+            state->last_layer = state->layer;
+            mesh_connected_indicator(state->layer);
+            state->connected = true;
+            mesh_rejoin_on_connected(connected);
+            mesh_backup_on_parent_connected(connected);
+            mesh_prof_mark(MESH_PROF_PARENT_CONNECTED);
+            if (esp_mesh_is_root()) {
+                esp_netif_dhcpc_stop(state->netif_sta);
+                esp_netif_dhcpc_start(state->netif_sta);
+            } else {
+                // non-root nodes never get an IP: startup ends here
+                mesh_prof_emit();
+            }
+            mesh_flow_parent_connected();
+            mesh_comm_start();
+            mesh_flow_start();
+            mesh_telemetry_start();
+            mesh_ps_start();
+            mesh_vote_on_parent_connected();
+            mesh_vote_start();
+            mesh_xfer_start();
+            mesh_ping_start();
+            mesh_backup_start();
+            mesh_bench_start();
+            mesh_time_start();
+        }
+        break;
+        case MESH_EVENT_PARENT_DISCONNECTED: {
+            mesh_event_disconnected_t *disconnected = (mesh_event_disconnected_t *)event_data;
+            ESP_LOGD(MESH_TAG,
+            "<MESH_EVENT_PARENT_DISCONNECTED>reason:%d",
+            disconnected->reason);
+            state->connected = false;
+            mesh_disconnected_indicator();
+            mesh_vote_on_parent_disconnected();
+            // go straight to the best backup parent from the last scans instead of scanning again
+            mesh_backup_on_parent_disconnected(disconnected);
+            state->layer = esp_mesh_get_layer();
+            }
+        break;
+        case MESH_EVENT_LAYER_CHANGE: {
+            mesh_event_layer_change_t *layer_change = (mesh_event_layer_change_t *)event_data;
+            state->layer = layer_change->new_layer;
+            ESP_LOGD(MESH_TAG, "<MESH_EVENT_LAYER_CHANGE>layer:%d-->%d%s",
+            state->last_layer, state->layer,
+            esp_mesh_is_root() ? "<ROOT>" :
+            (state->layer == 2) ? "<layer2>" : "");
+            state->last_layer = state->layer;
+            mesh_connected_indicator(state->layer);
+        }
+        break;
+        case MESH_EVENT_ROOT_ADDRESS: {
+            mesh_event_root_address_t *root_addr = (mesh_event_root_address_t *)event_data;
+            ESP_LOGD(MESH_TAG, "<MESH_EVENT_ROOT_ADDRESS>root address:"MACSTR"",
+            MAC2STR(root_addr->addr));
+            mesh_vote_on_root_address(root_addr->addr);
+            mesh_shard_on_root_address(root_addr->addr);
+        }
+        break;
+        case MESH_EVENT_VOTE_STARTED: {
+            mesh_event_vote_started_t *vote_started = (mesh_event_vote_started_t *)event_data;
+            ESP_LOGD(MESH_TAG,
+            "<MESH_EVENT_VOTE_STARTED>attempts:%d, reason:%d, rc_addr:"MACSTR"",
+            vote_started->attempts,
+            vote_started->reason,
+            MAC2STR(vote_started->rc_addr.addr));
+            mesh_vote_on_vote_started();
+        }
+        break;
+        case MESH_EVENT_VOTE_STOPPED: {
+            ESP_LOGD(MESH_TAG, "<MESH_EVENT_VOTE_STOPPED>");
+            break;
+        }
+        case MESH_EVENT_ROOT_SWITCH_REQ: {
+            mesh_event_root_switch_req_t *switch_req = (mesh_event_root_switch_req_t *)event_data;
+            ESP_LOGD(MESH_TAG,
+            "<MESH_EVENT_ROOT_SWITCH_REQ>reason:%d, rc_addr:"MACSTR"",
+            switch_req->reason,
+            MAC2STR( switch_req->rc_addr.addr));
+        }
+        break;
+        case MESH_EVENT_ROOT_SWITCH_ACK: {
+            /* new root */
+            state->layer = esp_mesh_get_layer();
+            esp_mesh_get_parent_bssid(&state->parent);
+            mesh_connected_indicator(state->layer);
+            ESP_LOGD(MESH_TAG, "<MESH_EVENT_ROOT_SWITCH_ACK>layer:%d, parent:"MACSTR"", state->layer, MAC2STR(state->parent.addr));
+        }
+        break;
+        case MESH_EVENT_TODS_STATE: {
+            mesh_event_toDS_state_t *toDs_state = (mesh_event_toDS_state_t *)event_data;
+            ESP_LOGD(MESH_TAG, "<MESH_EVENT_TODS_REACHABLE>state:%d", *toDs_state);
+            mesh_gateway_set_reachable(*toDs_state == MESH_TODS_REACHABLE);
+        }
+        break;
+        case MESH_EVENT_ROOT_FIXED: {
+            mesh_event_root_fixed_t *root_fixed = (mesh_event_root_fixed_t *)event_data;
+            ESP_LOGD(MESH_TAG, "<MESH_EVENT_ROOT_FIXED>%s",
+            root_fixed->is_fixed ? "fixed" : "not fixed");
+        }
+        break;
+        case MESH_EVENT_ROOT_ASKED_YIELD: {
+            mesh_event_root_conflict_t *root_conflict = (mesh_event_root_conflict_t *)event_data;
+            ESP_LOGD(MESH_TAG,
+            "<MESH_EVENT_ROOT_ASKED_YIELD>"MACSTR", rssi:%d, capacity:%d",
+            MAC2STR(root_conflict->addr),
+            root_conflict->rssi,
+            root_conflict->capacity);
+            mesh_vote_on_asked_yield(root_conflict);
+        }
+        break;
+        case MESH_EVENT_CHANNEL_SWITCH: {
+            mesh_event_channel_switch_t *channel_switch = (mesh_event_channel_switch_t *)event_data;
+            ESP_LOGD(MESH_TAG, "<MESH_EVENT_CHANNEL_SWITCH>new channel:%d", channel_switch->channel);
+        }
+        break;
+            case MESH_EVENT_SCAN_DONE: {
+            mesh_event_scan_done_t *scan_done = (mesh_event_scan_done_t *)event_data;
+            ESP_LOGD(MESH_TAG, "<MESH_EVENT_SCAN_DONE>number:%d",
+            scan_done->number);
+            mesh_backup_on_scan_done(scan_done->number);
+        }
+        break;
+        case MESH_EVENT_NETWORK_STATE: {
+            mesh_event_network_state_t *network_state = (mesh_event_network_state_t *)event_data;
+            ESP_LOGD(MESH_TAG, "<MESH_EVENT_NETWORK_STATE>is_rootless:%d",
+            network_state->is_rootless);
+        }
+        break;
+            case MESH_EVENT_STOP_RECONNECTION: {
+            ESP_LOGD(MESH_TAG, "<MESH_EVENT_STOP_RECONNECTION>");
+        }
+        break;
+        case MESH_EVENT_FIND_NETWORK: {
+            mesh_event_find_network_t *find_network = (mesh_event_find_network_t *)event_data;
+            ESP_LOGD(MESH_TAG, "<MESH_EVENT_FIND_NETWORK>new channel:%d, router BSSID:"MACSTR"",
+            find_network->channel, MAC2STR(find_network->router_bssid));
+        }
+        break;
+        case MESH_EVENT_ROUTER_SWITCH: {
+            mesh_event_router_switch_t *router_switch = (mesh_event_router_switch_t *)event_data;
+            ESP_LOGD(MESH_TAG, "<MESH_EVENT_ROUTER_SWITCH>new router:%s, channel:%d, "MACSTR"",
+            router_switch->ssid, router_switch->channel, MAC2STR(router_switch->bssid));
+        }
+        break;
+        case MESH_EVENT_PS_PARENT_DUTY: {
+            mesh_event_ps_duty_t *ps_duty = (mesh_event_ps_duty_t *)event_data;
+            ESP_LOGD(MESH_TAG, "<MESH_EVENT_PS_PARENT_DUTY>duty:%d", ps_duty->duty);
+            mesh_ps_on_parent_duty(ps_duty->duty);
+        }
+        break;
+        case MESH_EVENT_PS_CHILD_DUTY: {
+            mesh_event_ps_duty_t *ps_duty = (mesh_event_ps_duty_t *)event_data;
+            ESP_LOGD(MESH_TAG, "<MESH_EVENT_PS_CHILD_DUTY>cidx:%d, "MACSTR", duty:%d", ps_duty->child_connected.aid-1,
+            MAC2STR(ps_duty->child_connected.mac), ps_duty->duty);
+            mesh_ps_on_child_duty(ps_duty->child_connected.aid, ps_duty->duty);
+        }
+        break;
+        default:
+            ESP_LOGI(MESH_TAG, "unknown id:%" PRId32 "", event_id);
+        break;
+        }
+}
\ No newline at end of file
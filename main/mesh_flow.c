@@ -0,0 +1,369 @@
+/* Mesh Flow Control
+
+   Every CONFIG_MESH_FLOW_WINDOW_MS a parent splits its credit budget
+   evenly among its children and tells each one its share. A child may
+   send that many packets up through its parent in the window: it is
+   charged for everything it sends that leaves through the parent, to the
+   root or the outside (no address), broadcasts and nodes outside its own
+   subtree. A packet for us is metered against the child it came through,
+   looked up from the subtree of each child (esp_mesh_get_subnet_nodes_list,
+   refreshed when the routing table changes), not against the node that
+   sent it; over the grant it is dropped, so one noisy subtree cannot use
+   up the packet pool and the app ring of its siblings.
+
+   What this cannot control: the drop happens after esp_mesh_recv(), so
+   the packet has already taken airtime and a slot of the driver RX queue,
+   and only a well-behaved child holds back once its credits are gone.
+   Packets that ESP-MESH forwards between other nodes never reach the
+   application, so they are neither charged nor metered here; the driver
+   queue is all that bounds them.
+
+   The budget itself follows the load, AIMD style: it grows while buffers
+   and heap are plentiful and is halved when the driver RX queue backs up,
+   the packet pool runs dry or the free heap gets low.
+
+   The driver RX queue (esp_mesh_set_xon_qsize) can only be sized before
+   esp_mesh_start(), so that one is picked once, from the free heap.
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_mesh.h"
+#include "esp_timer.h"
+#include "esp_system.h"
+#include "freertos/FreeRTOS.h"
+#include "mesh_comm.h"
+#include "mesh_route.h"
+#include "mesh_flow.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define MESH_FLOW_MAX_CHILDREN      (CONFIG_MESH_AP_CONNECTIONS)
+#define MESH_FLOW_WINDOW_US         (CONFIG_MESH_FLOW_WINDOW_MS * 1000ULL)
+#define MESH_FLOW_BUDGET_MIN        (CONFIG_MESH_FLOW_BUDGET_MIN)
+#define MESH_FLOW_BUDGET_MAX        (CONFIG_MESH_FLOW_BUDGET_MAX)
+#define MESH_FLOW_BUDGET_STEP       (8)
+#define MESH_FLOW_HEAP_LOW          (CONFIG_MESH_FLOW_HEAP_LOW_KB * 1024)
+#define MESH_FLOW_QSIZE_MIN         (16)
+#define MESH_FLOW_QSIZE_MAX         (128)
+#define MESH_FLOW_MAX_NODES         (MESH_ROUTE_MAX)
+
+/*******************************************************
+ *                Structures
+ *******************************************************/
+typedef struct {
+    bool used;
+    mesh_flow_child_stats_t st;
+} mesh_flow_child_t;
+
+typedef struct {
+    uint8_t mac[6];         /* a node of our subtree, first for the sort */
+    uint8_t child[6];       /* the direct child it is reached through */
+} mesh_flow_owner_t;
+
+/*******************************************************
+ *                Variable Definitions
+ *******************************************************/
+static const char *FLOW_TAG = "mesh_flow";
+
+static mesh_flow_child_t s_children[MESH_FLOW_MAX_CHILDREN];
+static mesh_flow_stats_t s_flow;
+static bool s_has_parent = false;
+static portMUX_TYPE s_flow_lock = portMUX_INITIALIZER_UNLOCKED;
+static esp_timer_handle_t s_window_timer = NULL;
+static uint32_t s_last_pool_exhausted = 0;
+/* RX task only: the child every node of our subtree sends through, sorted by node */
+static mesh_flow_owner_t s_owners[MESH_FLOW_MAX_NODES];
+static int s_owner_count = 0;
+static uint32_t s_owner_generation = 0;
+static bool s_owners_stale = true;     /* children came or went, under s_flow_lock */
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+static mesh_flow_child_t *mesh_flow_find(const uint8_t mac[6])
+{
+    for (int i = 0; i < MESH_FLOW_MAX_CHILDREN; i++) {
+        if (s_children[i].used && memcmp(s_children[i].st.mac, mac, 6) == 0) {
+            return &s_children[i];
+        }
+    }
+    return NULL;
+}
+
+static int mesh_flow_count(void)
+{
+    int n = 0;
+    for (int i = 0; i < MESH_FLOW_MAX_CHILDREN; i++) {
+        n += s_children[i].used;
+    }
+    return n;
+}
+
+static void mesh_flow_send_grant(const uint8_t mac[6], uint16_t credits)
+{
+    uint8_t *buf = mesh_comm_alloc(0);
+    if (!buf) {
+        return;
+    }
+    mesh_flow_grant_t *grant = (mesh_flow_grant_t *) buf;
+    mesh_addr_t to;
+    memcpy(to.addr, mac, 6);
+    grant->type = MESH_MSG_TYPE_CREDIT;
+    grant->credits = credits;
+    mesh_comm_send(&to, buf, sizeof(mesh_flow_grant_t), MESH_DATA_P2P);
+}
+
+static void mesh_flow_adapt(void)
+{
+    mesh_rx_pending_t pending = { 0 };
+    mesh_comm_stats_t comm;
+    esp_mesh_get_rx_pending(&pending);
+    mesh_comm_get_stats(&comm);
+
+    bool starved = comm.pool_exhausted != s_last_pool_exhausted;
+    s_last_pool_exhausted = comm.pool_exhausted;
+    bool congested = pending.toSelf > s_flow.xon_qsize / 2;
+    bool low_heap = esp_get_free_heap_size() < MESH_FLOW_HEAP_LOW;
+
+    portENTER_CRITICAL(&s_flow_lock);
+    if (starved || congested || low_heap) {
+        s_flow.budget = s_flow.budget / 2 > MESH_FLOW_BUDGET_MIN ? s_flow.budget / 2 : MESH_FLOW_BUDGET_MIN;
+    } else if (s_flow.budget + MESH_FLOW_BUDGET_STEP <= MESH_FLOW_BUDGET_MAX) {
+        s_flow.budget += MESH_FLOW_BUDGET_STEP;
+    }
+    portEXIT_CRITICAL(&s_flow_lock);
+}
+
+static int mesh_flow_owner_cmp(const void *a, const void *b)
+{
+    return memcmp(a, b, 6);
+}
+
+/* RX task: rebuilds s_owners after the routing table or the children changed */
+static void mesh_flow_owners_update(void)
+{
+    static mesh_addr_t nodes[MESH_FLOW_MAX_NODES];
+    mesh_flow_child_stats_t children[MESH_FLOW_MAX_CHILDREN];
+    uint32_t generation = mesh_route_generation();
+    bool stale;
+
+    portENTER_CRITICAL(&s_flow_lock);
+    stale = s_owners_stale;
+    s_owners_stale = false;
+    portEXIT_CRITICAL(&s_flow_lock);
+    if (!stale && generation == s_owner_generation) {
+        return;
+    }
+    s_owner_generation = generation;
+    s_owner_count = 0;
+
+    int n = mesh_flow_get_children(children, MESH_FLOW_MAX_CHILDREN);
+    for (int i = 0; i < n && s_owner_count < MESH_FLOW_MAX_NODES; i++) {
+        mesh_addr_t child;
+        int num = 0;
+        memcpy(child.addr, children[i].mac, 6);
+        memcpy(s_owners[s_owner_count].mac, child.addr, 6);
+        memcpy(s_owners[s_owner_count++].child, child.addr, 6);
+        if (esp_mesh_get_subnet_nodes_num(&child, &num) != ESP_OK || num <= 0) {
+            continue;
+        }
+        num = num < MESH_FLOW_MAX_NODES - s_owner_count ? num : MESH_FLOW_MAX_NODES - s_owner_count;
+        if (num <= 0 || esp_mesh_get_subnet_nodes_list(&child, nodes, num) != ESP_OK) {
+            continue;
+        }
+        for (int j = 0; j < num; j++) {
+            memcpy(s_owners[s_owner_count].mac, nodes[j].addr, 6);
+            memcpy(s_owners[s_owner_count++].child, child.addr, 6);
+        }
+    }
+    qsort(s_owners, s_owner_count, sizeof(mesh_flow_owner_t), mesh_flow_owner_cmp);
+}
+
+static void mesh_flow_window(void *arg)
+{
+    uint8_t macs[MESH_FLOW_MAX_CHILDREN][6];
+    int n = 0;
+
+    mesh_flow_adapt();
+    portENTER_CRITICAL(&s_flow_lock);
+    int children = mesh_flow_count();
+    uint16_t share = children ? s_flow.budget / children : 0;
+    share = share ? share : 1;
+    for (int i = 0; i < MESH_FLOW_MAX_CHILDREN; i++) {
+        mesh_flow_child_stats_t *st = &s_children[i].st;
+        if (!s_children[i].used) {
+            continue;
+        }
+        if (st->depth >= st->granted) {
+            st->stalls++;
+        }
+        st->depth = 0;
+        st->granted = share;
+        memcpy(macs[n++], st->mac, 6);
+    }
+    portEXIT_CRITICAL(&s_flow_lock);
+
+    for (int i = 0; i < n; i++) {
+        mesh_flow_send_grant(macs[i], share);
+    }
+}
+
+static esp_err_t mesh_flow_process(mesh_addr_t *from, uint8_t *buf, uint16_t len)
+{
+    const mesh_flow_grant_t *grant = (const mesh_flow_grant_t *) buf;
+    if (len < sizeof(mesh_flow_grant_t)) {
+        return ESP_FAIL;
+    }
+    portENTER_CRITICAL(&s_flow_lock);
+    s_flow.tx_credits = grant->credits;
+    portEXIT_CRITICAL(&s_flow_lock);
+    return ESP_OK;
+}
+
+bool mesh_flow_tx_admit(const mesh_addr_t *to)
+{
+    static const uint8_t broadcast[6] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+    bool ok = true;
+
+    /* down into our own subtree: the parent never sees it */
+    if (to && memcmp(to->addr, broadcast, 6) != 0 && mesh_route_contains(to->addr)) {
+        return true;
+    }
+    portENTER_CRITICAL(&s_flow_lock);
+    if (s_has_parent) {
+        if (s_flow.tx_credits > 0) {
+            s_flow.tx_credits--;
+        } else {
+            s_flow.tx_stalls++;
+            ok = false;
+        }
+    }
+    portEXIT_CRITICAL(&s_flow_lock);
+    return ok;
+}
+
+bool mesh_flow_rx_admit(const mesh_addr_t *from)
+{
+    bool ok = true;
+
+    mesh_flow_owners_update();
+    const mesh_flow_owner_t *owner = bsearch(from->addr, s_owners, s_owner_count,
+                                             sizeof(mesh_flow_owner_t), mesh_flow_owner_cmp);
+    if (!owner) {
+        /* from our parent's side of the tree, or from outside the mesh: not ours to meter */
+        return true;
+    }
+    portENTER_CRITICAL(&s_flow_lock);
+    mesh_flow_child_t *child = mesh_flow_find(owner->child);
+    if (child) {
+        mesh_flow_child_stats_t *st = &child->st;
+        st->rx++;
+        if (st->depth >= st->granted) {
+            st->drops++;
+            ok = false;
+        } else if (++st->depth > st->max_depth) {
+            st->max_depth = st->depth;
+        }
+    }
+    portEXIT_CRITICAL(&s_flow_lock);
+    return ok;
+}
+
+void mesh_flow_child_add(const uint8_t mac[6])
+{
+    bool added = false;
+    portENTER_CRITICAL(&s_flow_lock);
+    if (!mesh_flow_find(mac)) {
+        for (int i = 0; i < MESH_FLOW_MAX_CHILDREN; i++) {
+            if (!s_children[i].used) {
+                memset(&s_children[i], 0, sizeof(mesh_flow_child_t));
+                s_children[i].used = true;
+                memcpy(s_children[i].st.mac, mac, 6);
+                s_children[i].st.granted = CONFIG_MESH_FLOW_INITIAL_CREDITS;
+                s_owners_stale = true;
+                added = true;
+                break;
+            }
+        }
+    }
+    portEXIT_CRITICAL(&s_flow_lock);
+    if (!added) {
+        ESP_LOGW(FLOW_TAG, "no slot for child "MACSTR, MAC2STR(mac));
+    }
+}
+
+void mesh_flow_child_remove(const uint8_t mac[6])
+{
+    portENTER_CRITICAL(&s_flow_lock);
+    mesh_flow_child_t *child = mesh_flow_find(mac);
+    if (child) {
+        child->used = false;
+        s_owners_stale = true;
+    }
+    portEXIT_CRITICAL(&s_flow_lock);
+}
+
+void mesh_flow_parent_connected(void)
+{
+    mesh_addr_t parent = { 0 };
+    bool has_parent = mesh_comm_get_parent(&parent) == ESP_OK;
+    portENTER_CRITICAL(&s_flow_lock);
+    s_has_parent = has_parent;
+    /* enough to get going until the new parent's first grant */
+    s_flow.tx_credits = CONFIG_MESH_FLOW_INITIAL_CREDITS;
+    portEXIT_CRITICAL(&s_flow_lock);
+}
+
+int mesh_flow_get_children(mesh_flow_child_stats_t *children, int max)
+{
+    int n = 0;
+    portENTER_CRITICAL(&s_flow_lock);
+    for (int i = 0; i < MESH_FLOW_MAX_CHILDREN && n < max; i++) {
+        if (s_children[i].used) {
+            children[n++] = s_children[i].st;
+        }
+    }
+    portEXIT_CRITICAL(&s_flow_lock);
+    return n;
+}
+
+void mesh_flow_get_stats(mesh_flow_stats_t *stats)
+{
+    portENTER_CRITICAL(&s_flow_lock);
+    memcpy(stats, &s_flow, sizeof(mesh_flow_stats_t));
+    portEXIT_CRITICAL(&s_flow_lock);
+}
+
+int mesh_flow_xon_qsize(void)
+{
+    /* one MESH_MPS packet per slot, and never more than a quarter of the heap */
+    int qsize = esp_get_free_heap_size() / 4 / MESH_MPS;
+    qsize = qsize < MESH_FLOW_QSIZE_MIN ? MESH_FLOW_QSIZE_MIN : qsize;
+    qsize = qsize > MESH_FLOW_QSIZE_MAX ? MESH_FLOW_QSIZE_MAX : qsize;
+    s_flow.xon_qsize = qsize;
+    return qsize;
+}
+
+esp_err_t mesh_flow_init(void)
+{
+    esp_timer_create_args_t timer_args = {
+        .callback = mesh_flow_window,
+        .name = "mesh_flow",
+    };
+    s_flow.budget = MESH_FLOW_BUDGET_MIN;
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &s_window_timer));
+    return mesh_comm_register_handler(MESH_MSG_TYPE_CREDIT, mesh_flow_process);
+}
+
+esp_err_t mesh_flow_start(void)
+{
+    if (esp_timer_is_active(s_window_timer)) {
+        return ESP_OK;
+    }
+    return esp_timer_start_periodic(s_window_timer, MESH_FLOW_WINDOW_US);
+}
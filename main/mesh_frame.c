@@ -0,0 +1,95 @@
+/* Mesh Command Frames
+
+   Parser and builder for mesh_frame_hdr_t frames. The parser authenticates
+   the whole frame up front, then only checks bounds as it walks; semantic
+   checks on each command are up to the handler that consumes it.
+*/
+
+#include <string.h>
+#include "esp_err.h"
+#include "esp_mac.h"
+#include "mesh_comm.h"
+#include "mesh_auth.h"
+#include "mesh_frame.h"
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+esp_err_t mesh_frame_iter_init(mesh_frame_iter_t *it, const uint8_t from[6], const uint8_t *buf, uint16_t len)
+{
+    const mesh_frame_hdr_t *hdr = (const mesh_frame_hdr_t *) buf;
+    if (!buf || len < sizeof(mesh_frame_hdr_t) + MESH_AUTH_TAG_LEN) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (hdr->type != MESH_MSG_TYPE_FRAME || hdr->version != MESH_FRAME_VERSION) {
+        return ESP_ERR_INVALID_VERSION;
+    }
+    if (hdr->length > len - sizeof(mesh_frame_hdr_t) - MESH_AUTH_TAG_LEN) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    mesh_auth_nonce_t nonce = { .boot = hdr->boot, .counter = hdr->counter };
+    uint16_t signed_len = sizeof(mesh_frame_hdr_t) + hdr->length;
+    esp_err_t err = mesh_auth_verify(from, buf, signed_len, buf + signed_len, &nonce);
+    if (err != ESP_OK) {
+        return err;
+    }
+    it->pos = buf + sizeof(mesh_frame_hdr_t);
+    it->end = it->pos + hdr->length;
+    it->remaining = hdr->count;
+    return ESP_OK;
+}
+
+const mesh_frame_cmd_t *mesh_frame_iter_next(mesh_frame_iter_t *it)
+{
+    if (it->remaining == 0 || it->end - it->pos < (int) sizeof(mesh_frame_cmd_t)) {
+        return NULL;
+    }
+    const mesh_frame_cmd_t *cmd = (const mesh_frame_cmd_t *) it->pos;
+    if (it->end - it->pos < (int) sizeof(mesh_frame_cmd_t) + cmd->len) {
+        it->remaining = 0;
+        return NULL;
+    }
+    it->pos += sizeof(mesh_frame_cmd_t) + cmd->len;
+    it->remaining--;
+    return cmd;
+}
+
+void mesh_frame_begin(mesh_frame_builder_t *b, uint8_t *buf, uint16_t cap)
+{
+    b->buf = buf;
+    b->cap = cap;
+    b->len = sizeof(mesh_frame_hdr_t);
+    memset(buf, 0, sizeof(mesh_frame_hdr_t));
+}
+
+uint8_t *mesh_frame_append(mesh_frame_builder_t *b, uint8_t cmd, uint8_t len)
+{
+    mesh_frame_hdr_t *hdr = (mesh_frame_hdr_t *) b->buf;
+    if (hdr->count == UINT8_MAX || b->len + sizeof(mesh_frame_cmd_t) + len + MESH_AUTH_TAG_LEN > b->cap) {
+        return NULL;
+    }
+    mesh_frame_cmd_t *c = (mesh_frame_cmd_t *) (b->buf + b->len);
+    c->cmd = cmd;
+    c->len = len;
+    b->len += sizeof(mesh_frame_cmd_t) + len;
+    hdr->count++;
+    return c->data;
+}
+
+uint16_t mesh_frame_finish(mesh_frame_builder_t *b)
+{
+    mesh_frame_hdr_t *hdr = (mesh_frame_hdr_t *) b->buf;
+    mesh_auth_nonce_t nonce;
+    uint8_t self[6];
+
+    mesh_auth_next_nonce(&nonce);
+    esp_read_mac(self, ESP_MAC_WIFI_STA);
+    hdr->type = MESH_MSG_TYPE_FRAME;
+    hdr->version = MESH_FRAME_VERSION;
+    hdr->length = b->len - sizeof(mesh_frame_hdr_t);
+    hdr->boot = nonce.boot;
+    hdr->counter = nonce.counter;
+    mesh_auth_sign(self, b->buf, b->len, b->buf + b->len);
+    b->len += MESH_AUTH_TAG_LEN;
+    return b->len;
+}
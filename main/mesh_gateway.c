@@ -0,0 +1,421 @@
+/* Mesh Gateway
+
+   The root is the only node with an IP, and its single STA link is
+   shared by the whole mesh. Instead of one TCP write per node message,
+   upstream messages (MESH_MSG_TYPE_UPLINK, plus the root's telemetry)
+   are appended to a batch that is sent when it is full or
+   CONFIG_MESH_GATEWAY_FLUSH_MS after its first message.
+
+   Full batches wait in a queue for the gateway task, which keeps one TCP
+   connection to the server open and reconnects with exponential backoff.
+   While the server cannot be reached the batches pile up; when the
+   queue is full the oldest one is dropped, so memory use is bounded and
+   the newest data wins.
+
+   The batch buffers are static, like the mesh_comm pool: a free queue
+   and a send queue of pointers move them between the filling side and
+   the gateway task.
+
+   The connection is kept open even with nothing to send, because the
+   server uses it the other way too: between two batches the gateway task
+   polls it for batches from the server, whose records go to the
+   downlink handler (mesh_shard, for messages from other shards).
+*/
+
+#include <string.h>
+#include <inttypes.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_random.h"
+#include "esp_mesh.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "lwip/sockets.h"
+#include "mesh_comm.h"
+#include "mesh_telemetry.h"
+#include "mesh_shard.h"
+#include "mesh_packbits.h"
+#include "mesh_gateway.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define MESH_GATEWAY_BATCH_SIZE     (CONFIG_MESH_GATEWAY_BATCH_SIZE)
+#define MESH_GATEWAY_QUEUE_LEN      (CONFIG_MESH_GATEWAY_QUEUE_LEN)
+/* the queued batches, the one being sent and the one being filled */
+#define MESH_GATEWAY_SLOTS          (MESH_GATEWAY_QUEUE_LEN + 2)
+#define MESH_GATEWAY_FLUSH_US       (CONFIG_MESH_GATEWAY_FLUSH_MS * 1000ULL)
+#define MESH_GATEWAY_RETRY_MIN_MS   (500)
+#define MESH_GATEWAY_RETRY_MAX_MS   (CONFIG_MESH_GATEWAY_RETRY_MAX_MS)
+#define MESH_GATEWAY_POLL_MS        (100)   /* longest wait for a batch from the server when idle */
+#define MESH_GATEWAY_RECV_TIMEOUT_S (2)     /* for the rest of a batch once its header is in */
+#define MESH_GATEWAY_TASK_STACK     (4096)
+#define MESH_GATEWAY_TASK_PRIO      (4)
+
+/*******************************************************
+ *                Structures
+ *******************************************************/
+typedef struct {
+    mesh_gateway_batch_hdr_t hdr;
+    uint8_t data[MESH_GATEWAY_BATCH_SIZE];
+} mesh_gateway_batch_t;
+
+/*******************************************************
+ *                Variable Definitions
+ *******************************************************/
+static const char *GATEWAY_TAG = "mesh_gateway";
+
+static mesh_gateway_batch_t s_batches[MESH_GATEWAY_SLOTS];
+static mesh_gateway_batch_t *s_fill = NULL;         /* batch being filled */
+static QueueHandle_t s_free_queue = NULL;
+static QueueHandle_t s_send_queue = NULL;
+static SemaphoreHandle_t s_batch_lock = NULL;       /* s_fill, s_seq and s_stats */
+static esp_timer_handle_t s_flush_timer = NULL;
+static mesh_gateway_stats_t s_stats;
+static uint32_t s_seq = 0;
+static uint8_t s_self[6];
+static volatile bool s_reachable = false;
+static bool s_gateway_started = false;
+static mesh_gateway_downlink_t s_downlink = NULL;
+static uint8_t s_down[MESH_GATEWAY_BATCH_SIZE];     /* batch from the server, gateway task only */
+#ifdef CONFIG_MESH_GATEWAY_COMPRESS
+static uint8_t s_wire[MESH_PACKBITS_MAX_LEN(MESH_GATEWAY_BATCH_SIZE)];
+#endif
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+static void mesh_gateway_reset(mesh_gateway_batch_t *batch)
+{
+    memset(&batch->hdr, 0, sizeof(batch->hdr));
+    batch->hdr.magic = MESH_GATEWAY_MAGIC;
+    batch->hdr.version = MESH_GATEWAY_VERSION;
+    memcpy(batch->hdr.root, s_self, 6);
+    batch->hdr.shard = mesh_shard_get_id();
+}
+
+/* Call with s_batch_lock held */
+static void mesh_gateway_flush_locked(void)
+{
+    mesh_gateway_batch_t *next = NULL;
+
+    if (s_fill->hdr.count == 0) {
+        return;
+    }
+    esp_timer_stop(s_flush_timer);
+    if (xQueueReceive(s_free_queue, &next, 0) != pdTRUE) {
+        /* the server has been away for a while: make room by dropping the oldest waiting batch */
+        if (xQueueReceive(s_send_queue, &next, 0) != pdTRUE) {
+            s_stats.dropped++;
+            mesh_gateway_reset(s_fill);
+            return;
+        }
+        s_stats.dropped++;
+    }
+    s_fill->hdr.seq = s_seq++;
+    xQueueSend(s_send_queue, &s_fill, 0);
+    mesh_gateway_reset(next);
+    s_fill = next;
+}
+
+static void mesh_gateway_flush(void *arg)
+{
+    xSemaphoreTake(s_batch_lock, portMAX_DELAY);
+    mesh_gateway_flush_locked();
+    xSemaphoreGive(s_batch_lock);
+}
+
+static esp_err_t mesh_gateway_append(const uint8_t src[6], const uint8_t *data, uint16_t len)
+{
+    size_t need = sizeof(mesh_gateway_record_t) + len;
+
+    xSemaphoreTake(s_batch_lock, portMAX_DELAY);
+    if (need > MESH_GATEWAY_BATCH_SIZE) {
+        s_stats.oversize++;
+        xSemaphoreGive(s_batch_lock);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (s_fill->hdr.raw_len + need > MESH_GATEWAY_BATCH_SIZE) {
+        mesh_gateway_flush_locked();
+    }
+    if (s_fill->hdr.count == 0) {
+        esp_timer_start_once(s_flush_timer, MESH_GATEWAY_FLUSH_US);
+    }
+    mesh_gateway_record_t *rec = (mesh_gateway_record_t *) (s_fill->data + s_fill->hdr.raw_len);
+    memcpy(rec->src, src, 6);
+    rec->len = len;
+    memcpy(rec->data, data, len);
+    s_fill->hdr.count++;
+    s_fill->hdr.raw_len += need;
+    s_stats.records++;
+    xSemaphoreGive(s_batch_lock);
+    return ESP_OK;
+}
+
+/* Sets the wire length and flags of the batch, returns the bytes to send after the header */
+static const uint8_t *mesh_gateway_encode(mesh_gateway_batch_t *batch)
+{
+    batch->hdr.len = batch->hdr.raw_len;
+#ifdef CONFIG_MESH_GATEWAY_COMPRESS
+    size_t len = mesh_packbits_encode(batch->data, batch->hdr.raw_len, s_wire);
+    if (len < batch->hdr.raw_len) {
+        batch->hdr.flags |= MESH_GATEWAY_FLAG_PACKBITS;
+        batch->hdr.len = len;
+        return s_wire;
+    }
+#endif
+    return batch->data;
+}
+
+static int mesh_gateway_connect(void)
+{
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(CONFIG_MESH_GATEWAY_PORT),
+    };
+    int keepalive = 1;
+    struct timeval timeout = { .tv_sec = MESH_GATEWAY_RECV_TIMEOUT_S };
+
+    if (inet_pton(AF_INET, CONFIG_MESH_GATEWAY_HOST, &addr.sin_addr) != 1) {
+        ESP_LOGE(GATEWAY_TAG, "bad server address %s", CONFIG_MESH_GATEWAY_HOST);
+        return -1;
+    }
+    int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (sock < 0) {
+        return -1;
+    }
+    setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &keepalive, sizeof(keepalive));
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (connect(sock, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        ESP_LOGW(GATEWAY_TAG, "connect %s:%d failed, errno:%d", CONFIG_MESH_GATEWAY_HOST, CONFIG_MESH_GATEWAY_PORT, errno);
+        close(sock);
+        return -1;
+    }
+    ESP_LOGI(GATEWAY_TAG, "connected to %s:%d", CONFIG_MESH_GATEWAY_HOST, CONFIG_MESH_GATEWAY_PORT);
+    return sock;
+}
+
+static bool mesh_gateway_write(int sock, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    while (len > 0) {
+        int n = send(sock, p, len, 0);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool mesh_gateway_read(int sock, void *data, size_t len)
+{
+    uint8_t *p = data;
+    while (len > 0) {
+        int n = recv(sock, p, len, 0);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+/* Waits up to `wait_ms` for a batch from the server and hands its records to the downlink.
+ * Returns false when the connection has to be dropped. */
+static bool mesh_gateway_receive(int sock, uint32_t wait_ms)
+{
+    mesh_gateway_batch_hdr_t hdr;
+    struct timeval tv = { .tv_sec = wait_ms / 1000, .tv_usec = (wait_ms % 1000) * 1000 };
+    fd_set readable;
+
+    FD_ZERO(&readable);
+    FD_SET(sock, &readable);
+    if (select(sock + 1, &readable, NULL, NULL, &tv) <= 0) {
+        return true;
+    }
+    if (!mesh_gateway_read(sock, &hdr, sizeof(hdr))) {
+        return false;
+    }
+    if (hdr.magic != MESH_GATEWAY_MAGIC || hdr.version != MESH_GATEWAY_VERSION
+            || (hdr.flags & MESH_GATEWAY_FLAG_PACKBITS) || hdr.len > sizeof(s_down)) {
+        ESP_LOGW(GATEWAY_TAG, "bad batch from the server, reconnecting");
+        return false;
+    }
+    if (!mesh_gateway_read(sock, s_down, hdr.len)) {
+        return false;
+    }
+    uint16_t off = 0;
+    uint16_t records = 0;
+    while (records < hdr.count && off + sizeof(mesh_gateway_record_t) <= hdr.len) {
+        const mesh_gateway_record_t *rec = (const mesh_gateway_record_t *) (s_down + off);
+        off += sizeof(mesh_gateway_record_t);
+        if (rec->len > hdr.len - off) {
+            break;
+        }
+        if (s_downlink) {
+            s_downlink(rec->src, rec->data, rec->len);
+        }
+        off += rec->len;
+        records++;
+    }
+    xSemaphoreTake(s_batch_lock, portMAX_DELAY);
+    s_stats.down_batches++;
+    s_stats.down_records += records;
+    xSemaphoreGive(s_batch_lock);
+    return true;
+}
+
+static void mesh_gateway_task(void *arg)
+{
+    mesh_gateway_batch_t *batch = NULL;
+    const uint8_t *payload = NULL;
+    uint32_t backoff_ms = MESH_GATEWAY_RETRY_MIN_MS;
+    int sock = -1;
+
+    while (true) {
+        if (!s_reachable) {
+            vTaskDelay(pdMS_TO_TICKS(MESH_GATEWAY_RETRY_MIN_MS));
+            continue;
+        }
+        if (sock < 0) {
+            sock = mesh_gateway_connect();
+            if (sock < 0) {
+                vTaskDelay(pdMS_TO_TICKS(backoff_ms));
+                backoff_ms = backoff_ms * 2 < MESH_GATEWAY_RETRY_MAX_MS ? backoff_ms * 2 : MESH_GATEWAY_RETRY_MAX_MS;
+                continue;
+            }
+            xSemaphoreTake(s_batch_lock, portMAX_DELAY);
+            s_stats.connects++;
+            xSemaphoreGive(s_batch_lock);
+        }
+        if (!batch && xQueueReceive(s_send_queue, &batch, 0) == pdTRUE) {
+            payload = mesh_gateway_encode(batch);
+        }
+        if (batch) {
+            if (!mesh_gateway_write(sock, &batch->hdr, sizeof(batch->hdr))
+                    || !mesh_gateway_write(sock, payload, batch->hdr.len)) {
+                /* the batch is sent again on the new connection; the server drops duplicates by sequence number */
+                close(sock);
+                sock = -1;
+                xSemaphoreTake(s_batch_lock, portMAX_DELAY);
+                s_stats.send_errors++;
+                xSemaphoreGive(s_batch_lock);
+                vTaskDelay(pdMS_TO_TICKS(backoff_ms));
+                backoff_ms = backoff_ms * 2 < MESH_GATEWAY_RETRY_MAX_MS ? backoff_ms * 2 : MESH_GATEWAY_RETRY_MAX_MS;
+                continue;
+            }
+            backoff_ms = MESH_GATEWAY_RETRY_MIN_MS;
+            xSemaphoreTake(s_batch_lock, portMAX_DELAY);
+            s_stats.batches++;
+            s_stats.raw_bytes += batch->hdr.raw_len;
+            s_stats.wire_bytes += batch->hdr.len;
+            xSemaphoreGive(s_batch_lock);
+            xQueueSend(s_free_queue, &batch, 0);
+            batch = NULL;
+        }
+        /* nothing more to send: wait on the server instead, the next batch is at most one poll away */
+        uint32_t wait_ms = uxQueueMessagesWaiting(s_send_queue) ? 0 : MESH_GATEWAY_POLL_MS;
+        if (!mesh_gateway_receive(sock, wait_ms)) {
+            close(sock);
+            sock = -1;
+        }
+    }
+}
+
+static esp_err_t mesh_gateway_process(mesh_addr_t *from, uint8_t *buf, uint16_t len)
+{
+    if (len < 1 || !esp_mesh_is_root()) {
+        return ESP_FAIL;
+    }
+    return mesh_gateway_append(from->addr, buf + 1, len - 1);
+}
+
+static void mesh_gateway_telemetry(const mesh_telemetry_report_t *report)
+{
+    mesh_gateway_append(s_self, (const uint8_t *) report, sizeof(mesh_telemetry_report_t));
+}
+
+esp_err_t mesh_gateway_send(const uint8_t *data, uint16_t len)
+{
+    if (esp_mesh_is_root()) {
+        return mesh_gateway_append(s_self, data, len);
+    }
+    if (len + 1 > MESH_COMM_BUF_SIZE) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    uint8_t *buf = mesh_comm_alloc(0);
+    if (!buf) {
+        return ESP_ERR_NO_MEM;
+    }
+    buf[0] = MESH_MSG_TYPE_UPLINK;
+    memcpy(buf + 1, data, len);
+    return mesh_comm_send(NULL, buf, len + 1, MESH_DATA_P2P);
+}
+
+void mesh_gateway_set_reachable(bool reachable)
+{
+    s_reachable = reachable;
+}
+
+void mesh_gateway_set_downlink(mesh_gateway_downlink_t downlink)
+{
+    s_downlink = downlink;
+}
+
+void mesh_gateway_get_stats(mesh_gateway_stats_t *stats)
+{
+    xSemaphoreTake(s_batch_lock, portMAX_DELAY);
+    memcpy(stats, &s_stats, sizeof(mesh_gateway_stats_t));
+    xSemaphoreGive(s_batch_lock);
+}
+
+esp_err_t mesh_gateway_init(void)
+{
+    esp_timer_create_args_t timer_args = {
+        .callback = mesh_gateway_flush,
+        .name = "mesh_gateway",
+    };
+    if (s_free_queue) {
+        return ESP_OK;
+    }
+    s_free_queue = xQueueCreate(MESH_GATEWAY_SLOTS, sizeof(mesh_gateway_batch_t *));
+    s_send_queue = xQueueCreate(MESH_GATEWAY_QUEUE_LEN, sizeof(mesh_gateway_batch_t *));
+    s_batch_lock = xSemaphoreCreateMutex();
+    if (!s_free_queue || !s_send_queue || !s_batch_lock) {
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_ERROR_CHECK(esp_read_mac(s_self, ESP_MAC_WIFI_STA));
+    for (int i = 1; i < MESH_GATEWAY_SLOTS; i++) {
+        mesh_gateway_batch_t *batch = &s_batches[i];
+        xQueueSend(s_free_queue, &batch, 0);
+    }
+    s_fill = &s_batches[0];
+    /* a random start, so the server does not take the batches after a reboot for duplicates */
+    s_seq = esp_random();
+    mesh_gateway_reset(s_fill);
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &s_flush_timer));
+    /* on the root the mesh-wide telemetry goes to the server too */
+    mesh_telemetry_set_sink(mesh_gateway_telemetry);
+    return mesh_comm_register_handler(MESH_MSG_TYPE_UPLINK, mesh_gateway_process);
+}
+
+esp_err_t mesh_gateway_start(void)
+{
+    s_reachable = true;
+    if (s_gateway_started) {
+        return ESP_OK;
+    }
+    if (!s_free_queue) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    s_gateway_started = true;
+    xTaskCreate(mesh_gateway_task, "mesh_gateway", MESH_GATEWAY_TASK_STACK, NULL, MESH_GATEWAY_TASK_PRIO, NULL);
+    return ESP_OK;
+}
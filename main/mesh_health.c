@@ -0,0 +1,229 @@
+/* Mesh Health
+
+   Every CONFIG_MESH_HEALTH_PERIOD_S a sample of free and minimum heap,
+   the largest free block, the stack high-water mark of the tasks that
+   matter and the mesh stack's TX/RX queues goes into a ring of
+   CONFIG_MESH_HEALTH_RING_LEN samples, the oldest one overwritten.
+
+   Slow leaks and fragmentation show up as a trend, not in one value: a
+   largest block shrinking while free heap stays put is fragmentation,
+   both going down together is a leak. So the ring, plus the smallest
+   largest block since boot, can be read from another node with a
+   MESH_MSG_TYPE_HEALTH query, even when this one has no serial console,
+   and the ring is logged once when the largest block first drops below
+   CONFIG_MESH_HEALTH_BLOCK_WARN.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_mesh.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "mesh_comm.h"
+#include "mesh_health.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define MESH_HEALTH_RING_LEN    (CONFIG_MESH_HEALTH_RING_LEN)
+#define MESH_HEALTH_MAX_REPLY   ((MESH_COMM_BUF_SIZE - sizeof(mesh_health_reply_t)) / sizeof(mesh_health_sample_t))
+
+/*******************************************************
+ *                Variable Definitions
+ *******************************************************/
+static const char *HEALTH_TAG = "mesh_health";
+
+static const char *s_health_tasks[MESH_HEALTH_TASKS] = {
+    "mesh_rx", "mesh_tx", "mesh_app", "mesh_light", "mesh_gateway", "mesh_xfer",
+    "esp_timer", "tiT", "wifi",
+};
+
+static mesh_health_sample_t s_ring[MESH_HEALTH_RING_LEN];
+static int s_head = 0;      /* next slot to write */
+static int s_count = 0;
+static uint32_t s_worst_block = UINT32_MAX;
+static uint32_t s_worst_block_s = 0;
+static bool s_warned = false;
+static portMUX_TYPE s_health_lock = portMUX_INITIALIZER_UNLOCKED;
+static esp_timer_handle_t s_sample_timer = NULL;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+static uint16_t mesh_health_clamp(int value)
+{
+    return value < 0 ? 0 : (value > UINT16_MAX ? UINT16_MAX : value);
+}
+
+void mesh_health_sample(mesh_health_sample_t *sample)
+{
+    mesh_tx_pending_t tx = { 0 };
+    mesh_rx_pending_t rx = { 0 };
+
+    sample->uptime_s = (uint32_t) (esp_timer_get_time() / 1000000);
+    sample->free_heap = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    sample->min_free_heap = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+    sample->largest_block = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    esp_mesh_get_tx_pending(&tx);
+    esp_mesh_get_rx_pending(&rx);
+    sample->tx_parent = mesh_health_clamp(tx.to_parent + tx.to_parent_p2p);
+    sample->tx_child = mesh_health_clamp(tx.to_child + tx.to_child_p2p);
+    sample->rx_self = mesh_health_clamp(rx.toSelf);
+    sample->rx_ds = mesh_health_clamp(rx.toDS);
+    for (int i = 0; i < MESH_HEALTH_TASKS; i++) {
+        /* looked up every time: some tasks only exist on the root, or once connected */
+        TaskHandle_t task = xTaskGetHandle(s_health_tasks[i]);
+        /* on ESP-IDF stacks are counted in bytes */
+        sample->stack_free[i] = task ? mesh_health_clamp(uxTaskGetStackHighWaterMark(task)) : MESH_HEALTH_NO_TASK;
+    }
+}
+
+static void mesh_health_log(const char *who, const mesh_health_sample_t *s)
+{
+    int low = -1;
+    for (int i = 0; i < MESH_HEALTH_TASKS; i++) {
+        if (s->stack_free[i] != MESH_HEALTH_NO_TASK && (low < 0 || s->stack_free[i] < s->stack_free[low])) {
+            low = i;
+        }
+    }
+    ESP_LOGI(HEALTH_TAG, "%s %" PRIu32 "s heap free:%" PRIu32 " min:%" PRIu32 " block:%" PRIu32
+             " tx:%u/%u rx:%u/%u stack low:%s %u", who, s->uptime_s, s->free_heap, s->min_free_heap,
+             s->largest_block, s->tx_parent, s->tx_child, s->rx_self, s->rx_ds,
+             low < 0 ? "-" : s_health_tasks[low], low < 0 ? 0 : s->stack_free[low]);
+}
+
+int mesh_health_get(mesh_health_sample_t *samples, int max)
+{
+    int n = 0;
+
+    portENTER_CRITICAL(&s_health_lock);
+    for (; n < max && n < s_count; n++) {
+        samples[n] = s_ring[(s_head - 1 - n + MESH_HEALTH_RING_LEN) % MESH_HEALTH_RING_LEN];
+    }
+    portEXIT_CRITICAL(&s_health_lock);
+    return n;
+}
+
+void mesh_health_dump(void)
+{
+    static mesh_health_sample_t samples[MESH_HEALTH_RING_LEN];
+    int n = mesh_health_get(samples, MESH_HEALTH_RING_LEN);
+
+    /* oldest first, it reads as a time series */
+    while (n-- > 0) {
+        mesh_health_log("self", &samples[n]);
+    }
+    ESP_LOGI(HEALTH_TAG, "smallest block since boot:%" PRIu32 " at %" PRIu32 "s", s_worst_block, s_worst_block_s);
+}
+
+static void mesh_health_tick(void *arg)
+{
+    mesh_health_sample_t sample;
+    bool warn = false;
+
+    mesh_health_sample(&sample);
+    portENTER_CRITICAL(&s_health_lock);
+    s_ring[s_head] = sample;
+    s_head = (s_head + 1) % MESH_HEALTH_RING_LEN;
+    if (s_count < MESH_HEALTH_RING_LEN) {
+        s_count++;
+    }
+    if (sample.largest_block < s_worst_block) {
+        s_worst_block = sample.largest_block;
+        s_worst_block_s = sample.uptime_s;
+    }
+    if (!s_warned && sample.largest_block < CONFIG_MESH_HEALTH_BLOCK_WARN) {
+        s_warned = warn = true;
+    }
+    portEXIT_CRITICAL(&s_health_lock);
+
+    if (warn) {
+        ESP_LOGW(HEALTH_TAG, "largest free block down to %" PRIu32 " bytes, history:", sample.largest_block);
+        mesh_health_dump();
+    }
+}
+
+esp_err_t mesh_health_query(const uint8_t mac[6], int count)
+{
+    mesh_addr_t to;
+    mesh_health_hdr_t query = {
+        .type = MESH_MSG_TYPE_HEALTH,
+        .op = MESH_HEALTH_OP_QUERY,
+        .count = count > MESH_HEALTH_MAX_REPLY ? MESH_HEALTH_MAX_REPLY : count,
+        .layer = esp_mesh_get_layer(),
+    };
+    if (count <= 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    uint8_t *buf = mesh_comm_alloc(0);
+    if (!buf) {
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(buf, &query, sizeof(query));
+    memcpy(to.addr, mac, 6);
+    return mesh_comm_send(&to, buf, sizeof(query), MESH_DATA_P2P);
+}
+
+static esp_err_t mesh_health_process(mesh_addr_t *from, uint8_t *buf, uint16_t len)
+{
+    mesh_health_hdr_t hdr;
+    char who[24];
+
+    if (len < sizeof(mesh_health_hdr_t)) {
+        return ESP_FAIL;
+    }
+    memcpy(&hdr, buf, sizeof(hdr));
+
+    if (hdr.op == MESH_HEALTH_OP_QUERY) {
+        uint8_t *out = mesh_comm_alloc(0);
+        if (!out) {
+            return ESP_ERR_NO_MEM;
+        }
+        mesh_health_reply_t *reply = (mesh_health_reply_t *) out;
+        int want = hdr.count > MESH_HEALTH_MAX_REPLY ? MESH_HEALTH_MAX_REPLY : hdr.count;
+        int n = mesh_health_get(reply->samples, want);
+        reply->hdr.type = MESH_MSG_TYPE_HEALTH;
+        reply->hdr.op = MESH_HEALTH_OP_REPLY;
+        reply->hdr.count = n;
+        reply->hdr.layer = esp_mesh_get_layer();
+        portENTER_CRITICAL(&s_health_lock);
+        reply->worst_block = s_worst_block;
+        reply->worst_block_s = s_worst_block_s;
+        portEXIT_CRITICAL(&s_health_lock);
+        return mesh_comm_send(from, out, sizeof(mesh_health_reply_t) + n * sizeof(mesh_health_sample_t), MESH_DATA_P2P);
+    }
+    if (hdr.op != MESH_HEALTH_OP_REPLY
+            || len < sizeof(mesh_health_reply_t) + hdr.count * sizeof(mesh_health_sample_t)) {
+        return ESP_FAIL;
+    }
+
+    const mesh_health_reply_t *reply = (const mesh_health_reply_t *) buf;
+    snprintf(who, sizeof(who), MACSTR" L%d", MAC2STR(from->addr), hdr.layer);
+    for (int i = hdr.count - 1; i >= 0; i--) {
+        mesh_health_sample_t sample;
+        memcpy(&sample, &reply->samples[i], sizeof(sample));
+        mesh_health_log(who, &sample);
+    }
+    ESP_LOGI(HEALTH_TAG, "%s smallest block since boot:%" PRIu32 " at %" PRIu32 "s",
+             who, reply->worst_block, reply->worst_block_s);
+    return ESP_OK;
+}
+
+esp_err_t mesh_health_init(void)
+{
+    esp_timer_create_args_t sample_args = {
+        .callback = mesh_health_tick,
+        .name = "mesh_health",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&sample_args, &s_sample_timer));
+    /* a first sample right away: the baseline right after boot */
+    mesh_health_tick(NULL);
+    ESP_ERROR_CHECK(esp_timer_start_periodic(s_sample_timer, CONFIG_MESH_HEALTH_PERIOD_S * 1000000ULL));
+    return mesh_comm_register_handler(MESH_MSG_TYPE_HEALTH, mesh_health_process);
+}
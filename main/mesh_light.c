@@ -10,9 +10,16 @@
 #include <string.h>
 #include "esp_err.h"
 #include "esp_mesh.h"
+#include "esp_timer.h"
 #include "mesh_light.h"
+#include "mesh_frame.h"
+#include "mesh_comm.h"
+#include "mesh_rel.h"
+#include "mesh_time.h"
 #include "driver/gpio.h"
 #include "driver/ledc.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 
 /*******************************************************
  *                Constants
@@ -23,10 +30,43 @@
 #define LEDC_IO_2    (4)
 #define LEDC_IO_3    (5)
 
+#define MESH_LIGHT_FADE_MS      (CONFIG_MESH_LIGHT_FADE_MS)
+#define MESH_LIGHT_TASK_STACK   (2048)
+#define MESH_LIGHT_TASK_PRIO    (2)
+#define MESH_LIGHT_SCENE_MAX_MS (60 * 1000)    /* further ahead than this, the clocks disagree */
+
+/*******************************************************
+ *                Structures
+ *******************************************************/
+typedef struct {
+    int color;
+    uint16_t fade_ms;
+    uint32_t duty[3];       /* computed ahead, so that starting the fade is all that is left */
+} mesh_light_scene_state_t;
+
 /*******************************************************
  *                Variable Definitions
  *******************************************************/
 static bool s_light_inited = false;
+/* Mailbox of depth one, under s_light_lock: the newest request, which the
+ * LED task picks up when notified. A newer request replaces one the task
+ * has not picked up yet, so whatever the order the notifications arrive
+ * in, the last color requested is the one that ends up on the LEDs. */
+static TaskHandle_t s_light_task = NULL;
+static portMUX_TYPE s_light_lock = portMUX_INITIALIZER_UNLOCKED;
+static int s_light_requested = -1;
+static bool s_light_pending = false;
+static int s_light_applied = -1;        /* written by the LED task only */
+static mesh_light_stats_t s_light_stats;
+/* Scenes, under s_light_lock: the timer moves the next one to `due` and
+ * wakes the LED task, which is the only one programming the LEDC */
+static esp_timer_handle_t s_scene_timer = NULL;
+static mesh_light_scene_state_t s_scene_next;
+static mesh_light_scene_state_t s_scene_due;
+static bool s_scene_fired = false;
+
+static void mesh_light_task(void *arg);
+static void mesh_light_scene_run(void *arg);
 
 /*******************************************************
  *                Function Definitions
@@ -68,85 +108,293 @@ esp_err_t mesh_light_init(void)
     ledc_channel_config(&ledc_channel);
     ledc_fade_func_install(0);
 
+    esp_timer_create_args_t scene_args = {
+        .callback = mesh_light_scene_run,
+        .name = "mesh_scene",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&scene_args, &s_scene_timer));
+    if (xTaskCreate(mesh_light_task, "mesh_light", MESH_LIGHT_TASK_STACK, NULL, MESH_LIGHT_TASK_PRIO,
+                    &s_light_task) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+
     mesh_light_set(MESH_LIGHT_OFF);
     return ESP_OK;
 }
 
-esp_err_t mesh_light_set(int color)
+static void mesh_light_duty(int color, uint32_t duty[3])
 {
     switch (color) {
     case MESH_LIGHT_OFF:
         /* Green */
-        ledc_set_duty(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0, 0);
-        ledc_set_duty(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_1, 0);
-        ledc_set_duty(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_2, 0);
+        duty[0] = 0;
+        duty[1] = 0;
+        duty[2] = 0;
         break;
     case MESH_LIGHT_ON:
         // Small modification here to make it work (not RGB led)
         /* Blue */
-        ledc_set_duty(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0, 3000);
-        ledc_set_duty(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_1, 3000);
-        ledc_set_duty(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_2, 0);
+        duty[0] = 3000;
+        duty[1] = 3000;
+        duty[2] = 0;
+        break;
+    case MESH_LIGHT_RED:
+        duty[0] = 3000;
+        duty[1] = 0;
+        duty[2] = 0;
+        break;
+    case MESH_LIGHT_GREEN:
+        duty[0] = 0;
+        duty[1] = 3000;
+        duty[2] = 0;
+        break;
+    case MESH_LIGHT_BLUE:
+        duty[0] = 0;
+        duty[1] = 0;
+        duty[2] = 3000;
+        break;
+    case MESH_LIGHT_YELLOW:
+        duty[0] = 3000;
+        duty[1] = 3000;
+        duty[2] = 0;
+        break;
+    case MESH_LIGHT_PINK:
+        duty[0] = 3000;
+        duty[1] = 0;
+        duty[2] = 3000;
+        break;
+    case MESH_LIGHT_INIT:
+        duty[0] = 0;
+        duty[1] = 3000;
+        duty[2] = 3000;
         break;
     default:
         /* off */
-        ledc_set_duty(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0, 3000);
-        ledc_set_duty(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_1, 3000);
-        ledc_set_duty(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_2, 3000);
+        duty[0] = 3000;
+        duty[1] = 3000;
+        duty[2] = 3000;
+    }
+}
+
+static void mesh_light_fade(const uint32_t duty[3], uint16_t fade_ms)
+{
+    /* The fade engine runs in hardware, so this returns without waiting for the fade */
+    for (int ch = LEDC_CHANNEL_0; ch <= LEDC_CHANNEL_2; ch++) {
+        ledc_set_fade_with_time(LEDC_LOW_SPEED_MODE, ch, duty[ch], fade_ms);
+        ledc_fade_start(LEDC_LOW_SPEED_MODE, ch, LEDC_FADE_NO_WAIT);
+    }
+}
+
+/* Must hold s_light_lock. A fired scene goes first: a color requested after it fired is newer */
+static bool mesh_light_take(mesh_light_scene_state_t *next)
+{
+    if (s_scene_fired) {
+        s_scene_fired = false;
+        *next = s_scene_due;
+        return true;
+    }
+    if (!s_light_pending) {
+        return false;
     }
+    s_light_pending = false;
+    if (s_light_requested == s_light_applied) {
+        /* e.g. back to the color on the LEDs before we got to the one in between */
+        s_light_stats.skipped++;
+        return false;
+    }
+    next->color = s_light_requested;
+    next->fade_ms = MESH_LIGHT_FADE_MS;
+    mesh_light_duty(next->color, next->duty);
+    return true;
+}
+
+static void mesh_light_task(void *arg)
+{
+    mesh_light_scene_state_t next;
+    bool work;
 
-    ledc_update_duty(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0);
-    ledc_update_duty(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_1);
-    ledc_update_duty(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_2);
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        do {
+            portENTER_CRITICAL(&s_light_lock);
+            work = mesh_light_take(&next);
+            portEXIT_CRITICAL(&s_light_lock);
+            if (work) {
+                mesh_light_fade(next.duty, next.fade_ms);
+                portENTER_CRITICAL(&s_light_lock);
+                s_light_applied = next.color;
+                s_light_stats.applied++;
+                portEXIT_CRITICAL(&s_light_lock);
+            }
+        } while (work);
+    }
+}
 
+esp_err_t mesh_light_set(int color)
+{
+    if (!s_light_task) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    portENTER_CRITICAL(&s_light_lock);
+    s_light_stats.requested++;
+    if (color == s_light_requested) {
+        /* Same as the last request: nothing to do, not even a notification */
+        s_light_stats.skipped++;
+        portEXIT_CRITICAL(&s_light_lock);
+        return ESP_OK;
+    }
+    s_light_requested = color;
+    if (s_light_pending) {
+        s_light_stats.coalesced++;
+    }
+    s_light_pending = true;
+    portEXIT_CRITICAL(&s_light_lock);
+
+    xTaskNotifyGive(s_light_task);
     return ESP_OK;
 }
 
-void mesh_connected_indicator(int layer)
+void mesh_light_get_stats(mesh_light_stats_t *stats)
 {
-    // switch (layer) {
-    // case 1:
-    //     mesh_light_set(MESH_LIGHT_PINK);
-    //     break;
-    // case 2:
-    //     mesh_light_set(MESH_LIGHT_YELLOW);
-    //     break;
-    // case 3:
-    //     mesh_light_set(MESH_LIGHT_RED);
-    //     break;
-    // case 4:
-    //     mesh_light_set(MESH_LIGHT_BLUE);
-    //     break;
-    // case 5:
-    //     mesh_light_set(MESH_LIGHT_GREEN);
-    //     break;
-    // case 6:
-    //     mesh_light_set(MESH_LIGHT_WARNING);
-    //     break;
-    // default:
-    //     mesh_light_set(0);
-    // }
+    portENTER_CRITICAL(&s_light_lock);
+    memcpy(stats, &s_light_stats, sizeof(mesh_light_stats_t));
+    portEXIT_CRITICAL(&s_light_lock);
 }
 
-void mesh_disconnected_indicator(void)
+/* esp_timer task: hands the staged scene to the LED task */
+static void mesh_light_scene_run(void *arg)
 {
-    //mesh_light_set(MESH_LIGHT_WARNING);
+    portENTER_CRITICAL(&s_light_lock);
+    s_scene_due = s_scene_next;
+    s_scene_fired = true;
+    /* the scene replaces any color still in the mailbox, and later
+     * mesh_light_set() calls compare against it */
+    s_light_pending = false;
+    s_light_requested = s_scene_due.color;
+    portEXIT_CRITICAL(&s_light_lock);
+    xTaskNotifyGive(s_light_task);
 }
 
-esp_err_t mesh_light_process(mesh_addr_t *from, uint8_t *buf, uint16_t len)
+/* `at_us` is on the mesh clock */
+static void mesh_light_scene_schedule(int color, uint16_t fade_ms, int64_t at_us)
 {
-    mesh_light_ctl_t *in = (mesh_light_ctl_t *) buf;
-    if (!from || !buf || len < sizeof(mesh_light_ctl_t)) {
-        return ESP_FAIL;
+    if (color == MESH_LIGHT_LAYER) {
+        color = mesh_light_layer_color(esp_mesh_get_layer());
+    }
+    mesh_light_scene_state_t scene = {
+        .color = color,
+        .fade_ms = fade_ms,
+    };
+    mesh_light_duty(color, scene.duty);
+
+    int64_t wait_us = mesh_time_to_local(at_us) - esp_timer_get_time();
+    /* late is better than never, and a far future means our clock is off */
+    bool late = !mesh_time_is_synced() || wait_us <= 0 || wait_us > MESH_LIGHT_SCENE_MAX_MS * 1000LL;
+
+    esp_timer_stop(s_scene_timer);
+    portENTER_CRITICAL(&s_light_lock);
+    s_scene_next = scene;
+    if (late) {
+        s_light_stats.scenes_late++;
+    } else {
+        s_light_stats.scenes++;
+    }
+    portEXIT_CRITICAL(&s_light_lock);
+    if (late) {
+        mesh_light_scene_run(NULL);
+        return;
     }
-    if (in->token_id != MESH_TOKEN_ID || in->token_value != MESH_TOKEN_VALUE) {
+    esp_timer_start_once(s_scene_timer, wait_us);
+}
+
+esp_err_t mesh_light_scene_send(int color, uint16_t fade_ms)
+{
+    static const mesh_addr_t broadcast = { .addr = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff } };
+    mesh_frame_builder_t b;
+    mesh_light_scene_t scene = {
+        .color = color,
+        .fade_ms = fade_ms,
+    };
+
+    if (!mesh_time_is_synced()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    uint8_t *buf = mesh_comm_alloc(0);
+    if (!buf) {
+        return ESP_ERR_NO_MEM;
+    }
+    /* one broadcast per scene: the lead time covers its trip down the tree */
+    int64_t at_us = mesh_time_now() + CONFIG_MESH_LIGHT_SCENE_LEAD_MS * 1000LL;
+    at_us -= at_us % 1000;
+    scene.at_ms = (uint32_t) (at_us / 1000);
+    mesh_frame_begin(&b, buf, MESH_COMM_BUF_SIZE);
+    uint8_t *data = mesh_frame_append(&b, MESH_FRAME_CMD_LIGHT_SCENE, sizeof(scene));
+    if (!data) {
+        mesh_comm_free(buf);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(data, &scene, sizeof(scene));
+    uint16_t len = mesh_frame_finish(&b);
+
+    mesh_light_scene_schedule(color, fade_ms, at_us);
+    return mesh_comm_send(&broadcast, buf, len, MESH_DATA_P2P);
+}
+
+esp_err_t mesh_light_color_send(const mesh_addr_t *to, int color)
+{
+    uint8_t frame[CONFIG_MESH_REL_MAX_LEN];
+    mesh_frame_builder_t b;
+
+    mesh_frame_begin(&b, frame, sizeof(frame));
+    uint8_t *data = mesh_frame_append(&b, MESH_FRAME_CMD_LIGHT_COLOR, 1);
+    if (!data) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    data[0] = color;
+    /* signed once: retransmits carry the same nonce, the peer's window drops the copies */
+    return mesh_rel_send(to, frame, mesh_frame_finish(&b));
+}
+
+esp_err_t mesh_light_process(mesh_addr_t *from, uint8_t *buf, uint16_t len)
+{
+    mesh_frame_iter_t it;
+    const mesh_frame_cmd_t *cmd;
+    if (!from || mesh_frame_iter_init(&it, from->addr, buf, len) != ESP_OK) {
         return ESP_FAIL;
     }
-    if (in->cmd == MESH_CONTROL_CMD) {
-        if (in->on) {
-            mesh_connected_indicator(esp_mesh_get_layer());
-        } else {
-            mesh_light_set(0);
+    /* Commands are applied in order; the LED task only shows the last color anyway */
+    while ((cmd = mesh_frame_iter_next(&it)) != NULL) {
+        switch (cmd->cmd) {
+        case MESH_FRAME_CMD_LIGHT_ON_OFF:
+            if (cmd->len < 1) {
+                break;
+            }
+            if (cmd->data[0]) {
+                mesh_connected_indicator(esp_mesh_get_layer());
+            } else {
+                mesh_light_set(0);
+            }
+            break;
+        case MESH_FRAME_CMD_LIGHT_COLOR:
+            if (cmd->len >= 1) {
+                mesh_light_set(cmd->data[0]);
+            }
+            break;
+        case MESH_FRAME_CMD_LIGHT_SCENE: {
+            mesh_light_scene_t scene;
+            if (cmd->len < sizeof(mesh_light_scene_t)) {
+                break;
+            }
+            memcpy(&scene, cmd->data, sizeof(mesh_light_scene_t));
+            /* back to a full mesh clock value, around now */
+            int64_t now_ms = mesh_time_now() / 1000;
+            int32_t ahead_ms = (int32_t) (scene.at_ms - (uint32_t) now_ms);
+            mesh_light_scene_schedule(scene.color, scene.fade_ms, (now_ms + ahead_ms) * 1000);
+            break;
+        }
+        default:
+            /* not for us, commands of other modules can share the frame */
+            break;
         }
     }
     return ESP_OK;
@@ -0,0 +1,44 @@
+/* Mesh Light Indicators
+
+   What the LEDs say about the mesh state: the color of the layer once
+   connected, the root included (layer 1), and off without a parent. Only mesh_light_set() is called from here, never the LED
+   driver, so tools/mesh_sim links this file and keeps one LED per
+   simulated node behind its own mesh_light_set().
+*/
+
+#include "esp_err.h"
+#include "esp_mesh.h"
+#include "mesh_light.h"
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+int mesh_light_layer_color(int layer)
+{
+    switch (layer) {
+    case 1:
+        return MESH_LIGHT_PINK;
+    case 2:
+        return MESH_LIGHT_YELLOW;
+    case 3:
+        return MESH_LIGHT_RED;
+    case 4:
+        return MESH_LIGHT_BLUE;
+    case 5:
+        return MESH_LIGHT_GREEN;
+    case 6:
+        return MESH_LIGHT_WARNING;
+    default:
+        return 0;
+    }
+}
+
+void mesh_connected_indicator(int layer)
+{
+    mesh_light_set(mesh_light_layer_color(layer));
+}
+
+void mesh_disconnected_indicator(void)
+{
+    mesh_light_set(MESH_LIGHT_OFF);
+}
@@ -0,0 +1,46 @@
+/* Mesh PackBits
+
+   A header byte n in 0..127 is followed by n + 1 literal bytes, n in
+   -127..-1 by one byte to be repeated 1 - n times; -128 is never
+   written. Only runs of 3 or more are worth encoding as runs: a run of
+   2 inside literals costs nothing extra, and breaking the literals for
+   it would cost a header byte.
+*/
+
+#include <string.h>
+#include "mesh_packbits.h"
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+size_t mesh_packbits_encode(const uint8_t *in, size_t len, uint8_t *out)
+{
+    size_t i = 0;
+    size_t o = 0;
+
+    while (i < len) {
+        size_t run = 1;
+        while (i + run < len && run < 128 && in[i + run] == in[i]) {
+            run++;
+        }
+        if (run >= 3) {
+            out[o++] = (uint8_t) (1 - (int) run);
+            out[o++] = in[i];
+            i += run;
+            continue;
+        }
+        size_t start = i;
+        size_t n = 0;
+        while (i < len && n < 128) {
+            if (i + 2 < len && in[i] == in[i + 1] && in[i] == in[i + 2]) {
+                break;
+            }
+            i++;
+            n++;
+        }
+        out[o++] = (uint8_t) (n - 1);
+        memcpy(out + o, in + start, n);
+        o += n;
+    }
+    return o;
+}
@@ -0,0 +1,346 @@
+/* Mesh Ping
+
+   A ping is a MESH_MSG_TYPE_PING request that the destination answers
+   with a reply carrying its layer and the origin timestamp of the
+   request, so the round trip time is computed on the origin clock alone.
+   Intermediate hops are forwarded inside the mesh driver and cannot be
+   stamped, so per-hop latency is read from the per-layer histograms
+   instead: the difference between layer N and layer N-1 is what the Nth
+   hop costs.
+
+   Outstanding requests sit in a small table indexed by sequence number;
+   a request still there after CONFIG_MESH_PING_TIMEOUT_MS, or whose slot
+   is needed again, counts as lost.
+*/
+
+#include <string.h>
+#include <inttypes.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_mesh.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "mesh_comm.h"
+#include "mesh_route.h"
+#include "mesh_ping.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define MESH_PING_PENDING       (32)    /* power of two */
+#define MESH_PING_PACE_US       (20 * 1000)
+#define MESH_PING_TIMEOUT_US    (CONFIG_MESH_PING_TIMEOUT_MS * 1000LL)
+
+/*******************************************************
+ *                Structures
+ *******************************************************/
+typedef struct {
+    bool used;
+    uint16_t seq;
+    uint8_t mac[6];
+    int64_t sent_us;
+} mesh_ping_pending_t;
+
+typedef struct {
+    mesh_ping_dest_t stats;
+    int64_t last_us;        /* last ping sent, for LRU replacement */
+    bool used;
+} mesh_ping_slot_t;
+
+/*******************************************************
+ *                Variable Definitions
+ *******************************************************/
+static const char *PING_TAG = "mesh_ping";
+
+static mesh_ping_slot_t s_dests[CONFIG_MESH_PING_MAX_DEST];
+static mesh_ping_hist_t s_layers[MESH_PING_LAYERS];
+static mesh_ping_pending_t s_pending[MESH_PING_PENDING];
+static uint16_t s_seq = 0;
+static uint8_t s_self[6];
+static portMUX_TYPE s_ping_lock = portMUX_INITIALIZER_UNLOCKED;
+/* ping-all walks a snapshot of the routing table, one node per pace tick */
+static mesh_addr_t s_all[MESH_ROUTE_MAX];
+static int s_all_count = 0;
+static int s_all_next = 0;
+static uint32_t s_all_generation = 0;
+static esp_timer_handle_t s_pace_timer = NULL;
+static esp_timer_handle_t s_period_timer = NULL;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+static void mesh_ping_hist_add(mesh_ping_hist_t *hist, uint32_t us)
+{
+    int b = 0;
+    while (b < MESH_PING_HIST_BUCKETS - 1 && (us >> (b + 1))) {
+        b++;
+    }
+    hist->hist[b]++;
+    if (!hist->count || us < hist->min_us) {
+        hist->min_us = us;
+    }
+    if (us > hist->max_us) {
+        hist->max_us = us;
+    }
+    hist->sum_us += us;
+    hist->count++;
+}
+
+/* Must hold s_ping_lock */
+static mesh_ping_slot_t *mesh_ping_find(const uint8_t mac[6], bool create)
+{
+    mesh_ping_slot_t *victim = NULL;
+    for (int i = 0; i < CONFIG_MESH_PING_MAX_DEST; i++) {
+        mesh_ping_slot_t *slot = &s_dests[i];
+        if (slot->used && memcmp(slot->stats.mac, mac, 6) == 0) {
+            return slot;
+        }
+        if (!victim || (victim->used && (!slot->used || slot->last_us < victim->last_us))) {
+            victim = slot;
+        }
+    }
+    if (!create) {
+        return NULL;
+    }
+    memset(victim, 0, sizeof(mesh_ping_slot_t));
+    memcpy(victim->stats.mac, mac, 6);
+    victim->used = true;
+    return victim;
+}
+
+/* Must hold s_ping_lock */
+static void mesh_ping_lose(mesh_ping_pending_t *p)
+{
+    mesh_ping_slot_t *slot = mesh_ping_find(p->mac, false);
+    if (slot) {
+        slot->stats.lost++;
+    }
+    p->used = false;
+}
+
+static void mesh_ping_expire(void)
+{
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&s_ping_lock);
+    for (int i = 0; i < MESH_PING_PENDING; i++) {
+        if (s_pending[i].used && now - s_pending[i].sent_us > MESH_PING_TIMEOUT_US) {
+            mesh_ping_lose(&s_pending[i]);
+        }
+    }
+    portEXIT_CRITICAL(&s_ping_lock);
+}
+
+esp_err_t mesh_ping_send(const uint8_t mac[6])
+{
+    mesh_addr_t to;
+    mesh_ping_msg_t msg = {
+        .type = MESH_MSG_TYPE_PING,
+        .op = MESH_PING_OP_REQUEST,
+        .layer = esp_mesh_get_layer(),
+    };
+    uint8_t *buf = mesh_comm_alloc(0);
+    if (!buf) {
+        return ESP_ERR_NO_MEM;
+    }
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&s_ping_lock);
+    msg.seq = s_seq++;
+    mesh_ping_pending_t *p = &s_pending[msg.seq & (MESH_PING_PENDING - 1)];
+    if (p->used) {
+        mesh_ping_lose(p);
+    }
+    mesh_ping_slot_t *slot = mesh_ping_find(mac, true);
+    slot->stats.sent++;
+    slot->last_us = now;
+    p->used = true;
+    p->seq = msg.seq;
+    p->sent_us = now;
+    memcpy(p->mac, mac, 6);
+    portEXIT_CRITICAL(&s_ping_lock);
+
+    msg.sent_us = (uint32_t) now;
+    memcpy(buf, &msg, sizeof(mesh_ping_msg_t));
+    memcpy(to.addr, mac, 6);
+    return mesh_comm_send(&to, buf, sizeof(mesh_ping_msg_t), MESH_DATA_P2P);
+}
+
+static void mesh_ping_pace(void *arg)
+{
+    mesh_addr_t to;
+
+    mesh_ping_expire();
+    do {
+        if (s_all_next >= s_all_count) {
+            esp_timer_stop(s_pace_timer);
+            return;
+        }
+        to = s_all[s_all_next++];
+    } while (memcmp(to.addr, s_self, 6) == 0);
+    mesh_ping_send(to.addr);
+}
+
+esp_err_t mesh_ping_all(void)
+{
+    if (esp_timer_is_active(s_pace_timer)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    mesh_route_snapshot(s_all, MESH_ROUTE_MAX, &s_all_count, &s_all_generation);
+    s_all_next = 0;
+    return esp_timer_start_periodic(s_pace_timer, MESH_PING_PACE_US);
+}
+
+static void mesh_ping_period(void *arg)
+{
+    if (esp_mesh_is_root()) {
+        /* results of the previous round, before this one starts */
+        mesh_ping_dump();
+        mesh_ping_all();
+    }
+}
+
+static esp_err_t mesh_ping_process(mesh_addr_t *from, uint8_t *buf, uint16_t len)
+{
+    mesh_ping_msg_t msg;
+    if (len < sizeof(mesh_ping_msg_t)) {
+        return ESP_FAIL;
+    }
+    memcpy(&msg, buf, sizeof(mesh_ping_msg_t));
+
+    if (msg.op == MESH_PING_OP_REQUEST) {
+        uint8_t *reply = mesh_comm_alloc(0);
+        if (!reply) {
+            return ESP_ERR_NO_MEM;
+        }
+        msg.op = MESH_PING_OP_REPLY;
+        msg.layer = esp_mesh_get_layer();
+        memcpy(reply, &msg, sizeof(mesh_ping_msg_t));
+        return mesh_comm_send(from, reply, sizeof(mesh_ping_msg_t), MESH_DATA_P2P);
+    }
+    if (msg.op != MESH_PING_OP_REPLY) {
+        return ESP_FAIL;
+    }
+
+    uint32_t rtt = (uint32_t) esp_timer_get_time() - msg.sent_us;
+    int layer = msg.layer < 1 ? 1 : (msg.layer > MESH_PING_LAYERS ? MESH_PING_LAYERS : msg.layer);
+    bool late = false;
+
+    portENTER_CRITICAL(&s_ping_lock);
+    mesh_ping_pending_t *p = &s_pending[msg.seq & (MESH_PING_PENDING - 1)];
+    if (!p->used || p->seq != msg.seq || memcmp(p->mac, from->addr, 6) != 0) {
+        /* already counted as lost */
+        late = true;
+    } else {
+        p->used = false;
+        mesh_ping_slot_t *slot = mesh_ping_find(from->addr, true);
+        slot->stats.layer = msg.layer;
+        mesh_ping_hist_add(&slot->stats.rtt, rtt);
+        mesh_ping_hist_add(&s_layers[layer - 1], rtt);
+    }
+    portEXIT_CRITICAL(&s_ping_lock);
+    if (late) {
+        ESP_LOGD(PING_TAG, "late reply %u from "MACSTR", %" PRIu32 " us", msg.seq, MAC2STR(from->addr), rtt);
+    }
+    return ESP_OK;
+}
+
+int mesh_ping_get_dests(mesh_ping_dest_t *dests, int max)
+{
+    int n = 0;
+
+    mesh_ping_expire();
+    portENTER_CRITICAL(&s_ping_lock);
+    for (int i = 0; i < CONFIG_MESH_PING_MAX_DEST && n < max; i++) {
+        if (s_dests[i].used) {
+            dests[n++] = s_dests[i].stats;
+        }
+    }
+    portEXIT_CRITICAL(&s_ping_lock);
+    return n;
+}
+
+void mesh_ping_get_layer(int layer, mesh_ping_hist_t *hist)
+{
+    layer = layer < 1 ? 1 : (layer > MESH_PING_LAYERS ? MESH_PING_LAYERS : layer);
+    portENTER_CRITICAL(&s_ping_lock);
+    memcpy(hist, &s_layers[layer - 1], sizeof(mesh_ping_hist_t));
+    portEXIT_CRITICAL(&s_ping_lock);
+}
+
+uint32_t mesh_ping_percentile(const mesh_ping_hist_t *hist, int pct)
+{
+    uint64_t want = ((uint64_t) hist->count * pct + 99) / 100;
+    uint64_t seen = 0;
+
+    for (int b = 0; b < MESH_PING_HIST_BUCKETS; b++) {
+        seen += hist->hist[b];
+        if (seen >= want && seen) {
+            uint32_t upper = b < MESH_PING_HIST_BUCKETS - 1 ? (2u << b) : hist->max_us;
+            return upper < hist->max_us ? upper : hist->max_us;
+        }
+    }
+    return 0;
+}
+
+void mesh_ping_dump(void)
+{
+    static mesh_ping_dest_t dests[CONFIG_MESH_PING_MAX_DEST];
+    mesh_ping_hist_t hist;
+    int n = mesh_ping_get_dests(dests, CONFIG_MESH_PING_MAX_DEST);
+
+    for (int i = 0; i < n; i++) {
+        const mesh_ping_hist_t *h = &dests[i].rtt;
+        ESP_LOGI(PING_TAG, MACSTR" L%d sent:%" PRIu32 " lost:%" PRIu32 " rtt min:%" PRIu32 " avg:%" PRIu32
+                 " p50:%" PRIu32 " p99:%" PRIu32 " max:%" PRIu32 " us", MAC2STR(dests[i].mac), dests[i].layer,
+                 dests[i].sent, dests[i].lost, h->min_us, h->count ? (uint32_t)(h->sum_us / h->count) : 0,
+                 mesh_ping_percentile(h, 50), mesh_ping_percentile(h, 99), h->max_us);
+    }
+    for (int layer = 1; layer <= MESH_PING_LAYERS; layer++) {
+        mesh_ping_get_layer(layer, &hist);
+        if (!hist.count) {
+            continue;
+        }
+        ESP_LOGI(PING_TAG, "layer %d%s: %" PRIu32 " replies, rtt avg:%" PRIu32 " p50:%" PRIu32 " p99:%" PRIu32 " us",
+                 layer, layer == MESH_PING_LAYERS ? "+" : "", hist.count, (uint32_t)(hist.sum_us / hist.count),
+                 mesh_ping_percentile(&hist, 50), mesh_ping_percentile(&hist, 99));
+    }
+}
+
+void mesh_ping_reset(void)
+{
+    portENTER_CRITICAL(&s_ping_lock);
+    memset(s_dests, 0, sizeof(s_dests));
+    memset(s_layers, 0, sizeof(s_layers));
+    memset(s_pending, 0, sizeof(s_pending));
+    portEXIT_CRITICAL(&s_ping_lock);
+}
+
+esp_err_t mesh_ping_init(void)
+{
+    esp_timer_create_args_t pace_args = {
+        .callback = mesh_ping_pace,
+        .name = "mesh_ping_pace",
+    };
+    esp_timer_create_args_t period_args = {
+        .callback = mesh_ping_period,
+        .name = "mesh_ping",
+    };
+    ESP_ERROR_CHECK(esp_read_mac(s_self, ESP_MAC_WIFI_STA));
+    ESP_ERROR_CHECK(esp_timer_create(&pace_args, &s_pace_timer));
+    ESP_ERROR_CHECK(esp_timer_create(&period_args, &s_period_timer));
+    return mesh_comm_register_handler(MESH_MSG_TYPE_PING, mesh_ping_process);
+}
+
+esp_err_t mesh_ping_start(void)
+{
+#if CONFIG_MESH_PING_PERIOD_S > 0
+    if (esp_timer_is_active(s_period_timer)) {
+        return ESP_OK;
+    }
+    return esp_timer_start_periodic(s_period_timer, CONFIG_MESH_PING_PERIOD_S * 1000000ULL);
+#else
+    return ESP_OK;
+#endif
+}
@@ -0,0 +1,82 @@
+/* Mesh Startup Profiler
+
+   Phases are marked in the order they finish. A phase's duration is the
+   time since the previous mark, and its heap delta the change in free
+   heap over the same interval, so the phases tile the whole startup.
+*/
+
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_system.h"
+#include "freertos/FreeRTOS.h"
+#include "mesh_prof.h"
+
+/*******************************************************
+ *                Variable Definitions
+ *******************************************************/
+static const char *PROF_TAG = "mesh_prof";
+
+static struct __attribute__((packed)) {
+    mesh_prof_hdr_t hdr;
+    mesh_prof_entry_t entries[MESH_PROF_PHASE_MAX];
+} s_record;
+static uint32_t s_marked = 0;   /* bitmap of phases already recorded */
+static uint32_t s_last_heap = 0;
+static bool s_emitted = false;
+static portMUX_TYPE s_prof_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+void mesh_prof_begin(void)
+{
+    s_record.hdr.magic = MESH_PROF_MAGIC;
+    s_record.hdr.version = MESH_PROF_VERSION;
+    s_record.hdr.start_us = (uint32_t) esp_timer_get_time();
+    s_record.hdr.start_heap = esp_get_free_heap_size();
+    s_last_heap = s_record.hdr.start_heap;
+}
+
+void mesh_prof_mark(mesh_prof_phase_t phase)
+{
+    if (phase >= MESH_PROF_PHASE_MAX) {
+        return;
+    }
+    /* app_main() and the event task can both be marking at this point */
+    portENTER_CRITICAL(&s_prof_lock);
+    if ((s_marked & (1 << phase)) || s_emitted) {
+        portEXIT_CRITICAL(&s_prof_lock);
+        return;
+    }
+    uint32_t heap = esp_get_free_heap_size();
+    mesh_prof_entry_t *e = &s_record.entries[s_record.hdr.count++];
+    e->phase = phase;
+    e->end_us = (uint32_t) esp_timer_get_time() - s_record.hdr.start_us;
+    e->heap_delta = (int32_t) heap - (int32_t) s_last_heap;
+    s_last_heap = heap;
+    s_marked |= 1 << phase;
+    portEXIT_CRITICAL(&s_prof_lock);
+}
+
+void mesh_prof_emit(void)
+{
+    static const char hex[] = "0123456789abcdef";
+    static char line[2 * sizeof(s_record) + 1];
+    portENTER_CRITICAL(&s_prof_lock);
+    if (s_emitted) {
+        portEXIT_CRITICAL(&s_prof_lock);
+        return;
+    }
+    s_emitted = true;
+    portEXIT_CRITICAL(&s_prof_lock);
+
+    const uint8_t *raw = (const uint8_t *) &s_record;
+    size_t len = sizeof(mesh_prof_hdr_t) + s_record.hdr.count * sizeof(mesh_prof_entry_t);
+    for (size_t i = 0; i < len; i++) {
+        line[2 * i] = hex[raw[i] >> 4];
+        line[2 * i + 1] = hex[raw[i] & 0xf];
+    }
+    line[2 * len] = '\0';
+    ESP_LOGI(PROF_TAG, "record:%s", line);
+}
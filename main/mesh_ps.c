@@ -0,0 +1,231 @@
+/* Mesh Power Save Tuner
+
+   Every CONFIG_MESH_PS_PERIOD_MS the node looks at how many packets it
+   sent and received and at the driver TX/RX queues. A busy node doubles
+   its device duty cycle at once; a node that stayed idle for
+   CONFIG_MESH_PS_IDLE_PERIODS periods in a row lowers it by one step.
+   The gap between the busy and idle thresholds, plus the idle streak,
+   keep the duty cycle from bouncing on bursty traffic.
+
+   A parent never goes below the highest duty cycle announced by its
+   children (MESH_EVENT_PS_CHILD_DUTY), otherwise a busy child would be
+   throttled by a sleepy parent. The root does not sleep, so it keeps
+   its duty cycle.
+
+   Energy is accounted as duty x time (the time spent awake) and latency
+   as the mean time packets waited in the mesh_comm TX queue.
+*/
+
+#include <string.h>
+#include <inttypes.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_mesh.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "mesh_comm.h"
+#include "mesh_ps.h"
+
+#ifdef CONFIG_MESH_PS_AUTO
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define MESH_PS_PERIOD_US       (CONFIG_MESH_PS_PERIOD_MS * 1000ULL)
+#define MESH_PS_DUTY_MIN        (CONFIG_MESH_PS_DUTY_MIN)
+#define MESH_PS_DUTY_MAX        (CONFIG_MESH_PS_DUTY_MAX)
+#define MESH_PS_DUTY_STEP       (10)
+#define MESH_PS_MAX_CHILDREN    (CONFIG_MESH_AP_CONNECTIONS)
+
+/*******************************************************
+ *                Variable Definitions
+ *******************************************************/
+static const char *PS_TAG = "mesh_ps";
+
+static mesh_ps_stats_t s_ps;
+static uint8_t s_child_duty[MESH_PS_MAX_CHILDREN];
+static portMUX_TYPE s_ps_lock = portMUX_INITIALIZER_UNLOCKED;
+static esp_timer_handle_t s_ps_timer = NULL;
+static int64_t s_last_us = 0;
+static uint32_t s_last_packets = 0;
+static uint32_t s_last_tx = 0;
+static uint64_t s_last_wait_us = 0;
+static int s_idle_periods = 0;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+static int mesh_ps_clamp(int duty)
+{
+    duty = duty < MESH_PS_DUTY_MIN ? MESH_PS_DUTY_MIN : duty;
+    return duty > MESH_PS_DUTY_MAX ? MESH_PS_DUTY_MAX : duty;
+}
+
+static int mesh_ps_pending(void)
+{
+    mesh_tx_pending_t tx = { 0 };
+    mesh_rx_pending_t rx = { 0 };
+    esp_mesh_get_tx_pending(&tx);
+    esp_mesh_get_rx_pending(&rx);
+    /* management and broadcast frames are always around, only count data */
+    return tx.to_parent + tx.to_parent_p2p + tx.to_child + tx.to_child_p2p + rx.toSelf;
+}
+
+static void mesh_ps_sample(void *arg)
+{
+    mesh_comm_stats_t comm;
+    mesh_comm_get_stats(&comm);
+    int pending = mesh_ps_pending();
+    int64_t now = esp_timer_get_time();
+    uint32_t dt_ms = (uint32_t)((now - s_last_us) / 1000);
+    uint32_t packets = comm.rx_packets + comm.tx_packets;
+    uint32_t sent = comm.tx_packets - s_last_tx;
+    uint64_t wait_us = comm.tx_wait_us_total - s_last_wait_us;
+
+    if (dt_ms == 0) {
+        return;
+    }
+    s_last_us = now;
+    uint32_t pps = (uint32_t)((uint64_t)(packets - s_last_packets) * 1000 / dt_ms);
+    s_last_packets = packets;
+    s_last_tx = comm.tx_packets;
+    s_last_wait_us = comm.tx_wait_us_total;
+
+    portENTER_CRITICAL(&s_ps_lock);
+    int duty = s_ps.duty;
+    int target = duty;
+    s_ps.load_pps = pps;
+    s_ps.active_ms += (uint64_t) duty * dt_ms / 100;
+    s_ps.total_ms += dt_ms;
+    if (sent) {
+        s_ps.tx_wait_us_avg = (uint32_t)(wait_us / sent);
+        if (s_ps.tx_wait_us_avg > s_ps.tx_wait_us_max) {
+            s_ps.tx_wait_us_max = s_ps.tx_wait_us_avg;
+        }
+    }
+    if (pps >= CONFIG_MESH_PS_BUSY_PPS || pending > 0) {
+        s_idle_periods = 0;
+        target = duty * 2;
+    } else if (pps <= CONFIG_MESH_PS_IDLE_PPS) {
+        if (++s_idle_periods >= CONFIG_MESH_PS_IDLE_PERIODS) {
+            s_idle_periods = 0;
+            target = duty - MESH_PS_DUTY_STEP;
+        }
+    } else {
+        s_idle_periods = 0;
+    }
+    target = target < s_ps.child_duty ? s_ps.child_duty : target;
+    target = mesh_ps_clamp(target);
+    portEXIT_CRITICAL(&s_ps_lock);
+
+    if (target == duty || esp_mesh_is_root()) {
+        return;
+    }
+    esp_err_t err = esp_mesh_set_active_duty_cycle(target, CONFIG_MESH_PS_DEV_DUTY_TYPE);
+    if (err != ESP_OK) {
+        ESP_LOGW(PS_TAG, "set duty %d failed:0x%x", target, err);
+        return;
+    }
+    portENTER_CRITICAL(&s_ps_lock);
+    s_ps.duty = target;
+    if (target > duty) {
+        s_ps.raises++;
+    } else {
+        s_ps.lowers++;
+    }
+    portEXIT_CRITICAL(&s_ps_lock);
+    ESP_LOGD(PS_TAG, "duty %d-->%d, load:%" PRIu32 " pps, pending:%d", duty, target, pps, pending);
+}
+
+void mesh_ps_on_parent_duty(uint8_t duty)
+{
+    portENTER_CRITICAL(&s_ps_lock);
+    s_ps.parent_duty = duty;
+    portEXIT_CRITICAL(&s_ps_lock);
+}
+
+void mesh_ps_on_child_duty(uint16_t aid, uint8_t duty)
+{
+    /* aid starts from 1 */
+    if (aid == 0 || aid > MESH_PS_MAX_CHILDREN) {
+        return;
+    }
+    portENTER_CRITICAL(&s_ps_lock);
+    s_child_duty[aid - 1] = duty;
+    s_ps.child_duty = 0;
+    for (int i = 0; i < MESH_PS_MAX_CHILDREN; i++) {
+        if (s_child_duty[i] > s_ps.child_duty) {
+            s_ps.child_duty = s_child_duty[i];
+        }
+    }
+    portEXIT_CRITICAL(&s_ps_lock);
+}
+
+void mesh_ps_get_stats(mesh_ps_stats_t *stats)
+{
+    portENTER_CRITICAL(&s_ps_lock);
+    memcpy(stats, &s_ps, sizeof(mesh_ps_stats_t));
+    portEXIT_CRITICAL(&s_ps_lock);
+}
+
+esp_err_t mesh_ps_init(void)
+{
+    int duty = CONFIG_MESH_PS_DEV_DUTY;
+    int type = CONFIG_MESH_PS_DEV_DUTY_TYPE;
+    esp_timer_create_args_t timer_args = {
+        .callback = mesh_ps_sample,
+        .name = "mesh_ps",
+    };
+    if (s_ps_timer) {
+        return ESP_OK;
+    }
+    /* start from whatever app_main configured */
+    esp_mesh_get_active_duty_cycle(&duty, &type);
+    s_ps.duty = mesh_ps_clamp(duty);
+    return esp_timer_create(&timer_args, &s_ps_timer);
+}
+
+esp_err_t mesh_ps_start(void)
+{
+    if (!s_ps_timer) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (esp_timer_is_active(s_ps_timer)) {
+        return ESP_OK;
+    }
+    mesh_comm_stats_t comm;
+    mesh_comm_get_stats(&comm);
+    s_last_us = esp_timer_get_time();
+    s_last_packets = comm.rx_packets + comm.tx_packets;
+    s_last_tx = comm.tx_packets;
+    s_last_wait_us = comm.tx_wait_us_total;
+    return esp_timer_start_periodic(s_ps_timer, MESH_PS_PERIOD_US);
+}
+
+#else /* CONFIG_MESH_PS_AUTO */
+
+/* Fixed duty cycle: nothing to tune */
+esp_err_t mesh_ps_init(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t mesh_ps_start(void)
+{
+    return ESP_OK;
+}
+
+void mesh_ps_on_parent_duty(uint8_t duty)
+{
+}
+
+void mesh_ps_on_child_duty(uint16_t aid, uint8_t duty)
+{
+}
+
+void mesh_ps_get_stats(mesh_ps_stats_t *stats)
+{
+    memset(stats, 0, sizeof(mesh_ps_stats_t));
+}
+
+#endif /* CONFIG_MESH_PS_AUTO */
@@ -0,0 +1,189 @@
+/* Mesh Fast Rejoin
+
+   After a power blip every node scanning all channels and voting at the
+   same time is what makes reconvergence slow. With a stored hint the node
+   listens only on the stored channel and asks for the stored parent with
+   esp_mesh_set_parent(). If that parent does not show up (NO_PARENT_FOUND
+   or CONFIG_MESH_FAST_REJOIN_TIMEOUT_MS) the hint is dropped and
+   self-organized networking is turned back on, which is the normal scan.
+*/
+
+#include <string.h>
+#include <inttypes.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_mesh.h"
+#include "esp_timer.h"
+#include "nvs.h"
+#include "mesh_rejoin.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define MESH_REJOIN_NVS_NAMESPACE   "mesh_rejoin"
+#define MESH_REJOIN_NVS_KEY         "parent"
+#define MESH_REJOIN_VERSION         (1)
+
+/*******************************************************
+ *                Structures
+ *******************************************************/
+typedef struct {
+    uint8_t version;
+    uint8_t bssid[6];
+    uint8_t channel;
+    uint8_t layer;
+} mesh_rejoin_hint_t;
+
+/*******************************************************
+ *                Variable Definitions
+ *******************************************************/
+static const char *REJOIN_TAG = "mesh_rejoin";
+
+static mesh_rejoin_hint_t s_hint;
+static bool s_hint_valid = false;
+static bool s_trying = false;
+static bool s_joined = false;
+static int64_t s_start_us = 0;
+static esp_timer_handle_t s_timeout_timer = NULL;
+static mesh_rejoin_stats_t s_stats;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+static void mesh_rejoin_fallback(const char *why)
+{
+    if (!s_trying) {
+        return;
+    }
+    s_trying = false;
+    s_stats.fallbacks++;
+    esp_timer_stop(s_timeout_timer);
+    ESP_LOGW(REJOIN_TAG, "parent "MACSTR" not reachable (%s), scanning", MAC2STR(s_hint.bssid), why);
+    /* self-organized again, and select a parent now */
+    esp_mesh_set_self_organized(true, true);
+}
+
+static void mesh_rejoin_timeout(void *arg)
+{
+    mesh_rejoin_fallback("timeout");
+}
+
+static void mesh_rejoin_save(const mesh_rejoin_hint_t *hint)
+{
+    nvs_handle_t nvs;
+    if (nvs_open(MESH_REJOIN_NVS_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK) {
+        return;
+    }
+    if (nvs_set_blob(nvs, MESH_REJOIN_NVS_KEY, hint, sizeof(*hint)) == ESP_OK) {
+        nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+}
+
+esp_err_t mesh_rejoin_init(void)
+{
+    nvs_handle_t nvs;
+    size_t len = sizeof(s_hint);
+
+    esp_timer_create_args_t timer_args = {
+        .callback = mesh_rejoin_timeout,
+        .name = "mesh_rejoin",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &s_timeout_timer));
+
+    if (nvs_open(MESH_REJOIN_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        /* first boot: the namespace does not exist yet */
+        return ESP_OK;
+    }
+    if (nvs_get_blob(nvs, MESH_REJOIN_NVS_KEY, &s_hint, &len) == ESP_OK
+            && len == sizeof(s_hint) && s_hint.version == MESH_REJOIN_VERSION) {
+        s_hint_valid = true;
+        ESP_LOGI(REJOIN_TAG, "stored parent:"MACSTR", channel:%d, layer:%d",
+                 MAC2STR(s_hint.bssid), s_hint.channel, s_hint.layer);
+    }
+    nvs_close(nvs);
+    return ESP_OK;
+}
+
+void mesh_rejoin_apply(mesh_cfg_t *cfg)
+{
+#ifdef CONFIG_MESH_FAST_REJOIN
+    /* a channel fixed in menuconfig always wins over the stored one */
+    if (s_hint_valid && cfg->channel == 0 && s_hint.channel != 0) {
+        cfg->channel = s_hint.channel;
+        cfg->allow_channel_switch = true;
+    }
+#endif
+}
+
+esp_err_t mesh_rejoin_try_parent(const uint8_t bssid[6], uint8_t channel, int layer)
+{
+    wifi_config_t parent = { 0 };
+    memcpy(parent.sta.bssid, bssid, 6);
+    parent.sta.bssid_set = true;
+    parent.sta.channel = channel;
+    return esp_mesh_set_parent(&parent, NULL, MESH_NODE, layer);
+}
+
+esp_err_t mesh_rejoin_start(void)
+{
+    s_start_us = esp_timer_get_time();
+    s_joined = false;
+#ifdef CONFIG_MESH_FAST_REJOIN
+    /* the root's parent is the router: the channel hint is all it needs */
+    if (!s_hint_valid || s_hint.layer <= MESH_ROOT_LAYER) {
+        return ESP_OK;
+    }
+    esp_err_t err = mesh_rejoin_try_parent(s_hint.bssid, s_hint.channel, s_hint.layer);
+    if (err != ESP_OK) {
+        ESP_LOGW(REJOIN_TAG, "set parent failed:0x%x", err);
+        return err;
+    }
+    s_trying = true;
+    s_stats.fast_path = true;
+    esp_timer_start_once(s_timeout_timer, CONFIG_MESH_FAST_REJOIN_TIMEOUT_MS * 1000ULL);
+#endif
+    return ESP_OK;
+}
+
+void mesh_rejoin_on_connected(const mesh_event_connected_t *connected)
+{
+    if (!s_joined) {
+        s_joined = true;
+        s_stats.join_us = esp_timer_get_time() - s_start_us;
+        if (s_trying && memcmp(connected->connected.bssid, s_hint.bssid, 6) == 0) {
+            s_stats.fast_hit = true;
+        }
+        ESP_LOGI(REJOIN_TAG, "time to parent:%" PRId64 " ms (%s)", s_stats.join_us / 1000,
+                 s_stats.fast_hit ? "fast rejoin" : "scan");
+    }
+    if (s_trying) {
+        s_trying = false;
+        esp_timer_stop(s_timeout_timer);
+        /* keep self-healing on, but stay with the parent we just got */
+        esp_mesh_set_self_organized(true, false);
+    }
+
+    mesh_rejoin_hint_t hint = {
+        .version = MESH_REJOIN_VERSION,
+        .channel = connected->connected.channel,
+        .layer = connected->self_layer,
+    };
+    memcpy(hint.bssid, connected->connected.bssid, 6);
+    /* only touch the flash when something changed */
+    if (!s_hint_valid || memcmp(&hint, &s_hint, sizeof(hint)) != 0) {
+        s_hint = hint;
+        s_hint_valid = true;
+        mesh_rejoin_save(&hint);
+    }
+}
+
+void mesh_rejoin_on_no_parent(void)
+{
+    mesh_rejoin_fallback("no parent found");
+}
+
+void mesh_rejoin_get_stats(mesh_rejoin_stats_t *stats)
+{
+    memcpy(stats, &s_stats, sizeof(mesh_rejoin_stats_t));
+}
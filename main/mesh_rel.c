@@ -0,0 +1,436 @@
+/* Mesh Reliable Delivery
+
+   mesh_rel_send() copies the message into one of CONFIG_MESH_REL_SLOTS
+   retransmit slots, gives it the next sequence number towards that peer
+   and sends it behind a mesh_rel_hdr_t. The slot is resent with an
+   exponential backoff from CONFIG_MESH_REL_RTO_MS until the peer
+   acknowledges it, or dropped after CONFIG_MESH_REL_MAX_TRIES sends.
+
+   The receiver keeps, per peer, the lowest sequence number not yet
+   received and a 32 bit bitmap of what arrived above it, which is enough
+   to deliver every message at most once even out of order. The same two
+   fields are the ACK: cumulative plus selective. ACKs ride on the next
+   reliable message going back to the peer; only if none leaves within
+   CONFIG_MESH_REL_ACK_DELAY_MS is an ACK-only packet sent, and that one
+   covers everything received in the meantime.
+
+   Every peer entry gets a random epoch when it is created and numbers
+   its messages from 0. Each data packet also carries `base`, the lowest
+   sequence number the sender still retransmits. A peer that sees a new
+   epoch (we rebooted, or dropped and re-created the entry) starts its
+   receive window at `base` rather than at whichever message happened to
+   arrive first, so a lost or reordered first message is still delivered.
+   Within an epoch the window slides up to `base` when the sender gives
+   up on a message, instead of waiting for it forever. The sender never
+   gets more than the window ahead of `base`, since the receiver could
+   not take those messages until the oldest one is through.
+*/
+
+#include <string.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_mesh.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "mesh_comm.h"
+#include "mesh_rel.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define MESH_REL_MAX_PEERS      (CONFIG_MESH_REL_MAX_PEERS)
+#define MESH_REL_SLOTS          (CONFIG_MESH_REL_SLOTS)
+#define MESH_REL_MAX_LEN        (CONFIG_MESH_REL_MAX_LEN)
+#define MESH_REL_RTO_US         (CONFIG_MESH_REL_RTO_MS * 1000LL)
+#define MESH_REL_ACK_DELAY_US   (CONFIG_MESH_REL_ACK_DELAY_MS * 1000LL)
+#define MESH_REL_TICK_US        (CONFIG_MESH_REL_ACK_DELAY_MS * 1000ULL)
+#define MESH_REL_BACKOFF_MAX    (4)     /* the RTO doubles at most this many times */
+#define MESH_REL_WINDOW         (32)
+
+/*******************************************************
+ *                Structures
+ *******************************************************/
+typedef struct {
+    bool used;
+    uint8_t mac[6];
+    int64_t last_us;        /* for LRU replacement */
+    uint16_t tx_epoch;
+    uint16_t tx_seq;        /* next seq to send */
+    bool rx_valid;
+    uint16_t rx_epoch;
+    uint16_t rx_next;       /* every seq below was received */
+    uint32_t rx_bitmap;     /* bit i set: rx_next + i was received (bit 0 never is) */
+    bool ack_pending;
+    int64_t ack_due_us;
+} mesh_rel_peer_t;
+
+typedef struct {
+    bool used;
+    uint8_t peer;           /* index in s_peers */
+    uint8_t tries;
+    uint16_t seq;
+    uint16_t len;
+    int64_t next_us;        /* next (re)transmission */
+    uint8_t data[MESH_REL_MAX_LEN];
+} mesh_rel_slot_t;
+
+/*******************************************************
+ *                Variable Definitions
+ *******************************************************/
+static const char *REL_TAG = "mesh_rel";
+
+static mesh_rel_peer_t s_peers[MESH_REL_MAX_PEERS];
+static mesh_rel_slot_t s_slots[MESH_REL_SLOTS];
+static mesh_rel_stats_t s_stats;
+static portMUX_TYPE s_rel_lock = portMUX_INITIALIZER_UNLOCKED;
+static esp_timer_handle_t s_tick_timer = NULL;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+/* Must hold s_rel_lock */
+static void mesh_rel_drop_slots(int peer)
+{
+    for (int i = 0; i < MESH_REL_SLOTS; i++) {
+        if (s_slots[i].used && s_slots[i].peer == peer) {
+            s_slots[i].used = false;
+            s_stats.tx_failed++;
+        }
+    }
+}
+
+/* Must hold s_rel_lock */
+static int mesh_rel_find_peer(const uint8_t mac[6])
+{
+    int victim = 0;
+    for (int i = 0; i < MESH_REL_MAX_PEERS; i++) {
+        if (s_peers[i].used && memcmp(s_peers[i].mac, mac, 6) == 0) {
+            return i;
+        }
+        if (s_peers[victim].used && (!s_peers[i].used || s_peers[i].last_us < s_peers[victim].last_us)) {
+            victim = i;
+        }
+    }
+    if (s_peers[victim].used) {
+        mesh_rel_drop_slots(victim);
+    }
+    memset(&s_peers[victim], 0, sizeof(mesh_rel_peer_t));
+    s_peers[victim].used = true;
+    s_peers[victim].tx_epoch = esp_random();
+    memcpy(s_peers[victim].mac, mac, 6);
+    return victim;
+}
+
+/* Must hold s_rel_lock */
+static uint16_t mesh_rel_base(int peer)
+{
+    uint16_t base = s_peers[peer].tx_seq;
+    for (int i = 0; i < MESH_REL_SLOTS; i++) {
+        if (s_slots[i].used && s_slots[i].peer == peer && (int16_t)(s_slots[i].seq - base) < 0) {
+            base = s_slots[i].seq;
+        }
+    }
+    return base;
+}
+
+/* Must hold s_rel_lock */
+static void mesh_rel_fill_ack(mesh_rel_peer_t *peer, mesh_rel_hdr_t *hdr)
+{
+    if (!peer->rx_valid) {
+        return;
+    }
+    hdr->flags |= MESH_REL_FLAG_ACK;
+    hdr->ack_epoch = peer->rx_epoch;
+    hdr->ack = peer->rx_next;
+    hdr->sack = peer->rx_bitmap >> 1;
+    peer->ack_pending = false;
+}
+
+/* Must hold s_rel_lock */
+static void mesh_rel_acked(int peer, uint16_t ack, uint32_t sack)
+{
+    for (int i = 0; i < MESH_REL_SLOTS; i++) {
+        mesh_rel_slot_t *slot = &s_slots[i];
+        if (!slot->used || slot->peer != peer) {
+            continue;
+        }
+        int16_t d = (int16_t)(slot->seq - ack);
+        if (d < 0 || (d >= 1 && d <= MESH_REL_WINDOW && (sack & (1UL << (d - 1))))) {
+            slot->used = false;
+        }
+    }
+}
+
+static void mesh_rel_arm(void)
+{
+    if (!esp_timer_is_active(s_tick_timer)) {
+        esp_timer_start_once(s_tick_timer, MESH_REL_TICK_US);
+    }
+}
+
+static void mesh_rel_transmit(int i)
+{
+    mesh_rel_hdr_t hdr = {
+        .type = MESH_MSG_TYPE_REL,
+        .flags = MESH_REL_FLAG_DATA,
+    };
+    mesh_addr_t to;
+    uint16_t len = 0;
+    uint8_t *buf = mesh_comm_alloc(0);
+    if (!buf) {
+        /* the tick tries again */
+        return;
+    }
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&s_rel_lock);
+    mesh_rel_slot_t *slot = &s_slots[i];
+    if (slot->used) {
+        mesh_rel_peer_t *peer = &s_peers[slot->peer];
+        hdr.epoch = peer->tx_epoch;
+        hdr.seq = slot->seq;
+        hdr.base = mesh_rel_base(slot->peer);
+        if (peer->ack_pending) {
+            s_stats.acks_piggybacked++;
+        }
+        mesh_rel_fill_ack(peer, &hdr);
+        memcpy(to.addr, peer->mac, 6);
+        memcpy(buf + sizeof(mesh_rel_hdr_t), slot->data, slot->len);
+        len = sizeof(mesh_rel_hdr_t) + slot->len;
+        if (slot->tries) {
+            s_stats.tx_retransmits++;
+        }
+        slot->next_us = now + (MESH_REL_RTO_US << (slot->tries < MESH_REL_BACKOFF_MAX ? slot->tries : MESH_REL_BACKOFF_MAX));
+        slot->tries++;
+    }
+    portEXIT_CRITICAL(&s_rel_lock);
+
+    if (!len) {
+        /* acknowledged in the meantime */
+        mesh_comm_free(buf);
+        return;
+    }
+    memcpy(buf, &hdr, sizeof(mesh_rel_hdr_t));
+    mesh_comm_send(&to, buf, len, MESH_DATA_P2P);
+}
+
+static void mesh_rel_send_ack(int i, int64_t now)
+{
+    mesh_rel_hdr_t hdr = {
+        .type = MESH_MSG_TYPE_REL,
+    };
+    mesh_addr_t to;
+    bool due;
+
+    portENTER_CRITICAL(&s_rel_lock);
+    mesh_rel_peer_t *peer = &s_peers[i];
+    due = peer->used && peer->ack_pending && now >= peer->ack_due_us;
+    if (due) {
+        hdr.epoch = peer->tx_epoch;
+        mesh_rel_fill_ack(peer, &hdr);
+        memcpy(to.addr, peer->mac, 6);
+    }
+    portEXIT_CRITICAL(&s_rel_lock);
+    if (!due) {
+        return;
+    }
+
+    uint8_t *buf = mesh_comm_alloc(0);
+    if (!buf) {
+        /* keep it pending for the next tick */
+        portENTER_CRITICAL(&s_rel_lock);
+        peer->ack_pending = true;
+        portEXIT_CRITICAL(&s_rel_lock);
+        return;
+    }
+    memcpy(buf, &hdr, sizeof(mesh_rel_hdr_t));
+    if (mesh_comm_send(&to, buf, sizeof(mesh_rel_hdr_t), MESH_DATA_P2P) == ESP_OK) {
+        portENTER_CRITICAL(&s_rel_lock);
+        s_stats.tx_acks++;
+        portEXIT_CRITICAL(&s_rel_lock);
+    }
+}
+
+static void mesh_rel_tick(void *arg)
+{
+    int64_t now = esp_timer_get_time();
+    bool busy = false;
+
+    for (int i = 0; i < MESH_REL_SLOTS; i++) {
+        bool due;
+        bool failed = false;
+        uint8_t mac[6];
+        uint16_t seq;
+        portENTER_CRITICAL(&s_rel_lock);
+        due = s_slots[i].used && now >= s_slots[i].next_us;
+        if (due && s_slots[i].tries >= CONFIG_MESH_REL_MAX_TRIES) {
+            s_slots[i].used = false;
+            s_stats.tx_failed++;
+            failed = true;
+            due = false;
+            seq = s_slots[i].seq;
+            memcpy(mac, s_peers[s_slots[i].peer].mac, 6);
+        }
+        portEXIT_CRITICAL(&s_rel_lock);
+        if (failed) {
+            ESP_LOGW(REL_TAG, "seq %u to "MACSTR" not acknowledged", seq, MAC2STR(mac));
+        } else if (due) {
+            mesh_rel_transmit(i);
+        }
+    }
+    for (int i = 0; i < MESH_REL_MAX_PEERS; i++) {
+        mesh_rel_send_ack(i, now);
+    }
+
+    portENTER_CRITICAL(&s_rel_lock);
+    for (int i = 0; i < MESH_REL_SLOTS && !busy; i++) {
+        busy = s_slots[i].used;
+    }
+    for (int i = 0; i < MESH_REL_MAX_PEERS && !busy; i++) {
+        busy = s_peers[i].used && s_peers[i].ack_pending;
+    }
+    portEXIT_CRITICAL(&s_rel_lock);
+    if (busy) {
+        mesh_rel_arm();
+    }
+}
+
+esp_err_t mesh_rel_send(const mesh_addr_t *to, const uint8_t *data, uint16_t len)
+{
+    int i;
+
+    if (!to || !data || !len || len > MESH_REL_MAX_LEN || sizeof(mesh_rel_hdr_t) + len > MESH_COMM_BUF_SIZE
+            || data[0] == MESH_MSG_TYPE_REL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    portENTER_CRITICAL(&s_rel_lock);
+    for (i = 0; i < MESH_REL_SLOTS && s_slots[i].used; i++) {
+    }
+    if (i == MESH_REL_SLOTS) {
+        s_stats.tx_no_slot++;
+        portEXIT_CRITICAL(&s_rel_lock);
+        return ESP_ERR_NO_MEM;
+    }
+    int peer = mesh_rel_find_peer(to->addr);
+    s_peers[peer].last_us = esp_timer_get_time();
+    if ((uint16_t)(s_peers[peer].tx_seq - mesh_rel_base(peer)) >= MESH_REL_WINDOW) {
+        /* the peer could not take it before the oldest one is through */
+        s_stats.tx_no_slot++;
+        portEXIT_CRITICAL(&s_rel_lock);
+        return ESP_ERR_NO_MEM;
+    }
+    mesh_rel_slot_t *slot = &s_slots[i];
+    slot->used = true;
+    slot->peer = peer;
+    slot->tries = 0;
+    slot->seq = s_peers[peer].tx_seq++;
+    slot->len = len;
+    slot->next_us = 0;
+    memcpy(slot->data, data, len);
+    s_stats.tx_data++;
+    portEXIT_CRITICAL(&s_rel_lock);
+
+    mesh_rel_transmit(i);
+    mesh_rel_arm();
+    return ESP_OK;
+}
+
+static esp_err_t mesh_rel_process(mesh_addr_t *from, uint8_t *buf, uint16_t len)
+{
+    mesh_rel_hdr_t hdr;
+    bool deliver = false;
+    bool ack = false;
+    if (len < sizeof(mesh_rel_hdr_t)) {
+        return ESP_FAIL;
+    }
+    memcpy(&hdr, buf, sizeof(mesh_rel_hdr_t));
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&s_rel_lock);
+    int i = mesh_rel_find_peer(from->addr);
+    mesh_rel_peer_t *peer = &s_peers[i];
+    peer->last_us = now;
+    if ((hdr.flags & MESH_REL_FLAG_ACK) && hdr.ack_epoch == peer->tx_epoch) {
+        mesh_rel_acked(i, hdr.ack, hdr.sack);
+    }
+    if ((hdr.flags & MESH_REL_FLAG_DATA) && len > sizeof(mesh_rel_hdr_t)) {
+        if (!peer->rx_valid || peer->rx_epoch != hdr.epoch) {
+            /* new sender session: the window starts at what it still retransmits */
+            peer->rx_valid = true;
+            peer->rx_epoch = hdr.epoch;
+            peer->rx_next = hdr.base;
+            peer->rx_bitmap = 0;
+        }
+        int16_t gone = (int16_t)(hdr.base - peer->rx_next);
+        if (gone > 0) {
+            /* the sender gave up on those: stop waiting for them */
+            peer->rx_bitmap = gone >= MESH_REL_WINDOW ? 0 : peer->rx_bitmap >> gone;
+            peer->rx_next = hdr.base;
+            while (peer->rx_bitmap & 1) {
+                peer->rx_bitmap >>= 1;
+                peer->rx_next++;
+            }
+        }
+        int16_t d = (int16_t)(hdr.seq - peer->rx_next);
+        if (d < 0 || (d < MESH_REL_WINDOW && (peer->rx_bitmap & (1UL << d)))) {
+            /* our ACK was lost: it goes out again below */
+            s_stats.rx_dups++;
+        } else if (d >= MESH_REL_WINDOW) {
+            s_stats.rx_out_of_window++;
+        } else {
+            peer->rx_bitmap |= 1UL << d;
+            while (peer->rx_bitmap & 1) {
+                peer->rx_bitmap >>= 1;
+                peer->rx_next++;
+            }
+            s_stats.rx_data++;
+            deliver = true;
+        }
+        if (!peer->ack_pending) {
+            peer->ack_pending = true;
+            peer->ack_due_us = now + MESH_REL_ACK_DELAY_US;
+        }
+        ack = true;
+    }
+    portEXIT_CRITICAL(&s_rel_lock);
+
+    if (ack) {
+        mesh_rel_arm();
+    }
+    if (!deliver || buf[sizeof(mesh_rel_hdr_t)] == MESH_MSG_TYPE_REL) {
+        return ESP_OK;
+    }
+    /* the handler may answer with mesh_rel_send(), which carries our ACK back */
+    return mesh_comm_dispatch(from, buf + sizeof(mesh_rel_hdr_t), len - sizeof(mesh_rel_hdr_t));
+}
+
+int mesh_rel_pending(void)
+{
+    int n = 0;
+    portENTER_CRITICAL(&s_rel_lock);
+    for (int i = 0; i < MESH_REL_SLOTS; i++) {
+        n += s_slots[i].used;
+    }
+    portEXIT_CRITICAL(&s_rel_lock);
+    return n;
+}
+
+void mesh_rel_get_stats(mesh_rel_stats_t *stats)
+{
+    portENTER_CRITICAL(&s_rel_lock);
+    memcpy(stats, &s_stats, sizeof(mesh_rel_stats_t));
+    portEXIT_CRITICAL(&s_rel_lock);
+}
+
+esp_err_t mesh_rel_init(void)
+{
+    esp_timer_create_args_t tick_args = {
+        .callback = mesh_rel_tick,
+        .name = "mesh_rel",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&tick_args, &s_tick_timer));
+    /* on the app task, next to the commands it carries */
+    return mesh_comm_register_app_handler(MESH_MSG_TYPE_REL, mesh_rel_process);
+}
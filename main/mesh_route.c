@@ -0,0 +1,215 @@
+/* Mesh Routing Table Index
+
+   The index keeps the routing table twice: sorted by MAC, for ordered
+   snapshots, and in an open-addressing hash set, for O(1) membership.
+   Routing table events only carry the size change, so on each event the
+   table is read into a scratch buffer, sorted and merged against the
+   current index; only the entries that really changed touch the hash set
+   and bump the generation counter.
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_mesh.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "mesh_route.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+/* Power of two, at least twice MESH_ROUTE_MAX to keep probe chains short */
+#if MESH_ROUTE_MAX <= 32
+#define MESH_ROUTE_HASH_BITS    (6)
+#elif MESH_ROUTE_MAX <= 64
+#define MESH_ROUTE_HASH_BITS    (7)
+#elif MESH_ROUTE_MAX <= 128
+#define MESH_ROUTE_HASH_BITS    (8)
+#else
+#define MESH_ROUTE_HASH_BITS    (10)
+#endif
+#define MESH_ROUTE_HASH_SIZE    (1 << MESH_ROUTE_HASH_BITS)
+#define MESH_ROUTE_HASH_MASK    (MESH_ROUTE_HASH_SIZE - 1)
+
+/*******************************************************
+ *                Structures
+ *******************************************************/
+typedef struct {
+    uint8_t mac[6];
+    bool used;
+} mesh_route_slot_t;
+
+/*******************************************************
+ *                Variable Definitions
+ *******************************************************/
+static const char *ROUTE_TAG = "mesh_route";
+
+static mesh_addr_t s_table_a[MESH_ROUTE_MAX];
+static mesh_addr_t s_table_b[MESH_ROUTE_MAX];
+static mesh_addr_t *s_sorted = s_table_a;
+static mesh_addr_t *s_spare = s_table_b;
+static int s_count = 0;
+static mesh_addr_t s_scratch[MESH_ROUTE_MAX];
+static mesh_route_slot_t s_hash[MESH_ROUTE_HASH_SIZE];
+/* starts at 1 so that a reader holding generation 0 always gets a first copy */
+static uint32_t s_generation = 1;
+static SemaphoreHandle_t s_route_lock = NULL;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+static int mesh_route_cmp(const void *a, const void *b)
+{
+    return memcmp(((const mesh_addr_t *)a)->addr, ((const mesh_addr_t *)b)->addr, 6);
+}
+
+static uint32_t mesh_route_hash(const uint8_t mac[6])
+{
+    /* the OUI is shared by the whole fleet, only the NIC part is worth hashing */
+    uint32_t key = ((uint32_t)mac[3] << 16) | ((uint32_t)mac[4] << 8) | mac[5];
+    key ^= (uint32_t)mac[2] << 24;
+    return (key * 2654435761u) >> (32 - MESH_ROUTE_HASH_BITS);
+}
+
+static int mesh_route_find_slot(const uint8_t mac[6])
+{
+    uint32_t i = mesh_route_hash(mac);
+    while (s_hash[i].used) {
+        if (memcmp(s_hash[i].mac, mac, 6) == 0) {
+            return i;
+        }
+        i = (i + 1) & MESH_ROUTE_HASH_MASK;
+    }
+    return -1;
+}
+
+static void mesh_route_hash_insert(const uint8_t mac[6])
+{
+    uint32_t i = mesh_route_hash(mac);
+    while (s_hash[i].used) {
+        i = (i + 1) & MESH_ROUTE_HASH_MASK;
+    }
+    memcpy(s_hash[i].mac, mac, 6);
+    s_hash[i].used = true;
+}
+
+static void mesh_route_hash_remove(const uint8_t mac[6])
+{
+    int i = mesh_route_find_slot(mac);
+    if (i < 0) {
+        return;
+    }
+    /* backward-shift deletion keeps every probe chain intact without tombstones */
+    uint32_t hole = i;
+    uint32_t j = (hole + 1) & MESH_ROUTE_HASH_MASK;
+    while (s_hash[j].used) {
+        uint32_t home = mesh_route_hash(s_hash[j].mac);
+        if (((j - home) & MESH_ROUTE_HASH_MASK) >= ((j - hole) & MESH_ROUTE_HASH_MASK)) {
+            s_hash[hole] = s_hash[j];
+            hole = j;
+        }
+        j = (j + 1) & MESH_ROUTE_HASH_MASK;
+    }
+    s_hash[hole].used = false;
+}
+
+esp_err_t mesh_route_init(void)
+{
+    if (s_route_lock) {
+        return ESP_OK;
+    }
+    s_route_lock = xSemaphoreCreateMutex();
+    return s_route_lock ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+esp_err_t mesh_route_update(void)
+{
+    int size = 0;
+    esp_err_t err = esp_mesh_get_routing_table(s_scratch, sizeof(s_scratch), &size);
+    if (err != ESP_OK) {
+        return err;
+    }
+    qsort(s_scratch, size, sizeof(mesh_addr_t), mesh_route_cmp);
+
+    xSemaphoreTake(s_route_lock, portMAX_DELAY);
+    int i = 0, j = 0, n = 0, added = 0, removed = 0;
+    while (i < s_count || j < size) {
+        int cmp;
+        if (i == s_count) {
+            cmp = 1;
+        } else if (j == size) {
+            cmp = -1;
+        } else {
+            cmp = mesh_route_cmp(&s_sorted[i], &s_scratch[j]);
+        }
+        if (cmp == 0) {
+            s_spare[n++] = s_sorted[i++];
+            j++;
+        } else if (cmp < 0) {
+            mesh_route_hash_remove(s_sorted[i++].addr);
+            removed++;
+        } else {
+            mesh_route_hash_insert(s_scratch[j].addr);
+            s_spare[n++] = s_scratch[j++];
+            added++;
+        }
+    }
+    if (added || removed) {
+        mesh_addr_t *old = s_sorted;
+        s_sorted = s_spare;
+        s_spare = old;
+        s_count = n;
+        s_generation++;
+    }
+    xSemaphoreGive(s_route_lock);
+
+    ESP_LOGD(ROUTE_TAG, "+%d -%d, size:%d, gen:%" PRIu32, added, removed, n, s_generation);
+    return ESP_OK;
+}
+
+void mesh_route_clear(void)
+{
+    xSemaphoreTake(s_route_lock, portMAX_DELAY);
+    if (s_count) {
+        memset(s_hash, 0, sizeof(s_hash));
+        s_count = 0;
+        s_generation++;
+    }
+    xSemaphoreGive(s_route_lock);
+}
+
+bool mesh_route_contains(const uint8_t mac[6])
+{
+    xSemaphoreTake(s_route_lock, portMAX_DELAY);
+    bool found = mesh_route_find_slot(mac) >= 0;
+    xSemaphoreGive(s_route_lock);
+    return found;
+}
+
+int mesh_route_size(void)
+{
+    return s_count;
+}
+
+uint32_t mesh_route_generation(void)
+{
+    return s_generation;
+}
+
+bool mesh_route_snapshot(mesh_addr_t *table, int max, int *count, uint32_t *generation)
+{
+    bool copied = false;
+    xSemaphoreTake(s_route_lock, portMAX_DELAY);
+    if (*generation != s_generation) {
+        int n = s_count < max ? s_count : max;
+        memcpy(table, s_sorted, n * sizeof(mesh_addr_t));
+        *count = n;
+        *generation = s_generation;
+        copied = true;
+    }
+    xSemaphoreGive(s_route_lock);
+    return copied;
+}
@@ -0,0 +1,238 @@
+/* Mesh Shards
+
+   One root is the ceiling of a mesh: all of its traffic goes through the
+   root's airtime and every node has to fit in its routing table. A shard
+   is a mesh of its own, with its own root and uplink. Its mesh ID is a
+   hash of the base MESH_ID and the shard id, so shards never join each
+   other, and with CONFIG_MESH_SHARD_CHANNEL_PLAN neighbouring shard ids
+   sit on different non-overlapping channels.
+
+   The shard id comes from NVS (mesh_shard_provision()), or from
+   CONFIG_MESH_SHARD_ID on a node that was never provisioned.
+
+   A message for another shard travels in a mesh_shard_hdr_t envelope: up
+   to our root as an uplink record, to the gateway server, which knows
+   the shard of every root connection, down to the root of the other
+   shard and from there to the destination node, which dispatches the
+   message inside as if the original sender had sent it.
+
+   Nothing in the envelope is checked by the server, so the receiving end
+   trusts it only so far: a root takes envelopes from the gateway
+   connection alone and a node from its root alone, and the message
+   inside must be a command frame, whose tag covers the original sender
+   address. A forged `src` then fails mesh_frame_iter_init() like any
+   other bad tag. Inner messages run on the app task, never on the
+   gateway task.
+*/
+
+#include <string.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_mesh.h"
+#include "nvs.h"
+#include "mbedtls/sha256.h"
+#include "freertos/FreeRTOS.h"
+#include "mesh_comm.h"
+#include "mesh_frame.h"
+#include "mesh_gateway.h"
+#include "mesh_shard.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define MESH_SHARD_NVS_NAMESPACE    "mesh_shard"
+#define MESH_SHARD_NVS_KEY          "id"
+
+/*******************************************************
+ *                Variable Definitions
+ *******************************************************/
+static const char *SHARD_TAG = "mesh_shard";
+
+static uint16_t s_shard = CONFIG_MESH_SHARD_ID;
+static uint8_t s_self[6];
+static uint8_t s_root[6];
+static mesh_shard_stats_t s_stats;
+static portMUX_TYPE s_shard_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+uint16_t mesh_shard_get_id(void)
+{
+    return s_shard;
+}
+
+void mesh_shard_apply(mesh_cfg_t *cfg)
+{
+    uint8_t seed[8];
+    uint8_t hash[32];
+
+    if (s_shard == 0) {
+        return;
+    }
+    memcpy(seed, cfg->mesh_id.addr, 6);
+    seed[6] = s_shard & 0xff;
+    seed[7] = s_shard >> 8;
+    mbedtls_sha256(seed, sizeof(seed), hash, 0);
+    memcpy(cfg->mesh_id.addr, hash, 6);
+#ifdef CONFIG_MESH_SHARD_CHANNEL_PLAN
+    static const uint8_t plan[] = { 1, 6, 11 };
+    cfg->channel = plan[s_shard % 3];
+    cfg->allow_channel_switch = false;
+#endif
+    ESP_LOGI(SHARD_TAG, "shard %u, mesh ID "MACSTR", channel %d", s_shard, MAC2STR(cfg->mesh_id.addr), cfg->channel);
+}
+
+esp_err_t mesh_shard_provision(uint16_t shard)
+{
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(MESH_SHARD_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = nvs_set_u16(nvs, MESH_SHARD_NVS_KEY, shard);
+    if (err == ESP_OK) {
+        err = nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+    return err;
+}
+
+static void mesh_shard_count(uint32_t *counter)
+{
+    portENTER_CRITICAL(&s_shard_lock);
+    (*counter)++;
+    portEXIT_CRITICAL(&s_shard_lock);
+}
+
+esp_err_t mesh_shard_send(uint16_t shard, const uint8_t dst[6], const uint8_t *msg, uint16_t len)
+{
+    static const uint8_t none[6] = { 0 };
+    mesh_addr_t to;
+    uint8_t *buf;
+
+    if (!len || msg[0] != MESH_MSG_TYPE_FRAME) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (sizeof(mesh_shard_hdr_t) + len > MESH_COMM_BUF_SIZE) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (shard == s_shard) {
+        /* same shard: no need for the server */
+        if (!(buf = mesh_comm_alloc(0))) {
+            return ESP_ERR_NO_MEM;
+        }
+        memcpy(buf, msg, len);
+        if (dst) {
+            memcpy(to.addr, dst, 6);
+        }
+        return mesh_comm_send(dst ? &to : NULL, buf, len, MESH_DATA_P2P);
+    }
+    if (!(buf = mesh_comm_alloc(0))) {
+        return ESP_ERR_NO_MEM;
+    }
+    mesh_shard_hdr_t *hdr = (mesh_shard_hdr_t *) buf;
+    hdr->type = MESH_MSG_TYPE_SHARD;
+    hdr->src_shard = s_shard;
+    hdr->dst_shard = shard;
+    memcpy(hdr->src, s_self, 6);
+    memcpy(hdr->dst, dst ? dst : none, 6);
+    memcpy(hdr->data, msg, len);
+    esp_err_t err = mesh_gateway_send(buf, sizeof(mesh_shard_hdr_t) + len);
+    mesh_comm_free(buf);
+    if (err == ESP_OK) {
+        mesh_shard_count(&s_stats.sent);
+    }
+    return err;
+}
+
+/* The envelope has arrived where it is going, from a source we trust */
+static esp_err_t mesh_shard_deliver(const uint8_t *buf, uint16_t len)
+{
+    const mesh_shard_hdr_t *hdr = (const mesh_shard_hdr_t *) buf;
+    mesh_addr_t src;
+
+    if (len <= sizeof(mesh_shard_hdr_t) || hdr->dst_shard != s_shard) {
+        mesh_shard_count(&s_stats.dropped);
+        return ESP_FAIL;
+    }
+    if (hdr->data[0] != MESH_MSG_TYPE_FRAME) {
+        /* `src` is only as good as the tag of the frame that names it */
+        mesh_shard_count(&s_stats.rejected);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    mesh_shard_count(&s_stats.delivered);
+    memcpy(src.addr, hdr->src, 6);
+    /* queued for the app task: `buf` may be gone once we return */
+    return mesh_comm_dispatch(&src, (uint8_t *) hdr->data, len - sizeof(mesh_shard_hdr_t));
+}
+
+/* RX task, on a node: an envelope relayed by our root */
+static esp_err_t mesh_shard_process(mesh_addr_t *from, uint8_t *buf, uint16_t len)
+{
+    bool trusted;
+
+    portENTER_CRITICAL(&s_shard_lock);
+    trusted = !esp_mesh_is_root() && memcmp(from->addr, s_root, 6) == 0;
+    portEXIT_CRITICAL(&s_shard_lock);
+    if (!trusted) {
+        /* a root only takes envelopes from the gateway connection */
+        mesh_shard_count(&s_stats.rejected);
+        return ESP_FAIL;
+    }
+    return mesh_shard_deliver(buf, len);
+}
+
+/* Gateway task, on the root: an envelope from another shard, via the server */
+static void mesh_shard_downlink(const uint8_t src[6], const uint8_t *data, uint16_t len)
+{
+    static const uint8_t none[6] = { 0 };
+    const mesh_shard_hdr_t *hdr = (const mesh_shard_hdr_t *) data;
+    mesh_addr_t to;
+
+    if (len <= sizeof(mesh_shard_hdr_t) || len > MESH_COMM_BUF_SIZE || hdr->type != MESH_MSG_TYPE_SHARD) {
+        mesh_shard_count(&s_stats.dropped);
+        return;
+    }
+    if (memcmp(hdr->dst, none, 6) == 0 || memcmp(hdr->dst, s_self, 6) == 0) {
+        mesh_shard_deliver(data, len);
+        return;
+    }
+    uint8_t *buf = mesh_comm_alloc(100);
+    if (!buf) {
+        mesh_shard_count(&s_stats.dropped);
+        return;
+    }
+    memcpy(buf, data, len);
+    memcpy(to.addr, hdr->dst, 6);
+    mesh_shard_count(mesh_comm_send(&to, buf, len, MESH_DATA_P2P) == ESP_OK ? &s_stats.relayed : &s_stats.dropped);
+}
+
+void mesh_shard_get_stats(mesh_shard_stats_t *stats)
+{
+    portENTER_CRITICAL(&s_shard_lock);
+    memcpy(stats, &s_stats, sizeof(mesh_shard_stats_t));
+    portEXIT_CRITICAL(&s_shard_lock);
+}
+
+void mesh_shard_on_root_address(const uint8_t root[6])
+{
+    portENTER_CRITICAL(&s_shard_lock);
+    memcpy(s_root, root, 6);
+    portEXIT_CRITICAL(&s_shard_lock);
+}
+
+esp_err_t mesh_shard_init(void)
+{
+    nvs_handle_t nvs;
+
+    ESP_ERROR_CHECK(esp_read_mac(s_self, ESP_MAC_WIFI_STA));
+    /* not provisioned yet: keep the menuconfig default */
+    if (nvs_open(MESH_SHARD_NVS_NAMESPACE, NVS_READONLY, &nvs) == ESP_OK) {
+        nvs_get_u16(nvs, MESH_SHARD_NVS_KEY, &s_shard);
+        nvs_close(nvs);
+    }
+    mesh_gateway_set_downlink(mesh_shard_downlink);
+    return mesh_comm_register_handler(MESH_MSG_TYPE_SHARD, mesh_shard_process);
+}
@@ -0,0 +1,228 @@
+/* Mesh Telemetry
+
+   Reports flow up one hop at a time. Each CONFIG_MESH_TELEMETRY_PERIOD_S
+   a node waits (CONFIG_MESH_MAX_LAYER - layer) slots, so the deepest
+   layer reports first and every parent has its children's reports in
+   hand when its own slot comes. It then merges them with its own sample,
+   sends one report to its parent and starts a new aggregate. On the root
+   the merged report goes to the sink.
+
+   The slots only line up if every node starts its period at the same
+   instant, so periods start on the mesh clock (mesh_time.h), at the
+   multiples of the period. Until a node has synced its clock its periods
+   are not aligned yet, and its report may miss its parent's slot.
+*/
+
+#include <string.h>
+#include <inttypes.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_mesh.h"
+#include "esp_wifi.h"
+#include "esp_timer.h"
+#include "esp_system.h"
+#include "freertos/FreeRTOS.h"
+#include "mesh_comm.h"
+#include "mesh_time.h"
+#include "mesh_telemetry.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define MESH_TELEMETRY_PERIOD_US    (CONFIG_MESH_TELEMETRY_PERIOD_S * 1000000ULL)
+#define MESH_TELEMETRY_SLOT_US      (CONFIG_MESH_TELEMETRY_SLOT_MS * 1000ULL)
+
+/*******************************************************
+ *                Variable Definitions
+ *******************************************************/
+static const char *TELEMETRY_TAG = "mesh_telemetry";
+
+static mesh_telemetry_report_t s_children;  /* children's reports received this period */
+static portMUX_TYPE s_telemetry_lock = portMUX_INITIALIZER_UNLOCKED;
+static esp_timer_handle_t s_period_timer = NULL;
+static esp_timer_handle_t s_slot_timer = NULL;
+static mesh_telemetry_sink_t s_sink = NULL;
+static bool s_telemetry_started = false;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+static void mesh_telemetry_reset(mesh_telemetry_report_t *r)
+{
+    memset(r, 0, sizeof(*r));
+    r->type = MESH_MSG_TYPE_TELEMETRY;
+    r->version = MESH_TELEMETRY_VERSION;
+    for (int i = 0; i < MESH_TELEMETRY_METRIC_MAX; i++) {
+        r->stats[i].min = INT32_MAX;
+        r->stats[i].max = INT32_MIN;
+    }
+}
+
+static void mesh_telemetry_add(mesh_telemetry_report_t *r, mesh_telemetry_metric_t metric, int32_t value)
+{
+    mesh_telemetry_stat_t *st = &r->stats[metric];
+    st->count++;
+    st->sum += value;
+    if (value < st->min) {
+        st->min = value;
+    }
+    if (value > st->max) {
+        st->max = value;
+    }
+}
+
+static void mesh_telemetry_merge(mesh_telemetry_report_t *dst, const mesh_telemetry_report_t *src)
+{
+    dst->nodes += src->nodes;
+    for (int i = 0; i < MESH_TELEMETRY_LAYER_HIST; i++) {
+        dst->layer_hist[i] += src->layer_hist[i];
+    }
+    for (int i = 0; i < MESH_TELEMETRY_RSSI_HIST; i++) {
+        dst->rssi_hist[i] += src->rssi_hist[i];
+    }
+    for (int i = 0; i < MESH_TELEMETRY_METRIC_MAX; i++) {
+        const mesh_telemetry_stat_t *s = &src->stats[i];
+        mesh_telemetry_stat_t *d = &dst->stats[i];
+        if (s->count == 0) {
+            continue;
+        }
+        d->count += s->count;
+        d->sum += s->sum;
+        d->min = s->min < d->min ? s->min : d->min;
+        d->max = s->max > d->max ? s->max : d->max;
+    }
+}
+
+static void mesh_telemetry_sample(mesh_telemetry_report_t *r, int layer)
+{
+    wifi_ap_record_t ap;
+
+    r->nodes++;
+    r->layer_hist[(layer >= 1 && layer < MESH_TELEMETRY_LAYER_HIST) ? layer - 1 : MESH_TELEMETRY_LAYER_HIST - 1]++;
+    mesh_telemetry_add(r, MESH_TELEMETRY_FREE_HEAP, esp_get_free_heap_size());
+    mesh_telemetry_add(r, MESH_TELEMETRY_MIN_FREE_HEAP, esp_get_minimum_free_heap_size());
+    mesh_telemetry_add(r, MESH_TELEMETRY_UPTIME_S, esp_timer_get_time() / 1000000);
+    /* for the root this is the router RSSI */
+    if (esp_wifi_sta_get_ap_info(&ap) == ESP_OK) {
+        int bucket = (ap.rssi + 100) / 10;
+        bucket = bucket < 0 ? 0 : (bucket >= MESH_TELEMETRY_RSSI_HIST ? MESH_TELEMETRY_RSSI_HIST - 1 : bucket);
+        r->rssi_hist[bucket]++;
+        mesh_telemetry_add(r, MESH_TELEMETRY_PARENT_RSSI, ap.rssi);
+    }
+}
+
+static void mesh_telemetry_log(const mesh_telemetry_report_t *r)
+{
+    const mesh_telemetry_stat_t *heap = &r->stats[MESH_TELEMETRY_FREE_HEAP];
+    const mesh_telemetry_stat_t *rssi = &r->stats[MESH_TELEMETRY_PARENT_RSSI];
+    ESP_LOGI(TELEMETRY_TAG, "nodes:%d, heap min/avg/max:%" PRId32 "/%" PRId64 "/%" PRId32 ", rssi min/max:%" PRId32 "/%" PRId32,
+             r->nodes, heap->min, heap->count ? heap->sum / heap->count : 0, heap->max,
+             rssi->count ? rssi->min : 0, rssi->count ? rssi->max : 0);
+}
+
+static void mesh_telemetry_slot(void *arg)
+{
+    mesh_telemetry_report_t *report;
+    uint8_t *buf = NULL;
+    mesh_telemetry_report_t root_report;
+    bool is_root = esp_mesh_is_root();
+
+    if (is_root) {
+        report = &root_report;
+    } else {
+        buf = mesh_comm_alloc(0);
+        if (!buf) {
+            /* keep the children's data for the next period */
+            return;
+        }
+        report = (mesh_telemetry_report_t *) buf;
+    }
+
+    portENTER_CRITICAL(&s_telemetry_lock);
+    memcpy(report, &s_children, sizeof(mesh_telemetry_report_t));
+    mesh_telemetry_reset(&s_children);
+    portEXIT_CRITICAL(&s_telemetry_lock);
+    mesh_telemetry_sample(report, esp_mesh_get_layer());
+
+    if (is_root) {
+        if (s_sink) {
+            s_sink(report);
+        } else {
+            mesh_telemetry_log(report);
+        }
+        return;
+    }
+    mesh_addr_t parent;
+    if (mesh_comm_get_parent(&parent) != ESP_OK) {
+        mesh_comm_free(buf);
+        return;
+    }
+    mesh_comm_send(&parent, buf, sizeof(mesh_telemetry_report_t), MESH_DATA_P2P);
+}
+
+/* Arms the period timer for the next multiple of the period on the mesh
+ * clock; `fired` skips the one we may be a hair before after a clock step */
+static void mesh_telemetry_arm(bool fired)
+{
+    const int64_t period = MESH_TELEMETRY_PERIOD_US;
+    int64_t now = mesh_time_now() + (fired ? period / 2 : 0);
+    int64_t next = (now / period + 1) * period;
+    int64_t wait = mesh_time_to_local(next) - esp_timer_get_time();
+    esp_timer_start_once(s_period_timer, wait > 0 ? wait : 1);
+}
+
+static void mesh_telemetry_period(void *arg)
+{
+    /* re-armed every period, so the boundaries follow the clock once it syncs */
+    mesh_telemetry_arm(true);
+    int layer = esp_mesh_get_layer();
+    int wait = CONFIG_MESH_MAX_LAYER - layer;
+    if (layer <= 0) {
+        return;
+    }
+    esp_timer_stop(s_slot_timer);
+    esp_timer_start_once(s_slot_timer, (wait > 0 ? wait : 0) * MESH_TELEMETRY_SLOT_US + 1);
+}
+
+esp_err_t mesh_telemetry_process(mesh_addr_t *from, uint8_t *buf, uint16_t len)
+{
+    const mesh_telemetry_report_t *in = (const mesh_telemetry_report_t *) buf;
+    if (len < sizeof(mesh_telemetry_report_t) || in->version != MESH_TELEMETRY_VERSION) {
+        return ESP_FAIL;
+    }
+    portENTER_CRITICAL(&s_telemetry_lock);
+    mesh_telemetry_merge(&s_children, in);
+    portEXIT_CRITICAL(&s_telemetry_lock);
+    return ESP_OK;
+}
+
+void mesh_telemetry_set_sink(mesh_telemetry_sink_t sink)
+{
+    s_sink = sink;
+}
+
+esp_err_t mesh_telemetry_init(void)
+{
+    esp_timer_create_args_t period_args = {
+        .callback = mesh_telemetry_period,
+        .name = "telemetry",
+    };
+    esp_timer_create_args_t slot_args = {
+        .callback = mesh_telemetry_slot,
+        .name = "telemetry_slot",
+    };
+    mesh_telemetry_reset(&s_children);
+    ESP_ERROR_CHECK(esp_timer_create(&period_args, &s_period_timer));
+    ESP_ERROR_CHECK(esp_timer_create(&slot_args, &s_slot_timer));
+    return mesh_comm_register_app_handler(MESH_MSG_TYPE_TELEMETRY, mesh_telemetry_process);
+}
+
+esp_err_t mesh_telemetry_start(void)
+{
+    if (s_telemetry_started) {
+        return ESP_OK;
+    }
+    s_telemetry_started = true;
+    mesh_telemetry_arm(false);
+    return ESP_OK;
+}
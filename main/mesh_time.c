@@ -0,0 +1,218 @@
+/* Mesh Time
+
+   The mesh clock is the first root's esp_timer. A node that becomes root
+   later keeps the offset it last synced and serves its own clock plus
+   that offset, so the mesh clock carries on across a root change instead
+   of jumping to the new root's uptime. Every other node estimates the
+   offset of its own clock from its parent's mesh clock, NTP style: a
+   request stamped t1 on the child, stamped t2 and t3 by the parent, back
+   at t4 on the child gives
+
+       offset = ((t2 - t1) + (t3 - t4)) / 2    delay = (t4 - t1) - (t3 - t2)
+
+   The error of a sample is at most half of how asymmetric its delay was,
+   and queueing is what makes it asymmetric, so each sync is a burst of
+   MESH_TIME_BURST requests of which only the fastest one is kept. A
+   parent only answers with a clock once it has one, so the sync spreads
+   down the tree layer by layer after boot.
+
+   The offset is stepped, not slewed: at the default period the crystals
+   drift apart by well under a millisecond between two syncs.
+*/
+
+#include <string.h>
+#include <inttypes.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_mesh.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "mesh_comm.h"
+#include "mesh_time.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define MESH_TIME_BURST         (4)
+#define MESH_TIME_GAP_US        (100 * 1000)    /* between the requests of a burst */
+#define MESH_TIME_MAX_DELAY_US  (50 * 1000)     /* slower samples are not worth keeping */
+#define MESH_TIME_PERIOD_US     (CONFIG_MESH_TIME_SYNC_PERIOD_S * 1000000LL)
+
+/*******************************************************
+ *                Variable Definitions
+ *******************************************************/
+static const char *TIME_TAG = "mesh_time";
+
+static portMUX_TYPE s_time_lock = portMUX_INITIALIZER_UNLOCKED;
+static mesh_time_stats_t s_time;
+/* best sample of the burst in progress */
+static bool s_best_valid = false;
+static int64_t s_best_offset = 0;
+static uint32_t s_best_delay = 0;
+static int s_burst_sent = 0;
+static esp_timer_handle_t s_sync_timer = NULL;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+bool mesh_time_is_synced(void)
+{
+    return esp_mesh_is_root() || s_time.synced;
+}
+
+/* Also on the root: 0 unless it synced under a former root */
+static int64_t mesh_time_offset(void)
+{
+    int64_t offset;
+
+    portENTER_CRITICAL(&s_time_lock);
+    offset = s_time.offset_us;
+    portEXIT_CRITICAL(&s_time_lock);
+    return offset;
+}
+
+int64_t mesh_time_now(void)
+{
+    return esp_timer_get_time() + mesh_time_offset();
+}
+
+int64_t mesh_time_to_local(int64_t mesh_us)
+{
+    return mesh_us - mesh_time_offset();
+}
+
+void mesh_time_get_stats(mesh_time_stats_t *stats)
+{
+    portENTER_CRITICAL(&s_time_lock);
+    memcpy(stats, &s_time, sizeof(mesh_time_stats_t));
+    portEXIT_CRITICAL(&s_time_lock);
+    stats->synced = mesh_time_is_synced();
+}
+
+static esp_err_t mesh_time_request(void)
+{
+    mesh_addr_t parent;
+    mesh_time_msg_t msg = {
+        .type = MESH_MSG_TYPE_TIME,
+        .op = MESH_TIME_OP_REQUEST,
+    };
+
+    if (mesh_comm_get_parent(&parent) != ESP_OK) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    uint8_t *buf = mesh_comm_alloc(0);
+    if (!buf) {
+        return ESP_ERR_NO_MEM;
+    }
+    msg.t1 = esp_timer_get_time();
+    memcpy(buf, &msg, sizeof(mesh_time_msg_t));
+    return mesh_comm_send(&parent, buf, sizeof(mesh_time_msg_t), MESH_DATA_P2P);
+}
+
+/* Takes the best sample of the burst that just ended */
+static void mesh_time_apply(void)
+{
+    bool first = false;
+    int32_t step = 0;
+
+    portENTER_CRITICAL(&s_time_lock);
+    if (s_best_valid) {
+        first = !s_time.synced;
+        step = (int32_t) (s_best_offset - s_time.offset_us);
+        s_time.offset_us = s_best_offset;
+        s_time.delay_us = s_best_delay;
+        s_time.last_step_us = step;
+        s_time.synced = true;
+        s_time.syncs++;
+    }
+    s_best_valid = false;
+    portEXIT_CRITICAL(&s_time_lock);
+
+    if (first) {
+        ESP_LOGI(TIME_TAG, "synced, offset %" PRId64 " us, delay %" PRIu32 " us", s_time.offset_us, s_time.delay_us);
+    } else if (step) {
+        ESP_LOGD(TIME_TAG, "step %" PRId32 " us, delay %" PRIu32 " us", step, s_time.delay_us);
+    }
+}
+
+static void mesh_time_tick(void *arg)
+{
+    if (esp_mesh_is_root()) {
+        /* the root is the clock: nothing to sync to, it runs on from its last offset */
+        return;
+    }
+    if (s_burst_sent < MESH_TIME_BURST) {
+        s_burst_sent++;
+        mesh_time_request();
+        esp_timer_start_once(s_sync_timer, MESH_TIME_GAP_US);
+        return;
+    }
+    mesh_time_apply();
+    s_burst_sent = 0;
+    esp_timer_start_once(s_sync_timer, s_time.synced ? MESH_TIME_PERIOD_US : MESH_TIME_GAP_US);
+}
+
+/* Runs on the RX task, so the stamps are as close to the radio as we can get them */
+static esp_err_t mesh_time_process(mesh_addr_t *from, uint8_t *buf, uint16_t len)
+{
+    int64_t now = esp_timer_get_time();
+    mesh_time_msg_t msg;
+
+    if (len < sizeof(mesh_time_msg_t)) {
+        return ESP_FAIL;
+    }
+    memcpy(&msg, buf, sizeof(mesh_time_msg_t));
+
+    if (msg.op == MESH_TIME_OP_REQUEST) {
+        uint8_t *reply = mesh_comm_alloc(0);
+        if (!reply) {
+            return ESP_ERR_NO_MEM;
+        }
+        int64_t offset = mesh_time_offset();
+        msg.op = MESH_TIME_OP_REPLY;
+        msg.synced = mesh_time_is_synced();
+        msg.t2 = now + offset;
+        msg.t3 = esp_timer_get_time() + offset;
+        memcpy(reply, &msg, sizeof(mesh_time_msg_t));
+        return mesh_comm_send(from, reply, sizeof(mesh_time_msg_t), MESH_DATA_P2P);
+    }
+    if (msg.op != MESH_TIME_OP_REPLY) {
+        return ESP_FAIL;
+    }
+
+    int64_t delay = (now - msg.t1) - (msg.t3 - msg.t2);
+    int64_t offset = ((msg.t2 - msg.t1) + (msg.t3 - now)) / 2;
+
+    portENTER_CRITICAL(&s_time_lock);
+    s_time.samples++;
+    if (!msg.synced || delay < 0 || delay > MESH_TIME_MAX_DELAY_US) {
+        s_time.rejected++;
+    } else if (!s_best_valid || delay < s_best_delay) {
+        s_best_valid = true;
+        s_best_offset = offset;
+        s_best_delay = (uint32_t) delay;
+    }
+    portEXIT_CRITICAL(&s_time_lock);
+    return ESP_OK;
+}
+
+esp_err_t mesh_time_start(void)
+{
+    /* a new parent may not share the old one's idea of the clock: resync now */
+    esp_timer_stop(s_sync_timer);
+    portENTER_CRITICAL(&s_time_lock);
+    s_best_valid = false;
+    portEXIT_CRITICAL(&s_time_lock);
+    s_burst_sent = 0;
+    return esp_timer_start_once(s_sync_timer, MESH_TIME_GAP_US);
+}
+
+esp_err_t mesh_time_init(void)
+{
+    esp_timer_create_args_t sync_args = {
+        .callback = mesh_time_tick,
+        .name = "mesh_time",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&sync_args, &s_sync_timer));
+    return mesh_comm_register_handler(MESH_MSG_TYPE_TIME, mesh_time_process);
+}
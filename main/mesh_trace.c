@@ -0,0 +1,270 @@
+/* Mesh Event Trace
+
+   Writers reserve a slot with one atomic increment and mark it complete
+   by writing its sequence number last, so recording an event takes no
+   lock and no formatting, and a reader can tell a torn slot from a
+   complete one. The ring lives in RTC_NOINIT memory: after anything but a
+   power-on reset the previous boot's events are still there and are
+   dumped at start.
+*/
+
+#include <string.h>
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_mesh.h"
+#include "esp_netif.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "mesh_trace.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define MESH_TRACE_ENTRIES      (CONFIG_MESH_TRACE_ENTRIES)
+#define MESH_TRACE_MASK         (MESH_TRACE_ENTRIES - 1)
+
+_Static_assert((MESH_TRACE_ENTRIES & MESH_TRACE_MASK) == 0, "MESH_TRACE_ENTRIES must be a power of two");
+/* RTC slow memory is 8 KB, shared with the rest of the RTC data */
+_Static_assert(MESH_TRACE_ENTRIES * sizeof(mesh_trace_entry_t) <= 4096, "MESH_TRACE_ENTRIES does not fit in RTC memory");
+
+/*******************************************************
+ *                Structures
+ *******************************************************/
+typedef struct {
+    uint32_t magic;
+    uint32_t head;
+    uint8_t boot;
+    mesh_trace_entry_t entries[MESH_TRACE_ENTRIES];
+} mesh_trace_ring_t;
+
+/*******************************************************
+ *                Variable Definitions
+ *******************************************************/
+static const char *TRACE_TAG = "mesh_trace";
+
+static RTC_NOINIT_ATTR mesh_trace_ring_t s_ring;
+static bool s_trace_ready = false;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+/* Little-endian field packer */
+typedef struct {
+    uint8_t *p;
+    uint8_t *end;
+} mesh_trace_pack_t;
+
+static void pack(mesh_trace_pack_t *pk, const void *src, size_t len)
+{
+    if (pk->p + len <= pk->end) {
+        memcpy(pk->p, src, len);
+        pk->p += len;
+    }
+}
+
+static void pack_u8(mesh_trace_pack_t *pk, uint8_t v)
+{
+    pack(pk, &v, 1);
+}
+
+static void pack_i32(mesh_trace_pack_t *pk, int32_t v)
+{
+    pack(pk, &v, 4);
+}
+
+/* Keep the field layout of each event in sync with tools/trace_decode/trace_decode.py */
+static void mesh_trace_pack_mesh(mesh_trace_pack_t *pk, int32_t event_id, const void *event_data)
+{
+    switch (event_id) {
+    case MESH_EVENT_CHILD_CONNECTED:
+    case MESH_EVENT_CHILD_DISCONNECTED: {
+        const wifi_event_ap_staconnected_t *child = event_data;
+        pack(pk, child->mac, 6);
+        pack_u8(pk, child->aid);
+        break;
+    }
+    case MESH_EVENT_ROUTING_TABLE_ADD:
+    case MESH_EVENT_ROUTING_TABLE_REMOVE: {
+        const mesh_event_routing_table_change_t *rt = event_data;
+        pack_i32(pk, rt->rt_size_change);
+        pack_i32(pk, rt->rt_size_new);
+        break;
+    }
+    case MESH_EVENT_NO_PARENT_FOUND:
+        pack_i32(pk, ((const mesh_event_no_parent_found_t *) event_data)->scan_times);
+        break;
+    case MESH_EVENT_PARENT_CONNECTED: {
+        const mesh_event_connected_t *connected = event_data;
+        pack(pk, connected->connected.bssid, 6);
+        pack_u8(pk, connected->connected.channel);
+        pack_u8(pk, connected->self_layer);
+        pack_u8(pk, connected->duty);
+        break;
+    }
+    case MESH_EVENT_PARENT_DISCONNECTED: {
+        const mesh_event_disconnected_t *disconnected = event_data;
+        pack(pk, disconnected->bssid, 6);
+        pack_u8(pk, disconnected->reason);
+        pack_u8(pk, disconnected->rssi);
+        break;
+    }
+    case MESH_EVENT_LAYER_CHANGE:
+        pack_i32(pk, ((const mesh_event_layer_change_t *) event_data)->new_layer);
+        break;
+    case MESH_EVENT_ROOT_ADDRESS:
+        pack(pk, ((const mesh_event_root_address_t *) event_data)->addr, 6);
+        break;
+    case MESH_EVENT_VOTE_STARTED: {
+        const mesh_event_vote_started_t *vote = event_data;
+        pack_i32(pk, vote->attempts);
+        pack_i32(pk, vote->reason);
+        pack(pk, vote->rc_addr.addr, 6);
+        break;
+    }
+    case MESH_EVENT_ROOT_SWITCH_REQ: {
+        const mesh_event_root_switch_req_t *req = event_data;
+        pack_i32(pk, req->reason);
+        pack(pk, req->rc_addr.addr, 6);
+        break;
+    }
+    case MESH_EVENT_TODS_STATE:
+        pack_i32(pk, *(const mesh_event_toDS_state_t *) event_data);
+        break;
+    case MESH_EVENT_ROOT_FIXED:
+        pack_u8(pk, ((const mesh_event_root_fixed_t *) event_data)->is_fixed);
+        break;
+    case MESH_EVENT_ROOT_ASKED_YIELD: {
+        const mesh_event_root_conflict_t *conflict = event_data;
+        pack(pk, conflict->addr, 6);
+        pack_u8(pk, conflict->rssi);
+        pack_i32(pk, conflict->capacity);
+        break;
+    }
+    case MESH_EVENT_CHANNEL_SWITCH:
+        pack_u8(pk, ((const mesh_event_channel_switch_t *) event_data)->channel);
+        break;
+    case MESH_EVENT_SCAN_DONE:
+        pack_u8(pk, ((const mesh_event_scan_done_t *) event_data)->number);
+        break;
+    case MESH_EVENT_NETWORK_STATE:
+        pack_u8(pk, ((const mesh_event_network_state_t *) event_data)->is_rootless);
+        break;
+    case MESH_EVENT_FIND_NETWORK: {
+        const mesh_event_find_network_t *find = event_data;
+        pack_u8(pk, find->channel);
+        pack(pk, find->router_bssid, 6);
+        break;
+    }
+    case MESH_EVENT_ROUTER_SWITCH: {
+        const mesh_event_router_switch_t *sw = event_data;
+        pack_u8(pk, sw->channel);
+        pack(pk, sw->bssid, 6);
+        break;
+    }
+    case MESH_EVENT_PS_PARENT_DUTY:
+        pack_u8(pk, ((const mesh_event_ps_duty_t *) event_data)->duty);
+        break;
+    case MESH_EVENT_PS_CHILD_DUTY: {
+        const mesh_event_ps_duty_t *duty = event_data;
+        pack_u8(pk, duty->duty);
+        pack(pk, duty->child_connected.mac, 6);
+        pack_u8(pk, duty->child_connected.aid);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+void mesh_trace_event(esp_event_base_t event_base, int32_t event_id, const void *event_data)
+{
+    if (!s_trace_ready) {
+        return;
+    }
+    uint32_t idx = __atomic_fetch_add(&s_ring.head, 1, __ATOMIC_RELAXED);
+    mesh_trace_entry_t *e = &s_ring.entries[idx & MESH_TRACE_MASK];
+    mesh_trace_pack_t pk = { e->data, e->data + MESH_TRACE_DATA_LEN };
+
+    __atomic_store_n(&e->seq, 0, __ATOMIC_RELAXED);
+    e->time_us = (uint32_t) esp_timer_get_time();
+    e->id = (uint16_t) event_id;
+    e->boot = s_ring.boot;
+    memset(e->data, 0, MESH_TRACE_DATA_LEN);
+    if (event_base == IP_EVENT) {
+        e->base = MESH_TRACE_BASE_IP;
+        if (event_id == IP_EVENT_STA_GOT_IP && event_data) {
+            pack(&pk, &((const ip_event_got_ip_t *) event_data)->ip_info.ip.addr, 4);
+        }
+    } else {
+        e->base = MESH_TRACE_BASE_MESH;
+        if (event_data) {
+            mesh_trace_pack_mesh(&pk, event_id, event_data);
+        }
+    }
+    __atomic_store_n(&e->seq, idx + 1, __ATOMIC_RELEASE);
+}
+
+static esp_err_t mesh_trace_read_one(uint32_t idx, mesh_trace_entry_t *out)
+{
+    const mesh_trace_entry_t *e = &s_ring.entries[idx & MESH_TRACE_MASK];
+    *out = *e;
+    /* a slot being rewritten while we copied does not match on one side or the other */
+    if (out->seq != idx + 1 || __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE) != idx + 1) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    return ESP_OK;
+}
+
+int mesh_trace_read(mesh_trace_entry_t *entries, int max)
+{
+    uint32_t head = __atomic_load_n(&s_ring.head, __ATOMIC_ACQUIRE);
+    uint32_t first = head > MESH_TRACE_ENTRIES ? head - MESH_TRACE_ENTRIES : 0;
+    int n = 0;
+    for (uint32_t idx = first; idx < head && n < max; idx++) {
+        if (mesh_trace_read_one(idx, &entries[n]) == ESP_OK) {
+            n++;
+        }
+    }
+    return n;
+}
+
+void mesh_trace_dump(void)
+{
+    static const char hex[] = "0123456789abcdef";
+    char line[2 * sizeof(mesh_trace_entry_t) + 1];
+    mesh_trace_entry_t e;
+    uint32_t head = __atomic_load_n(&s_ring.head, __ATOMIC_ACQUIRE);
+    uint32_t first = head > MESH_TRACE_ENTRIES ? head - MESH_TRACE_ENTRIES : 0;
+
+    for (uint32_t idx = first; idx < head; idx++) {
+        if (mesh_trace_read_one(idx, &e) != ESP_OK) {
+            continue;
+        }
+        const uint8_t *raw = (const uint8_t *) &e;
+        for (size_t i = 0; i < sizeof(e); i++) {
+            line[2 * i] = hex[raw[i] >> 4];
+            line[2 * i + 1] = hex[raw[i] & 0xf];
+        }
+        line[2 * sizeof(e)] = '\0';
+        ESP_LOGI(TRACE_TAG, "%s", line);
+    }
+}
+
+esp_err_t mesh_trace_init(void)
+{
+    esp_reset_reason_t reason = esp_reset_reason();
+    bool kept = s_ring.magic == MESH_TRACE_MAGIC && reason != ESP_RST_POWERON && reason != ESP_RST_UNKNOWN;
+
+    if (!kept) {
+        memset(&s_ring, 0, sizeof(s_ring));
+        s_ring.magic = MESH_TRACE_MAGIC;
+    } else {
+        s_ring.boot++;
+    }
+    s_trace_ready = true;
+    if (kept && s_ring.head) {
+        ESP_LOGI(TRACE_TAG, "events from before the reset (reason %d):", reason);
+        mesh_trace_dump();
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,291 @@
+/* Mesh Root Vote
+
+   ESP-MESH elects the root from the router RSSI alone and hands the role
+   over as soon as another node looks better, which makes the root flap
+   when several nodes see the router about equally well. Every flap
+   takes the whole mesh down for a few seconds.
+
+   Here every node scores itself from the RSSI at which it hears the
+   router: the root from its own connection, the other nodes from the
+   router's beacons seen by the mesh_backup refresh scans. A node that
+   never saw the router is no candidate, so without those scans
+   (CONFIG_MESH_BACKUP_SCAN_PERIOD_S) the root never hands over. Uptime
+   adds a small tie breaker, worth less than the default margin, so that
+   a node that just rebooted does not take over from an equal one.
+
+   Every CONFIG_MESH_VOTE_PERIOD_S each node sends its parent the best
+   candidate of its subtree, so the root learns the best candidate of
+   the network. The root only waives in favour of a candidate that beats
+   its own score by CONFIG_MESH_VOTE_MARGIN, after being root and after
+   the candidate has been better for CONFIG_MESH_VOTE_YIELD_WINDOW_S.
+
+   Elections are timed from MESH_EVENT_VOTE_STARTED to a PARENT_CONNECTED
+   that holds for CONFIG_MESH_VOTE_STABLE_MS.
+*/
+
+#include <string.h>
+#include <inttypes.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_mesh.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "freertos/FreeRTOS.h"
+#include "mesh_comm.h"
+#include "mesh_vote.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define MESH_VOTE_PERIOD_US         (CONFIG_MESH_VOTE_PERIOD_S * 1000000ULL)
+#define MESH_VOTE_WINDOW_US         (CONFIG_MESH_VOTE_YIELD_WINDOW_S * 1000000LL)
+#define MESH_VOTE_STABLE_US         (CONFIG_MESH_VOTE_STABLE_MS * 1000ULL)
+/* score weights: 2 per dB of router RSSI over -100 dBm, 1 per minute of uptime (up to 10 minutes) */
+#define MESH_VOTE_W_RSSI            (2)
+#define MESH_VOTE_UPTIME_MAX_MIN    (10)
+
+/*******************************************************
+ *                Variable Definitions
+ *******************************************************/
+static const char *VOTE_TAG = "mesh_vote";
+
+static mesh_vote_stats_t s_vote;
+static mesh_vote_candidate_t s_best_child;  /* best candidate reported by the children this period */
+static uint8_t s_self[6];
+static uint8_t s_root_addr[6];
+static int64_t s_vote_start_us = 0;         /* 0 when no election is running */
+static int64_t s_connected_us = 0;
+static int64_t s_root_since_us = 0;         /* 0 when we are not root */
+static int64_t s_better_since_us = 0;       /* 0 when no candidate beats us */
+static int8_t s_router_rssi = 0;            /* last scan that saw the router, 0 if none did */
+static portMUX_TYPE s_vote_lock = portMUX_INITIALIZER_UNLOCKED;
+static esp_timer_handle_t s_period_timer = NULL;
+static esp_timer_handle_t s_stable_timer = NULL;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+static uint16_t mesh_vote_score(void)
+{
+    wifi_ap_record_t ap;
+    int rssi = 0;
+    int uptime_min = esp_timer_get_time() / 60000000LL;
+
+    /* the router RSSI on every node, so that all candidates are scored alike */
+    if (esp_mesh_is_root()) {
+        if (esp_wifi_sta_get_ap_info(&ap) == ESP_OK) {
+            rssi = ap.rssi;
+        }
+    } else {
+        portENTER_CRITICAL(&s_vote_lock);
+        rssi = s_router_rssi;
+        portEXIT_CRITICAL(&s_vote_lock);
+    }
+    if (rssi == 0 || rssi <= -100) {
+        return 0;
+    }
+    int score = MESH_VOTE_W_RSSI * (rssi + 100);
+    score += uptime_min < MESH_VOTE_UPTIME_MAX_MIN ? uptime_min : MESH_VOTE_UPTIME_MAX_MIN;
+    return score;
+}
+
+static void mesh_vote_consider(const mesh_vote_candidate_t *best, uint16_t own)
+{
+    int64_t now = esp_timer_get_time();
+    bool waive = false;
+
+    portENTER_CRITICAL(&s_vote_lock);
+    if (memcmp(best->addr, s_self, 6) == 0 || best->score < own + CONFIG_MESH_VOTE_MARGIN) {
+        s_better_since_us = 0;
+    } else if (!s_better_since_us) {
+        s_better_since_us = now;
+    } else if (now - s_root_since_us >= MESH_VOTE_WINDOW_US && now - s_better_since_us >= MESH_VOTE_WINDOW_US) {
+        s_better_since_us = 0;
+        waive = true;
+    }
+    portEXIT_CRITICAL(&s_vote_lock);
+    if (!waive) {
+        return;
+    }
+
+    mesh_vote_t vote = {
+        .percentage = CONFIG_MESH_VOTE_PERCENTAGE / 100.0f,
+        .is_rc_specified = true,
+    };
+    memcpy(vote.config.rc_addr.addr, best->addr, 6);
+    ESP_LOGI(VOTE_TAG, "waive root to "MACSTR", score %d vs %d", MAC2STR(best->addr), best->score, own);
+    if (esp_mesh_waive_root(&vote, MESH_VOTE_REASON_ROOT_INITIATED) == ESP_OK) {
+        portENTER_CRITICAL(&s_vote_lock);
+        s_vote.waives++;
+        portEXIT_CRITICAL(&s_vote_lock);
+    }
+}
+
+static void mesh_vote_period(void *arg)
+{
+    mesh_vote_candidate_t best = {
+        .type = MESH_MSG_TYPE_VOTE,
+        .score = mesh_vote_score(),
+    };
+    uint16_t own = best.score;
+    memcpy(best.addr, s_self, 6);
+
+    portENTER_CRITICAL(&s_vote_lock);
+    if (s_best_child.type && s_best_child.score > best.score) {
+        best = s_best_child;
+    }
+    memset(&s_best_child, 0, sizeof(s_best_child));
+    s_vote.score = own;
+    portEXIT_CRITICAL(&s_vote_lock);
+
+    if (esp_mesh_is_root()) {
+        portENTER_CRITICAL(&s_vote_lock);
+        s_vote.best_score = best.score;
+        memcpy(s_vote.best_addr, best.addr, 6);
+        portEXIT_CRITICAL(&s_vote_lock);
+        mesh_vote_consider(&best, own);
+        return;
+    }
+    mesh_addr_t parent;
+    uint8_t *buf = mesh_comm_alloc(0);
+    if (!buf) {
+        return;
+    }
+    if (mesh_comm_get_parent(&parent) != ESP_OK) {
+        mesh_comm_free(buf);
+        return;
+    }
+    memcpy(buf, &best, sizeof(mesh_vote_candidate_t));
+    mesh_comm_send(&parent, buf, sizeof(mesh_vote_candidate_t), MESH_DATA_P2P);
+}
+
+static void mesh_vote_stable(void *arg)
+{
+    portENTER_CRITICAL(&s_vote_lock);
+    if (s_vote_start_us) {
+        uint32_t took = (uint32_t)(s_connected_us - s_vote_start_us);
+        s_vote.elections++;
+        s_vote.election_us_last = took;
+        if (took > s_vote.election_us_max) {
+            s_vote.election_us_max = took;
+        }
+        s_vote_start_us = 0;
+    }
+    portEXIT_CRITICAL(&s_vote_lock);
+    ESP_LOGI(VOTE_TAG, "election took %" PRIu32 " ms", s_vote.election_us_last / 1000);
+}
+
+static esp_err_t mesh_vote_process(mesh_addr_t *from, uint8_t *buf, uint16_t len)
+{
+    const mesh_vote_candidate_t *in = (const mesh_vote_candidate_t *) buf;
+    if (len < sizeof(mesh_vote_candidate_t)) {
+        return ESP_FAIL;
+    }
+    portENTER_CRITICAL(&s_vote_lock);
+    if (!s_best_child.type || in->score > s_best_child.score) {
+        s_best_child = *in;
+    }
+    portEXIT_CRITICAL(&s_vote_lock);
+    return ESP_OK;
+}
+
+void mesh_vote_on_vote_started(void)
+{
+    esp_timer_stop(s_stable_timer);
+    portENTER_CRITICAL(&s_vote_lock);
+    if (!s_vote_start_us) {
+        s_vote_start_us = esp_timer_get_time();
+    }
+    portEXIT_CRITICAL(&s_vote_lock);
+}
+
+void mesh_vote_on_parent_connected(void)
+{
+    int64_t now = esp_timer_get_time();
+    bool is_root = esp_mesh_is_root();
+    bool electing;
+
+    portENTER_CRITICAL(&s_vote_lock);
+    s_connected_us = now;
+    electing = s_vote_start_us != 0;
+    if (!is_root) {
+        s_root_since_us = 0;
+    } else if (!s_root_since_us) {
+        s_root_since_us = now;
+    }
+    portEXIT_CRITICAL(&s_vote_lock);
+    if (electing) {
+        esp_timer_stop(s_stable_timer);
+        esp_timer_start_once(s_stable_timer, MESH_VOTE_STABLE_US);
+    }
+}
+
+void mesh_vote_on_parent_disconnected(void)
+{
+    /* not stable after all: the election goes on until the next PARENT_CONNECTED */
+    esp_timer_stop(s_stable_timer);
+    portENTER_CRITICAL(&s_vote_lock);
+    s_root_since_us = 0;
+    s_better_since_us = 0;
+    portEXIT_CRITICAL(&s_vote_lock);
+}
+
+void mesh_vote_on_root_address(const uint8_t addr[6])
+{
+    static const uint8_t none[6] = { 0 };
+
+    portENTER_CRITICAL(&s_vote_lock);
+    if (memcmp(s_root_addr, none, 6) != 0 && memcmp(s_root_addr, addr, 6) != 0) {
+        s_vote.root_changes++;
+    }
+    memcpy(s_root_addr, addr, 6);
+    portEXIT_CRITICAL(&s_vote_lock);
+}
+
+void mesh_vote_on_router_rssi(int8_t rssi)
+{
+    portENTER_CRITICAL(&s_vote_lock);
+    s_router_rssi = rssi;
+    portEXIT_CRITICAL(&s_vote_lock);
+}
+
+void mesh_vote_on_asked_yield(const mesh_event_root_conflict_t *conflict)
+{
+    portENTER_CRITICAL(&s_vote_lock);
+    s_vote.yields_asked++;
+    portEXIT_CRITICAL(&s_vote_lock);
+    ESP_LOGW(VOTE_TAG, "asked to yield by "MACSTR", rssi:%d, capacity:%d, own score:%d",
+             MAC2STR(conflict->addr), conflict->rssi, conflict->capacity, s_vote.score);
+}
+
+void mesh_vote_get_stats(mesh_vote_stats_t *stats)
+{
+    portENTER_CRITICAL(&s_vote_lock);
+    memcpy(stats, &s_vote, sizeof(mesh_vote_stats_t));
+    portEXIT_CRITICAL(&s_vote_lock);
+}
+
+esp_err_t mesh_vote_init(void)
+{
+    esp_timer_create_args_t period_args = {
+        .callback = mesh_vote_period,
+        .name = "mesh_vote",
+    };
+    esp_timer_create_args_t stable_args = {
+        .callback = mesh_vote_stable,
+        .name = "mesh_vote_stable",
+    };
+    ESP_ERROR_CHECK(esp_read_mac(s_self, ESP_MAC_WIFI_STA));
+    ESP_ERROR_CHECK(esp_timer_create(&period_args, &s_period_timer));
+    ESP_ERROR_CHECK(esp_timer_create(&stable_args, &s_stable_timer));
+    return mesh_comm_register_handler(MESH_MSG_TYPE_VOTE, mesh_vote_process);
+}
+
+esp_err_t mesh_vote_start(void)
+{
+    if (esp_timer_is_active(s_period_timer)) {
+        return ESP_OK;
+    }
+    return esp_timer_start_periodic(s_period_timer, MESH_VOTE_PERIOD_US);
+}
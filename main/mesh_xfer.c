@@ -0,0 +1,669 @@
+/* Mesh Bulk Transfer
+
+   The root announces a transfer to its children (BEGIN) and streams the
+   chunks to each of them, with up to CONFIG_MESH_XFER_WINDOW chunks in
+   flight per child. Every node writes the chunks it receives straight
+   into its next OTA partition (the two slots come from partitions.csv,
+   selected in sdkconfig.defaults) and relays each stored chunk to its own
+   children right away, so the layers work in a pipeline: the whole mesh
+   has the blob after about one blob-time plus depth x chunk latency,
+   instead of one blob-time per node.
+
+   Children report what they have (STATUS): a cumulative base plus a
+   64-chunk bitmap after it. Only the chunks missing from the bitmap are
+   sent again: right away for the holes below the highest chunk the
+   child has, and after CONFIG_MESH_XFER_RTO_MS without news from the
+   child for the rest of the window.
+
+   The progress is saved in NVS every MESH_XFER_SAVE_EVERY chunks: after
+   a reboot, or under a new parent, the node answers the next BEGIN with
+   the saved base and the transfer carries on from there.
+*/
+
+#include <string.h>
+#include <inttypes.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_mesh.h"
+#include "esp_timer.h"
+#include "esp_random.h"
+#include "esp_rom_crc.h"
+#include "esp_partition.h"
+#include "esp_ota_ops.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "nvs.h"
+#include "mesh_comm.h"
+#include "mesh_flow.h"
+#include "mesh_xfer.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define MESH_XFER_CHUNK_SIZE        (CONFIG_MESH_XFER_CHUNK_SIZE)
+#define MESH_XFER_WINDOW            (CONFIG_MESH_XFER_WINDOW)
+#define MESH_XFER_RTO_US            (CONFIG_MESH_XFER_RTO_MS * 1000LL)
+#define MESH_XFER_MAX_CHUNKS        ((CONFIG_MESH_XFER_MAX_SIZE_KB * 1024 + MESH_XFER_CHUNK_SIZE - 1) / MESH_XFER_CHUNK_SIZE)
+#define MESH_XFER_MAP_WORDS         ((MESH_XFER_MAX_CHUNKS + 31) / 32)
+#define MESH_XFER_MSG_MAX           (sizeof(mesh_xfer_chunk_t) + MESH_XFER_CHUNK_SIZE)
+#define MESH_XFER_MAX_CHILDREN      (CONFIG_MESH_AP_CONNECTIONS)
+#define MESH_XFER_STATUS_EVERY      ((MESH_XFER_WINDOW + 1) / 2)
+#define MESH_XFER_SAVE_EVERY        (64)
+/* keep most of the mesh_comm pool for the rest of the traffic */
+#define MESH_XFER_BURST             (CONFIG_MESH_COMM_POOL_SIZE / 4 ? CONFIG_MESH_COMM_POOL_SIZE / 4 : 1)
+#define MESH_XFER_TICK_MS           (10)
+#define MESH_XFER_TASK_STACK        (4096)
+#define MESH_XFER_TASK_PRIO         (3)
+#define MESH_XFER_SECTOR_SIZE       (4096)
+#define MESH_XFER_NVS_NAMESPACE     "mesh_xfer"
+#define MESH_XFER_NVS_KEY           "state"
+/* local only, never on the wire: mesh_xfer_push() hands the new transfer to the task */
+#define MESH_XFER_OP_PUSH           (0x80)
+
+/*******************************************************
+ *                Structures
+ *******************************************************/
+typedef struct {
+    mesh_addr_t from;
+    uint16_t len;
+    uint8_t data[MESH_XFER_MSG_MAX];
+} mesh_xfer_rx_t;
+
+/* the current transfer, also what is saved in NVS */
+typedef struct {
+    uint32_t id;
+    uint32_t size;
+    uint32_t crc;
+    uint16_t chunk_size;
+    uint32_t base;          /* every chunk below is stored */
+} mesh_xfer_state_t;
+
+typedef struct {
+    bool used;
+    uint8_t mac[6];
+    uint32_t id;            /* transfer the child reported, 0 before its first STATUS */
+    uint32_t base;
+    uint64_t bitmap;
+    uint32_t next;          /* next chunk to consider sending */
+    uint32_t sent;          /* highest chunk sent + 1: anything below is a retransmission */
+    uint32_t repair;        /* next hole to fill below repair_end */
+    uint32_t repair_end;    /* the child reported chunks up to here, so the holes below are lost */
+    int64_t last_us;        /* last STATUS received, or BEGIN / rewind done */
+} mesh_xfer_child_t;
+
+/*******************************************************
+ *                Variable Definitions
+ *******************************************************/
+static const char *XFER_TAG = "mesh_xfer";
+
+static mesh_xfer_state_t s_cur;
+static mesh_xfer_state_t s_saved;
+static const esp_partition_t *s_part = NULL;    /* chunks are stored in / read from here */
+static const esp_partition_t *s_push_src = NULL;
+static bool s_source = false;                   /* we are the root of the transfer */
+static uint32_t s_map[MESH_XFER_MAP_WORDS];
+static mesh_xfer_child_t s_children[MESH_XFER_MAX_CHILDREN];
+static mesh_xfer_stats_t s_stats;
+static portMUX_TYPE s_xfer_lock = portMUX_INITIALIZER_UNLOCKED;
+static QueueHandle_t s_rx_queue = NULL;
+static mesh_xfer_rx_t s_rx_in;                  /* RX task side */
+static mesh_xfer_rx_t s_rx;                     /* xfer task side */
+static mesh_xfer_done_cb_t s_done_cb = NULL;
+static int64_t s_begin_us = 0;
+static int64_t s_last_rx_us = 0;
+static int64_t s_last_status_us = 0;
+static uint32_t s_unacked = 0;
+static bool s_xfer_started = false;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+static bool mesh_xfer_has(uint32_t index)
+{
+    return s_source || (s_map[index / 32] >> (index % 32)) & 1;
+}
+
+static uint32_t mesh_xfer_chunk_len(uint32_t index)
+{
+    uint32_t off = index * s_cur.chunk_size;
+    return s_cur.size - off < s_cur.chunk_size ? s_cur.size - off : s_cur.chunk_size;
+}
+
+static void mesh_xfer_save(void)
+{
+    nvs_handle_t nvs;
+    if (nvs_open(MESH_XFER_NVS_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK) {
+        return;
+    }
+    if (nvs_set_blob(nvs, MESH_XFER_NVS_KEY, &s_cur, sizeof(s_cur)) == ESP_OK) {
+        nvs_commit(nvs);
+        s_saved = s_cur;
+    }
+    nvs_close(nvs);
+}
+
+static void mesh_xfer_load(void)
+{
+    nvs_handle_t nvs;
+    size_t len = sizeof(s_saved);
+    if (nvs_open(MESH_XFER_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return;
+    }
+    if (nvs_get_blob(nvs, MESH_XFER_NVS_KEY, &s_saved, &len) != ESP_OK || len != sizeof(s_saved)) {
+        memset(&s_saved, 0, sizeof(s_saved));
+    }
+    nvs_close(nvs);
+}
+
+/* CRC32 (same as zlib's) of the first `size` bytes of the partition */
+static esp_err_t mesh_xfer_crc(const esp_partition_t *part, uint32_t size, uint32_t *crc)
+{
+    uint8_t block[256];
+    *crc = 0;
+    for (uint32_t off = 0; off < size; off += sizeof(block)) {
+        uint32_t n = size - off < sizeof(block) ? size - off : sizeof(block);
+        esp_err_t err = esp_partition_read(part, off, block, n);
+        if (err != ESP_OK) {
+            return err;
+        }
+        *crc = esp_rom_crc32_le(*crc, block, n);
+    }
+    return ESP_OK;
+}
+
+static void mesh_xfer_send_status(void)
+{
+    mesh_addr_t parent;
+    if (!s_cur.id || s_source || mesh_comm_get_parent(&parent) != ESP_OK) {
+        return;
+    }
+    uint8_t *buf = mesh_comm_alloc(0);
+    if (!buf) {
+        return;
+    }
+    mesh_xfer_ack_t *ack = (mesh_xfer_ack_t *) buf;
+    ack->hdr.type = MESH_MSG_TYPE_XFER;
+    ack->hdr.op = MESH_XFER_OP_STATUS;
+    ack->hdr.id = s_cur.id;
+    ack->base = s_cur.base;
+    ack->bitmap = 0;
+    for (uint32_t i = 1; i < 64 && s_cur.base + i < s_stats.chunks; i++) {
+        if (mesh_xfer_has(s_cur.base + i)) {
+            ack->bitmap |= 1ULL << i;
+        }
+    }
+    s_unacked = 0;
+    s_last_status_us = esp_timer_get_time();
+    mesh_comm_send(&parent, buf, sizeof(mesh_xfer_ack_t), MESH_DATA_P2P);
+}
+
+static void mesh_xfer_send_begin(const uint8_t mac[6])
+{
+    mesh_addr_t to;
+    uint8_t *buf = mesh_comm_alloc(0);
+    if (!buf) {
+        return;
+    }
+    mesh_xfer_begin_t *begin = (mesh_xfer_begin_t *) buf;
+    begin->hdr.type = MESH_MSG_TYPE_XFER;
+    begin->hdr.op = MESH_XFER_OP_BEGIN;
+    begin->hdr.id = s_cur.id;
+    begin->size = s_cur.size;
+    begin->crc = s_cur.crc;
+    begin->chunk_size = s_cur.chunk_size;
+    memcpy(to.addr, mac, 6);
+    mesh_comm_send(&to, buf, sizeof(mesh_xfer_begin_t), MESH_DATA_P2P);
+}
+
+static esp_err_t mesh_xfer_send_chunk(const uint8_t mac[6], uint32_t index)
+{
+    mesh_addr_t to;
+    uint32_t len = mesh_xfer_chunk_len(index);
+    uint8_t *buf = mesh_comm_alloc(0);
+    if (!buf) {
+        return ESP_ERR_NO_MEM;
+    }
+    mesh_xfer_chunk_t *chunk = (mesh_xfer_chunk_t *) buf;
+    chunk->hdr.type = MESH_MSG_TYPE_XFER;
+    chunk->hdr.op = MESH_XFER_OP_CHUNK;
+    chunk->hdr.id = s_cur.id;
+    chunk->index = index;
+    esp_err_t err = esp_partition_read(s_part, index * s_cur.chunk_size, chunk->data, len);
+    if (err != ESP_OK) {
+        mesh_comm_free(buf);
+        return err;
+    }
+    memcpy(to.addr, mac, 6);
+    return mesh_comm_send(&to, buf, sizeof(mesh_xfer_chunk_t) + len, MESH_DATA_P2P);
+}
+
+/* A new transfer: every child has to be told with a BEGIN first */
+static void mesh_xfer_reset_children(void)
+{
+    portENTER_CRITICAL(&s_xfer_lock);
+    for (int i = 0; i < MESH_XFER_MAX_CHILDREN; i++) {
+        s_children[i].id = 0;
+        s_children[i].last_us = 0;
+    }
+    s_stats.id = s_cur.id;
+    s_stats.size = s_cur.size;
+    s_stats.chunks = (s_cur.size + s_cur.chunk_size - 1) / s_cur.chunk_size;
+    s_stats.stored = s_source ? s_stats.chunks : s_cur.base;
+    s_stats.complete = s_source;
+    s_stats.elapsed_ms = 0;
+    portEXIT_CRITICAL(&s_xfer_lock);
+}
+
+static void mesh_xfer_on_push(const mesh_xfer_begin_t *push)
+{
+    memset(&s_cur, 0, sizeof(s_cur));
+    s_cur.id = push->hdr.id;
+    s_cur.size = push->size;
+    s_cur.crc = push->crc;
+    s_cur.chunk_size = push->chunk_size;
+    s_part = s_push_src;
+    s_source = true;
+    s_cur.base = (s_cur.size + s_cur.chunk_size - 1) / s_cur.chunk_size;
+    mesh_xfer_reset_children();
+    ESP_LOGI(XFER_TAG, "push id:%08" PRIx32 ", %" PRIu32 " bytes, crc:%08" PRIx32, s_cur.id, s_cur.size, s_cur.crc);
+}
+
+static void mesh_xfer_on_begin(const mesh_xfer_begin_t *begin)
+{
+    const esp_partition_t *part = esp_ota_get_next_update_partition(NULL);
+    uint32_t chunks = begin->chunk_size ? (begin->size + begin->chunk_size - 1) / begin->chunk_size : 0;
+
+    if (s_source) {
+        return;
+    }
+    if (begin->hdr.id == s_cur.id) {
+        /* a new parent, or our last STATUS got lost */
+        mesh_xfer_send_status();
+        return;
+    }
+    if (!part || chunks == 0 || begin->chunk_size > MESH_XFER_CHUNK_SIZE || chunks > MESH_XFER_MAX_CHUNKS
+            || begin->size > part->size) {
+        ESP_LOGW(XFER_TAG, "cannot take transfer id:%08" PRIx32 ", %" PRIu32 " bytes", begin->hdr.id, begin->size);
+        return;
+    }
+    bool resume = s_saved.id == begin->hdr.id && s_saved.size == begin->size && s_saved.crc == begin->crc
+                  && s_saved.chunk_size == begin->chunk_size && s_saved.base <= chunks;
+
+    s_part = part;
+    memset(s_map, 0, sizeof(s_map));
+    memset(&s_cur, 0, sizeof(s_cur));
+    s_cur.id = begin->hdr.id;
+    s_cur.size = begin->size;
+    s_cur.crc = begin->crc;
+    s_cur.chunk_size = begin->chunk_size;
+    if (resume) {
+        s_cur.base = s_saved.base;
+        for (uint32_t i = 0; i < s_cur.base; i++) {
+            s_map[i / 32] |= 1UL << (i % 32);
+        }
+        s_stats.resumes++;
+        ESP_LOGI(XFER_TAG, "resume id:%08" PRIx32 " at chunk %" PRIu32 "/%" PRIu32, s_cur.id, s_cur.base, chunks);
+    } else {
+        uint32_t erase = (s_cur.size + MESH_XFER_SECTOR_SIZE - 1) / MESH_XFER_SECTOR_SIZE * MESH_XFER_SECTOR_SIZE;
+        esp_err_t err = esp_partition_erase_range(s_part, 0, erase);
+        if (err != ESP_OK) {
+            ESP_LOGE(XFER_TAG, "erase %s failed:0x%x", s_part->label, err);
+            memset(&s_cur, 0, sizeof(s_cur));
+            return;
+        }
+        mesh_xfer_save();
+        ESP_LOGI(XFER_TAG, "begin id:%08" PRIx32 ", %" PRIu32 " bytes into %s", s_cur.id, s_cur.size, s_part->label);
+    }
+    s_begin_us = esp_timer_get_time();
+    s_last_rx_us = s_begin_us;
+    mesh_xfer_reset_children();
+    /* only a verified transfer is saved with every chunk stored */
+    s_stats.complete = s_cur.base == s_stats.chunks;
+    mesh_xfer_send_status();
+}
+
+static void mesh_xfer_finish(void)
+{
+    uint32_t crc = 0;
+    esp_err_t result = mesh_xfer_crc(s_part, s_cur.size, &crc);
+    if (result == ESP_OK && crc != s_cur.crc) {
+        result = ESP_ERR_INVALID_CRC;
+    }
+    if (result != ESP_OK) {
+        /* start over: a base of 0 makes the parent send everything again */
+        ESP_LOGE(XFER_TAG, "id:%08" PRIx32 " crc %08" PRIx32 " != %08" PRIx32 ", restarting", s_cur.id, crc, s_cur.crc);
+        memset(s_map, 0, sizeof(s_map));
+        s_cur.base = 0;
+        s_stats.stored = 0;
+        esp_partition_erase_range(s_part, 0, (s_cur.size + MESH_XFER_SECTOR_SIZE - 1) / MESH_XFER_SECTOR_SIZE * MESH_XFER_SECTOR_SIZE);
+    } else {
+        portENTER_CRITICAL(&s_xfer_lock);
+        s_stats.complete = true;
+        s_stats.elapsed_ms = (esp_timer_get_time() - s_begin_us) / 1000;
+        portEXIT_CRITICAL(&s_xfer_lock);
+        ESP_LOGI(XFER_TAG, "id:%08" PRIx32 " complete in %" PRIu32 " ms", s_cur.id, s_stats.elapsed_ms);
+    }
+    mesh_xfer_save();
+    mesh_xfer_send_status();
+    if (s_done_cb) {
+        s_done_cb(s_cur.id, s_part, result);
+    }
+}
+
+static void mesh_xfer_on_chunk(const mesh_xfer_chunk_t *chunk, uint16_t len)
+{
+    uint32_t index = chunk->index;
+
+    if (chunk->hdr.id != s_cur.id || s_source || index >= s_stats.chunks
+            || len - sizeof(mesh_xfer_chunk_t) != mesh_xfer_chunk_len(index)) {
+        return;
+    }
+    s_last_rx_us = esp_timer_get_time();
+    s_stats.rx_chunks++;
+    if (mesh_xfer_has(index)) {
+        /* our last STATUS was lost or late */
+        s_stats.rx_dups++;
+        if (++s_unacked >= MESH_XFER_STATUS_EVERY) {
+            mesh_xfer_send_status();
+        }
+        return;
+    }
+    esp_err_t err = esp_partition_write(s_part, index * s_cur.chunk_size, chunk->data, mesh_xfer_chunk_len(index));
+    if (err != ESP_OK) {
+        ESP_LOGE(XFER_TAG, "write chunk %" PRIu32 " failed:0x%x", index, err);
+        return;
+    }
+    s_map[index / 32] |= 1UL << (index % 32);
+    uint32_t old_base = s_cur.base;
+    while (s_cur.base < s_stats.chunks && mesh_xfer_has(s_cur.base)) {
+        s_cur.base++;
+    }
+    portENTER_CRITICAL(&s_xfer_lock);
+    s_stats.stored++;
+    portEXIT_CRITICAL(&s_xfer_lock);
+
+    if (s_cur.base == s_stats.chunks) {
+        mesh_xfer_finish();
+        return;
+    }
+    if (s_cur.base / MESH_XFER_SAVE_EVERY != old_base / MESH_XFER_SAVE_EVERY) {
+        mesh_xfer_save();
+    }
+    if (++s_unacked >= MESH_XFER_STATUS_EVERY) {
+        mesh_xfer_send_status();
+    }
+}
+
+static void mesh_xfer_on_status(const mesh_addr_t *from, const mesh_xfer_ack_t *ack)
+{
+    portENTER_CRITICAL(&s_xfer_lock);
+    for (int i = 0; i < MESH_XFER_MAX_CHILDREN; i++) {
+        mesh_xfer_child_t *c = &s_children[i];
+        if (!c->used || memcmp(c->mac, from->addr, 6) != 0) {
+            continue;
+        }
+        if (c->id != ack->hdr.id || ack->base < c->base) {
+            /* a new transfer, or the child started over: the holes of before are not this one's */
+            c->repair = ack->base;
+            c->repair_end = ack->base;
+        }
+        if (c->id != ack->hdr.id) {
+            c->id = ack->hdr.id;
+            c->next = ack->base;
+            c->sent = ack->base;
+        }
+        c->base = ack->base;
+        c->bitmap = ack->bitmap;
+        if (ack->bitmap) {
+            /* chunks after base arrived, so base and the other holes below them were lost */
+            uint32_t end = ack->base + 63 - __builtin_clzll(ack->bitmap);
+            if (end > c->repair_end) {
+                c->repair_end = end;
+                c->repair = ack->base;
+            }
+        }
+        c->last_us = esp_timer_get_time();
+        break;
+    }
+    portEXIT_CRITICAL(&s_xfer_lock);
+}
+
+/* Follow the children mesh_flow knows about */
+static void mesh_xfer_sync_children(void)
+{
+    mesh_flow_child_stats_t flow[MESH_XFER_MAX_CHILDREN];
+    int n = mesh_flow_get_children(flow, MESH_XFER_MAX_CHILDREN);
+
+    portENTER_CRITICAL(&s_xfer_lock);
+    for (int i = 0; i < MESH_XFER_MAX_CHILDREN; i++) {
+        bool found = false;
+        for (int j = 0; j < n && s_children[i].used && !found; j++) {
+            found = memcmp(s_children[i].mac, flow[j].mac, 6) == 0;
+        }
+        s_children[i].used = found;
+    }
+    for (int j = 0; j < n; j++) {
+        int free_slot = -1;
+        bool found = false;
+        for (int i = 0; i < MESH_XFER_MAX_CHILDREN && !found; i++) {
+            if (s_children[i].used) {
+                found = memcmp(s_children[i].mac, flow[j].mac, 6) == 0;
+            } else if (free_slot < 0) {
+                free_slot = i;
+            }
+        }
+        if (!found && free_slot >= 0) {
+            memset(&s_children[free_slot], 0, sizeof(mesh_xfer_child_t));
+            s_children[free_slot].used = true;
+            memcpy(s_children[free_slot].mac, flow[j].mac, 6);
+        }
+    }
+    portEXIT_CRITICAL(&s_xfer_lock);
+}
+
+static void mesh_xfer_serve(void)
+{
+    int64_t now = esp_timer_get_time();
+    int budget = MESH_XFER_BURST;
+
+    mesh_xfer_sync_children();
+    if (!s_cur.id) {
+        return;
+    }
+    for (int i = 0; i < MESH_XFER_MAX_CHILDREN && budget > 0; i++) {
+        mesh_xfer_child_t c;
+        portENTER_CRITICAL(&s_xfer_lock);
+        c = s_children[i];
+        portEXIT_CRITICAL(&s_xfer_lock);
+        if (!c.used) {
+            continue;
+        }
+        if (c.id != s_cur.id) {
+            if (now - c.last_us >= MESH_XFER_RTO_US) {
+                mesh_xfer_send_begin(c.mac);
+                c.last_us = now;
+                budget--;
+            }
+        } else if (c.base < s_stats.chunks) {
+            uint32_t end = c.base + MESH_XFER_WINDOW < s_stats.chunks ? c.base + MESH_XFER_WINDOW : s_stats.chunks;
+            c.next = c.next < c.base ? c.base : c.next;
+            c.repair = c.repair < c.base ? c.base : c.repair;
+            /* the source has every index, so never go past the blob */
+            uint32_t repair_end = c.repair_end < s_stats.chunks ? c.repair_end : s_stats.chunks;
+            while (c.repair < repair_end && budget > 0) {
+                uint32_t index = c.repair;
+                if (index - c.base < 64 && (c.bitmap >> (index - c.base)) & 1) {
+                    c.repair++;
+                    continue;
+                }
+                if (mesh_xfer_has(index)) {
+                    if (mesh_xfer_send_chunk(c.mac, index) != ESP_OK) {
+                        break;
+                    }
+                    s_stats.retransmits++;
+                    s_stats.tx_chunks++;
+                    budget--;
+                }
+                c.repair++;
+            }
+            if (c.next >= end && now - c.last_us >= MESH_XFER_RTO_US) {
+                /* the window is out and the child went quiet: send again what it is missing */
+                c.next = c.base;
+                c.last_us = now;
+            }
+            while (c.next < end && budget > 0) {
+                uint32_t index = c.next;
+                if (index - c.base < 64 && (c.bitmap >> (index - c.base)) & 1) {
+                    c.next++;
+                    continue;
+                }
+                if (!mesh_xfer_has(index) || mesh_xfer_send_chunk(c.mac, index) != ESP_OK) {
+                    /* not here from our parent yet, or the pool is busy: next tick */
+                    break;
+                }
+                if (index < c.sent) {
+                    s_stats.retransmits++;
+                } else {
+                    c.sent = index + 1;
+                }
+                s_stats.tx_chunks++;
+                c.next++;
+                budget--;
+            }
+        }
+        portENTER_CRITICAL(&s_xfer_lock);
+        mesh_xfer_child_t *dst = &s_children[i];
+        if (dst->used && memcmp(dst->mac, c.mac, 6) == 0) {
+            dst->next = c.next;
+            if (dst->repair_end == c.repair_end) {
+                dst->repair = c.repair;
+            }
+            dst->sent = c.sent > dst->sent ? c.sent : dst->sent;
+            dst->last_us = c.last_us > dst->last_us ? c.last_us : dst->last_us;
+        }
+        portEXIT_CRITICAL(&s_xfer_lock);
+    }
+}
+
+static void mesh_xfer_task(void *arg)
+{
+    int64_t last_serve_us = 0;
+
+    while (true) {
+        if (xQueueReceive(s_rx_queue, &s_rx, pdMS_TO_TICKS(MESH_XFER_TICK_MS)) == pdTRUE) {
+            const mesh_xfer_hdr_t *hdr = (const mesh_xfer_hdr_t *) s_rx.data;
+            if (hdr->op == MESH_XFER_OP_PUSH) {
+                mesh_xfer_on_push((const mesh_xfer_begin_t *) s_rx.data);
+            } else if (hdr->op == MESH_XFER_OP_BEGIN && s_rx.len >= sizeof(mesh_xfer_begin_t)) {
+                mesh_xfer_on_begin((const mesh_xfer_begin_t *) s_rx.data);
+            } else if (hdr->op == MESH_XFER_OP_CHUNK && s_rx.len >= sizeof(mesh_xfer_chunk_t)) {
+                mesh_xfer_on_chunk((const mesh_xfer_chunk_t *) s_rx.data, s_rx.len);
+            }
+        }
+        int64_t now = esp_timer_get_time();
+        if (now - last_serve_us < MESH_XFER_TICK_MS * 1000) {
+            continue;
+        }
+        last_serve_us = now;
+        mesh_xfer_serve();
+        /* a receiver that stopped getting chunks reminds its parent where it is */
+        if (s_cur.id && !s_source && s_cur.base < s_stats.chunks
+                && now - s_last_rx_us >= MESH_XFER_RTO_US && now - s_last_status_us >= MESH_XFER_RTO_US) {
+            mesh_xfer_send_status();
+        }
+    }
+}
+
+static esp_err_t mesh_xfer_process(mesh_addr_t *from, uint8_t *buf, uint16_t len)
+{
+    const mesh_xfer_hdr_t *hdr = (const mesh_xfer_hdr_t *) buf;
+    if (len < sizeof(mesh_xfer_hdr_t)) {
+        return ESP_FAIL;
+    }
+    if (hdr->op == MESH_XFER_OP_STATUS) {
+        if (len < sizeof(mesh_xfer_ack_t)) {
+            return ESP_FAIL;
+        }
+        mesh_xfer_on_status(from, (const mesh_xfer_ack_t *) buf);
+        return ESP_OK;
+    }
+    if (len > MESH_XFER_MSG_MAX || (hdr->op != MESH_XFER_OP_BEGIN && hdr->op != MESH_XFER_OP_CHUNK)) {
+        return ESP_FAIL;
+    }
+    /* flash writes are slow: leave them to the xfer task */
+    s_rx_in.from = *from;
+    s_rx_in.len = len;
+    memcpy(s_rx_in.data, buf, len);
+    if (xQueueSend(s_rx_queue, &s_rx_in, 0) != pdTRUE) {
+        s_stats.rx_overruns++;
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t mesh_xfer_push(const esp_partition_t *src, uint32_t size)
+{
+    static mesh_xfer_rx_t push;
+    mesh_xfer_begin_t *begin = (mesh_xfer_begin_t *) push.data;
+
+    if (!src || size == 0 || size > src->size) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!s_xfer_started) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    memset(&push, 0, sizeof(push));
+    begin->hdr.type = MESH_MSG_TYPE_XFER;
+    begin->hdr.op = MESH_XFER_OP_PUSH;
+    begin->hdr.id = esp_random() | 1;
+    begin->size = size;
+    begin->chunk_size = MESH_XFER_CHUNK_SIZE;
+    uint32_t crc;
+    esp_err_t err = mesh_xfer_crc(src, size, &crc);
+    if (err != ESP_OK) {
+        return err;
+    }
+    begin->crc = crc;
+    push.len = sizeof(mesh_xfer_begin_t);
+    s_push_src = src;
+    return xQueueSend(s_rx_queue, &push, portMAX_DELAY) == pdTRUE ? ESP_OK : ESP_FAIL;
+}
+
+void mesh_xfer_set_done_cb(mesh_xfer_done_cb_t cb)
+{
+    s_done_cb = cb;
+}
+
+void mesh_xfer_get_stats(mesh_xfer_stats_t *stats)
+{
+    portENTER_CRITICAL(&s_xfer_lock);
+    memcpy(stats, &s_stats, sizeof(mesh_xfer_stats_t));
+    portEXIT_CRITICAL(&s_xfer_lock);
+}
+
+esp_err_t mesh_xfer_init(void)
+{
+    if (s_rx_queue) {
+        return ESP_OK;
+    }
+    s_rx_queue = xQueueCreate(CONFIG_MESH_XFER_RX_QUEUE_LEN, sizeof(mesh_xfer_rx_t));
+    if (!s_rx_queue) {
+        return ESP_ERR_NO_MEM;
+    }
+    mesh_xfer_load();
+    return mesh_comm_register_handler(MESH_MSG_TYPE_XFER, mesh_xfer_process);
+}
+
+esp_err_t mesh_xfer_start(void)
+{
+    if (s_xfer_started) {
+        return ESP_OK;
+    }
+    if (!s_rx_queue) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    s_xfer_started = true;
+    xTaskCreate(mesh_xfer_task, "mesh_xfer", MESH_XFER_TASK_STACK, NULL, MESH_XFER_TASK_PRIO, NULL);
+    return ESP_OK;
+}
@@ -0,0 +1,149 @@
+#!/usr/bin/env python3
+"""Stand-in for the server behind the mesh gateway.
+
+The root (see main/mesh_gateway.c) keeps one TCP connection open and
+writes batches of upstream messages on it. This accepts the connection,
+decodes every batch and prints its records, so the gateway can be tried
+against a Linux box on the same network as the router:
+
+    python3 tools/gateway_server/gateway_server.py --port 7000
+
+then point CONFIG_MESH_GATEWAY_HOST at this machine.
+
+With several shards (main/mesh_shard.c) every root connects here, and
+records carrying a shard envelope are passed on to the root of the
+shard they are addressed to, as a batch of their own. A root is known
+here from its first batch on (the mesh telemetry sends one regularly).
+"""
+
+import argparse
+import asyncio
+import collections
+import struct
+
+MAGIC = 0x4257474d
+VERSION = 2
+FLAG_PACKBITS = 0x01
+HDR = struct.Struct('<IBBHHHI6sH')
+REC = struct.Struct('<6sH')
+
+MSG_TYPE_SHARD = 0x0D
+# Keep in sync with mesh_shard_hdr_t in main/include/mesh_shard.h
+SHARD = struct.Struct('<BHH6s6s')
+
+MSG_TYPE_TELEMETRY = 0x04
+TELEMETRY_VERSION = 1
+# Keep in sync with mesh_telemetry_report_t in main/include/mesh_telemetry.h
+TELEMETRY = struct.Struct('<BBH8H8H' + 'Iiiq' * 4)
+TELEMETRY_METRICS = ['free_heap', 'min_free_heap', 'parent_rssi', 'uptime_s']
+
+# (root, seq) of the last batches, to drop the ones resent after a reconnect
+seen = collections.defaultdict(lambda: collections.deque(maxlen=64))
+# shard id -> (writer, next seq) of the connection of its root
+roots = {}
+
+
+def mac(b):
+    return ':'.join('%02x' % x for x in b)
+
+
+def unpackbits(data):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        n = struct.unpack_from('b', data, i)[0]
+        i += 1
+        if n >= 0:
+            out += data[i:i + n + 1]
+            i += n + 1
+        elif n != -128:
+            out += bytes([data[i]]) * (1 - n)
+            i += 1
+    return bytes(out)
+
+
+def format_record(data):
+    if len(data) == TELEMETRY.size and data[0] == MSG_TYPE_TELEMETRY and data[1] == TELEMETRY_VERSION:
+        v = TELEMETRY.unpack(data)
+        nodes, layers = v[2], v[3:11]
+        parts = ['telemetry nodes:%d layers:%s' % (nodes, list(layers))]
+        for i, name in enumerate(TELEMETRY_METRICS):
+            count, lo, hi, total = v[19 + 4 * i:23 + 4 * i]
+            if count:
+                parts.append('%s:%d/%d/%d' % (name, lo, total // count, hi))
+        return ' '.join(parts)
+    if len(data) > SHARD.size and data[0] == MSG_TYPE_SHARD:
+        _, src_shard, dst_shard, src, dst = SHARD.unpack_from(data)
+        return 'shard %d -> %d %s: %s' % (src_shard, dst_shard, mac(dst), data[SHARD.size:].hex())
+    return data.hex()
+
+
+def forward(src, data):
+    """Sends a shard envelope to the root of its destination shard"""
+    dst_shard = SHARD.unpack_from(data)[2]
+    if dst_shard not in roots:
+        print('    no root for shard %d, dropped' % dst_shard)
+        return
+    writer, seq = roots[dst_shard]
+    roots[dst_shard] = (writer, seq + 1)
+    records = REC.pack(src, len(data)) + data
+    writer.write(HDR.pack(MAGIC, VERSION, 0, 1, len(records), len(records), seq, bytes(6), dst_shard) + records)
+
+
+def handle_batch(hdr, payload, writer):
+    magic, version, flags, count, raw_len, length, seq, root, shard = hdr
+    if magic != MAGIC or version != VERSION:
+        raise ValueError('bad batch header')
+    if seq in seen[root]:
+        print('root %s batch #%d: duplicate, dropped' % (mac(root), seq))
+        return
+    seen[root].append(seq)
+    raw = unpackbits(payload) if flags & FLAG_PACKBITS else payload
+    if len(raw) != raw_len:
+        raise ValueError('batch #%d decodes to %d bytes, expected %d' % (seq, len(raw), raw_len))
+    if shard not in roots or roots[shard][0] is not writer:
+        roots[shard] = (writer, 0)
+    print('root %s shard %d batch #%d: %d records, %d -> %d bytes' % (mac(root), shard, seq, count, raw_len, length))
+    off = 0
+    for _ in range(count):
+        src, size = REC.unpack_from(raw, off)
+        off += REC.size
+        data = raw[off:off + size]
+        print('  %s  %s' % (mac(src), format_record(data)))
+        if len(data) > SHARD.size and data[0] == MSG_TYPE_SHARD:
+            forward(src, data)
+        off += size
+
+
+async def serve(reader, writer):
+    peer = writer.get_extra_info('peername')
+    print('connection from %s:%d' % peer[:2])
+    try:
+        while True:
+            hdr = HDR.unpack(await reader.readexactly(HDR.size))
+            handle_batch(hdr, await reader.readexactly(hdr[5]), writer)
+    except asyncio.IncompleteReadError:
+        print('connection from %s:%d closed' % peer[:2])
+    except ValueError as e:
+        print('%s:%d: %s, closing' % (peer[0], peer[1], e))
+    for shard in [s for s, (w, _) in roots.items() if w is writer]:
+        del roots[shard]
+    writer.close()
+
+
+async def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--host', default='0.0.0.0')
+    parser.add_argument('--port', type=int, default=7000)
+    args = parser.parse_args()
+    server = await asyncio.start_server(serve, args.host, args.port)
+    print('listening on %s:%d' % (args.host, args.port))
+    async with server:
+        await server.serve_forever()
+
+
+if __name__ == '__main__':
+    try:
+        asyncio.run(main())
+    except KeyboardInterrupt:
+        pass
@@ -0,0 +1,116 @@
+#!/usr/bin/env python3
+"""Round trip test of the gateway's PackBits.
+
+Builds the firmware encoder (main/mesh_packbits.c) into a shared library
+with the host's C compiler, encodes edge cases and random buffers with
+it, and checks that unpackbits() of gateway_server.py gives back every
+byte, that the output stays within MESH_PACKBITS_MAX_LEN and that runs
+do shrink:
+
+    python3 tools/gateway_server/packbits_test.py --rounds 20000 [--seed 1]
+"""
+
+import argparse
+import ctypes
+import os
+import random
+import subprocess
+import sys
+import tempfile
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+MAIN = os.path.join(HERE, '..', '..', 'main')
+
+sys.path.insert(0, HERE)
+# no __pycache__ next to the server
+sys.dont_write_bytecode = True
+from gateway_server import unpackbits  # noqa: E402
+
+
+def build_encoder(tmp):
+    lib = os.path.join(tmp, 'mesh_packbits.so')
+    subprocess.check_call([os.environ.get('CC', 'cc'), '-O1', '-g', '-shared', '-fPIC', '-Wall',
+                           '-I' + os.path.join(MAIN, 'include'), '-o', lib,
+                           os.path.join(MAIN, 'mesh_packbits.c')])
+    encoder = ctypes.CDLL(lib)
+    encoder.mesh_packbits_encode.argtypes = [ctypes.c_char_p, ctypes.c_size_t, ctypes.c_char_p]
+    encoder.mesh_packbits_encode.restype = ctypes.c_size_t
+    return encoder
+
+
+def max_len(n):
+    return n + n // 128 + 1
+
+
+def encode(encoder, data):
+    # a guard byte past the bound catches an encoder that writes too far
+    out = ctypes.create_string_buffer(b'\xa5' * (max_len(len(data)) + 1))
+    n = encoder.mesh_packbits_encode(data, len(data), out)
+    if n > max_len(len(data)) or out.raw[max_len(len(data))] != 0xa5:
+        raise AssertionError('%d bytes encoded to %d, more than the bound %d' % (len(data), n, max_len(len(data))))
+    return out.raw[:n]
+
+
+def random_buffer(rng):
+    """Gateway batches in miniature: literals, runs of every length around 128, zero padding"""
+    out = bytearray()
+    size = rng.choice([rng.randrange(8), rng.randrange(300), rng.randrange(4096)])
+    while len(out) < size:
+        kind = rng.randrange(4)
+        if kind == 0:
+            out += bytes(rng.randrange(256) for _ in range(rng.randrange(1, 200)))
+        elif kind == 1:
+            out += bytes([rng.randrange(256)]) * rng.choice([2, 3, 127, 128, 129, 130, 256, rng.randrange(1, 400)])
+        elif kind == 2:
+            out += bytes(rng.randrange(2) for _ in range(rng.randrange(1, 50)))
+        else:
+            out += bytes(rng.randrange(1, 40))
+    return bytes(out[:size])
+
+
+def edge_cases():
+    yield b''
+    for b in (b'\x00', b'\x80', b'\xff'):
+        for n in (1, 2, 3, 127, 128, 129, 130, 255, 256, 257, 384, 1000):
+            yield b * n
+    for n in (1, 2, 127, 128, 129, 256, 257):
+        yield bytes(i & 0xff for i in range(n))
+        # literals with a run of two in them, and ending on one
+        yield bytes(i & 0xff for i in range(n)) + b'\x07\x07' + bytes(range(5))
+        yield bytes(i & 0xff for i in range(n)) + b'\x07\x07'
+    yield b'\x01\x01\x02\x02\x03\x03' * 100
+    yield b'\x01\x01\x01\x02' * 100
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--rounds', type=int, default=20000)
+    parser.add_argument('--seed', type=int, default=1)
+    args = parser.parse_args()
+    rng = random.Random(args.seed)
+
+    with tempfile.TemporaryDirectory() as tmp:
+        encoder = build_encoder(tmp)
+        cases = list(edge_cases()) + [random_buffer(rng) for _ in range(args.rounds)]
+        raw_total = 0
+        wire_total = 0
+        for i, data in enumerate(cases):
+            wire = encode(encoder, data)
+            back = unpackbits(wire)
+            if back != data:
+                print('case %d: %d bytes came back as %d different ones' % (i, len(data), len(back)))
+                print('  in:   %s' % data[:64].hex())
+                print('  wire: %s' % wire[:64].hex())
+                return 1
+            if len(data) >= 3 and data == data[:1] * len(data) and len(wire) > 2 * ((len(data) + 127) // 128) + 1:
+                print('case %d: a run of %d bytes encoded to %d' % (i, len(data), len(wire)))
+                return 1
+            raw_total += len(data)
+            wire_total += len(wire)
+    print('%d buffers, %d bytes encoded to %d' % (len(cases), raw_total, wire_total))
+    print('ok')
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,139 @@
+/* Mesh Benchmark on the Host
+
+   Runs main/mesh_bench.c over main/mesh_comm.c on the host harness
+   (idf_host.h), one process per node, so a change that costs our own
+   stack throughput, loss or latency shows up without any hardware: the
+   esp_mesh_send()/esp_mesh_recv() mock is lossless and fast, so what is
+   lost or slow was lost or slow in our code. Node 0 is the root and
+   starts the run; every node logs as the firmware does, and the root
+   prints the per layer summary of mesh_bench. Exits 1 if a node did not
+   report or more than -l percent of the packets were lost.
+
+   Build and run:
+       cc -O2 -Wall -pthread -Itools/mesh_host/include -Itools/mesh_host -Imain/include \
+           -o bench_host tools/mesh_host/bench_host.c tools/mesh_host/idf_host.c \
+           main/mesh_comm.c main/mesh_bench.c
+       ./bench_host -n 7 -f 2 -m upstream -s 256 -r 100 -d 5 [-l 0]
+
+   -m is upstream, broadcast or peer; peer sends to the last node.
+*/
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "esp_err.h"
+#include "esp_mesh.h"
+#include "mesh_comm.h"
+#include "mesh_bench.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define BENCH_SETTLE_US         (300000)    /* every node up before the START */
+#define BENCH_END_US            (5500000)   /* run end to the summary, mesh_bench's drain and collect times */
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+static void bench_node_start(int self)
+{
+    host_mesh_join(self);
+    ESP_ERROR_CHECK(mesh_comm_init());
+    ESP_ERROR_CHECK(mesh_bench_init());
+    ESP_ERROR_CHECK(mesh_comm_start());
+}
+
+int main(int argc, char **argv)
+{
+    static const char *modes[] = { "upstream", "broadcast", "peer" };
+    mesh_bench_mode_t mode = MESH_BENCH_UPSTREAM;
+    int nodes = 7;
+    int fanout = 2;
+    uint16_t payload = 256;
+    uint16_t rate = 100;
+    uint16_t duration = 5;
+    double max_loss = 0.0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:f:m:s:r:d:l:")) != -1) {
+        switch (opt) {
+        case 'n':
+            nodes = atoi(optarg);
+            break;
+        case 'f':
+            fanout = atoi(optarg);
+            break;
+        case 'm':
+            for (mode = 0; mode <= MESH_BENCH_PEER && strcmp(optarg, modes[mode]) != 0; mode++) {
+            }
+            break;
+        case 's':
+            payload = strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            rate = strtoul(optarg, NULL, 0);
+            break;
+        case 'd':
+            duration = strtoul(optarg, NULL, 0);
+            break;
+        case 'l':
+            max_loss = atof(optarg);
+            break;
+        default:
+            mode = MESH_BENCH_PEER + 1;
+            break;
+        }
+    }
+    if (mode > MESH_BENCH_PEER || nodes < 2 || fanout < 1 || !duration) {
+        fprintf(stderr, "usage: %s [-n nodes] [-f fanout] [-m upstream|broadcast|peer] [-s payload]"
+                " [-r pps] [-d seconds] [-l max loss %%]\n", argv[0]);
+        return 2;
+    }
+
+    int64_t run_us = duration * 1000000LL + BENCH_END_US;
+    pid_t pids[nodes];
+    host_mesh_create(nodes, fanout);
+    fflush(stdout);
+    for (int i = 1; i < nodes; i++) {
+        pids[i] = fork();
+        if (pids[i] == 0) {
+            bench_node_start(i);
+            usleep(BENCH_SETTLE_US + run_us + 500000);
+            fflush(stdout);
+            _exit(0);
+        }
+    }
+
+    bench_node_start(0);
+    usleep(BENCH_SETTLE_US);
+    mesh_addr_t target;
+    host_mesh_addr(nodes - 1, &target);
+    esp_err_t err = mesh_bench_run(mode, target.addr, payload, rate, duration);
+    if (err != ESP_OK) {
+        fprintf(stderr, "mesh_bench_run() = 0x%x\n", err);
+    }
+    usleep(run_us);
+
+    mesh_bench_totals_t totals;
+    mesh_comm_stats_t stats;
+    mesh_bench_get_totals(&totals);
+    mesh_comm_get_stats(&stats);
+    uint32_t lost = totals.expected > totals.rx ? totals.expected - totals.rx : 0;
+    double loss = totals.expected ? 100.0 * lost / totals.expected : 100.0;
+    printf("%d nodes, fanout %d: %" PRIu32 " reports, %" PRIu32 " of %" PRIu32 " packets received, loss %.2f%%,"
+           " %" PRIu32 " blocked; root pool min free %" PRIu32 ", exhausted %" PRIu32 "\n",
+           nodes, fanout, totals.reports, totals.rx, totals.expected, loss, totals.tx_blocked,
+           stats.pool_min_free, stats.pool_exhausted);
+    fflush(stdout);
+
+    int failed = err != ESP_OK || !totals.run || totals.reports != (uint32_t) nodes || loss > max_loss;
+    for (int i = 1; i < nodes; i++) {
+        int status;
+        waitpid(pids[i], &status, 0);
+        failed |= !WIFEXITED(status) || WEXITSTATUS(status);
+    }
+    return failed;
+}
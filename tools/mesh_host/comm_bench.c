@@ -0,0 +1,226 @@
+/* Mesh Data Plane Benchmark
+
+   Runs main/mesh_comm.c on the host harness (idf_host.h): node 1, a
+   child process, sends to node 0, the root, through the
+   esp_mesh_send()/esp_mesh_recv() mock, so every packet goes pool
+   buffer, TX queue and task, the medium, RX task, handler and back to
+   the pool. Reports packets and bytes per second at the receiver,
+   packets lost, the pool and queue figures of mesh_comm_get_stats() on
+   both sides, and how many heap allocations each side made while the
+   run was going on, which must be none.
+
+   Build and run:
+       cc -O2 -Wall -pthread -Itools/mesh_host/include -Itools/mesh_host -Imain/include \
+           -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc -o comm_bench \
+           tools/mesh_host/comm_bench.c tools/mesh_host/idf_host.c main/mesh_comm.c
+       ./comm_bench -n 200000 -s 256 [-a]
+
+   -a hands the packets to an app task handler, through the SPSC ring,
+   instead of handling them on the RX task.
+*/
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "esp_err.h"
+#include "esp_mesh.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "mesh_comm.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define BENCH_TYPE              (0x1F)  /* not used by the firmware */
+#define BENCH_IDLE_US           (500000)
+
+/*******************************************************
+ *                Variable Definitions
+ *******************************************************/
+static bool s_counting = false;
+static uint32_t s_allocs = 0;
+static uint32_t s_rx = 0;
+static uint64_t s_rx_bytes = 0;
+static int64_t s_first_us = 0;
+static int64_t s_last_us = 0;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+static void bench_count_alloc(void)
+{
+    if (__atomic_load_n(&s_counting, __ATOMIC_RELAXED)) {
+        __atomic_fetch_add(&s_allocs, 1, __ATOMIC_RELAXED);
+    }
+}
+
+void *__wrap_malloc(size_t size)
+{
+    bench_count_alloc();
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+    bench_count_alloc();
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    bench_count_alloc();
+    return __real_realloc(ptr, size);
+}
+
+static esp_err_t bench_process(mesh_addr_t *from, uint8_t *buf, uint16_t len)
+{
+    int64_t now = esp_timer_get_time();
+    int64_t none = 0;
+    __atomic_compare_exchange_n(&s_first_us, &none, now, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    __atomic_store_n(&s_last_us, now, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s_rx, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s_rx_bytes, len, __ATOMIC_RELAXED);
+    return ESP_OK;
+}
+
+static void bench_print_stats(const char *who, bool app)
+{
+    mesh_comm_stats_t stats;
+    mesh_comm_get_stats(&stats);
+    printf("%s: pool min free %" PRIu32 ", exhausted %" PRIu32 ", tx wait avg %.1f us max %" PRIu32 " us",
+           who, stats.pool_min_free, stats.pool_exhausted,
+           stats.tx_packets ? (double) stats.tx_wait_us_total / stats.tx_packets : 0.0, stats.tx_wait_us_max);
+    if (app) {
+        printf(", app ring high water %" PRIu32 ", dropped %" PRIu32 ", latency avg %.1f us",
+               stats.app_ring_high_water, stats.app_dropped,
+               stats.app_packets ? (double) stats.app_latency_us_total / stats.app_packets : 0.0);
+    }
+    printf(", heap allocations %" PRIu32 "\n", __atomic_load_n(&s_allocs, __ATOMIC_RELAXED));
+}
+
+/* Node 1 */
+static int bench_sender(uint32_t count, uint16_t size)
+{
+    mesh_addr_t root;
+    mesh_comm_stats_t stats;
+    uint32_t sent = 0;
+    uint32_t refused = 0;
+
+    host_mesh_addr(0, &root);
+    ESP_ERROR_CHECK(mesh_comm_init());
+    ESP_ERROR_CHECK(mesh_comm_start());
+    /* the task handle of main() is allocated on first use, not during the run */
+    xTaskGetCurrentTaskHandle();
+    /* give the root time to start its RX task */
+    usleep(100000);
+
+    __atomic_store_n(&s_counting, true, __ATOMIC_RELAXED);
+    int64_t start = esp_timer_get_time();
+    while (sent < count) {
+        uint8_t *buf = mesh_comm_alloc(portMAX_DELAY);
+        memset(buf, 0, size);
+        buf[0] = BENCH_TYPE;
+        if (mesh_comm_send(&root, buf, size, MESH_DATA_P2P) == ESP_OK) {
+            sent++;
+        } else {
+            /* TX queue full: let the TX task catch up */
+            refused++;
+            vTaskDelay(1);
+        }
+    }
+    do {
+        usleep(1000);
+        mesh_comm_get_stats(&stats);
+    } while (stats.tx_packets + stats.tx_errors < sent);
+    int64_t end = esp_timer_get_time();
+    __atomic_store_n(&s_counting, false, __ATOMIC_RELAXED);
+
+    printf("sender: %" PRIu32 " packets in %.3f s, %" PRIu32 " sends refused, %" PRIu32 " send errors\n",
+           sent, (end - start) / 1e6, refused, stats.tx_errors);
+    bench_print_stats("sender", false);
+    return s_allocs == 0 ? 0 : 1;
+}
+
+/* Node 0 */
+static int bench_receiver(uint32_t count, uint16_t size, bool app)
+{
+    ESP_ERROR_CHECK(mesh_comm_init());
+    if (app) {
+        ESP_ERROR_CHECK(mesh_comm_register_app_handler(BENCH_TYPE, bench_process));
+    } else {
+        ESP_ERROR_CHECK(mesh_comm_register_handler(BENCH_TYPE, bench_process));
+    }
+    ESP_ERROR_CHECK(mesh_comm_start());
+    __atomic_store_n(&s_counting, true, __ATOMIC_RELAXED);
+
+    /* done once everything arrived, or nothing did for a while */
+    int64_t waited_us = 0;
+    while (__atomic_load_n(&s_rx, __ATOMIC_RELAXED) < count) {
+        int64_t last = __atomic_load_n(&s_last_us, __ATOMIC_RELAXED);
+        if (last ? esp_timer_get_time() - last > BENCH_IDLE_US : waited_us > 10 * BENCH_IDLE_US) {
+            break;
+        }
+        usleep(1000);
+        waited_us += 1000;
+    }
+    __atomic_store_n(&s_counting, false, __ATOMIC_RELAXED);
+
+    uint32_t rx = __atomic_load_n(&s_rx, __ATOMIC_RELAXED);
+    double secs = (s_last_us - s_first_us) / 1e6;
+    printf("receiver: %" PRIu32 " packets of %u B %s: %.0f pkt/s, %.1f MB/s, %" PRIu32 " lost\n",
+           rx, size, app ? "to the app task" : "on the RX task", secs > 0 ? rx / secs : 0.0,
+           secs > 0 ? s_rx_bytes / secs / 1e6 : 0.0, count - rx);
+    bench_print_stats("receiver", app);
+    return s_allocs == 0 && rx > 0 ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t count = 200000;
+    uint16_t size = 256;
+    bool app = false;
+    int status;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:s:a")) != -1) {
+        switch (opt) {
+        case 'n':
+            count = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            size = strtoul(optarg, NULL, 0);
+            break;
+        case 'a':
+            app = true;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n packets] [-s bytes] [-a]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (!size || size > MESH_COMM_BUF_SIZE) {
+        fprintf(stderr, "size must be 1 to %d\n", MESH_COMM_BUF_SIZE);
+        return 2;
+    }
+
+    host_mesh_create(2, 1);
+    fflush(stdout);
+    pid_t sender = fork();
+    if (sender == 0) {
+        host_mesh_join(1);
+        exit(bench_sender(count, size));
+    }
+    host_mesh_join(0);
+    int rc = bench_receiver(count, size, app);
+    fflush(stdout);
+    waitpid(sender, &status, 0);
+    return rc || !WIFEXITED(status) || WEXITSTATUS(status);
+}
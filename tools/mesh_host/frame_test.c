@@ -0,0 +1,436 @@
+/* Mesh Command Frame Test
+
+   Round trip and fuzz test of main/mesh_frame.c, with the real
+   main/mesh_auth.c behind it.
+
+   - round trip: frames of random commands go through mesh_frame_finish()
+     and come back out of mesh_frame_iter_init()/mesh_frame_iter_next()
+     unchanged, exactly once; the same bytes again, from another sender
+     or with any one bit flipped are refused
+   - replay window: frames verified out of order are all accepted once,
+     a frame older than MESH_AUTH_WINDOW never
+   - eviction: a frame of ours is still refused as a replay once frames
+     from CONFIG_MESH_AUTH_MAX_SENDERS other senders pushed us out of the
+     window table, and a new one of ours is still accepted
+   - truncation: every shorter prefix of a valid frame is refused
+   - fuzz: random bytes are refused by mesh_frame_iter_init(), and
+     properly signed frames with a random body, random command count and
+     random command lengths never make mesh_frame_iter_next() step out of
+     the frame
+
+   Every buffer handed to the parser is allocated at its exact size, so
+   with the sanitizers on, one byte read past the frame aborts the run.
+
+   Build and run:
+       cc -O1 -g -fsanitize=address,undefined -fno-sanitize-recover=all -Wall -pthread \
+           -Itools/mesh_host/include -Itools/mesh_host -Imain/include -o frame_test \
+           tools/mesh_host/frame_test.c tools/mesh_host/idf_host.c main/mesh_frame.c \
+           main/mesh_auth.c -lmbedcrypto
+       ./frame_test -n 100000 [-s seed]
+*/
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "esp_err.h"
+#include "esp_mac.h"
+#include "esp_mesh.h"
+#include "mesh_comm.h"
+#include "mesh_auth.h"
+#include "mesh_frame.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define FRAME_MAX_LEN           (MESH_MPS)
+#define FRAME_MAX_CMDS          (40)
+
+/*******************************************************
+ *                Structures
+ *******************************************************/
+typedef struct {
+    uint8_t cmd;
+    uint8_t len;
+    uint8_t data[UINT8_MAX];
+} frame_cmd_copy_t;
+
+/*******************************************************
+ *                Variable Definitions
+ *******************************************************/
+static uint64_t s_rand = 0x9e3779b97f4a7c15ULL;
+static uint8_t s_self[6];
+static uint32_t s_errors = 0;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+static uint32_t frame_rand(void)
+{
+    /* xorshift64*: the same seed gives the same run */
+    s_rand ^= s_rand >> 12;
+    s_rand ^= s_rand << 25;
+    s_rand ^= s_rand >> 27;
+    return (s_rand * 0x2545f4914f6cdd1dULL) >> 32;
+}
+
+static void frame_fail(const char *what, uint32_t round, esp_err_t err)
+{
+    if (s_errors++ < 10) {
+        fprintf(stderr, "round %" PRIu32 ": %s (0x%x)\n", round, what, err);
+    }
+}
+
+/* The parser only ever sees a copy of exactly `len` bytes */
+static esp_err_t frame_parse(mesh_frame_iter_t *it, const uint8_t from[6], uint8_t **copy,
+                             const uint8_t *buf, uint16_t len)
+{
+    *copy = malloc(len ? len : 1);
+    memcpy(*copy, buf, len);
+    return mesh_frame_iter_init(it, from, *copy, len);
+}
+
+/* Walks the commands and checks that each lies inside [start, end) */
+static int frame_walk(mesh_frame_iter_t *it, const uint8_t *start, const uint8_t *end, uint32_t round)
+{
+    const mesh_frame_cmd_t *cmd;
+    int count = 0;
+
+    while ((cmd = mesh_frame_iter_next(it)) != NULL) {
+        const uint8_t *at = (const uint8_t *) cmd;
+        if (at < start || at + sizeof(mesh_frame_cmd_t) + cmd->len > end) {
+            frame_fail("command outside the frame", round, ESP_OK);
+            break;
+        }
+        count++;
+    }
+    return count;
+}
+
+static uint16_t frame_build(uint8_t *buf, uint16_t cap, frame_cmd_copy_t *cmds, int *count)
+{
+    mesh_frame_builder_t b;
+    int want = frame_rand() % FRAME_MAX_CMDS;
+
+    mesh_frame_begin(&b, buf, cap);
+    *count = 0;
+    for (int i = 0; i < want; i++) {
+        frame_cmd_copy_t *c = &cmds[*count];
+        c->cmd = frame_rand();
+        c->len = frame_rand() % 4 ? frame_rand() % 8 : frame_rand() % (UINT8_MAX + 1);
+        uint8_t *data = mesh_frame_append(&b, c->cmd, c->len);
+        if (!data) {
+            break;
+        }
+        for (int j = 0; j < c->len; j++) {
+            c->data[j] = frame_rand();
+        }
+        memcpy(data, c->data, c->len);
+        (*count)++;
+    }
+    return mesh_frame_finish(&b);
+}
+
+static void frame_round_trip(uint32_t round)
+{
+    static uint8_t buf[FRAME_MAX_LEN];
+    static frame_cmd_copy_t cmds[FRAME_MAX_CMDS];
+    mesh_frame_iter_t it;
+    uint8_t *copy;
+    int count;
+
+    uint16_t cap = sizeof(mesh_frame_hdr_t) + MESH_AUTH_TAG_LEN
+                   + frame_rand() % (FRAME_MAX_LEN - sizeof(mesh_frame_hdr_t) - MESH_AUTH_TAG_LEN + 1);
+    uint16_t len = frame_build(buf, cap, cmds, &count);
+    if (len > cap) {
+        frame_fail("frame longer than its buffer", round, ESP_OK);
+        return;
+    }
+
+    /* one bit flipped anywhere: refused, and the nonce is not used up */
+    uint8_t from[6];
+    memcpy(from, s_self, 6);
+    uint32_t bit = frame_rand() % (len * 8);
+    buf[bit / 8] ^= 1 << (bit % 8);
+    esp_err_t err = frame_parse(&it, from, &copy, buf, len);
+    free(copy);
+    buf[bit / 8] ^= 1 << (bit % 8);
+    if (err == ESP_OK) {
+        frame_fail("frame with a flipped bit accepted", round, err);
+    }
+    /* nor from anyone else */
+    from[5] ^= 1 + frame_rand() % 0xff;
+    err = frame_parse(&it, from, &copy, buf, len);
+    free(copy);
+    if (err != ESP_ERR_INVALID_MAC) {
+        frame_fail("frame accepted from another sender", round, err);
+    }
+
+    err = frame_parse(&it, s_self, &copy, buf, len);
+    if (err != ESP_OK) {
+        frame_fail("valid frame refused", round, err);
+        free(copy);
+        return;
+    }
+    const mesh_frame_cmd_t *cmd;
+    int i = 0;
+    while ((cmd = mesh_frame_iter_next(&it)) != NULL) {
+        if (i >= count || cmd->cmd != cmds[i].cmd || cmd->len != cmds[i].len
+                || memcmp(cmd->data, cmds[i].data, cmd->len) != 0) {
+            frame_fail("command changed on the way", round, ESP_OK);
+            break;
+        }
+        i++;
+    }
+    if (i != count) {
+        frame_fail("commands missing", round, ESP_OK);
+    }
+    free(copy);
+
+    err = frame_parse(&it, s_self, &copy, buf, len);
+    free(copy);
+    if (err != ESP_ERR_INVALID_STATE) {
+        frame_fail("replayed frame not refused as a replay", round, err);
+    }
+}
+
+static void frame_truncated(uint32_t round)
+{
+    static uint8_t buf[FRAME_MAX_LEN];
+    static frame_cmd_copy_t cmds[FRAME_MAX_CMDS];
+    mesh_frame_iter_t it;
+    uint8_t *copy;
+    int count;
+
+    uint16_t len = frame_build(buf, 256, cmds, &count);
+    for (uint16_t cut = 0; cut < len; cut++) {
+        esp_err_t err = frame_parse(&it, s_self, &copy, buf, cut);
+        free(copy);
+        if (err == ESP_OK) {
+            frame_fail("truncated frame accepted", round, err);
+        }
+    }
+    esp_err_t err = frame_parse(&it, s_self, &copy, buf, len);
+    free(copy);
+    if (err != ESP_OK) {
+        frame_fail("frame refused after its truncated copies", round, err);
+    }
+}
+
+/* A sender holding the key, but sending a body that is not a list of commands */
+static void frame_signed_garbage(uint32_t round)
+{
+    static uint8_t buf[FRAME_MAX_LEN];
+    mesh_frame_hdr_t *hdr = (mesh_frame_hdr_t *) buf;
+    mesh_auth_nonce_t nonce;
+    mesh_frame_iter_t it;
+    uint8_t *copy;
+
+    uint16_t body = frame_rand() % (FRAME_MAX_LEN - sizeof(mesh_frame_hdr_t) - MESH_AUTH_TAG_LEN + 1);
+    /* mostly short bodies, where the lengths most often point past the end */
+    if (frame_rand() % 2) {
+        body %= 16;
+    }
+    for (uint16_t i = 0; i < sizeof(mesh_frame_hdr_t) + body; i++) {
+        buf[i] = frame_rand();
+    }
+    mesh_auth_next_nonce(&nonce);
+    hdr->type = MESH_MSG_TYPE_FRAME;
+    hdr->version = MESH_FRAME_VERSION;
+    hdr->length = body;
+    hdr->boot = nonce.boot;
+    hdr->counter = nonce.counter;
+    uint16_t len = sizeof(mesh_frame_hdr_t) + body;
+    mesh_auth_sign(s_self, buf, len, buf + len);
+    len += MESH_AUTH_TAG_LEN;
+
+    esp_err_t err = frame_parse(&it, s_self, &copy, buf, len);
+    if (err != ESP_OK) {
+        frame_fail("signed frame refused", round, err);
+    } else {
+        int count = frame_walk(&it, copy + sizeof(mesh_frame_hdr_t), copy + sizeof(mesh_frame_hdr_t) + body,
+                               round);
+        if (count > hdr->count || mesh_frame_iter_next(&it) != NULL) {
+            frame_fail("iterator went on past the end", round, ESP_OK);
+        }
+    }
+    free(copy);
+}
+
+static void frame_random_bytes(uint32_t round)
+{
+    static uint8_t buf[FRAME_MAX_LEN];
+    mesh_frame_hdr_t *hdr = (mesh_frame_hdr_t *) buf;
+    mesh_frame_iter_t it;
+    uint8_t *copy;
+
+    uint16_t len = frame_rand() % 64;
+    for (uint16_t i = 0; i < len; i++) {
+        buf[i] = frame_rand();
+    }
+    /* past the first checks most of the time */
+    if (len >= sizeof(mesh_frame_hdr_t) && frame_rand() % 4) {
+        hdr->type = MESH_MSG_TYPE_FRAME;
+        hdr->version = MESH_FRAME_VERSION;
+        if (frame_rand() % 2) {
+            hdr->length = len - sizeof(mesh_frame_hdr_t) - (len >= sizeof(mesh_frame_hdr_t) + MESH_AUTH_TAG_LEN
+                          ? MESH_AUTH_TAG_LEN : 0);
+        }
+    }
+    esp_err_t err = frame_parse(&it, s_self, &copy, buf, len);
+    free(copy);
+    if (err == ESP_OK) {
+        frame_fail("random bytes accepted", round, err);
+    }
+}
+
+static void frame_replay_window(void)
+{
+    static uint8_t bufs[MESH_AUTH_WINDOW + 2][64];
+    static uint16_t lens[MESH_AUTH_WINDOW + 2];
+    mesh_frame_builder_t b;
+    mesh_frame_iter_t it;
+    uint8_t *copy;
+    esp_err_t err;
+
+    for (int i = 0; i < MESH_AUTH_WINDOW + 2; i++) {
+        mesh_frame_begin(&b, bufs[i], sizeof(bufs[i]));
+        *mesh_frame_append(&b, MESH_FRAME_CMD_LIGHT_COLOR, 1) = i;
+        lens[i] = mesh_frame_finish(&b);
+    }
+
+    /* the newest first, then the rest backwards: all inside the window but the oldest */
+    for (int i = MESH_AUTH_WINDOW + 1; i >= 0; i--) {
+        err = frame_parse(&it, s_self, &copy, bufs[i], lens[i]);
+        free(copy);
+        bool want = i >= 2;
+        if ((err == ESP_OK) != want) {
+            frame_fail(want ? "reordered frame refused" : "frame behind the window accepted", i, err);
+        }
+    }
+    for (int i = 0; i < MESH_AUTH_WINDOW + 2; i++) {
+        err = frame_parse(&it, s_self, &copy, bufs[i], lens[i]);
+        free(copy);
+        if (err != ESP_ERR_INVALID_STATE) {
+            frame_fail("frame accepted twice", i, err);
+        }
+    }
+}
+
+/* A fresh, properly signed message from `src`, straight through mesh_auth */
+static esp_err_t frame_verify_other(const uint8_t src[6], uint32_t counter)
+{
+    mesh_auth_nonce_t nonce = {
+        .boot = 1,
+        .counter = counter,
+    };
+    uint8_t msg[16] = { 0 };
+    uint8_t tag[MESH_AUTH_TAG_LEN];
+
+    memcpy(msg, &nonce.boot, sizeof(uint16_t));
+    memcpy(msg + sizeof(uint16_t), &nonce.counter, sizeof(uint32_t));
+    mesh_auth_sign(src, msg, sizeof(msg), tag);
+    return mesh_auth_verify(src, msg, sizeof(msg), tag, &nonce);
+}
+
+static void frame_evicted_replay(void)
+{
+    uint8_t old[64];
+    uint8_t fresh[64];
+    mesh_frame_builder_t b;
+    mesh_frame_iter_t it;
+    mesh_auth_stats_t before;
+    mesh_auth_stats_t after;
+    uint8_t *copy;
+    esp_err_t err;
+
+    mesh_frame_begin(&b, old, sizeof(old));
+    *mesh_frame_append(&b, MESH_FRAME_CMD_LIGHT_COLOR, 1) = 1;
+    uint16_t old_len = mesh_frame_finish(&b);
+    mesh_frame_begin(&b, fresh, sizeof(fresh));
+    *mesh_frame_append(&b, MESH_FRAME_CMD_LIGHT_COLOR, 1) = 2;
+    uint16_t fresh_len = mesh_frame_finish(&b);
+
+    err = frame_parse(&it, s_self, &copy, old, old_len);
+    free(copy);
+    if (err != ESP_OK) {
+        frame_fail("frame refused before the eviction", 0, err);
+    }
+
+    /* as many other senders as the table holds, each newer than us */
+    mesh_auth_get_stats(&before);
+    for (int i = 0; i < CONFIG_MESH_AUTH_MAX_SENDERS; i++) {
+        uint8_t src[6] = { 0x02, 0x00, 0x00, 0x00, 0xee, i };
+        err = frame_verify_other(src, 0);
+        if (err != ESP_OK) {
+            frame_fail("other sender refused", i, err);
+        }
+    }
+    mesh_auth_get_stats(&after);
+    if (after.evicted == before.evicted) {
+        frame_fail("no sender pushed out of the table", 0, ESP_OK);
+    }
+
+    err = frame_parse(&it, s_self, &copy, old, old_len);
+    free(copy);
+    if (err != ESP_ERR_INVALID_STATE) {
+        frame_fail("frame replayed after its sender was pushed out accepted", 0, err);
+    }
+    err = frame_parse(&it, s_self, &copy, fresh, fresh_len);
+    free(copy);
+    if (err != ESP_OK) {
+        frame_fail("new frame refused after its sender was pushed out", 0, err);
+    }
+    /* back in the table, up from the floor */
+    err = frame_parse(&it, s_self, &copy, old, old_len);
+    free(copy);
+    if (err != ESP_ERR_INVALID_STATE) {
+        frame_fail("frame replayed after its sender came back accepted", 0, err);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t rounds = 100000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+        switch (opt) {
+        case 'n':
+            rounds = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            s_rand = strtoull(optarg, NULL, 0) | 1;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n rounds] [-s seed]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    ESP_ERROR_CHECK(mesh_auth_init());
+    esp_read_mac(s_self, ESP_MAC_WIFI_STA);
+
+    frame_replay_window();
+    frame_evicted_replay();
+    for (uint32_t round = 0; round < rounds; round++) {
+        frame_round_trip(round);
+        frame_signed_garbage(round);
+        frame_random_bytes(round);
+        if (round % 100 == 0) {
+            frame_truncated(round);
+        }
+    }
+
+    mesh_auth_stats_t stats;
+    mesh_auth_get_stats(&stats);
+    printf("%" PRIu32 " rounds: %" PRIu32 " frames signed, %" PRIu32 " verified, %" PRIu32 " bad tags, %" PRIu32
+           " replays\n", rounds, stats.signed_msgs, stats.verified, stats.bad_tags, stats.replays);
+    if (s_errors) {
+        printf("%" PRIu32 " errors\n", s_errors);
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,726 @@
+/* Mesh Host Harness
+
+   pthread implementation of idf_host.h. Nothing here allocates once a
+   node is up: queues and timers are allocated when created, and packets
+   go straight from the caller's buffer to the socket and back, so a
+   benchmark can count the allocations of the modules it drives.
+*/
+
+#include <errno.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include "idf_host.h"
+#include "mesh_flow.h"
+#include "mesh_route.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define HOST_MAX_NODES          (200)     /* the softAP MAC is the last byte + 1 */
+#define HOST_MAX_TIMERS         (32)
+#define HOST_NVS_ENTRIES        (16)
+#define HOST_SEND_TIMEOUT_US    (100000)
+
+/*******************************************************
+ *                Structures
+ *******************************************************/
+struct host_task {
+    pthread_t thread;
+    const char *name;
+    TaskFunction_t fn;
+    void *arg;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t notify;
+};
+
+struct host_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    uint8_t *items;
+    uint32_t item_size;
+    uint32_t length;
+    uint32_t head;
+    uint32_t count;
+};
+
+struct host_timer {
+    esp_timer_cb_t callback;
+    void *arg;
+    const char *name;
+    bool active;
+    int64_t due_us;
+    uint64_t period_us;     /* 0 for a one-shot timer */
+};
+
+typedef struct {
+    char name[16];
+    char key[16];
+    uint16_t value;
+    bool used;
+} host_nvs_entry_t;
+
+/*******************************************************
+ *                Variable Definitions
+ *******************************************************/
+static esp_log_level_t s_log_level = ESP_LOG_INFO;
+static __thread struct host_task *s_current = NULL;
+
+static pthread_mutex_t s_timer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_timer_cond = PTHREAD_COND_INITIALIZER;
+static struct host_timer *s_timers[HOST_MAX_TIMERS];
+static int s_timer_count = 0;
+static bool s_timer_task_started = false;
+
+static pthread_mutex_t s_nvs_lock = PTHREAD_MUTEX_INITIALIZER;
+static char s_nvs_names[HOST_NVS_ENTRIES][16];
+static host_nvs_entry_t s_nvs[HOST_NVS_ENTRIES];
+
+static int64_t s_boot_us = 0;
+
+static int s_run = 0;       /* pid of the process that created the sockets */
+static int s_nodes = 0;
+static int s_fanout = 1;
+static int s_self = 0;
+static int s_socks[HOST_MAX_NODES];
+static int s_send_sock = -1;
+static host_mesh_filter_t s_filter = NULL;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+static int64_t host_now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void host_deadline(struct timespec *ts, int64_t wait_us)
+{
+    clock_gettime(CLOCK_REALTIME, ts);
+    ts->tv_sec += wait_us / 1000000;
+    ts->tv_nsec += (wait_us % 1000000) * 1000;
+    if (ts->tv_nsec >= 1000000000) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000;
+    }
+}
+
+/* Waits on `cond` until woken, or `ticks` ms: false once they are over */
+static bool host_wait(pthread_cond_t *cond, pthread_mutex_t *lock, TickType_t ticks)
+{
+    struct timespec ts;
+    if (ticks == portMAX_DELAY) {
+        pthread_cond_wait(cond, lock);
+        return true;
+    }
+    host_deadline(&ts, (int64_t) ticks * portTICK_PERIOD_MS * 1000);
+    return pthread_cond_timedwait(cond, lock, &ts) != ETIMEDOUT;
+}
+
+void esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+    s_log_level = level;
+}
+
+void host_log(esp_log_level_t level, const char *tag, const char *fmt, ...)
+{
+    static const char letters[] = "NEWIDV";
+    char line[512];
+    va_list ap;
+
+    if (level > s_log_level) {
+        return;
+    }
+    va_start(ap, fmt);
+    vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    /* one write per line, so that the nodes of a run do not interleave */
+    fprintf(level <= ESP_LOG_WARN ? stderr : stdout, "%c (%lld) n%d %s: %s\n",
+            letters[level], (long long) (esp_timer_get_time() / 1000), s_self, tag, line);
+}
+
+void host_critical_enter(portMUX_TYPE *mux)
+{
+    pthread_t self = pthread_self();
+    if (__atomic_load_n(&mux->depth, __ATOMIC_ACQUIRE) && pthread_equal(mux->owner, self)) {
+        mux->depth++;
+        return;
+    }
+    pthread_mutex_lock(&mux->lock);
+    mux->owner = self;
+    __atomic_store_n(&mux->depth, 1, __ATOMIC_RELEASE);
+}
+
+void host_critical_exit(portMUX_TYPE *mux)
+{
+    if (--mux->depth == 0) {
+        pthread_mutex_unlock(&mux->lock);
+    }
+}
+
+static struct host_task *host_task_new(const char *name, TaskFunction_t fn, void *arg)
+{
+    struct host_task *task = calloc(1, sizeof(struct host_task));
+    if (!task) {
+        abort();
+    }
+    task->name = name;
+    task->fn = fn;
+    task->arg = arg;
+    pthread_mutex_init(&task->lock, NULL);
+    pthread_cond_init(&task->cond, NULL);
+    return task;
+}
+
+static void *host_task_main(void *arg)
+{
+    s_current = arg;
+    s_current->fn(s_current->arg);
+    return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack, void *arg,
+                                   UBaseType_t prio, TaskHandle_t *handle, BaseType_t core)
+{
+    struct host_task *task = host_task_new(name, fn, arg);
+    if (handle) {
+        /* before the thread runs: it may be notified right away */
+        *handle = task;
+    }
+    if (pthread_create(&task->thread, NULL, host_task_main, task) != 0) {
+        abort();
+    }
+    pthread_detach(task->thread);
+    return pdPASS;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    if (!s_current) {
+        /* main(), or any thread the test started itself */
+        s_current = host_task_new("main", NULL, NULL);
+        s_current->thread = pthread_self();
+    }
+    return s_current;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    usleep((useconds_t) ticks * portTICK_PERIOD_MS * 1000);
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    pthread_mutex_lock(&task->lock);
+    task->notify++;
+    pthread_cond_signal(&task->cond);
+    pthread_mutex_unlock(&task->lock);
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks)
+{
+    struct host_task *task = xTaskGetCurrentTaskHandle();
+    uint32_t value;
+
+    pthread_mutex_lock(&task->lock);
+    while (!task->notify && host_wait(&task->cond, &task->lock, ticks)) {
+    }
+    value = task->notify;
+    if (value) {
+        task->notify = clear ? 0 : value - 1;
+    }
+    pthread_mutex_unlock(&task->lock);
+    return value;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    struct host_queue *queue = calloc(1, sizeof(struct host_queue));
+    if (!queue || !(queue->items = malloc((size_t) length * item_size))) {
+        free(queue);
+        return NULL;
+    }
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->not_empty, NULL);
+    pthread_cond_init(&queue->not_full, NULL);
+    queue->item_size = item_size;
+    queue->length = length;
+    return queue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+    bool done = false;
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == queue->length && host_wait(&queue->not_full, &queue->lock, ticks)) {
+    }
+    if (queue->count < queue->length) {
+        uint32_t slot = (queue->head + queue->count) % queue->length;
+        memcpy(queue->items + slot * queue->item_size, item, queue->item_size);
+        queue->count++;
+        pthread_cond_signal(&queue->not_empty);
+        done = true;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return done ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks)
+{
+    bool done = false;
+
+    pthread_mutex_lock(&queue->lock);
+    while (!queue->count && host_wait(&queue->not_empty, &queue->lock, ticks)) {
+    }
+    if (queue->count) {
+        memcpy(item, queue->items + queue->head * queue->item_size, queue->item_size);
+        queue->head = (queue->head + 1) % queue->length;
+        queue->count--;
+        pthread_cond_signal(&queue->not_full);
+        done = true;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return done ? pdTRUE : pdFALSE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    UBaseType_t count = queue->count;
+    pthread_mutex_unlock(&queue->lock);
+    return count;
+}
+
+__attribute__((constructor)) static void host_boot(void)
+{
+    s_boot_us = host_now_us();
+}
+
+int64_t esp_timer_get_time(void)
+{
+    return host_now_us() - s_boot_us;
+}
+
+static void host_timer_task(void *arg)
+{
+    pthread_mutex_lock(&s_timer_lock);
+    while (true) {
+        struct host_timer *next = NULL;
+        for (int i = 0; i < s_timer_count; i++) {
+            if (s_timers[i]->active && (!next || s_timers[i]->due_us < next->due_us)) {
+                next = s_timers[i];
+            }
+        }
+        int64_t now = esp_timer_get_time();
+        if (!next) {
+            pthread_cond_wait(&s_timer_cond, &s_timer_lock);
+            continue;
+        }
+        if (next->due_us > now) {
+            struct timespec ts;
+            host_deadline(&ts, next->due_us - now);
+            pthread_cond_timedwait(&s_timer_cond, &s_timer_lock, &ts);
+            continue;
+        }
+        if (next->period_us) {
+            next->due_us += next->period_us;
+        } else {
+            next->active = false;
+        }
+        /* unlocked: the callback may start or stop timers, its own included */
+        pthread_mutex_unlock(&s_timer_lock);
+        next->callback(next->arg);
+        pthread_mutex_lock(&s_timer_lock);
+    }
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *timer)
+{
+    struct host_timer *t = calloc(1, sizeof(struct host_timer));
+    if (!t) {
+        return ESP_ERR_NO_MEM;
+    }
+    t->callback = args->callback;
+    t->arg = args->arg;
+    t->name = args->name;
+
+    pthread_mutex_lock(&s_timer_lock);
+    if (s_timer_count == HOST_MAX_TIMERS) {
+        pthread_mutex_unlock(&s_timer_lock);
+        free(t);
+        return ESP_ERR_NO_MEM;
+    }
+    s_timers[s_timer_count++] = t;
+    bool start = !s_timer_task_started;
+    s_timer_task_started = true;
+    pthread_mutex_unlock(&s_timer_lock);
+    if (start) {
+        xTaskCreatePinnedToCore(host_timer_task, "esp_timer", 0, NULL, 22, NULL, 0);
+    }
+    *timer = t;
+    return ESP_OK;
+}
+
+static esp_err_t host_timer_start(esp_timer_handle_t timer, uint64_t us, uint64_t period_us)
+{
+    esp_err_t err = ESP_OK;
+
+    pthread_mutex_lock(&s_timer_lock);
+    if (timer->active) {
+        err = ESP_ERR_INVALID_STATE;
+    } else {
+        timer->active = true;
+        timer->due_us = esp_timer_get_time() + us;
+        timer->period_us = period_us;
+        pthread_cond_signal(&s_timer_cond);
+    }
+    pthread_mutex_unlock(&s_timer_lock);
+    return err;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+    return host_timer_start(timer, timeout_us, 0);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period_us)
+{
+    return host_timer_start(timer, period_us, period_us);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+    pthread_mutex_lock(&s_timer_lock);
+    bool was = timer->active;
+    timer->active = false;
+    pthread_mutex_unlock(&s_timer_lock);
+    return was ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
+bool esp_timer_is_active(esp_timer_handle_t timer)
+{
+    pthread_mutex_lock(&s_timer_lock);
+    bool active = timer->active;
+    pthread_mutex_unlock(&s_timer_lock);
+    return active;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t mode, nvs_handle_t *handle)
+{
+    esp_err_t err = ESP_ERR_NO_MEM;
+
+    pthread_mutex_lock(&s_nvs_lock);
+    for (int i = 0; i < HOST_NVS_ENTRIES; i++) {
+        if (!s_nvs_names[i][0] || strcmp(s_nvs_names[i], name) == 0) {
+            snprintf(s_nvs_names[i], sizeof(s_nvs_names[i]), "%s", name);
+            *handle = i + 1;
+            err = ESP_OK;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&s_nvs_lock);
+    return err;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+}
+
+/* Must hold s_nvs_lock */
+static host_nvs_entry_t *host_nvs_find(nvs_handle_t handle, const char *key, bool create)
+{
+    host_nvs_entry_t *free_entry = NULL;
+    for (int i = 0; i < HOST_NVS_ENTRIES; i++) {
+        host_nvs_entry_t *e = &s_nvs[i];
+        if (e->used && strcmp(e->name, s_nvs_names[handle - 1]) == 0 && strcmp(e->key, key) == 0) {
+            return e;
+        }
+        if (!e->used && !free_entry) {
+            free_entry = e;
+        }
+    }
+    if (!create || !free_entry) {
+        return NULL;
+    }
+    free_entry->used = true;
+    snprintf(free_entry->name, sizeof(free_entry->name), "%s", s_nvs_names[handle - 1]);
+    snprintf(free_entry->key, sizeof(free_entry->key), "%s", key);
+    return free_entry;
+}
+
+esp_err_t nvs_get_u16(nvs_handle_t handle, const char *key, uint16_t *value)
+{
+    pthread_mutex_lock(&s_nvs_lock);
+    host_nvs_entry_t *e = host_nvs_find(handle, key, false);
+    if (e) {
+        *value = e->value;
+    }
+    pthread_mutex_unlock(&s_nvs_lock);
+    return e ? ESP_OK : ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_set_u16(nvs_handle_t handle, const char *key, uint16_t value)
+{
+    pthread_mutex_lock(&s_nvs_lock);
+    host_nvs_entry_t *e = host_nvs_find(handle, key, true);
+    if (e) {
+        e->value = value;
+    }
+    pthread_mutex_unlock(&s_nvs_lock);
+    return e ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    return ESP_OK;
+}
+
+uint32_t esp_random(void)
+{
+    static bool seeded = false;
+    if (!seeded) {
+        srandom((unsigned) (host_now_us() ^ getpid()));
+        seeded = true;
+    }
+    /* random() has 31 bits */
+    return ((uint32_t) random() << 16) ^ (uint32_t) random();
+}
+
+esp_cpu_cycle_count_t esp_cpu_get_cycle_count(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (esp_cpu_cycle_count_t) ((uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+void host_mesh_addr(int node, mesh_addr_t *addr)
+{
+    static const uint8_t base[6] = { 0x24, 0x0a, 0xc4, 0x00, 0x00, 0x00 };
+    memcpy(addr->addr, base, 6);
+    addr->addr[4] = node >> 8;
+    addr->addr[5] = node & 0xff;
+}
+
+esp_err_t esp_read_mac(uint8_t *mac, esp_mac_type_t type)
+{
+    mesh_addr_t addr;
+    host_mesh_addr(s_self, &addr);
+    memcpy(mac, addr.addr, 6);
+    if (type == ESP_MAC_WIFI_SOFTAP) {
+        /* as on ESP32, the STA MAC + 1 */
+        mac[5]++;
+    }
+    return ESP_OK;
+}
+
+static void host_sock_addr(int node, struct sockaddr_un *sun, socklen_t *len)
+{
+    memset(sun, 0, sizeof(*sun));
+    sun->sun_family = AF_UNIX;
+    /* abstract namespace: nothing left behind in the file system */
+    int n = snprintf(sun->sun_path + 1, sizeof(sun->sun_path) - 1, "mesh_host.%d.%d", s_run, node);
+    *len = offsetof(struct sockaddr_un, sun_path) + 1 + n;
+}
+
+void host_mesh_create(int nodes, int fanout)
+{
+    if (nodes < 1 || nodes > HOST_MAX_NODES || fanout < 1) {
+        abort();
+    }
+    /* our pid names the sockets: runs side by side do not meet */
+    s_run = getpid();
+    s_nodes = nodes;
+    s_fanout = fanout;
+    for (int i = 0; i < nodes; i++) {
+        struct sockaddr_un sun;
+        socklen_t len;
+        int buf = 1 << 20;
+        host_sock_addr(i, &sun, &len);
+        s_socks[i] = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (s_socks[i] < 0 || bind(s_socks[i], (struct sockaddr *) &sun, len) != 0) {
+            perror("mesh_host socket");
+            abort();
+        }
+        setsockopt(s_socks[i], SOL_SOCKET, SO_RCVBUF, &buf, sizeof(buf));
+    }
+    s_send_sock = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    struct timeval timeout = { .tv_usec = HOST_SEND_TIMEOUT_US };
+    setsockopt(s_send_sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+void host_mesh_join(int self)
+{
+    s_self = self;
+    for (int i = 0; i < s_nodes; i++) {
+        if (i != self) {
+            close(s_socks[i]);
+            s_socks[i] = -1;
+        }
+    }
+}
+
+int host_mesh_nodes(void)
+{
+    return s_nodes;
+}
+
+void host_mesh_set_filter(host_mesh_filter_t filter)
+{
+    s_filter = filter;
+}
+
+static int host_mesh_layer_of(int node)
+{
+    int layer = 1;
+    while (node) {
+        node = (node - 1) / s_fanout;
+        layer++;
+    }
+    return layer;
+}
+
+static int host_mesh_node_of(const uint8_t mac[6])
+{
+    mesh_addr_t addr;
+    for (int i = 0; i < s_nodes; i++) {
+        host_mesh_addr(i, &addr);
+        if (memcmp(addr.addr, mac, 6) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void host_mesh_sendto(int node, const mesh_data_t *data)
+{
+    struct sockaddr_un sun;
+    socklen_t len;
+    mesh_addr_t from;
+    struct iovec iov[2] = {
+        { .iov_base = from.addr, .iov_len = 6 },
+        { .iov_base = data->data, .iov_len = data->size },
+    };
+    struct msghdr msg = {
+        .msg_name = &sun,
+        .msg_iov = iov,
+        .msg_iovlen = 2,
+    };
+    host_mesh_addr(s_self, &from);
+    host_sock_addr(node, &sun, &len);
+    msg.msg_namelen = len;
+    /* blocks while the receiver is full, as esp_mesh_send() does without
+     * MESH_DATA_NONBLOCK; past the send timeout the packet is lost */
+    sendmsg(s_send_sock, &msg, 0);
+}
+
+esp_err_t esp_mesh_send(const mesh_addr_t *to, const mesh_data_t *data, int flag, const mesh_opt_t opt[], int opt_count)
+{
+    static const uint8_t broadcast[6] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+
+    if (!data || !data->data || !data->size || data->size > MESH_MPS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (s_filter && !s_filter(to, data->data, data->size)) {
+        return ESP_OK;
+    }
+    if (!to) {
+        host_mesh_sendto(0, data);
+        return ESP_OK;
+    }
+    if (memcmp(to->addr, broadcast, 6) == 0) {
+        for (int i = 0; i < s_nodes; i++) {
+            if (i != s_self) {
+                host_mesh_sendto(i, data);
+            }
+        }
+        return ESP_OK;
+    }
+    int node = host_mesh_node_of(to->addr);
+    if (node < 0) {
+        return ESP_ERR_MESH_NO_ROUTE_FOUND;
+    }
+    host_mesh_sendto(node, data);
+    return ESP_OK;
+}
+
+esp_err_t esp_mesh_recv(mesh_addr_t *from, mesh_data_t *data, int timeout_ms, int *flag, mesh_opt_t opt[], int opt_count)
+{
+    struct pollfd pfd = { .fd = s_socks[s_self], .events = POLLIN };
+    struct iovec iov[2] = {
+        { .iov_base = from->addr, .iov_len = 6 },
+        { .iov_base = data->data, .iov_len = data->size },
+    };
+    struct msghdr msg = {
+        .msg_iov = iov,
+        .msg_iovlen = 2,
+    };
+
+    int ready = poll(&pfd, 1, timeout_ms == (int) portMAX_DELAY ? -1 : timeout_ms);
+    if (ready <= 0) {
+        data->size = 0;
+        return ESP_ERR_TIMEOUT;
+    }
+    ssize_t n = recvmsg(s_socks[s_self], &msg, 0);
+    if (n < 6) {
+        data->size = 0;
+        return ESP_FAIL;
+    }
+    data->size = n - 6;
+    if (flag) {
+        *flag = MESH_DATA_P2P;
+    }
+    return ESP_OK;
+}
+
+bool esp_mesh_is_root(void)
+{
+    return s_self == 0;
+}
+
+int esp_mesh_get_layer(void)
+{
+    return host_mesh_layer_of(s_self);
+}
+
+esp_err_t esp_mesh_get_parent_bssid(mesh_addr_t *bssid)
+{
+    if (s_self == 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    host_mesh_addr((s_self - 1) / s_fanout, bssid);
+    bssid->addr[5]++;
+    return ESP_OK;
+}
+
+/* Flow control is not modelled: the medium drops what does not fit */
+bool mesh_flow_tx_admit(const mesh_addr_t *to)
+{
+    return true;
+}
+
+bool mesh_flow_rx_admit(const mesh_addr_t *from)
+{
+    return true;
+}
+
+bool mesh_route_snapshot(mesh_addr_t *table, int max, int *count, uint32_t *generation)
+{
+    int n = 0;
+    for (int i = 0; i < s_nodes && n < max; i++) {
+        host_mesh_addr(i, &table[n++]);
+    }
+    *count = n;
+    *generation = 1;
+    return true;
+}
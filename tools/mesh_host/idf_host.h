@@ -0,0 +1,435 @@
+/* Mesh Host Harness
+
+   Just enough of ESP-IDF, FreeRTOS and ESP-MESH, on top of pthreads, to
+   build the firmware modules of main/ unchanged on a PC and drive them
+   from a test or a benchmark. The headers in include/ all lead here.
+
+   - tasks are threads, task notifications and queues are mutex and
+     condition variable based, a critical section is a mutex
+   - esp_timer callbacks run on one "esp_timer" thread
+   - NVS lives in memory, for the life of the process
+   - the mesh is one process per node: esp_mesh_send() and
+     esp_mesh_recv() exchange datagrams over UNIX sockets, node 0 is the
+     root and node i hangs below node (i - 1) / fanout
+
+   Only what the modules built on the host use is here; a module that
+   needs more will not link, which is the point. The event types are
+   here for main/mesh_events.c, which tools/mesh_sim runs for thousands
+   of nodes in one process: the simulator implements the esp_mesh_*
+   calls and the event bases itself and does not link idf_host.c.
+*/
+
+#ifndef __IDF_HOST_H__
+#define __IDF_HOST_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "sdkconfig.h"
+
+/*******************************************************
+ *                esp_err.h
+ *******************************************************/
+typedef int esp_err_t;
+
+#define ESP_OK                          (0)
+#define ESP_FAIL                        (-1)
+#define ESP_ERR_NO_MEM                  (0x101)
+#define ESP_ERR_INVALID_ARG             (0x102)
+#define ESP_ERR_INVALID_STATE           (0x103)
+#define ESP_ERR_INVALID_SIZE            (0x104)
+#define ESP_ERR_NOT_FOUND               (0x105)
+#define ESP_ERR_NOT_SUPPORTED           (0x106)
+#define ESP_ERR_TIMEOUT                 (0x107)
+#define ESP_ERR_INVALID_VERSION         (0x10A)
+#define ESP_ERR_INVALID_MAC             (0x10B)
+#define ESP_ERR_NVS_NOT_FOUND           (0x1102)
+#define ESP_ERR_MESH_NO_ROUTE_FOUND     (0x4008)
+
+#define ESP_ERROR_CHECK(x) do {                                             \
+        esp_err_t err_rc_ = (x);                                            \
+        if (err_rc_ != ESP_OK) {                                            \
+            fprintf(stderr, "%s:%d: %s = 0x%x\n", __FILE__, __LINE__, #x, err_rc_); \
+            abort();                                                        \
+        }                                                                   \
+    } while (0)
+
+/*******************************************************
+ *                esp_log.h
+ *******************************************************/
+typedef enum {
+    ESP_LOG_NONE,
+    ESP_LOG_ERROR,
+    ESP_LOG_WARN,
+    ESP_LOG_INFO,
+    ESP_LOG_DEBUG,
+    ESP_LOG_VERBOSE,
+} esp_log_level_t;
+
+void host_log(esp_log_level_t level, const char *tag, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+void esp_log_level_set(const char *tag, esp_log_level_t level);
+
+#define ESP_LOGE(tag, fmt, ...) host_log(ESP_LOG_ERROR, tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) host_log(ESP_LOG_WARN, tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...) host_log(ESP_LOG_INFO, tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGD(tag, fmt, ...) host_log(ESP_LOG_DEBUG, tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGV(tag, fmt, ...) host_log(ESP_LOG_VERBOSE, tag, fmt, ##__VA_ARGS__)
+
+/*******************************************************
+ *                esp_mac.h, esp_random.h, esp_cpu.h
+ *******************************************************/
+typedef enum {
+    ESP_MAC_WIFI_STA,
+    ESP_MAC_WIFI_SOFTAP,
+} esp_mac_type_t;
+
+#define MACSTR "%02x:%02x:%02x:%02x:%02x:%02x"
+#define MAC2STR(a) (a)[0], (a)[1], (a)[2], (a)[3], (a)[4], (a)[5]
+
+esp_err_t esp_read_mac(uint8_t *mac, esp_mac_type_t type);
+uint32_t esp_random(void);
+
+/* On the host one cycle is one nanosecond */
+typedef uint32_t esp_cpu_cycle_count_t;
+esp_cpu_cycle_count_t esp_cpu_get_cycle_count(void);
+
+/*******************************************************
+ *                FreeRTOS
+ *******************************************************/
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef void (*TaskFunction_t)(void *);
+typedef struct host_task *TaskHandle_t;
+typedef struct host_queue *QueueHandle_t;
+
+#define configTICK_RATE_HZ      (1000)
+#define portTICK_PERIOD_MS      (1000 / configTICK_RATE_HZ)
+#define portMAX_DELAY           (0xffffffffu)
+#define pdMS_TO_TICKS(ms)       ((TickType_t) (ms) * configTICK_RATE_HZ / 1000)
+#define pdTRUE                  (1)
+#define pdFALSE                 (0)
+#define pdPASS                  (1)
+#define tskNO_AFFINITY          (0x7fffffff)
+
+/* Recursive, like a spinlock taken twice on the same core */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_t owner;
+    int depth;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED { PTHREAD_MUTEX_INITIALIZER, 0, 0 }
+
+void host_critical_enter(portMUX_TYPE *mux);
+void host_critical_exit(portMUX_TYPE *mux);
+
+#define portENTER_CRITICAL(mux)     host_critical_enter(mux)
+#define portEXIT_CRITICAL(mux)      host_critical_exit(mux)
+
+/* Stack size and core are ignored; the priority too, threads share the CPUs */
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack, void *arg,
+                                   UBaseType_t prio, TaskHandle_t *handle, BaseType_t core);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+void vTaskDelay(TickType_t ticks);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks);
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size);
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks);
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue);
+
+/*******************************************************
+ *                esp_timer.h
+ *******************************************************/
+typedef struct host_timer *esp_timer_handle_t;
+typedef void (*esp_timer_cb_t)(void *arg);
+
+typedef struct {
+    esp_timer_cb_t callback;
+    void *arg;
+    const char *name;
+} esp_timer_create_args_t;
+
+int64_t esp_timer_get_time(void);
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *timer);
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us);
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period_us);
+esp_err_t esp_timer_stop(esp_timer_handle_t timer);
+bool esp_timer_is_active(esp_timer_handle_t timer);
+
+/*******************************************************
+ *                nvs.h
+ *******************************************************/
+typedef uint32_t nvs_handle_t;
+
+typedef enum {
+    NVS_READONLY,
+    NVS_READWRITE,
+} nvs_open_mode_t;
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t mode, nvs_handle_t *handle);
+void nvs_close(nvs_handle_t handle);
+esp_err_t nvs_get_u16(nvs_handle_t handle, const char *key, uint16_t *value);
+esp_err_t nvs_set_u16(nvs_handle_t handle, const char *key, uint16_t value);
+esp_err_t nvs_commit(nvs_handle_t handle);
+
+/*******************************************************
+ *                esp_mesh.h
+ *******************************************************/
+#define MESH_MPS                (1472)
+#define MESH_ROOT_LAYER         (1)
+#define MESH_DATA_P2P           (0x02)
+#define MESH_DATA_TODS          (0x08)
+
+typedef struct __attribute__((packed)) {
+    uint8_t ip4[4];
+    uint16_t port;
+} mip_t;
+
+typedef union {
+    uint8_t addr[6];
+    mip_t mip;
+} mesh_addr_t;
+
+typedef enum {
+    MESH_PROTO_BIN,
+} mesh_proto_t;
+
+typedef enum {
+    MESH_TOS_P2P,
+    MESH_TOS_E2E,
+    MESH_TOS_DEF,
+} mesh_tos_t;
+
+typedef struct {
+    uint8_t *data;
+    uint16_t size;
+    mesh_proto_t proto;
+    mesh_tos_t tos;
+} mesh_data_t;
+
+typedef struct {
+    uint8_t type;
+    uint16_t len;
+    uint8_t *val;
+} __attribute__((packed)) mesh_opt_t;
+
+/* `timeout_ms` of esp_mesh_recv() is in ms, portMAX_DELAY waits forever */
+esp_err_t esp_mesh_send(const mesh_addr_t *to, const mesh_data_t *data, int flag, const mesh_opt_t opt[], int opt_count);
+esp_err_t esp_mesh_recv(mesh_addr_t *from, mesh_data_t *data, int timeout_ms, int *flag, mesh_opt_t opt[], int opt_count);
+bool esp_mesh_is_root(void);
+int esp_mesh_get_layer(void);
+esp_err_t esp_mesh_get_parent_bssid(mesh_addr_t *bssid);
+
+/* The router is the parent of the root */
+typedef struct {
+    uint8_t ssid[32];
+    uint8_t ssid_len;
+    uint8_t bssid[6];
+    uint8_t channel;
+    int authmode;
+    uint16_t aid;
+} wifi_event_sta_connected_t;
+
+typedef struct {
+    uint8_t ssid[32];
+    uint8_t ssid_len;
+    uint8_t bssid[6];
+    uint8_t reason;
+    int8_t rssi;
+} wifi_event_sta_disconnected_t;
+
+typedef struct {
+    uint8_t mac[6];
+    uint8_t aid;
+    bool is_mesh_child;
+} wifi_event_ap_staconnected_t;
+
+typedef struct {
+    uint8_t mac[6];
+    uint8_t aid;
+    bool is_mesh_child;
+    uint16_t reason;
+} wifi_event_ap_stadisconnected_t;
+
+/* In the order of ESP-IDF, so that event ids read the same in the logs */
+typedef enum {
+    MESH_EVENT_STARTED,
+    MESH_EVENT_STOPPED,
+    MESH_EVENT_CHANNEL_SWITCH,
+    MESH_EVENT_CHILD_CONNECTED,
+    MESH_EVENT_CHILD_DISCONNECTED,
+    MESH_EVENT_ROUTING_TABLE_ADD,
+    MESH_EVENT_ROUTING_TABLE_REMOVE,
+    MESH_EVENT_PARENT_CONNECTED,
+    MESH_EVENT_PARENT_DISCONNECTED,
+    MESH_EVENT_NO_PARENT_FOUND,
+    MESH_EVENT_LAYER_CHANGE,
+    MESH_EVENT_TODS_STATE,
+    MESH_EVENT_VOTE_STARTED,
+    MESH_EVENT_VOTE_STOPPED,
+    MESH_EVENT_ROOT_ADDRESS,
+    MESH_EVENT_ROOT_SWITCH_REQ,
+    MESH_EVENT_ROOT_SWITCH_ACK,
+    MESH_EVENT_ROOT_ASKED_YIELD,
+    MESH_EVENT_ROOT_FIXED,
+    MESH_EVENT_SCAN_DONE,
+    MESH_EVENT_NETWORK_STATE,
+    MESH_EVENT_STOP_RECONNECTION,
+    MESH_EVENT_FIND_NETWORK,
+    MESH_EVENT_ROUTER_SWITCH,
+    MESH_EVENT_PS_PARENT_DUTY,
+    MESH_EVENT_PS_CHILD_DUTY,
+    MESH_EVENT_PS_DEVICE_DUTY,
+    MESH_EVENT_MAX,
+} mesh_event_id_t;
+
+typedef enum {
+    MESH_VOTE_REASON_ROOT_INITIATED = 1,
+    MESH_VOTE_REASON_CHILD_INITIATED,
+} mesh_vote_reason_t;
+
+typedef enum {
+    MESH_TODS_UNREACHABLE,
+    MESH_TODS_REACHABLE,
+} mesh_event_toDS_state_t;
+
+typedef wifi_event_ap_staconnected_t mesh_event_child_connected_t;
+typedef wifi_event_ap_stadisconnected_t mesh_event_child_disconnected_t;
+typedef wifi_event_sta_disconnected_t mesh_event_disconnected_t;
+typedef wifi_event_sta_connected_t mesh_event_router_switch_t;
+typedef mesh_addr_t mesh_event_root_address_t;
+
+typedef struct {
+    uint8_t channel;
+} mesh_event_channel_switch_t;
+
+typedef struct {
+    uint16_t rt_size_new;
+    uint16_t rt_size_change;
+} mesh_event_routing_table_change_t;
+
+typedef struct {
+    wifi_event_sta_connected_t connected;
+    uint16_t self_layer;
+    uint8_t duty;
+} mesh_event_connected_t;
+
+typedef struct {
+    int scan_times;
+} mesh_event_no_parent_found_t;
+
+typedef struct {
+    uint16_t new_layer;
+} mesh_event_layer_change_t;
+
+typedef struct {
+    int attempts;
+    mesh_vote_reason_t reason;
+    mesh_addr_t rc_addr;
+} mesh_event_vote_started_t;
+
+typedef struct {
+    mesh_vote_reason_t reason;
+    mesh_addr_t rc_addr;
+} mesh_event_root_switch_req_t;
+
+typedef struct {
+    int8_t rssi;
+    uint16_t capacity;
+    uint8_t addr[6];
+} mesh_event_root_conflict_t;
+
+typedef struct {
+    bool is_fixed;
+} mesh_event_root_fixed_t;
+
+typedef struct {
+    uint8_t number;
+} mesh_event_scan_done_t;
+
+typedef struct {
+    bool is_rootless;
+} mesh_event_network_state_t;
+
+typedef struct {
+    uint8_t channel;
+    uint8_t router_bssid[6];
+} mesh_event_find_network_t;
+
+typedef struct {
+    uint8_t duty;
+    mesh_event_child_connected_t child_connected;
+} mesh_event_ps_duty_t;
+
+/* Only passed around by pointer on the host */
+typedef struct host_mesh_cfg mesh_cfg_t;
+
+esp_err_t esp_mesh_get_id(mesh_addr_t *id);
+
+/*******************************************************
+ *                esp_event.h, esp_netif.h
+ *******************************************************/
+typedef const char *esp_event_base_t;
+typedef struct host_netif esp_netif_t;
+
+#define ESP_EVENT_ANY_ID        (-1)
+
+extern esp_event_base_t const MESH_EVENT;
+extern esp_event_base_t const IP_EVENT;
+
+typedef enum {
+    IP_EVENT_STA_GOT_IP,
+    IP_EVENT_STA_LOST_IP,
+} ip_event_t;
+
+typedef struct {
+    uint32_t addr;
+} esp_ip4_addr_t;
+
+typedef struct {
+    esp_ip4_addr_t ip;
+    esp_ip4_addr_t netmask;
+    esp_ip4_addr_t gw;
+} esp_netif_ip_info_t;
+
+typedef struct {
+    esp_netif_t *esp_netif;
+    esp_netif_ip_info_t ip_info;
+    bool ip_changed;
+} ip_event_got_ip_t;
+
+#define IPSTR "%d.%d.%d.%d"
+#define IP2STR(ipaddr) ((ipaddr)->addr >> 0) & 0xff, ((ipaddr)->addr >> 8) & 0xff, \
+                       ((ipaddr)->addr >> 16) & 0xff, ((ipaddr)->addr >> 24) & 0xff
+
+esp_err_t esp_netif_dhcpc_start(esp_netif_t *netif);
+esp_err_t esp_netif_dhcpc_stop(esp_netif_t *netif);
+
+/*******************************************************
+ *                esp_partition.h
+ *******************************************************/
+typedef struct host_partition esp_partition_t;
+
+/*******************************************************
+ *                Host side
+ *******************************************************/
+/* Returns false to drop the packet, as the air would */
+typedef bool (*host_mesh_filter_t)(const mesh_addr_t *to, const uint8_t *data, uint16_t len);
+
+/* Opens a socket for each of `nodes` nodes; call once, before fork() */
+void host_mesh_create(int nodes, int fanout);
+/* In each process: this process is node `self` */
+void host_mesh_join(int self);
+int host_mesh_nodes(void);
+/* Mesh (STA) address of `node` */
+void host_mesh_addr(int node, mesh_addr_t *addr);
+/* Called by esp_mesh_send() on every packet, in the sending process */
+void host_mesh_set_filter(host_mesh_filter_t filter);
+
+#endif /* __IDF_HOST_H__ */
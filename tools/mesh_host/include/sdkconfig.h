@@ -0,0 +1,33 @@
+/* Mesh Host Harness
+
+   The menuconfig defaults of main/Kconfig.projbuild for the modules built
+   on the host, with the benchmark built in.
+*/
+
+#ifndef __SDKCONFIG_H__
+#define __SDKCONFIG_H__
+
+#define CONFIG_MESH_ROUTE_TABLE_SIZE    50
+#define CONFIG_MESH_COMM_POOL_SIZE      16
+#define CONFIG_MESH_COMM_BUF_SIZE       1472
+#define CONFIG_MESH_COMM_TX_QUEUE_LEN   16
+#define CONFIG_MESH_COMM_TASK_CORE      0
+#define CONFIG_MESH_APP_TASK_CORE       1
+#define CONFIG_MESH_APP_RING_LEN        16
+#define CONFIG_MESH_REL_MAX_PEERS       8
+#define CONFIG_MESH_REL_SLOTS           8
+#define CONFIG_MESH_REL_MAX_LEN         128
+#define CONFIG_MESH_REL_RTO_MS          300
+#define CONFIG_MESH_REL_MAX_TRIES       5
+#define CONFIG_MESH_REL_ACK_DELAY_MS    30
+#define CONFIG_MESH_BENCH_ENABLE        1
+#define CONFIG_MESH_BENCH_AUTO_START_S  30
+#define CONFIG_MESH_BENCH_MODE          0
+#define CONFIG_MESH_BENCH_PAYLOAD       256
+#define CONFIG_MESH_BENCH_RATE_PPS      20
+#define CONFIG_MESH_BENCH_DURATION_S    10
+#define CONFIG_MESH_BENCH_ECHO_EVERY    10
+#define CONFIG_MESH_AUTH_KEY            "change me"
+#define CONFIG_MESH_AUTH_MAX_SENDERS    16
+
+#endif /* __SDKCONFIG_H__ */
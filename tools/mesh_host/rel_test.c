@@ -0,0 +1,239 @@
+/* Mesh Reliable Delivery Test
+
+   Runs main/mesh_rel.c over main/mesh_comm.c on the host harness
+   (idf_host.h): node 1, a child process, sends numbered messages to node
+   0 with mesh_rel_send() while the mock medium drops packets:
+
+   - the very first data packet, so the receive window has to start at
+     the sender's `base` and not at whatever arrives first
+   - every copy of one message in the middle of the run, so the sender
+     gives up on it and the receiver has to slide its window past it
+   - -l percent of all other data and ACK packets, at random
+
+   Node 0 delivers the messages to an app task handler, as the light
+   commands are delivered, and counts every one. The test passes if no
+   message was delivered twice, every message the sender did not give up
+   on was delivered and none arrived beyond the receive window.
+
+   Build and run:
+       cc -O2 -Wall -pthread -Itools/mesh_host/include -Itools/mesh_host -Imain/include \
+           -o rel_test tools/mesh_host/rel_test.c tools/mesh_host/idf_host.c \
+           main/mesh_comm.c main/mesh_rel.c
+       ./rel_test -n 1000 -l 10
+*/
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "esp_err.h"
+#include "esp_mesh.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "mesh_comm.h"
+#include "mesh_rel.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define REL_TEST_TYPE           (0x1E)  /* not used by the firmware */
+#define REL_TEST_MAX            (100000)
+#define REL_TEST_SETTLE_US      (100000)
+
+/*******************************************************
+ *                Structures
+ *******************************************************/
+typedef struct __attribute__((packed)) {
+    uint8_t type;           /* REL_TEST_TYPE */
+    uint32_t seq;
+} rel_test_msg_t;
+
+/*******************************************************
+ *                Variable Definitions
+ *******************************************************/
+static uint32_t s_loss = 10;                /* percent */
+static uint32_t s_lost_seq = UINT32_MAX;    /* every copy of this one is dropped */
+static bool s_first_dropped = false;
+static uint64_t s_rand = 0x9e3779b97f4a7c15ULL;
+static uint8_t s_delivered[REL_TEST_MAX];
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+static uint32_t rel_test_rand(void)
+{
+    s_rand ^= s_rand >> 12;
+    s_rand ^= s_rand << 25;
+    s_rand ^= s_rand >> 27;
+    return (s_rand * 0x2545f4914f6cdd1dULL) >> 32;
+}
+
+/* Runs on the TX task of either node */
+static bool rel_test_filter(const mesh_addr_t *to, const uint8_t *data, uint16_t len)
+{
+    mesh_rel_hdr_t hdr;
+    rel_test_msg_t msg;
+
+    if (len < sizeof(mesh_rel_hdr_t) || data[0] != MESH_MSG_TYPE_REL) {
+        return true;
+    }
+    memcpy(&hdr, data, sizeof(mesh_rel_hdr_t));
+    if ((hdr.flags & MESH_REL_FLAG_DATA) && len >= sizeof(mesh_rel_hdr_t) + sizeof(rel_test_msg_t)) {
+        memcpy(&msg, data + sizeof(mesh_rel_hdr_t), sizeof(rel_test_msg_t));
+        if (!s_first_dropped) {
+            s_first_dropped = true;
+            return false;
+        }
+        if (msg.seq == s_lost_seq) {
+            return false;
+        }
+    }
+    return rel_test_rand() % 100 >= s_loss;
+}
+
+/* Node 0, app task */
+static esp_err_t rel_test_process(mesh_addr_t *from, uint8_t *buf, uint16_t len)
+{
+    rel_test_msg_t msg;
+    if (len < sizeof(rel_test_msg_t)) {
+        return ESP_FAIL;
+    }
+    memcpy(&msg, buf, sizeof(rel_test_msg_t));
+    if (msg.seq < REL_TEST_MAX && s_delivered[msg.seq] < UINT8_MAX) {
+        s_delivered[msg.seq]++;
+    }
+    return ESP_OK;
+}
+
+static void rel_test_start(int self)
+{
+    host_mesh_join(self);
+    host_mesh_set_filter(rel_test_filter);
+    s_rand += self;
+    ESP_ERROR_CHECK(mesh_comm_init());
+    ESP_ERROR_CHECK(mesh_rel_init());
+    if (self == 0) {
+        ESP_ERROR_CHECK(mesh_comm_register_app_handler(REL_TEST_TYPE, rel_test_process));
+    }
+    ESP_ERROR_CHECK(mesh_comm_start());
+}
+
+/* Node 1: writes its mesh_rel stats to `out` once nothing is pending any more */
+static int rel_test_sender(uint32_t count, int out)
+{
+    mesh_addr_t root;
+    mesh_rel_stats_t stats;
+
+    rel_test_start(1);
+    host_mesh_addr(0, &root);
+    usleep(REL_TEST_SETTLE_US);
+
+    int64_t start = esp_timer_get_time();
+    for (uint32_t seq = 0; seq < count; seq++) {
+        rel_test_msg_t msg = {
+            .type = REL_TEST_TYPE,
+            .seq = seq,
+        };
+        /* no free slot, or a window ahead of the receiver: wait for an ACK */
+        while (mesh_rel_send(&root, (const uint8_t *) &msg, sizeof(msg)) == ESP_ERR_NO_MEM) {
+            vTaskDelay(1);
+        }
+    }
+    while (mesh_rel_pending()) {
+        vTaskDelay(10);
+    }
+    int64_t took = esp_timer_get_time() - start;
+    /* the last ACK-only packets of node 0 may still be on their way */
+    usleep(2 * CONFIG_MESH_REL_ACK_DELAY_MS * 1000);
+
+    mesh_rel_get_stats(&stats);
+    printf("sender: %" PRIu32 " messages in %.2f s, %" PRIu32 " retransmits, %" PRIu32 " given up\n",
+           count, took / 1e6, stats.tx_retransmits, stats.tx_failed);
+    fflush(stdout);
+    return write(out, &stats, sizeof(stats)) == sizeof(stats) ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t count = 1000;
+    mesh_rel_stats_t tx;
+    mesh_rel_stats_t rx;
+    int fds[2];
+    int status;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:l:")) != -1) {
+        switch (opt) {
+        case 'n':
+            count = strtoul(optarg, NULL, 0);
+            break;
+        case 'l':
+            s_loss = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n messages] [-l loss %%]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (count < 2 || count > REL_TEST_MAX || s_loss >= 100) {
+        fprintf(stderr, "2 to %d messages, loss below 100%%\n", REL_TEST_MAX);
+        return 2;
+    }
+    s_lost_seq = count / 2;
+
+    host_mesh_create(2, 1);
+    if (pipe(fds) != 0) {
+        perror("pipe");
+        return 1;
+    }
+    fflush(stdout);
+    pid_t sender = fork();
+    if (sender == 0) {
+        close(fds[0]);
+        exit(rel_test_sender(count, fds[1]));
+    }
+    close(fds[1]);
+    rel_test_start(0);
+    bool got = read(fds[0], &tx, sizeof(tx)) == sizeof(tx);
+    waitpid(sender, &status, 0);
+    if (!got || !WIFEXITED(status) || WEXITSTATUS(status)) {
+        fprintf(stderr, "the sender did not finish\n");
+        return 1;
+    }
+
+    /* the app task has had every delivery by now: it came before its ACK */
+    uint32_t missing = 0;
+    uint32_t twice = 0;
+    for (uint32_t seq = 0; seq < count; seq++) {
+        missing += !s_delivered[seq];
+        twice += s_delivered[seq] > 1;
+    }
+    mesh_rel_get_stats(&rx);
+    printf("receiver: %" PRIu32 " delivered, %" PRIu32 " missing, %" PRIu32 " twice; %" PRIu32 " duplicates"
+           " dropped, %" PRIu32 " out of the window, %" PRIu32 " ACK-only packets\n",
+           rx.rx_data, missing, twice, rx.rx_dups, rx.rx_out_of_window, rx.tx_acks);
+
+    bool ok = true;
+    if (!s_delivered[0]) {
+        fprintf(stderr, "the first message, lost once, was never delivered\n");
+        ok = false;
+    }
+    if (s_delivered[s_lost_seq] || tx.tx_failed < 1) {
+        fprintf(stderr, "message %" PRIu32 " was never sent, yet delivered or not given up on\n", s_lost_seq);
+        ok = false;
+    }
+    if (rx.rx_out_of_window) {
+        fprintf(stderr, "the sender got more than the window ahead of the receiver\n");
+        ok = false;
+    }
+    if (twice || missing > tx.tx_failed) {
+        fprintf(stderr, "%" PRIu32 " delivered twice, %" PRIu32 " missing for %" PRIu32 " given up\n",
+                twice, missing, tx.tx_failed);
+        ok = false;
+    }
+    printf("%s\n", ok ? "ok" : "failed");
+    return ok ? 0 : 1;
+}
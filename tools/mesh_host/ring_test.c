@@ -0,0 +1,222 @@
+/* Mesh SPSC Ring Test
+
+   Stress test and benchmark of main/include/mesh_ring.h with one
+   producer and one consumer thread, as the RX and app tasks use it.
+
+   For every capacity from 2 to 1024 the producer pushes a run of
+   sequence numbers, each element carrying its number and its complement
+   over the whole element, and the consumer checks that every element
+   arrives whole, once and in order. Both sides retry right away on a
+   full or empty ring, so they keep catching each other at the
+   boundaries. Then the ring is timed with capacity 16, the size the app
+   ring has by default, against a mutex protected ring of the same size.
+
+   Build and run:
+       cc -O2 -Wall -pthread -Imain/include -o ring_test tools/mesh_host/ring_test.c
+       ./ring_test -n 10000000
+   and, to have the memory ordering checked too:
+       cc -O1 -g -fsanitize=thread -pthread -Imain/include -o ring_test tools/mesh_host/ring_test.c
+       ./ring_test -n 200000
+*/
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "mesh_ring.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define RING_MAX_CAPACITY       (1024)
+#define RING_BENCH_CAPACITY     (16)
+#define RING_SPINS              (64)    /* failed retries before sleeping */
+#define RING_WORDS              (6)     /* 24 bytes, close to a mesh_comm_app_t */
+
+/*******************************************************
+ *                Structures
+ *******************************************************/
+typedef struct {
+    uint32_t seq;
+    uint32_t check[RING_WORDS - 1];     /* ~seq each */
+} ring_elem_t;
+
+typedef struct {
+    mesh_ring_t ring;
+    pthread_mutex_t lock;   /* mutex variant only */
+    uint64_t count;
+    uint64_t errors;
+    bool locked;
+} ring_run_t;
+
+/*******************************************************
+ *                Variable Definitions
+ *******************************************************/
+static ring_elem_t s_slots[RING_MAX_CAPACITY];
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+static int64_t ring_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Retries stay tight, but on a machine with one CPU the other side only
+ * runs once we really sleep */
+static void ring_backoff(int spins)
+{
+    static const struct timespec nap = { .tv_nsec = 1000 };
+    if (spins < RING_SPINS) {
+        sched_yield();
+    } else {
+        nanosleep(&nap, NULL);
+    }
+}
+
+static bool ring_push(ring_run_t *run, const ring_elem_t *elem)
+{
+    if (!run->locked) {
+        return mesh_ring_push(&run->ring, elem);
+    }
+    pthread_mutex_lock(&run->lock);
+    bool done = mesh_ring_push(&run->ring, elem);
+    pthread_mutex_unlock(&run->lock);
+    return done;
+}
+
+static bool ring_pop(ring_run_t *run, ring_elem_t *elem)
+{
+    if (!run->locked) {
+        return mesh_ring_pop(&run->ring, elem);
+    }
+    pthread_mutex_lock(&run->lock);
+    bool done = mesh_ring_pop(&run->ring, elem);
+    pthread_mutex_unlock(&run->lock);
+    return done;
+}
+
+static void *ring_producer(void *arg)
+{
+    ring_run_t *run = arg;
+    ring_elem_t elem;
+
+    for (uint64_t i = 0; i < run->count; i++) {
+        elem.seq = (uint32_t) i;
+        for (int w = 0; w < RING_WORDS - 1; w++) {
+            elem.check[w] = ~elem.seq;
+        }
+        for (int spins = 0; !ring_push(run, &elem); spins++) {
+            ring_backoff(spins);
+        }
+    }
+    return NULL;
+}
+
+static void *ring_consumer(void *arg)
+{
+    ring_run_t *run = arg;
+    ring_elem_t elem;
+
+    for (uint64_t i = 0; i < run->count; i++) {
+        for (int spins = 0; !ring_pop(run, &elem); spins++) {
+            ring_backoff(spins);
+        }
+        bool bad = elem.seq != (uint32_t) i;
+        for (int w = 0; w < RING_WORDS - 1; w++) {
+            bad |= elem.check[w] != ~elem.seq;
+        }
+        if (bad && run->errors++ < 5) {
+            fprintf(stderr, "capacity %u: got %" PRIu32 " expected %" PRIu64 "\n",
+                    run->ring.mask + 1, elem.seq, i);
+        }
+    }
+    return NULL;
+}
+
+/* Returns the ns per element, both threads running */
+static double ring_run(ring_run_t *run, uint32_t capacity, uint64_t count, bool locked)
+{
+    pthread_t producer;
+    pthread_t consumer;
+
+    memset(run, 0, sizeof(ring_run_t));
+    mesh_ring_init(&run->ring, s_slots, sizeof(ring_elem_t), capacity);
+    pthread_mutex_init(&run->lock, NULL);
+    run->count = count;
+    run->locked = locked;
+
+    int64_t start = ring_now_ns();
+    pthread_create(&consumer, NULL, ring_consumer, run);
+    pthread_create(&producer, NULL, ring_producer, run);
+    pthread_join(producer, NULL);
+    pthread_join(consumer, NULL);
+    int64_t took = ring_now_ns() - start;
+    pthread_mutex_destroy(&run->lock);
+    return (double) took / count;
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t count = 10000000;
+    uint64_t errors = 0;
+    ring_run_t run;
+    uint8_t small[4];
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        if (opt != 'n') {
+            fprintf(stderr, "usage: %s [-n elements]\n", argv[0]);
+            return 2;
+        }
+        count = strtoull(optarg, NULL, 0);
+    }
+
+    /* the API contract first */
+    if (mesh_ring_init(&run.ring, small, 1, 3) || mesh_ring_init(&run.ring, NULL, 1, 4)
+            || !mesh_ring_init(&run.ring, small, 1, 4)) {
+        fprintf(stderr, "mesh_ring_init() accepted a bad capacity or storage\n");
+        return 1;
+    }
+    for (uint8_t i = 0; i < 4; i++) {
+        mesh_ring_push(&run.ring, &i);
+    }
+    uint8_t out;
+    if (mesh_ring_push(&run.ring, &out) || run.ring.full != 1 || run.ring.high_water != 4
+            || mesh_ring_count(&run.ring) != 4 || !mesh_ring_pop(&run.ring, &out) || out != 0) {
+        fprintf(stderr, "mesh_ring full ring accounting is wrong\n");
+        return 1;
+    }
+
+    for (uint32_t capacity = 2; capacity <= RING_MAX_CAPACITY; capacity *= 2) {
+        double ns = ring_run(&run, capacity, count / 10, false);
+        errors += run.errors;
+        if (run.ring.pushed != count / 10 || mesh_ring_count(&run.ring) != 0) {
+            fprintf(stderr, "capacity %u: %" PRIu32 " pushed, %u left\n",
+                    capacity, run.ring.pushed, mesh_ring_count(&run.ring));
+            errors++;
+        }
+        printf("capacity %4u: %" PRIu64 " elements, %6.1f ns each, %" PRIu32 " pushes found it full,"
+               " high water %" PRIu32 "\n", capacity, count / 10, ns, run.ring.full, run.ring.high_water);
+    }
+
+    double lock_free = ring_run(&run, RING_BENCH_CAPACITY, count, false);
+    errors += run.errors;
+    double locked = ring_run(&run, RING_BENCH_CAPACITY, count, true);
+    errors += run.errors;
+    printf("capacity %u, %" PRIu64 " elements of %zu B: lock-free %.1f ns each, mutex %.1f ns each\n",
+           RING_BENCH_CAPACITY, count, sizeof(ring_elem_t), lock_free, locked);
+
+    if (errors) {
+        printf("%" PRIu64 " errors\n", errors);
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
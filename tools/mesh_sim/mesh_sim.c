@@ -0,0 +1,929 @@
+/* Mesh Discrete-Event Simulator
+
+   Host-side model of ESP-WIFI-MESH network formation and upstream delivery,
+   used to try CONFIG_MESH_TOPOLOGY, CONFIG_MESH_MAX_LAYER and
+   CONFIG_MESH_AP_CONNECTIONS on thousands of virtual nodes before rolling
+   them out to real boards.
+
+   Every node walks the same states the firmware sees as mesh events:
+   scan (MESH_EVENT_SCAN_DONE / NO_PARENT_FOUND), vote (VOTE_STARTED /
+   VOTE_STOPPED), join (PARENT_CONNECTED, and CHILD_CONNECTED and
+   ROUTING_TABLE_ADD up the tree), root conflict (ROOT_ASKED_YIELD) and
+   parent loss (PARENT_DISCONNECTED). Each of them is posted to the
+   firmware's own mesh_event_handler() (main/mesh_events.c) with the
+   state of that node, and the IP event to the root once its DHCP client
+   is restarted. The esp_mesh_* calls the handler makes answer for the
+   node the event is for, its LEDs are driven by the firmware's
+   indicators (main/mesh_light_indicator.c) and the modules it calls are
+   no-ops (sim_modules.c). At the end, what the handler tracked (layer,
+   parent, connected) must match the simulated mesh, and every connected
+   node must show the color of its layer, every other one none or off.
+
+   Once the tree has formed, every node sends messages to the root hop by
+   hop, each hop adding airtime, queueing at the forwarding node and the
+   configured per-hop latency.
+
+   Build and run:
+       cc -O2 -Wall -Itools/mesh_host/include -Itools/mesh_host -Imain/include \
+           -o mesh_sim tools/mesh_sim/mesh_sim.c tools/mesh_sim/sim_modules.c \
+           main/mesh_events.c main/mesh_light_indicator.c -lm
+       ./mesh_sim -n 2000 -t tree -l 6 -c 6 -k 90000
+
+   Reported: convergence time, root elections / yields, layer histogram,
+   reconvergence after the root is killed (-k), end-to-end latency
+   percentiles, the events handled and the colors the LEDs ended on.
+   Exits 1 if the handler's state or the LEDs of a node disagree with
+   the mesh.
+*/
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "esp_err.h"
+#include "esp_event.h"
+#include "esp_log.h"
+#include "esp_mesh.h"
+#include "esp_netif.h"
+#include "mesh_events.h"
+#include "mesh_light.h"
+
+/*******************************************************
+ *                Constants
+ *******************************************************/
+#define SIM_RSSI_MIN            (-85)   /* weakest usable link */
+#define SIM_SCAN_US             (1500000)
+#define SIM_VOTE_US             (3000000)
+#define SIM_ASSOC_US            (300000)
+#define SIM_BEACON_LOSS_US      (2000000)
+#define SIM_YIELD_DETECT_US     (5000000)
+#define SIM_DHCP_US             (500000)
+#define SIM_REASON_BEACON_TIMEOUT (200)
+#define SIM_MAX_SCAN_ATTEMPTS   (10)
+#define SIM_AIRTIME_US          (1200)  /* one MESH_MPS frame at ~10 Mbit/s */
+#define SIM_LAYER_HIST          (1024)
+
+enum {
+    NODE_OFF,
+    NODE_SCANNING,
+    NODE_VOTING,
+    NODE_CONNECTING,
+    NODE_CONNECTED,
+    NODE_ISOLATED,
+};
+
+enum {
+    EV_BOOT,
+    EV_SCAN_DONE,
+    EV_VOTE_DONE,
+    EV_PARENT_CONNECTED,
+    EV_ROOT_CONFLICT,
+    EV_KILL_ROOT,
+    EV_MSG_SEND,
+    EV_MSG_HOP,
+    EV_GOT_IP,
+};
+
+/*******************************************************
+ *                Structures
+ *******************************************************/
+typedef struct {
+    int64_t time;
+    int type;
+    int node;
+    int arg;
+    int64_t t0;
+} sim_event_t;
+
+typedef struct {
+    double x, y;
+    int state;
+    int parent;
+    int pending_parent;
+    int layer;
+    int children;
+    int scan_attempts;
+    int router_rssi;
+    int alive;
+    int yielded_to;         /* root we yielded to, -1 if none: no vote of ours while it is root */
+    int routes;             /* routing table size: this node and all below it */
+    int64_t busy_until;
+    mesh_events_state_t events;     /* what mesh_event_handler() knows */
+    int led;                /* last color passed to mesh_light_set(), -1 before any */
+} sim_node_t;
+
+typedef struct {
+    int nodes;
+    int chain;
+    int max_layer;
+    int max_children;
+    double area;
+    int64_t hop_us;
+    int64_t jitter_us;
+    int64_t kill_root_us;
+    int64_t traffic_us;
+    int messages;
+    int64_t msg_interval_us;
+    unsigned seed;
+} sim_config_t;
+
+/*******************************************************
+ *                Variable Definitions
+ *******************************************************/
+static sim_config_t s_cfg = {
+    .nodes = 500,
+    .chain = 0,
+    .max_layer = 6,
+    .max_children = 6,
+    .area = 0,
+    .hop_us = 2000,
+    .jitter_us = 1000,
+    .kill_root_us = 0,
+    .traffic_us = 60000000,
+    .messages = 10,
+    .msg_interval_us = 1000000,
+    .seed = 1,
+};
+
+static sim_node_t *s_nodes;
+static sim_event_t *s_heap;
+static size_t s_heap_len, s_heap_cap;
+static int64_t s_now;
+
+static int s_connected;
+static int s_elections;
+static int s_yields;
+static int s_parent_losses;
+static int64_t s_last_connect_us;
+static int64_t s_converged_us = -1;
+static int64_t s_reconverged_us = -1;
+static int64_t s_killed_us = -1;
+static int s_self = -1;     /* node whose event the handler is running */
+static int s_events;
+
+esp_event_base_t const MESH_EVENT = "MESH_EVENT";
+esp_event_base_t const IP_EVENT = "IP_EVENT";
+
+static int64_t *s_latency;
+static size_t s_latency_len, s_latency_cap;
+static int s_msg_sent, s_msg_lost;
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+static double rnd(void)
+{
+    return rand() / (RAND_MAX + 1.0);
+}
+
+static void ev_push(int64_t time, int type, int node, int arg, int64_t t0)
+{
+    if (s_heap_len == s_heap_cap) {
+        s_heap_cap = s_heap_cap ? s_heap_cap * 2 : 1024;
+        s_heap = realloc(s_heap, s_heap_cap * sizeof(sim_event_t));
+    }
+    size_t i = s_heap_len++;
+    sim_event_t ev = { time, type, node, arg, t0 };
+    while (i > 0 && s_heap[(i - 1) / 2].time > time) {
+        s_heap[i] = s_heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    s_heap[i] = ev;
+}
+
+static sim_event_t ev_pop(void)
+{
+    sim_event_t top = s_heap[0];
+    sim_event_t last = s_heap[--s_heap_len];
+    size_t i = 0;
+    while (true) {
+        size_t c = 2 * i + 1;
+        if (c >= s_heap_len) {
+            break;
+        }
+        if (c + 1 < s_heap_len && s_heap[c + 1].time < s_heap[c].time) {
+            c++;
+        }
+        if (last.time <= s_heap[c].time) {
+            break;
+        }
+        s_heap[i] = s_heap[c];
+        i = c;
+    }
+    s_heap[i] = last;
+    return top;
+}
+
+static int link_rssi(double dx, double dy)
+{
+    double d = sqrt(dx * dx + dy * dy);
+    if (d < 1.0) {
+        d = 1.0;
+    }
+    /* log-distance path loss, -40 dBm at 1 m, exponent 3 */
+    return (int)(-40.0 - 30.0 * log10(d));
+}
+
+static int node_rssi(int a, int b)
+{
+    return link_rssi(s_nodes[a].x - s_nodes[b].x, s_nodes[a].y - s_nodes[b].y);
+}
+
+static bool is_root(int i)
+{
+    return s_nodes[i].alive && s_nodes[i].state == NODE_CONNECTED && s_nodes[i].parent == -1;
+}
+
+static int alive_roots(int except)
+{
+    int roots = 0;
+    for (int i = 0; i < s_cfg.nodes; i++) {
+        if (i != except && s_nodes[i].alive && s_nodes[i].state == NODE_CONNECTED && s_nodes[i].parent < 0) {
+            roots++;
+        }
+    }
+    return roots;
+}
+
+/* STA address of node i, the router's for i < 0 */
+static void sim_mac(int i, uint8_t mac[6])
+{
+    uint32_t id = i < 0 ? 0xffffff : (uint32_t) i;
+    mac[0] = 0x24;
+    mac[1] = 0x0a;
+    mac[2] = 0xc4;
+    mac[3] = id >> 16;
+    mac[4] = id >> 8;
+    mac[5] = id;
+}
+
+static int root_of(int i)
+{
+    while (s_nodes[i].parent >= 0) {
+        i = s_nodes[i].parent;
+    }
+    return i;
+}
+
+/* Runs the firmware's handler for node i at once, so it sees the mesh as it is now */
+static void sim_post(int i, int32_t event_id, void *event_data)
+{
+    s_self = i;
+    s_events++;
+    mesh_event_handler(&s_nodes[i].events, MESH_EVENT, event_id, event_data);
+    s_self = -1;
+}
+
+/* The ESP-MESH, ESP-IDF and LED side of main/mesh_events.c, for node s_self */
+bool esp_mesh_is_root(void)
+{
+    return s_nodes[s_self].state == NODE_CONNECTED && s_nodes[s_self].parent == -1;
+}
+
+int esp_mesh_get_layer(void)
+{
+    return s_nodes[s_self].layer;
+}
+
+esp_err_t esp_mesh_get_id(mesh_addr_t *id)
+{
+    memset(id->addr, 0x77, sizeof(id->addr));
+    return ESP_OK;
+}
+
+esp_err_t esp_mesh_get_parent_bssid(mesh_addr_t *bssid)
+{
+    sim_mac(s_nodes[s_self].parent, bssid->addr);
+    return ESP_OK;
+}
+
+esp_err_t esp_netif_dhcpc_stop(esp_netif_t *netif)
+{
+    return ESP_OK;
+}
+
+/* The root gets its IP_EVENT_STA_GOT_IP a DHCP exchange later */
+esp_err_t esp_netif_dhcpc_start(esp_netif_t *netif)
+{
+    ev_push(s_now + SIM_DHCP_US, EV_GOT_IP, s_self, 0, 0);
+    return ESP_OK;
+}
+
+esp_err_t mesh_light_set(int color)
+{
+    s_nodes[s_self].led = color;
+    return ESP_OK;
+}
+
+/* The handler logs every event at debug level: only warnings and errors get through */
+void host_log(esp_log_level_t level, const char *tag, const char *fmt, ...)
+{
+    va_list ap;
+    if (level > ESP_LOG_WARN) {
+        return;
+    }
+    printf("t=%.3fs node %d %s: ", s_now / 1e6, s_self, tag);
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    printf("\n");
+}
+
+/* PARENT_CONNECTED and ROOT_ADDRESS at i, CHILD_CONNECTED at its parent and ROUTING_TABLE_ADD up to the root */
+static void post_connected(int i)
+{
+    sim_node_t *n = &s_nodes[i];
+    mesh_event_connected_t connected = {
+        .connected.channel = 1,
+        .self_layer = n->layer,
+    };
+    mesh_event_root_address_t root;
+
+    sim_mac(n->parent, connected.connected.bssid);
+    sim_post(i, MESH_EVENT_PARENT_CONNECTED, &connected);
+    sim_mac(root_of(i), root.addr);
+    sim_post(i, MESH_EVENT_ROOT_ADDRESS, &root);
+    if (n->parent < 0) {
+        return;
+    }
+    mesh_event_child_connected_t child = {
+        .aid = s_nodes[n->parent].children,
+        .is_mesh_child = true,
+    };
+    sim_mac(i, child.mac);
+    sim_post(n->parent, MESH_EVENT_CHILD_CONNECTED, &child);
+    for (int p = n->parent; p >= 0; p = s_nodes[p].parent) {
+        mesh_event_routing_table_change_t rt = {
+            .rt_size_new = s_nodes[p].routes,
+            .rt_size_change = n->routes,
+        };
+        sim_post(p, MESH_EVENT_ROUTING_TABLE_ADD, &rt);
+    }
+}
+
+static void schedule_scan(int i, int64_t delay)
+{
+    s_nodes[i].state = NODE_SCANNING;
+    ev_push(s_now + delay, EV_SCAN_DONE, i, 0, 0);
+}
+
+/* MESH_EVENT_PARENT_DISCONNECTED for node i and, transitively, its whole subtree */
+static void disconnect_subtree(int root)
+{
+    int *stack = malloc(sizeof(int) * s_cfg.nodes);
+    int top = 0;
+    int removed = s_nodes[root].routes;
+    mesh_event_disconnected_t disconnected = {
+        .reason = SIM_REASON_BEACON_TIMEOUT,
+    };
+
+    /* the parent of the subtree, if any, and all above it lose its routes */
+    if (s_nodes[root].state == NODE_CONNECTED && s_nodes[root].parent >= 0) {
+        int parent = s_nodes[root].parent;
+        mesh_event_child_disconnected_t child = {
+            .is_mesh_child = true,
+            .reason = SIM_REASON_BEACON_TIMEOUT,
+        };
+        sim_mac(root, child.mac);
+        for (int p = parent; p >= 0; p = s_nodes[p].parent) {
+            s_nodes[p].routes -= removed;
+        }
+        s_nodes[parent].children--;
+        child.aid = s_nodes[parent].children + 1;
+        s_nodes[root].parent = -2;
+        sim_post(parent, MESH_EVENT_CHILD_DISCONNECTED, &child);
+        for (int p = parent; p >= 0; p = s_nodes[p].parent) {
+            mesh_event_routing_table_change_t rt = {
+                .rt_size_new = s_nodes[p].routes,
+                .rt_size_change = removed,
+            };
+            sim_post(p, MESH_EVENT_ROUTING_TABLE_REMOVE, &rt);
+        }
+    }
+    stack[top++] = root;
+    while (top) {
+        int i = stack[--top];
+        sim_node_t *n = &s_nodes[i];
+        if (n->state == NODE_CONNECTED) {
+            s_connected--;
+        }
+        n->parent = -1;
+        n->layer = 0;
+        n->routes = 1;
+        n->scan_attempts = 0;
+        if (n->alive && i != root) {
+            s_parent_losses++;
+            schedule_scan(i, SIM_BEACON_LOSS_US + (int64_t)(rnd() * SIM_SCAN_US));
+        }
+        for (int j = 0; j < s_cfg.nodes; j++) {
+            if (s_nodes[j].state == NODE_CONNECTED && s_nodes[j].parent == i) {
+                stack[top++] = j;
+                s_nodes[i].children--;
+                s_nodes[j].parent = -2;   /* parent already torn down */
+            }
+        }
+        n->state = n->alive ? NODE_SCANNING : NODE_OFF;
+        if (n->alive) {
+            sim_post(i, MESH_EVENT_PARENT_DISCONNECTED, &disconnected);
+        }
+    }
+    free(stack);
+}
+
+static void become_root(int i)
+{
+    sim_node_t *n = &s_nodes[i];
+    n->state = NODE_CONNECTED;
+    n->parent = -1;
+    n->layer = 1;
+    n->yielded_to = -1;
+    s_connected++;
+    s_elections++;
+    s_last_connect_us = s_now;
+    /* the router is our parent */
+    post_connected(i);
+    if (alive_roots(i) > 0) {
+        /* two roots on the same router: the weaker one gets ROOT_ASKED_YIELD */
+        ev_push(s_now + SIM_YIELD_DETECT_US, EV_ROOT_CONFLICT, i, 0, 0);
+    }
+}
+
+static void on_scan_done(int i)
+{
+    sim_node_t *n = &s_nodes[i];
+    if (!n->alive || n->state != NODE_SCANNING) {
+        return;
+    }
+    int cap = s_cfg.chain ? 1 : s_cfg.max_children;
+    int best = -1, best_rssi = -1000;
+    int seen = 0;
+    for (int j = 0; j < s_cfg.nodes; j++) {
+        sim_node_t *c = &s_nodes[j];
+        if (j == i || !c->alive || c->state != NODE_CONNECTED) {
+            continue;
+        }
+        int rssi = node_rssi(i, j);
+        if (rssi < SIM_RSSI_MIN) {
+            continue;
+        }
+        seen++;
+        if (c->layer >= s_cfg.max_layer || c->children >= cap) {
+            continue;
+        }
+        /* prefer the shallowest parent, then the strongest link */
+        if (best < 0 || c->layer < s_nodes[best].layer
+                || (c->layer == s_nodes[best].layer && rssi > best_rssi)) {
+            best = j;
+            best_rssi = rssi;
+        }
+    }
+    mesh_event_scan_done_t scan_done = {
+        .number = seen < UINT8_MAX ? seen : UINT8_MAX,
+    };
+    sim_post(i, MESH_EVENT_SCAN_DONE, &scan_done);
+    if (best >= 0) {
+        n->state = NODE_CONNECTING;
+        n->pending_parent = best;
+        ev_push(s_now + SIM_ASSOC_US, EV_PARENT_CONNECTED, i, best, 0);
+        return;
+    }
+    /* a node that yielded joins the root it yielded to, and votes again once that one is gone */
+    if ((n->yielded_to < 0 || !is_root(n->yielded_to)) && n->router_rssi >= SIM_RSSI_MIN) {
+        mesh_event_vote_started_t vote_started = {
+            .attempts = n->scan_attempts + 1,
+            .reason = MESH_VOTE_REASON_CHILD_INITIATED,
+        };
+        sim_mac(i, vote_started.rc_addr.addr);
+        n->state = NODE_VOTING;
+        sim_post(i, MESH_EVENT_VOTE_STARTED, &vote_started);
+        ev_push(s_now + SIM_VOTE_US, EV_VOTE_DONE, i, 0, 0);
+        return;
+    }
+    mesh_event_no_parent_found_t no_parent = {
+        .scan_times = ++n->scan_attempts,
+    };
+    sim_post(i, MESH_EVENT_NO_PARENT_FOUND, &no_parent);
+    if (n->scan_attempts >= SIM_MAX_SCAN_ATTEMPTS) {
+        n->state = NODE_ISOLATED;
+        return;
+    }
+    schedule_scan(i, SIM_SCAN_US << (n->scan_attempts < 4 ? n->scan_attempts : 4));
+}
+
+static void on_vote_done(int i)
+{
+    sim_node_t *n = &s_nodes[i];
+    if (!n->alive || n->state != NODE_VOTING) {
+        return;
+    }
+    sim_post(i, MESH_EVENT_VOTE_STOPPED, NULL);
+    /* the candidate with the best router RSSI among voters in range wins */
+    for (int j = 0; j < s_cfg.nodes; j++) {
+        sim_node_t *c = &s_nodes[j];
+        if (j == i || !c->alive || node_rssi(i, j) < SIM_RSSI_MIN) {
+            continue;
+        }
+        if (c->state == NODE_VOTING && c->router_rssi > n->router_rssi) {
+            schedule_scan(i, SIM_SCAN_US);
+            return;
+        }
+    }
+    become_root(i);
+}
+
+static void on_parent_connected(int i, int p)
+{
+    sim_node_t *n = &s_nodes[i];
+    sim_node_t *parent = &s_nodes[p];
+    int cap = s_cfg.chain ? 1 : s_cfg.max_children;
+    if (!n->alive || n->state != NODE_CONNECTING) {
+        return;
+    }
+    if (!parent->alive || parent->state != NODE_CONNECTED
+            || parent->children >= cap || parent->layer >= s_cfg.max_layer) {
+        schedule_scan(i, SIM_SCAN_US);
+        return;
+    }
+    n->state = NODE_CONNECTED;
+    n->parent = p;
+    n->layer = parent->layer + 1;
+    n->scan_attempts = 0;
+    parent->children++;
+    for (int a = p; a >= 0; a = s_nodes[a].parent) {
+        s_nodes[a].routes += n->routes;
+    }
+    s_connected++;
+    s_last_connect_us = s_now;
+    post_connected(i);
+}
+
+static void on_root_conflict(int i)
+{
+    sim_node_t *n = &s_nodes[i];
+    if (!n->alive || n->state != NODE_CONNECTED || n->parent != -1) {
+        return;
+    }
+    int stronger = -1;
+    for (int j = 0; j < s_cfg.nodes; j++) {
+        sim_node_t *c = &s_nodes[j];
+        if (j != i && c->alive && c->state == NODE_CONNECTED && c->parent == -1) {
+            if (stronger < 0 || c->router_rssi > s_nodes[stronger].router_rssi) {
+                stronger = j;
+            }
+        }
+    }
+    if (stronger < 0) {
+        return;
+    }
+    int loser = (s_nodes[stronger].router_rssi > n->router_rssi) ? i : stronger;
+    int winner = loser == i ? stronger : i;
+    mesh_event_root_conflict_t conflict = {
+        .rssi = s_nodes[winner].router_rssi,
+        .capacity = s_nodes[winner].routes,
+    };
+    sim_mac(winner, conflict.addr);
+    s_yields++;
+    s_nodes[loser].yielded_to = winner;
+    sim_post(loser, MESH_EVENT_ROOT_ASKED_YIELD, &conflict);
+    disconnect_subtree(loser);
+    s_nodes[loser].state = NODE_SCANNING;
+    s_nodes[loser].scan_attempts = 0;
+    schedule_scan(loser, SIM_SCAN_US);
+    if (loser != i) {
+        ev_push(s_now + SIM_YIELD_DETECT_US, EV_ROOT_CONFLICT, i, 0, 0);
+    }
+}
+
+static void on_kill_root(void)
+{
+    for (int i = 0; i < s_cfg.nodes; i++) {
+        if (s_nodes[i].alive && s_nodes[i].state == NODE_CONNECTED && s_nodes[i].parent == -1) {
+            s_nodes[i].alive = 0;
+            disconnect_subtree(i);
+            s_killed_us = s_now;
+            printf("t=%.3fs: killed root %d\n", s_now / 1e6, i);
+            return;
+        }
+    }
+}
+
+static void record_latency(int64_t us)
+{
+    if (s_latency_len == s_latency_cap) {
+        s_latency_cap = s_latency_cap ? s_latency_cap * 2 : 4096;
+        s_latency = realloc(s_latency, s_latency_cap * sizeof(int64_t));
+    }
+    s_latency[s_latency_len++] = us;
+}
+
+static void on_msg_hop(int i, int64_t t0)
+{
+    sim_node_t *n = &s_nodes[i];
+    if (n->state == NODE_CONNECTED && n->parent == -1) {
+        record_latency(s_now - t0);
+        return;
+    }
+    if (!n->alive || n->state != NODE_CONNECTED) {
+        s_msg_lost++;
+        return;
+    }
+    /* serialize on this node's radio, then one hop of latency to the parent */
+    int64_t start = s_now > n->busy_until ? s_now : n->busy_until;
+    n->busy_until = start + SIM_AIRTIME_US;
+    int64_t jitter = (int64_t)(rnd() * s_cfg.jitter_us);
+    ev_push(n->busy_until + s_cfg.hop_us + jitter, EV_MSG_HOP, n->parent, 0, t0);
+}
+
+static void on_msg_send(int i, int remaining)
+{
+    s_msg_sent++;
+    on_msg_hop(i, s_now);
+    if (remaining > 1) {
+        ev_push(s_now + s_cfg.msg_interval_us, EV_MSG_SEND, i, remaining - 1, 0);
+    }
+}
+
+static void check_convergence(void)
+{
+    int alive = 0, isolated = 0;
+    for (int i = 0; i < s_cfg.nodes; i++) {
+        alive += s_nodes[i].alive;
+        isolated += s_nodes[i].alive && s_nodes[i].state == NODE_ISOLATED;
+    }
+    if (s_connected + isolated != alive) {
+        return;
+    }
+    /* a root killed before the first convergence only delays it */
+    if (s_converged_us < 0) {
+        s_converged_us = s_now;
+    } else if (s_killed_us >= s_converged_us && s_reconverged_us < 0) {
+        s_reconverged_us = s_now - s_killed_us;
+    }
+}
+
+static void on_got_ip(int i)
+{
+    ip_event_got_ip_t got_ip = {
+        .ip_info.ip.addr = 0x6401a8c0,     /* 192.168.1.100 */
+    };
+    if (!s_nodes[i].alive || s_nodes[i].state != NODE_CONNECTED || s_nodes[i].parent != -1) {
+        return;
+    }
+    s_self = i;
+    s_events++;
+    ip_event_handler(NULL, IP_EVENT, IP_EVENT_STA_GOT_IP, &got_ip);
+    s_self = -1;
+}
+
+/* Nodes whose handler state disagrees with the simulated mesh; prints the first one */
+static int check_handlers(void)
+{
+    int wrong = 0;
+    for (int i = 0; i < s_cfg.nodes; i++) {
+        sim_node_t *n = &s_nodes[i];
+        bool connected = n->state == NODE_CONNECTED;
+        mesh_addr_t parent;
+        if (!n->alive) {
+            continue;
+        }
+        sim_mac(n->parent, parent.addr);
+        if (n->events.connected == connected && (!connected || (n->events.layer == n->layer
+                && memcmp(n->events.parent.addr, parent.addr, sizeof(parent.addr)) == 0))) {
+            continue;
+        }
+        if (!wrong++) {
+            printf("node %d: handler has %s, layer %d, parent " MACSTR "; mesh has %s, layer %d, parent " MACSTR "\n",
+                   i, n->events.connected ? "connected" : "not connected", n->events.layer,
+                   MAC2STR(n->events.parent.addr), connected ? "connected" : "not connected", n->layer,
+                   MAC2STR(parent.addr));
+        }
+    }
+    return wrong;
+}
+
+/* Nodes whose LEDs do not show what the indicators promise; prints the first one */
+static int check_leds(void)
+{
+    int wrong = 0;
+    for (int i = 0; i < s_cfg.nodes; i++) {
+        sim_node_t *n = &s_nodes[i];
+        bool connected = n->state == NODE_CONNECTED;
+        if (!n->alive) {
+            continue;
+        }
+        if (connected ? n->led == mesh_light_layer_color(n->layer) : (n->led == -1 || n->led == MESH_LIGHT_OFF)) {
+            continue;
+        }
+        if (!wrong++) {
+            printf("node %d: %s at layer %d, LEDs at 0x%02x, layer color 0x%02x\n", i,
+                   connected ? "connected" : "not connected", n->layer, n->led, mesh_light_layer_color(n->layer));
+        }
+    }
+    return wrong;
+}
+
+static void report_leds(void)
+{
+    static const struct {
+        int color;
+        const char *name;
+    } colors[] = {
+        { -1, "none" }, { MESH_LIGHT_OFF, "off" }, { MESH_LIGHT_ON, "on" }, { MESH_LIGHT_PINK, "pink" },
+        { MESH_LIGHT_YELLOW, "yellow" }, { MESH_LIGHT_RED, "red" }, { MESH_LIGHT_BLUE, "blue" },
+        { MESH_LIGHT_GREEN, "green" }, { MESH_LIGHT_WARNING, "warning" },
+    };
+    int count[sizeof(colors) / sizeof(colors[0])] = { 0 };
+    int other = 0;
+
+    for (int i = 0; i < s_cfg.nodes; i++) {
+        size_t c = 0;
+        while (c < sizeof(colors) / sizeof(colors[0]) && colors[c].color != s_nodes[i].led) {
+            c++;
+        }
+        if (!s_nodes[i].alive) {
+            continue;
+        }
+        if (c < sizeof(colors) / sizeof(colors[0])) {
+            count[c]++;
+        } else {
+            other++;
+        }
+    }
+    printf("leds:");
+    for (size_t c = 0; c < sizeof(colors) / sizeof(colors[0]); c++) {
+        if (count[c]) {
+            printf(" %s=%d", colors[c].name, count[c]);
+        }
+    }
+    if (other) {
+        printf(" other=%d", other);
+    }
+    printf("\n");
+}
+
+static int cmp_i64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void report(void)
+{
+    int hist[SIM_LAYER_HIST] = { 0 };
+    int isolated = 0, deepest = 0;
+    for (int i = 0; i < s_cfg.nodes; i++) {
+        sim_node_t *n = &s_nodes[i];
+        if (n->state == NODE_CONNECTED && n->layer < SIM_LAYER_HIST) {
+            hist[n->layer]++;
+            deepest = n->layer > deepest ? n->layer : deepest;
+        }
+        isolated += n->state == NODE_ISOLATED;
+    }
+    printf("nodes:%d topology:%s max_layer:%d max_children:%d hop:%" PRId64 "us\n",
+           s_cfg.nodes, s_cfg.chain ? "chain" : "tree", s_cfg.max_layer, s_cfg.max_children, s_cfg.hop_us);
+    printf("connected:%d isolated:%d deepest_layer:%d\n", s_connected, isolated, deepest);
+    if (s_converged_us >= 0) {
+        printf("convergence:%.3fs last_join:%.3fs\n", s_converged_us / 1e6, s_last_connect_us / 1e6);
+    } else {
+        printf("convergence:n/a last_join:%.3fs\n", s_last_connect_us / 1e6);
+    }
+    printf("root_elections:%d root_yields:%d parent_losses:%d\n", s_elections, s_yields, s_parent_losses);
+    if (s_cfg.kill_root_us > 0) {
+        if (s_killed_us < 0) {
+            printf("reconvergence_after_root_loss:n/a (no root to kill)\n");
+        } else if (s_converged_us < 0 || s_killed_us < s_converged_us) {
+            printf("reconvergence_after_root_loss:n/a (root killed before the mesh converged)\n");
+        } else if (s_reconverged_us >= 0) {
+            printf("reconvergence_after_root_loss:%.3fs\n", s_reconverged_us / 1e6);
+        } else {
+            printf("reconvergence_after_root_loss:n/a (never reconverged)\n");
+        }
+    }
+    printf("layers:");
+    for (int l = 1; l <= deepest; l++) {
+        printf(" L%d=%d", l, hist[l]);
+    }
+    printf("\n");
+    if (s_latency_len) {
+        qsort(s_latency, s_latency_len, sizeof(int64_t), cmp_i64);
+        printf("e2e_latency_us: n=%zu p50=%" PRId64 " p90=%" PRId64 " p99=%" PRId64 " max=%" PRId64 "\n",
+               s_latency_len, s_latency[s_latency_len / 2], s_latency[s_latency_len * 9 / 10],
+               s_latency[s_latency_len * 99 / 100], s_latency[s_latency_len - 1]);
+    }
+    printf("messages: sent=%d delivered=%zu lost=%d\n", s_msg_sent, s_latency_len, s_msg_lost);
+    printf("events_handled:%d\n", s_events);
+    report_leds();
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-n nodes] [-t tree|chain] [-l max_layer] [-c max_children]\n"
+            "          [-a area_m] [-h hop_us] [-j jitter_us] [-k kill_root_ms]\n"
+            "          [-T traffic_start_ms] [-m messages_per_node] [-s seed]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "n:t:l:c:a:h:j:k:T:m:s:")) != -1) {
+        switch (opt) {
+        case 'n': s_cfg.nodes = atoi(optarg); break;
+        case 't': s_cfg.chain = strcmp(optarg, "chain") == 0; break;
+        case 'l': s_cfg.max_layer = atoi(optarg); break;
+        case 'c': s_cfg.max_children = atoi(optarg); break;
+        case 'a': s_cfg.area = atof(optarg); break;
+        case 'h': s_cfg.hop_us = atoll(optarg); break;
+        case 'j': s_cfg.jitter_us = atoll(optarg); break;
+        case 'k': s_cfg.kill_root_us = atoll(optarg) * 1000; break;
+        case 'T': s_cfg.traffic_us = atoll(optarg) * 1000; break;
+        case 'm': s_cfg.messages = atoi(optarg); break;
+        case 's': s_cfg.seed = (unsigned)atoi(optarg); break;
+        default: usage(argv[0]);
+        }
+    }
+    if (s_cfg.nodes <= 0 || s_cfg.max_layer <= 0 || s_cfg.max_children <= 0) {
+        usage(argv[0]);
+    }
+    if (s_cfg.area <= 0) {
+        /* keep density roughly constant: ~8 m between neighbours */
+        s_cfg.area = 8.0 * sqrt((double)s_cfg.nodes);
+    }
+    srand(s_cfg.seed);
+
+    s_nodes = calloc(s_cfg.nodes, sizeof(sim_node_t));
+    for (int i = 0; i < s_cfg.nodes; i++) {
+        sim_node_t *n = &s_nodes[i];
+        n->x = rnd() * s_cfg.area;
+        n->y = rnd() * s_cfg.area;
+        n->router_rssi = link_rssi(n->x - s_cfg.area / 2, n->y - s_cfg.area / 2);
+        mesh_events_state_t events = MESH_EVENTS_STATE_DEFAULT();
+        n->parent = -1;
+        n->alive = 1;
+        n->routes = 1;
+        n->yielded_to = -1;
+        n->events = events;
+        n->led = -1;
+        /* power-on spread of a few hundred ms */
+        ev_push((int64_t)(rnd() * 500000), EV_BOOT, i, 0, 0);
+    }
+    if (s_cfg.kill_root_us > 0) {
+        ev_push(s_cfg.kill_root_us, EV_KILL_ROOT, -1, 0, 0);
+    }
+    for (int i = 0; i < s_cfg.nodes && s_cfg.messages > 0; i++) {
+        ev_push(s_cfg.traffic_us + (int64_t)(rnd() * s_cfg.msg_interval_us), EV_MSG_SEND, i, s_cfg.messages, 0);
+    }
+
+    while (s_heap_len) {
+        sim_event_t ev = ev_pop();
+        s_now = ev.time;
+        switch (ev.type) {
+        case EV_BOOT:
+            sim_post(ev.node, MESH_EVENT_STARTED, NULL);
+            schedule_scan(ev.node, SIM_SCAN_US);
+            break;
+        case EV_SCAN_DONE:
+            on_scan_done(ev.node);
+            break;
+        case EV_VOTE_DONE:
+            on_vote_done(ev.node);
+            break;
+        case EV_PARENT_CONNECTED:
+            on_parent_connected(ev.node, ev.arg);
+            break;
+        case EV_ROOT_CONFLICT:
+            on_root_conflict(ev.node);
+            break;
+        case EV_KILL_ROOT:
+            on_kill_root();
+            break;
+        case EV_MSG_SEND:
+            on_msg_send(ev.node, ev.arg);
+            break;
+        case EV_MSG_HOP:
+            on_msg_hop(ev.node, ev.t0);
+            break;
+        case EV_GOT_IP:
+            on_got_ip(ev.node);
+            break;
+        }
+        if (ev.type != EV_MSG_HOP && ev.type != EV_MSG_SEND) {
+            check_convergence();
+        }
+    }
+
+    report();
+    int wrong = check_handlers();
+    int wrong_leds = check_leds();
+    printf("handler_state_mismatches:%d led_mismatches:%d\n", wrong, wrong_leds);
+    free(s_nodes);
+    free(s_heap);
+    free(s_latency);
+    return wrong || wrong_leds ? 1 : 0;
+}
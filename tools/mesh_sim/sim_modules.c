@@ -0,0 +1,179 @@
+/* Mesh Simulator Modules
+
+   main/mesh_events.c calls into most firmware modules on every mesh
+   event. The simulator models formation and delivery itself, so here
+   those calls do nothing: what runs for real is the handler, its state
+   and the light indicators. The LEDs and the esp_mesh_* side are in
+   mesh_sim.c, per simulated node.
+*/
+
+#include "esp_err.h"
+#include "esp_event.h"
+#include "esp_mesh.h"
+#include "mesh_comm.h"
+#include "mesh_route.h"
+#include "mesh_rejoin.h"
+#include "mesh_prof.h"
+#include "mesh_telemetry.h"
+#include "mesh_flow.h"
+#include "mesh_trace.h"
+#include "mesh_ps.h"
+#include "mesh_vote.h"
+#include "mesh_gateway.h"
+#include "mesh_xfer.h"
+#include "mesh_ping.h"
+#include "mesh_backup.h"
+#include "mesh_bench.h"
+#include "mesh_time.h"
+#include "mesh_shard.h"
+
+/*******************************************************
+ *                Function Definitions
+ *******************************************************/
+void mesh_trace_event(esp_event_base_t event_base, int32_t event_id, const void *event_data)
+{
+}
+
+void mesh_prof_mark(mesh_prof_phase_t phase)
+{
+}
+
+void mesh_prof_emit(void)
+{
+}
+
+esp_err_t mesh_comm_start(void)
+{
+    return ESP_OK;
+}
+
+void mesh_route_clear(void)
+{
+}
+
+esp_err_t mesh_route_update(void)
+{
+    return ESP_OK;
+}
+
+void mesh_rejoin_on_no_parent(void)
+{
+}
+
+void mesh_rejoin_on_connected(const mesh_event_connected_t *connected)
+{
+}
+
+esp_err_t mesh_telemetry_start(void)
+{
+    return ESP_OK;
+}
+
+void mesh_flow_child_add(const uint8_t mac[6])
+{
+}
+
+void mesh_flow_child_remove(const uint8_t mac[6])
+{
+}
+
+void mesh_flow_parent_connected(void)
+{
+}
+
+esp_err_t mesh_flow_start(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t mesh_ps_start(void)
+{
+    return ESP_OK;
+}
+
+void mesh_ps_on_parent_duty(uint8_t duty)
+{
+}
+
+void mesh_ps_on_child_duty(uint16_t aid, uint8_t duty)
+{
+}
+
+esp_err_t mesh_vote_start(void)
+{
+    return ESP_OK;
+}
+
+void mesh_vote_on_parent_connected(void)
+{
+}
+
+void mesh_vote_on_parent_disconnected(void)
+{
+}
+
+void mesh_vote_on_root_address(const uint8_t addr[6])
+{
+}
+
+void mesh_vote_on_vote_started(void)
+{
+}
+
+void mesh_vote_on_asked_yield(const mesh_event_root_conflict_t *conflict)
+{
+}
+
+esp_err_t mesh_gateway_start(void)
+{
+    return ESP_OK;
+}
+
+void mesh_gateway_set_reachable(bool reachable)
+{
+}
+
+esp_err_t mesh_xfer_start(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t mesh_ping_start(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t mesh_backup_start(void)
+{
+    return ESP_OK;
+}
+
+void mesh_backup_on_scan_done(int number)
+{
+}
+
+void mesh_backup_on_no_parent(void)
+{
+}
+
+void mesh_backup_on_parent_connected(const mesh_event_connected_t *connected)
+{
+}
+
+void mesh_backup_on_parent_disconnected(const mesh_event_disconnected_t *disconnected)
+{
+}
+
+esp_err_t mesh_bench_start(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t mesh_time_start(void)
+{
+    return ESP_OK;
+}
+
+void mesh_shard_on_root_address(const uint8_t root[6])
+{
+}
@@ -0,0 +1,122 @@
+#!/usr/bin/env python3
+"""Decode and compare mesh startup profiles.
+
+The firmware logs one line per boot (see main/mesh_prof.c):
+
+    I (5123) mesh_prof: record:4d505246010c...
+
+Give one or more serial logs; every record found is one run. With a single
+run the phases are listed, with several the runs are shown side by side
+with the difference to the first one.
+
+    python3 tools/prof_decode/prof_decode.py before.log after.log
+"""
+
+import argparse
+import re
+import struct
+import sys
+
+MAGIC = 0x4652504d
+VERSION = 1
+HDR = struct.Struct('<IBBHII')
+ENTRY = struct.Struct('<BIi')
+
+# Keep in sync with mesh_prof_phase_t in main/include/mesh_prof.h
+PHASES = [
+    'light_init',
+    'nvs_init',
+    'netif_init',
+    'event_loop',
+    'mesh_netifs',
+    'wifi_init',
+    'wifi_start',
+    'mesh_init',
+    'mesh_config',
+    'mesh_start',
+    'app_main_done',
+    'parent_connected',
+    'got_ip',
+]
+
+RECORD_RE = re.compile(r'mesh_prof: record:([0-9a-fA-F]+)')
+
+
+def decode(raw):
+    magic, version, count, _, start_us, start_heap = HDR.unpack_from(raw, 0)
+    if magic != MAGIC or version != VERSION:
+        raise ValueError('not a mesh_prof v%d record' % VERSION)
+    phases = {}
+    prev_us = 0
+    for i in range(count):
+        phase, end_us, heap_delta = ENTRY.unpack_from(raw, HDR.size + i * ENTRY.size)
+        name = PHASES[phase] if phase < len(PHASES) else 'phase_%d' % phase
+        phases[name] = (end_us - prev_us, end_us, heap_delta)
+        prev_us = end_us
+    return {'start_us': start_us, 'start_heap': start_heap, 'phases': phases}
+
+
+def load(paths):
+    runs = []
+    for path in paths:
+        with open(path, errors='replace') as f:
+            for n, line in enumerate(f, 1):
+                m = RECORD_RE.search(line)
+                if not m:
+                    continue
+                try:
+                    run = decode(bytes.fromhex(m.group(1)))
+                except (ValueError, struct.error) as e:
+                    print('%s:%d: %s' % (path, n, e), file=sys.stderr)
+                    continue
+                run['name'] = '%s:%d' % (path, n)
+                runs.append(run)
+    return runs
+
+
+def show_one(run):
+    print('%s  (app_main at %.1f ms, free heap %d)' % (run['name'], run['start_us'] / 1000.0, run['start_heap']))
+    print('%-18s %10s %10s %10s' % ('phase', 'ms', 'at ms', 'heap'))
+    for name in PHASES:
+        if name in run['phases']:
+            dur, end, heap = run['phases'][name]
+            print('%-18s %10.1f %10.1f %+10d' % (name, dur / 1000.0, end / 1000.0, heap))
+
+
+def show_many(runs):
+    base = runs[0]
+    print('%-18s' % 'phase' + ''.join(' %14s' % ('run%d ms' % i) for i in range(len(runs))))
+    for name in PHASES:
+        if not any(name in r['phases'] for r in runs):
+            continue
+        cells = []
+        for r in runs:
+            if name not in r['phases']:
+                cells.append(' %14s' % '-')
+                continue
+            dur = r['phases'][name][0] / 1000.0
+            if r is base or name not in base['phases']:
+                cells.append(' %14.1f' % dur)
+            else:
+                cells.append(' %7.1f(%+5.0f)' % (dur, dur - base['phases'][name][0] / 1000.0))
+        print('%-18s' % name + ''.join(cells))
+    for i, r in enumerate(runs):
+        print('run%d: %s' % (i, r['name']))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('logs', nargs='+', help='serial logs containing mesh_prof records')
+    args = parser.parse_args()
+
+    runs = load(args.logs)
+    if not runs:
+        sys.exit('no mesh_prof record found')
+    if len(runs) == 1:
+        show_one(runs[0])
+    else:
+        show_many(runs)
+
+
+if __name__ == '__main__':
+    main()
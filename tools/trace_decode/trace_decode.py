@@ -0,0 +1,130 @@
+#!/usr/bin/env python3
+"""Format the binary mesh event trace.
+
+The firmware dumps the trace ring (see main/mesh_trace.c) as one hex line
+per event, on demand with mesh_trace_dump() and automatically at boot
+when events survived a soft reset:
+
+    I (312) mesh_trace: 2a000000e8030f0007000000a4cf12...
+
+Pass the serial log(s); events are printed oldest first, one per line.
+The ring and its boot counter start over after a power cycle, so events
+are told apart by power cycle, boot and seq: a power cycle is spotted by
+the ROM bootloader's "rst:0x1 (POWERON_RESET)" line, which means logs
+have to be passed in the order they were captured.
+
+    python3 tools/trace_decode/trace_decode.py monitor.log
+"""
+
+import argparse
+import re
+import struct
+import sys
+
+ENTRY = struct.Struct('<IIHBB20s')
+BASE_MESH = 0
+BASE_IP = 1
+
+# mesh_event_id_t, in ESP-IDF order
+MESH_EVENTS = [
+    'STARTED', 'STOPPED', 'CHANNEL_SWITCH', 'CHILD_CONNECTED', 'CHILD_DISCONNECTED',
+    'ROUTING_TABLE_ADD', 'ROUTING_TABLE_REMOVE', 'PARENT_CONNECTED', 'PARENT_DISCONNECTED',
+    'NO_PARENT_FOUND', 'LAYER_CHANGE', 'TODS_STATE', 'VOTE_STARTED', 'VOTE_STOPPED',
+    'ROOT_ADDRESS', 'ROOT_SWITCH_REQ', 'ROOT_SWITCH_ACK', 'ROOT_ASKED_YIELD', 'ROOT_FIXED',
+    'SCAN_DONE', 'NETWORK_STATE', 'STOP_RECONNECTION', 'FIND_NETWORK', 'ROUTER_SWITCH',
+    'PS_PARENT_DUTY', 'PS_CHILD_DUTY', 'PS_DEVICE_DUTY',
+]
+
+IP_EVENTS = ['STA_GOT_IP', 'STA_LOST_IP']
+
+
+def mac(b):
+    return ':'.join('%02x' % x for x in b)
+
+
+def fields(fmt, names, data):
+    """Unpack `data` with struct format `fmt`; 'M' stands for a 6-byte MAC."""
+    out = []
+    off = 0
+    for code, name in zip(fmt, names):
+        if code == 'M':
+            out.append('%s:%s' % (name, mac(data[off:off + 6])))
+            off += 6
+        else:
+            (v,) = struct.unpack_from('<' + code, data, off)
+            out.append('%s:%d' % (name, v))
+            off += struct.calcsize('<' + code)
+    return ', '.join(out)
+
+
+# Keep in sync with mesh_trace_pack_mesh() in main/mesh_trace.c
+MESH_LAYOUT = {
+    'CHILD_CONNECTED': ('MB', ('mac', 'aid')),
+    'CHILD_DISCONNECTED': ('MB', ('mac', 'aid')),
+    'ROUTING_TABLE_ADD': ('ii', ('change', 'size')),
+    'ROUTING_TABLE_REMOVE': ('ii', ('change', 'size')),
+    'NO_PARENT_FOUND': ('i', ('scan_times',)),
+    'PARENT_CONNECTED': ('MBBB', ('parent', 'channel', 'layer', 'duty')),
+    'PARENT_DISCONNECTED': ('MBb', ('parent', 'reason', 'rssi')),
+    'LAYER_CHANGE': ('i', ('layer',)),
+    'ROOT_ADDRESS': ('M', ('root',)),
+    'VOTE_STARTED': ('iiM', ('attempts', 'reason', 'rc_addr')),
+    'ROOT_SWITCH_REQ': ('iM', ('reason', 'rc_addr')),
+    'TODS_STATE': ('i', ('state',)),
+    'ROOT_FIXED': ('B', ('fixed',)),
+    'ROOT_ASKED_YIELD': ('Mbi', ('root', 'rssi', 'capacity')),
+    'CHANNEL_SWITCH': ('B', ('channel',)),
+    'SCAN_DONE': ('B', ('number',)),
+    'NETWORK_STATE': ('B', ('rootless',)),
+    'FIND_NETWORK': ('BM', ('channel', 'router')),
+    'ROUTER_SWITCH': ('BM', ('channel', 'router')),
+    'PS_PARENT_DUTY': ('B', ('duty',)),
+    'PS_CHILD_DUTY': ('BMB', ('duty', 'child', 'aid')),
+}
+
+LINE_RE = re.compile(r'mesh_trace: ([0-9a-fA-F]{%d})' % (2 * ENTRY.size))
+POWERON_RE = re.compile(r'rst:0x1 \(POWERON')
+
+
+def format_entry(raw):
+    seq, time_us, ev, base, boot, data = ENTRY.unpack(raw)
+    if base == BASE_IP:
+        name = 'IP_' + (IP_EVENTS[ev] if ev < len(IP_EVENTS) else str(ev))
+        detail = '.'.join(str(b) for b in data[:4]) if ev == 0 else ''
+    else:
+        name = MESH_EVENTS[ev] if ev < len(MESH_EVENTS) else 'MESH_%d' % ev
+        layout = MESH_LAYOUT.get(name)
+        detail = fields(layout[0], layout[1], data) if layout else ''
+    return (boot, seq), '#%-6d boot %-3d %12.6f s  %-22s %s' % (seq, boot, time_us / 1e6, name, detail)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('logs', nargs='+', help='serial logs containing mesh_trace lines')
+    args = parser.parse_args()
+
+    # (power cycle, boot, seq) -> text; the same entry is dumped at every soft reset
+    events = {}
+    power = 0
+    for path in args.logs:
+        with open(path, errors='replace') as f:
+            for line in f:
+                if POWERON_RE.search(line):
+                    power += 1
+                    continue
+                m = LINE_RE.search(line)
+                if m:
+                    key, text = format_entry(bytes.fromhex(m.group(1)))
+                    events[(power,) + key] = text
+    if not events:
+        sys.exit('no mesh_trace entries found')
+    last = None
+    for key in sorted(events):
+        if last is not None and key[0] != last:
+            print('--- power cycle')
+        last = key[0]
+        print(events[key])
+
+
+if __name__ == '__main__':
+    main()